@@ -20,15 +20,156 @@ typedef struct {
     UINT32 framebuffer_bpp;
 } framebuffer_info_t;
 
+// RDTSC stamps taken as efi_main() finishes each step; the kernel reports
+// the differences. Fields are only ever appended; bump the version with them.
+#define BOOT_TIMING_VERSION         4
+
+#define BOOT_TSC_EFI_ENTRY          0
+#define BOOT_TSC_LOGO               1
+#define BOOT_TSC_MEMORY_MAP         2
+#define BOOT_TSC_GRAPHICS           3
+#define BOOT_TSC_KERNEL_LOADED      4
+#define BOOT_TSC_EXIT_BOOT_SERVICES 5
+#define BOOT_TSC_KERNEL_JUMP        6
+#define BOOT_TSC_COUNT              7
+
+#define BOOT_KERNEL_RAW             0
+#define BOOT_KERNEL_LZ4             1
+
+typedef struct {
+    UINT32 version;
+    UINT32 exit_retries;        // failed ExitBootServices() calls
+    UINT64 tsc[BOOT_TSC_COUNT];
+    // Version 2: how the kernel was loaded
+    UINT32 kernel_format;       // BOOT_KERNEL_*
+    UINT32 kernel_async_reads;  // chunks read with ReadEx() during decompression
+    UINT64 kernel_file_bytes;
+    UINT64 kernel_image_bytes;
+    UINT64 kernel_read_tsc;     // waiting for the file system
+    UINT64 kernel_inflate_tsc;  // decompressing and checksumming
+    // Version 3
+    UINT64 kernel_place_tsc;    // copying PT_LOAD segments and zeroing .bss
+    UINT64 kernel_bss_bytes;
+    // Version 4
+    UINT64 modules_read_tsc;    // reading \EFI\BOOT\modules
+} boot_timing_t;
+
+// The kernel's ELF section headers, copied with the contents of its symbol
+// and string tables; sh_addr of those copies points at them. All zero if the
+// image had no section headers.
+typedef struct {
+    UINT64 sections;            // physical address of the header array
+    UINT32 section_count;
+    UINT32 section_size;
+    UINT32 section_names;       // index of .shstrtab
+    UINT32 reserved;
+} kernel_elf_info_t;
+
+// Files from \EFI\BOOT\modules, each read whole into pages of their own,
+// in directory order. Names are the file names, truncated to ASCII.
+#define BOOT_MODULE_MAX             16
+#define BOOT_MODULE_NAME_MAX        48
+
+typedef struct {
+    UINT64 base;                // physical, page-aligned
+    UINT64 size;
+    CHAR8 name[BOOT_MODULE_NAME_MAX];
+} boot_module_t;
+
+// Memory holding the kernel's segments, page tables, section copies and boot
+// modules. Types from 0x80000000 are the OS loader's own, so the kernel never
+// mistakes these pages for reclaimable loader data.
+#define KERNEL_MEMORY_TYPE          ((EFI_MEMORY_TYPE)0x80000000U)
+
 typedef struct {
     memory_info_t memory_info;
     framebuffer_info_t framebuffer;
     UINT8 acpi_enabled;
     UINT8 apic_enabled;
+    UINT64 rsdp_address;
+    boot_timing_t timing;
+    kernel_elf_info_t elf;
+    UINT32 module_count;
+    boot_module_t modules[BOOT_MODULE_MAX];
 } kernel_params_t;
 
 typedef void (*kernel_main_t)(kernel_params_t*);
 
+// Compressed kernel container written by tools/mkkernelz.py: this header,
+// then one record per block_size bytes of the kernel ELF, each a UINT32
+// stored size (KERNEL_BLOCK_STORED set if the bytes are not compressed) and
+// that many bytes of LZ4 block data. Matches may reach back into earlier
+// blocks.
+#define KERNEL_CONTAINER_MAGIC      0x315A4B56      // "VKZ1"
+#define KERNEL_CONTAINER_VERSION    2
+#define KERNEL_BLOCK_STORED         0x80000000U
+
+typedef struct {
+    UINT32 magic;
+    UINT16 version;
+    UINT16 header_size;
+    UINT32 block_size;
+    UINT32 image_crc32;         // CRC-32 (IEEE 802.3) of the whole image
+    UINT64 image_size;
+    UINT64 compressed_size;     // bytes of block records after the header
+} kernel_container_t;
+
+// The subset of ELF64 the loader reads
+#define ELF_MAGIC                   0x464C457FU     // "\x7FELF"
+#define ELF_CLASS_64                2
+#define ELF_DATA_LSB                1
+#define ELF_TYPE_EXEC               2
+#define ELF_MACHINE_X86_64          62
+#define ELF_PT_LOAD                 1
+#define ELF_SHT_SYMTAB              2
+#define ELF_SHT_STRTAB              3
+#define ELF_SHF_ALLOC               0x2
+
+typedef struct {
+    UINT32 magic;
+    UINT8 class;
+    UINT8 data;
+    UINT8 ident_version;
+    UINT8 ident_pad[9];
+    UINT16 type;
+    UINT16 machine;
+    UINT32 version;
+    UINT64 entry;
+    UINT64 phoff;
+    UINT64 shoff;
+    UINT32 flags;
+    UINT16 ehsize;
+    UINT16 phentsize;
+    UINT16 phnum;
+    UINT16 shentsize;
+    UINT16 shnum;
+    UINT16 shstrndx;
+} elf64_ehdr_t;
+
+typedef struct {
+    UINT32 type;
+    UINT32 flags;
+    UINT64 offset;
+    UINT64 vaddr;
+    UINT64 paddr;
+    UINT64 filesz;
+    UINT64 memsz;
+    UINT64 align;
+} elf64_phdr_t;
+
+typedef struct {
+    UINT32 name;
+    UINT32 type;
+    UINT64 flags;
+    UINT64 addr;
+    UINT64 offset;
+    UINT64 size;
+    UINT32 link;
+    UINT32 info;
+    UINT64 addralign;
+    UINT64 entsize;
+} elf64_shdr_t;
+
 EFI_STATUS initialize_graphics(EFI_BOOT_SERVICES *BS);
 void detect_hardware_features(void);
 EFI_STATUS configure_memory(
@@ -46,7 +187,8 @@ EFI_STATUS reacquire_memory_map_and_exit_boot_services(
     UINTN *DescriptorSize,
     UINT32 *DescriptorVersion
 );
-EFI_STATUS load_kernel(EFI_FILE_PROTOCOL *Root, EFI_PHYSICAL_ADDRESS *KernelAddress);
+EFI_STATUS load_kernel(EFI_FILE_PROTOCOL *Root, EFI_PHYSICAL_ADDRESS *KernelEntry);
+EFI_STATUS load_modules(EFI_FILE_PROTOCOL *Root);
 void display_logo(EFI_SIMPLE_TEXT_OUT_PROTOCOL *ConOut);
 void error_freeze(EFI_SIMPLE_TEXT_OUT_PROTOCOL *ConOut, EFI_STATUS Status);
 
@@ -3,7 +3,10 @@
 #include "../include/bootloader.h"
 
 #define RESERVED_MEMORY (512 * 1024 * 1024)
-#define STATIC_BUFFER_SIZE (64 * 1024 * 1024)
+
+// Room for the memory map. Firmware maps run to a few hundred descriptors;
+// this holds over a thousand of the usual 48 bytes.
+#define MEMORY_MAP_BUFFER_SIZE (64 * 1024)
 
 static kernel_params_t g_kernel_params;
 
@@ -33,7 +36,15 @@ const CHAR16 *VISUALOS_LOGO[] = {
     L"                                      * *************           "
 };
 
-static UINT8 g_memory_buffer[STATIC_BUFFER_SIZE] __attribute__((aligned(4096)));
+static UINT8 g_memory_buffer[MEMORY_MAP_BUFFER_SIZE] __attribute__((aligned(4096)));
+
+static inline UINT64 read_tsc(void) {
+    UINT32 lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((UINT64)hi << 32) | lo;
+}
+
+#define BOOT_STAMP(step) (g_kernel_params.timing.tsc[step] = read_tsc())
 
 void display_logo(EFI_SIMPLE_TEXT_OUT_PROTOCOL *ConOut) {
     UINTN Columns, Rows;
@@ -71,9 +82,26 @@ EFI_STATUS initialize_graphics(EFI_BOOT_SERVICES *BS) {
     return EFI_SUCCESS;
 }
 
+// Prefer the ACPI 2.0 RSDP (XSDT) and fall back to the 1.0 one (RSDT)
+static UINT64 find_rsdp(void) {
+    UINT64 rsdp = 0;
+    for (UINTN i = 0; i < ST->NumberOfTableEntries; i++) {
+        EFI_CONFIGURATION_TABLE *Table = &ST->ConfigurationTable[i];
+        if (CompareGuid(&Table->VendorGuid, &Acpi20TableGuid) == 0)
+            return (UINT64)(UINTN)Table->VendorTable;
+        if (CompareGuid(&Table->VendorGuid, &AcpiTableGuid) == 0)
+            rsdp = (UINT64)(UINTN)Table->VendorTable;
+    }
+    return rsdp;
+}
+
 void detect_hardware_features(void) {
-    g_kernel_params.acpi_enabled = 0;
-    g_kernel_params.apic_enabled = 0;
+    UINT32 eax, ebx, ecx, edx;
+    __asm__ volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1), "c"(0));
+
+    g_kernel_params.rsdp_address = find_rsdp();
+    g_kernel_params.acpi_enabled = g_kernel_params.rsdp_address != 0;
+    g_kernel_params.apic_enabled = (edx & (1U << 9)) != 0;
 }
 
 EFI_STATUS configure_memory(
@@ -85,8 +113,7 @@ EFI_STATUS configure_memory(
 ) {
     EFI_STATUS Status;
     
-    SetMem(g_memory_buffer, sizeof(g_memory_buffer), 0);
-    
+    // GetMemoryMap() writes every byte it reports; nothing to clear first
     *MemoryMapSize = 0;
     Status = gBS->GetMemoryMap(MemoryMapSize, NULL, MapKey, DescriptorSize, DescriptorVersion);
     if (Status != EFI_BUFFER_TOO_SMALL) return Status;
@@ -137,53 +164,539 @@ EFI_STATUS reacquire_memory_map_and_exit_boot_services(
         if (!EFI_ERROR(Status)) return EFI_SUCCESS;
         
         RetryCount++;
+        g_kernel_params.timing.exit_retries = RetryCount;
     } while (RetryCount < 5);
     
     return Status;
 }
 
-EFI_STATUS load_kernel(EFI_FILE_PROTOCOL *Root, EFI_PHYSICAL_ADDRESS *KernelAddress) {
+// Bytes per file system read when streaming the compressed kernel
+#define KERNEL_READ_CHUNK (256 * 1024)
+
+// EFI_FILE_PROTOCOL revision that has ReadEx()
+#define FILE_REVISION_READ_EX 0x00020000
+
+static UINT32 g_crc_table[256];
+
+static void crc32_init(void) {
+    for (UINT32 i = 0; i < 256; i++) {
+        UINT32 c = i;
+        for (int k = 0; k < 8; k++) c = (c >> 1) ^ (c & 1 ? 0xEDB88320U : 0);
+        g_crc_table[i] = c;
+    }
+}
+
+static UINT32 crc32_update(UINT32 crc, const UINT8 *p, UINTN len) {
+    crc = ~crc;
+    while (len--) crc = g_crc_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// Read an LZ4 length continuation: bytes are added while they are 255
+static BOOLEAN lz4_length(const UINT8 **ip, const UINT8 *iend, UINTN *len) {
+    UINT8 b;
+    do {
+        if (*ip >= iend) return FALSE;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return TRUE;
+}
+
+// Decode one LZ4 block into image[pos, pos + out_len). Matches may reach
+// back to the start of the image. Every length and offset is checked, so a
+// corrupt file fails here rather than writing outside the image.
+static EFI_STATUS lz4_decode(const UINT8 *src, UINTN src_len, UINT8 *image, UINTN pos, UINTN out_len) {
+    const UINT8 *ip = src, *iend = src + src_len;
+    UINT8 *op = image + pos, *oend = op + out_len;
+
+    while (ip < iend) {
+        UINTN token = *ip++;
+        UINTN len = token >> 4;
+        if (len == 15 && !lz4_length(&ip, iend, &len)) return EFI_LOAD_ERROR;
+        if ((UINTN)(iend - ip) < len || (UINTN)(oend - op) < len) return EFI_LOAD_ERROR;
+        CopyMem(op, ip, len);
+        op += len;
+        ip += len;
+        if (ip == iend) break;          // the last sequence has no match
+
+        if (iend - ip < 2) return EFI_LOAD_ERROR;
+        UINTN offset = ip[0] | ((UINTN)ip[1] << 8);
+        ip += 2;
+        if (!offset || offset > (UINTN)(op - image)) return EFI_LOAD_ERROR;
+        len = token & 15;
+        if (len == 15 && !lz4_length(&ip, iend, &len)) return EFI_LOAD_ERROR;
+        len += 4;
+        if ((UINTN)(oend - op) < len) return EFI_LOAD_ERROR;
+
+        const UINT8 *match = op - offset;
+        if (offset >= len) {
+            CopyMem(op, match, len);
+            op += len;
+        } else {
+            // Overlapping: the match repeats bytes it is producing
+            while (len--) *op++ = *match++;
+        }
+    }
+    return op == oend ? EFI_SUCCESS : EFI_LOAD_ERROR;
+}
+
+// Sequential chunked reads. With ReadEx() a chunk is read while the caller
+// decompresses the previous one; without it, or if the firmware refuses,
+// reads are synchronous.
+typedef struct {
+    EFI_FILE_PROTOCOL *file;
+    EFI_FILE_IO_TOKEN token;
+    BOOLEAN async;
+    UINT8 *next;                // where the next chunk lands
+    UINTN remaining;            // bytes not yet requested
+    UINTN issued;               // size of the outstanding chunk
+    EFI_STATUS status;          // of a synchronous read
+} chunk_reader_t;
+
+static void reader_issue(chunk_reader_t *r) {
+    UINTN size = r->remaining < KERNEL_READ_CHUNK ? r->remaining : KERNEL_READ_CHUNK;
+    r->issued = size;
+    r->status = EFI_SUCCESS;
+    if (!size) return;
+
+    if (r->async) {
+        r->token.Status = EFI_SUCCESS;
+        r->token.BufferSize = size;
+        r->token.Buffer = r->next;
+        if (!EFI_ERROR(r->file->ReadEx(r->file, &r->token))) return;
+        r->async = FALSE;
+        gBS->CloseEvent(r->token.Event);
+    }
+    r->status = r->file->Read(r->file, &r->issued, r->next);
+}
+
+// Wait for the outstanding chunk; returns the bytes it delivered in *got
+static EFI_STATUS reader_wait(chunk_reader_t *r, UINTN *got) {
+    EFI_STATUS Status = r->status;
+    *got = r->issued;
+    if (r->async && r->issued) {
+        r->issued = 0;
+        UINTN Index;
+        Status = gBS->WaitForEvent(1, &r->token.Event, &Index);
+        if (!EFI_ERROR(Status)) Status = r->token.Status;
+        *got = r->token.BufferSize;
+        g_kernel_params.timing.kernel_async_reads++;
+    }
+    if (EFI_ERROR(Status)) return Status;
+    if (!*got) return EFI_END_OF_FILE;
+    r->next += *got;
+    r->remaining -= *got;
+    return EFI_SUCCESS;
+}
+
+// Decompress the container into a pool buffer holding the kernel ELF
+static EFI_STATUS read_container(EFI_FILE_PROTOCOL *KernelFile, UINT8 **Image, UINTN *ImageSize) {
+    EFI_STATUS Status;
+    kernel_container_t Header;
+    UINTN Size = sizeof(Header);
+    boot_timing_t *timing = &g_kernel_params.timing;
+
+    Status = KernelFile->Read(KernelFile, &Size, &Header);
+    if (EFI_ERROR(Status)) return Status;
+    if (Size != sizeof(Header) || Header.magic != KERNEL_CONTAINER_MAGIC ||
+        Header.version != KERNEL_CONTAINER_VERSION || Header.header_size < sizeof(Header) ||
+        !Header.block_size || Header.block_size >= KERNEL_BLOCK_STORED ||
+        !Header.image_size || !Header.compressed_size)
+        return EFI_LOAD_ERROR;
+    Status = KernelFile->SetPosition(KernelFile, Header.header_size);
+    if (EFI_ERROR(Status)) return Status;
+
+    UINT8 *Out;
+    Status = gBS->AllocatePool(EfiLoaderData, Header.image_size, (VOID **)&Out);
+    if (EFI_ERROR(Status)) return Status;
+
+    // The whole stream is staged so that blocks never straddle two buffers
+    UINT8 *Stage;
+    Status = gBS->AllocatePool(EfiLoaderData, Header.compressed_size, (VOID **)&Stage);
+    if (EFI_ERROR(Status)) {
+        gBS->FreePool(Out);
+        return Status;
+    }
+
+    chunk_reader_t Reader = { 0 };
+    Reader.file = KernelFile;
+    Reader.next = Stage;
+    Reader.remaining = Header.compressed_size;
+    Reader.async = KernelFile->Revision >= FILE_REVISION_READ_EX &&
+                   !EFI_ERROR(gBS->CreateEvent(0, 0, NULL, NULL, &Reader.token.Event));
+
+    UINTN Arrived = 0, Consumed = 0, Produced = 0;
+    UINT32 Crc = 0;
+
+    crc32_init();
+    reader_issue(&Reader);
+    while (Arrived < Header.compressed_size) {
+        UINTN Got;
+        UINT64 t0 = read_tsc();
+        Status = reader_wait(&Reader, &Got);
+        timing->kernel_read_tsc += read_tsc() - t0;
+        if (EFI_ERROR(Status)) break;
+        Arrived += Got;
+        reader_issue(&Reader);
+
+        // Decompress every block that has fully arrived
+        t0 = read_tsc();
+        while (Arrived - Consumed >= sizeof(UINT32)) {
+            UINT32 Word = *(UINT32 *)(Stage + Consumed);
+            UINTN Stored = Word & ~KERNEL_BLOCK_STORED;
+            if (Arrived - Consumed - sizeof(UINT32) < Stored) break;
+
+            UINTN Length = Header.image_size - Produced;
+            if (Length > Header.block_size) Length = Header.block_size;
+            const UINT8 *Src = Stage + Consumed + sizeof(UINT32);
+            if (!Length) {
+                Status = EFI_LOAD_ERROR;
+            } else if (Word & KERNEL_BLOCK_STORED) {
+                Status = Stored == Length ? EFI_SUCCESS : EFI_LOAD_ERROR;
+                if (!EFI_ERROR(Status)) CopyMem(Out + Produced, Src, Length);
+            } else {
+                Status = lz4_decode(Src, Stored, Out, Produced, Length);
+            }
+            if (EFI_ERROR(Status)) break;
+
+            Crc = crc32_update(Crc, Out + Produced, Length);
+            Produced += Length;
+            Consumed += sizeof(UINT32) + Stored;
+        }
+        timing->kernel_inflate_tsc += read_tsc() - t0;
+        if (EFI_ERROR(Status)) break;
+    }
+
+    // An early exit may leave a read in flight into the staging buffer
+    if (Reader.async && Reader.issued) {
+        UINTN Got;
+        reader_wait(&Reader, &Got);
+    }
+    if (Reader.async) gBS->CloseEvent(Reader.token.Event);
+    gBS->FreePool(Stage);
+
+    if (!EFI_ERROR(Status) && (Consumed != Header.compressed_size || Produced != Header.image_size))
+        Status = EFI_LOAD_ERROR;
+    if (!EFI_ERROR(Status) && Crc != Header.image_crc32)
+        Status = EFI_CRC_ERROR;
+    if (EFI_ERROR(Status)) {
+        gBS->FreePool(Out);
+        return Status;
+    }
+
+    timing->kernel_format = BOOT_KERNEL_LZ4;
+    timing->kernel_file_bytes = Header.header_size + Header.compressed_size;
+    timing->kernel_image_bytes = Header.image_size;
+    *Image = Out;
+    *ImageSize = Header.image_size;
+    return EFI_SUCCESS;
+}
+
+// Read the uncompressed ELF into a pool buffer in one go
+static EFI_STATUS read_raw(EFI_FILE_PROTOCOL *KernelFile, UINT8 **Image, UINTN *ImageSize) {
     EFI_STATUS Status;
-    EFI_FILE_PROTOCOL *KernelFile;
     EFI_FILE_INFO *FileInfo;
     UINTN InfoSize = sizeof(EFI_FILE_INFO) + 1024;
     UINTN FileSize;
     
-    Status = Root->Open(Root, &KernelFile, L"\\EFI\\BOOT\\kernel.bin", EFI_FILE_MODE_READ, 0);
-    if (EFI_ERROR(Status)) return Status;
-    
     Status = gBS->AllocatePool(EfiLoaderData, InfoSize, (VOID **)&FileInfo);
-    if (EFI_ERROR(Status)) {
-        KernelFile->Close(KernelFile);
-        return Status;
-    }
+    if (EFI_ERROR(Status)) return Status;
     
     Status = KernelFile->GetInfo(KernelFile, &gEfiFileInfoGuid, &InfoSize, FileInfo);
     if (EFI_ERROR(Status)) {
         gBS->FreePool(FileInfo);
-        KernelFile->Close(KernelFile);
         return Status;
     }
     
     FileSize = FileInfo->FileSize;
     gBS->FreePool(FileInfo);
+    if (!FileSize) return EFI_LOAD_ERROR;
     
-    EFI_PHYSICAL_ADDRESS desiredAddress = 0x00100000;
+    UINT8 *Buffer;
+    Status = gBS->AllocatePool(EfiLoaderData, FileSize, (VOID **)&Buffer);
+    if (EFI_ERROR(Status)) return Status;
     
-    Status = gBS->AllocatePages(AllocateAddress, EfiLoaderData, 
-                              EFI_SIZE_TO_PAGES(FileSize + 0x10000), &desiredAddress);
+    UINTN Size = FileSize;
+    UINT64 t0 = read_tsc();
+    Status = KernelFile->Read(KernelFile, &Size, Buffer);
+    g_kernel_params.timing.kernel_read_tsc = read_tsc() - t0;
+    if (!EFI_ERROR(Status) && Size != FileSize) Status = EFI_LOAD_ERROR;
     if (EFI_ERROR(Status)) {
-        KernelFile->Close(KernelFile);
+        gBS->FreePool(Buffer);
         return Status;
     }
     
-    *KernelAddress = desiredAddress;
-    Status = KernelFile->Read(KernelFile, &FileSize, (VOID *)(*KernelAddress));
+    g_kernel_params.timing.kernel_format = BOOT_KERNEL_RAW;
+    g_kernel_params.timing.kernel_file_bytes = FileSize;
+    g_kernel_params.timing.kernel_image_bytes = FileSize;
+    *Image = Buffer;
+    *ImageSize = FileSize;
+    return EFI_SUCCESS;
+}
+
+// Zero the .bss part of a segment: eight bytes per store, then the tail
+static void fill_zero(VOID *dst, UINTN len) {
+    UINTN qwords = len / 8, bytes = len % 8;
+    __asm__ volatile("rep stosq" : "+D"(dst), "+c"(qwords) : "a"(0ULL) : "memory");
+    __asm__ volatile("rep stosb" : "+D"(dst), "+c"(bytes) : "a"(0) : "memory");
+}
+
+// Page tables for segments linked away from their load address. The firmware's
+// PML4 entries are copied so that everything it maps stays reachable until
+// the kernel installs its own tables; the loader only ever adds tables of its
+// own below the copy, tagged in an available bit, and never writes into the
+// firmware's.
+#define PTE_PRESENT     0x001ULL
+#define PTE_WRITABLE    0x002ULL
+#define PTE_LARGE       0x080ULL
+#define PTE_LOADER      0x200ULL
+#define PTE_ADDR_MASK   0x000FFFFFFFFFF000ULL
+
+static UINT64 *g_kernel_pml4;
+
+static UINT64 *alloc_table(void) {
+    EFI_PHYSICAL_ADDRESS Page;
+    if (EFI_ERROR(gBS->AllocatePages(AllocateAnyPages, KERNEL_MEMORY_TYPE, 1, &Page)))
+        return NULL;
+    SetMem((VOID *)(UINTN)Page, EFI_PAGE_SIZE, 0);
+    return (UINT64 *)(UINTN)Page;
+}
+
+static EFI_STATUS map_page(UINT64 Virt, UINT64 Phys) {
+    if (!g_kernel_pml4) {
+        UINT64 Cr3;
+        __asm__ volatile("mov %%cr3, %0" : "=r"(Cr3));
+        g_kernel_pml4 = alloc_table();
+        if (!g_kernel_pml4) return EFI_OUT_OF_RESOURCES;
+        CopyMem(g_kernel_pml4, (VOID *)(UINTN)(Cr3 & PTE_ADDR_MASK), EFI_PAGE_SIZE);
+    }
+
+    UINT64 *Table = g_kernel_pml4;
+    for (int Shift = 39; Shift > 12; Shift -= 9) {
+        UINT64 *Entry = &Table[(Virt >> Shift) & 0x1FF];
+        if (!(*Entry & PTE_PRESENT)) {
+            UINT64 *Next = alloc_table();
+            if (!Next) return EFI_OUT_OF_RESOURCES;
+            *Entry = (UINT64)(UINTN)Next | PTE_PRESENT | PTE_WRITABLE | PTE_LOADER;
+        } else if (!(*Entry & PTE_LOADER) || (*Entry & PTE_LARGE)) {
+            // The firmware already maps this range
+            return EFI_UNSUPPORTED;
+        }
+        Table = (UINT64 *)(UINTN)(*Entry & PTE_ADDR_MASK);
+    }
+    UINT64 *Pte = &Table[(Virt >> 12) & 0x1FF];
+    if (*Pte & PTE_PRESENT) return EFI_LOAD_ERROR;
+    *Pte = Phys | PTE_PRESENT | PTE_WRITABLE;
+    return EFI_SUCCESS;
+}
+
+static BOOLEAN elf_range_ok(UINTN ImageSize, UINT64 Offset, UINT64 Size) {
+    return Offset <= ImageSize && Size <= ImageSize - Offset;
+}
+
+// Copy the section headers and the symbol and string tables the kernel can
+// fall back on for symbolization. Allocated sections are left alone, since
+// they already sit in the loaded segments.
+static EFI_STATUS copy_sections(const UINT8 *Image, UINTN ImageSize, const elf64_ehdr_t *Ehdr) {
+    if (!Ehdr->shoff || !Ehdr->shnum) return EFI_SUCCESS;
+    if (Ehdr->shentsize != sizeof(elf64_shdr_t) || Ehdr->shstrndx >= Ehdr->shnum ||
+        !elf_range_ok(ImageSize, Ehdr->shoff, (UINT64)Ehdr->shnum * sizeof(elf64_shdr_t)))
+        return EFI_LOAD_ERROR;
+
+    const elf64_shdr_t *Src = (const elf64_shdr_t *)(Image + Ehdr->shoff);
+    UINTN Total = Ehdr->shnum * sizeof(elf64_shdr_t);
+    for (UINTN i = 0; i < Ehdr->shnum; i++) {
+        if (Src[i].flags & ELF_SHF_ALLOC) continue;
+        if (Src[i].type != ELF_SHT_SYMTAB && Src[i].type != ELF_SHT_STRTAB) continue;
+        if (!elf_range_ok(ImageSize, Src[i].offset, Src[i].size)) return EFI_LOAD_ERROR;
+        Total += (Src[i].size + 7) & ~7ULL;
+    }
+
+    EFI_PHYSICAL_ADDRESS Base;
+    EFI_STATUS Status = gBS->AllocatePages(AllocateAnyPages, KERNEL_MEMORY_TYPE,
+                                           EFI_SIZE_TO_PAGES(Total), &Base);
+    if (EFI_ERROR(Status)) return Status;
+
+    elf64_shdr_t *Dst = (elf64_shdr_t *)(UINTN)Base;
+    UINT8 *Data = (UINT8 *)(Dst + Ehdr->shnum);
+    CopyMem(Dst, Src, Ehdr->shnum * sizeof(elf64_shdr_t));
+    for (UINTN i = 0; i < Ehdr->shnum; i++) {
+        if (Dst[i].flags & ELF_SHF_ALLOC) continue;
+        if (Dst[i].type != ELF_SHT_SYMTAB && Dst[i].type != ELF_SHT_STRTAB) continue;
+        CopyMem(Data, Image + Dst[i].offset, Dst[i].size);
+        Dst[i].addr = (UINT64)(UINTN)Data;
+        Data += (Dst[i].size + 7) & ~7ULL;
+    }
+
+    g_kernel_params.elf.sections = Base;
+    g_kernel_params.elf.section_count = Ehdr->shnum;
+    g_kernel_params.elf.section_size = sizeof(elf64_shdr_t);
+    g_kernel_params.elf.section_names = Ehdr->shstrndx;
+    return EFI_SUCCESS;
+}
+
+// Place every PT_LOAD segment at its physical address, zero what lies past
+// its file bytes and map it at its virtual address if that differs
+static EFI_STATUS load_elf(const UINT8 *Image, UINTN ImageSize, EFI_PHYSICAL_ADDRESS *Entry) {
+    const elf64_ehdr_t *Ehdr = (const elf64_ehdr_t *)Image;
+    if (ImageSize < sizeof(*Ehdr) || Ehdr->magic != ELF_MAGIC ||
+        Ehdr->class != ELF_CLASS_64 || Ehdr->data != ELF_DATA_LSB ||
+        Ehdr->type != ELF_TYPE_EXEC || Ehdr->machine != ELF_MACHINE_X86_64 ||
+        Ehdr->phentsize != sizeof(elf64_phdr_t) || !Ehdr->phnum ||
+        !elf_range_ok(ImageSize, Ehdr->phoff, (UINT64)Ehdr->phnum * sizeof(elf64_phdr_t)))
+        return EFI_LOAD_ERROR;
+
+    const elf64_phdr_t *Phdr = (const elf64_phdr_t *)(Image + Ehdr->phoff);
+    boot_timing_t *timing = &g_kernel_params.timing;
+    UINT64 Placed = 0;          // end of the pages allocated so far
+    BOOLEAN EntryMapped = FALSE;
+    EFI_STATUS Status;
+
+    UINT64 t0 = read_tsc();
+    for (UINTN i = 0; i < Ehdr->phnum; i++) {
+        const elf64_phdr_t *Seg = &Phdr[i];
+        if (Seg->type != ELF_PT_LOAD || !Seg->memsz) continue;
+        if (Seg->filesz > Seg->memsz || !elf_range_ok(ImageSize, Seg->offset, Seg->filesz) ||
+            (Seg->vaddr & 0xFFF) != (Seg->paddr & 0xFFF) ||
+            Seg->paddr + Seg->memsz < Seg->paddr)
+            return EFI_LOAD_ERROR;
+
+        // Segments may share a page with the one before them, but must come
+        // in address order, as ld emits them
+        UINT64 First = Seg->paddr & ~0xFFFULL;
+        UINT64 Last = (Seg->paddr + Seg->memsz + 0xFFF) & ~0xFFFULL;
+        if (Seg->paddr < Placed && First + EFI_PAGE_SIZE != Placed) return EFI_LOAD_ERROR;
+        if (First < Placed) First = Placed;
+        if (First < Last) {
+            EFI_PHYSICAL_ADDRESS Addr = First;
+            Status = gBS->AllocatePages(AllocateAddress, KERNEL_MEMORY_TYPE,
+                                        EFI_SIZE_TO_PAGES(Last - First), &Addr);
+            if (EFI_ERROR(Status)) return Status;
+            Placed = Last;
+        }
+
+        UINT8 *Dst = (UINT8 *)(UINTN)Seg->paddr;
+        CopyMem(Dst, Image + Seg->offset, Seg->filesz);
+        fill_zero(Dst + Seg->filesz, Seg->memsz - Seg->filesz);
+        timing->kernel_bss_bytes += Seg->memsz - Seg->filesz;
+
+        if (Seg->vaddr != Seg->paddr) {
+            UINT64 Offset = Seg->vaddr - Seg->paddr;
+            for (UINT64 Page = Seg->paddr & ~0xFFFULL; Page < Seg->paddr + Seg->memsz; Page += EFI_PAGE_SIZE) {
+                Status = map_page(Page + Offset, Page);
+                // Pages shared with the previous segment are already mapped
+                if (Status == EFI_LOAD_ERROR && Page < (Seg->paddr & ~0xFFFULL) + EFI_PAGE_SIZE)
+                    continue;
+                if (EFI_ERROR(Status)) return Status;
+            }
+        }
+        if (Ehdr->entry >= Seg->vaddr && Ehdr->entry < Seg->vaddr + Seg->memsz)
+            EntryMapped = TRUE;
+    }
+    timing->kernel_place_tsc = read_tsc() - t0;
+    if (!EntryMapped) return EFI_LOAD_ERROR;
+
+    Status = copy_sections(Image, ImageSize, Ehdr);
+    if (EFI_ERROR(Status)) return Status;
+
+    *Entry = Ehdr->entry;
+    return EFI_SUCCESS;
+}
+
+// Prefer the compressed container; fall back to the plain ELF
+EFI_STATUS load_kernel(EFI_FILE_PROTOCOL *Root, EFI_PHYSICAL_ADDRESS *KernelEntry) {
+    EFI_STATUS Status;
+    EFI_FILE_PROTOCOL *KernelFile;
+    UINT8 *Image;
+    UINTN ImageSize;
+    
+    Status = Root->Open(Root, &KernelFile, L"\\EFI\\BOOT\\kernel.kz", EFI_FILE_MODE_READ, 0);
+    if (!EFI_ERROR(Status)) {
+        Status = read_container(KernelFile, &Image, &ImageSize);
+    } else {
+        Status = Root->Open(Root, &KernelFile, L"\\EFI\\BOOT\\kernel.elf", EFI_FILE_MODE_READ, 0);
+        if (EFI_ERROR(Status)) return Status;
+        Status = read_raw(KernelFile, &Image, &ImageSize);
+    }
     KernelFile->Close(KernelFile);
+    if (EFI_ERROR(Status)) return Status;
     
+    Status = load_elf(Image, ImageSize, KernelEntry);
+    gBS->FreePool(Image);
     return Status;
 }
 
+static EFI_STATUS load_module(EFI_FILE_PROTOCOL *Dir, EFI_FILE_INFO *Info, boot_module_t *Module) {
+    EFI_STATUS Status;
+    EFI_FILE_PROTOCOL *File;
+    EFI_PHYSICAL_ADDRESS Base;
+    UINTN Pages = EFI_SIZE_TO_PAGES(Info->FileSize);
+
+    Status = Dir->Open(Dir, &File, Info->FileName, EFI_FILE_MODE_READ, 0);
+    if (EFI_ERROR(Status)) return Status;
+    Status = gBS->AllocatePages(AllocateAnyPages, KERNEL_MEMORY_TYPE, Pages, &Base);
+    if (EFI_ERROR(Status)) {
+        File->Close(File);
+        return Status;
+    }
+
+    UINTN Size = Info->FileSize;
+    Status = File->Read(File, &Size, (VOID *)(UINTN)Base);
+    File->Close(File);
+    if (!EFI_ERROR(Status) && Size != Info->FileSize) Status = EFI_LOAD_ERROR;
+    if (EFI_ERROR(Status)) {
+        gBS->FreePages(Base, Pages);
+        return Status;
+    }
+
+    Module->base = Base;
+    Module->size = Size;
+    UINTN i;
+    for (i = 0; i < BOOT_MODULE_NAME_MAX - 1 && Info->FileName[i]; i++)
+        Module->name[i] = Info->FileName[i] < 0x80 ? (CHAR8)Info->FileName[i] : '?';
+    Module->name[i] = 0;
+    return EFI_SUCCESS;
+}
+
+// Load every file in \EFI\BOOT\modules; without the directory there are none.
+// Modules are optional, so a file that cannot be loaded is skipped and the
+// boot goes on with the rest: this never fails.
+EFI_STATUS load_modules(EFI_FILE_PROTOCOL *Root) {
+    EFI_STATUS Status;
+    EFI_FILE_PROTOCOL *Dir;
+    UINT64 InfoBuffer[(sizeof(EFI_FILE_INFO) + 512) / sizeof(UINT64)];
+    EFI_FILE_INFO *Info = (EFI_FILE_INFO *)InfoBuffer;
+
+    Status = Root->Open(Root, &Dir, L"\\EFI\\BOOT\\modules", EFI_FILE_MODE_READ, 0);
+    if (EFI_ERROR(Status)) return EFI_SUCCESS;
+
+    UINT64 t0 = read_tsc();
+    for (;;) {
+        UINTN Size = sizeof(InfoBuffer);
+        Status = Dir->Read(Dir, &Size, Info);
+        if (EFI_ERROR(Status)) {
+            Print(L"Modules: cannot list the directory (%r), loading no more\n", Status);
+            break;
+        }
+        if (!Size) break;
+        if ((Info->Attribute & EFI_FILE_DIRECTORY) || !Info->FileSize) continue;
+        if (g_kernel_params.module_count == BOOT_MODULE_MAX) {
+            Print(L"Modules: more than %d files, ignoring %s and the rest\n", BOOT_MODULE_MAX, Info->FileName);
+            break;
+        }
+        Status = load_module(Dir, Info, &g_kernel_params.modules[g_kernel_params.module_count]);
+        if (EFI_ERROR(Status)) {
+            Print(L"Modules: skipping %s (%r)\n", Info->FileName, Status);
+            continue;
+        }
+        g_kernel_params.module_count++;
+    }
+    g_kernel_params.timing.modules_read_tsc = read_tsc() - t0;
+    Dir->Close(Dir);
+    return EFI_SUCCESS;
+}
+
 EFI_STATUS
 efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable)
 {
@@ -196,11 +709,15 @@ efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable)
     UINTN                            MapKey           = 0;
     UINTN                            DescriptorSize   = 0;
     UINT32                           DescriptorVersion= 0;
-    EFI_PHYSICAL_ADDRESS             KernelImageAddr = 0;
+    EFI_PHYSICAL_ADDRESS             KernelEntry      = 0;
+
+    g_kernel_params.timing.version = BOOT_TIMING_VERSION;
+    BOOT_STAMP(BOOT_TSC_EFI_ENTRY);
 
     // 1) UEFI setup + splash
     InitializeLib(ImageHandle, SystemTable);
     display_logo(SystemTable->ConOut);
+    BOOT_STAMP(BOOT_TSC_LOGO);
 
     // 2) Grab a stable memory map
     Status = configure_memory(
@@ -210,6 +727,7 @@ efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable)
     );
     if (EFI_ERROR(Status))
         error_freeze(SystemTable->ConOut, Status);
+    BOOT_STAMP(BOOT_TSC_MEMORY_MAP);
 
     // 3) Populate g_kernel_params.memory_info
     g_kernel_params.memory_info.memory_map        = MemoryMap;
@@ -223,8 +741,9 @@ efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable)
     if (EFI_ERROR(Status))
         error_freeze(SystemTable->ConOut, Status);
     detect_hardware_features();
+    BOOT_STAMP(BOOT_TSC_GRAPHICS);
 
-    // 5) Load kernel.bin at 1 MiB
+    // 5) Load the kernel ELF, from kernel.kz or kernel.elf, and the boot modules
     Status = BS->HandleProtocol(
         ImageHandle,
         &gEfiSimpleFileSystemProtocolGuid,
@@ -237,9 +756,13 @@ efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable)
     if (EFI_ERROR(Status))
         error_freeze(SystemTable->ConOut, Status);
 
-    Status = load_kernel(Root, &KernelImageAddr);
+    Status = load_kernel(Root, &KernelEntry);
+    if (EFI_ERROR(Status))
+        error_freeze(SystemTable->ConOut, Status);
+    Status = load_modules(Root);
     if (EFI_ERROR(Status))
         error_freeze(SystemTable->ConOut, Status);
+    BOOT_STAMP(BOOT_TSC_KERNEL_LOADED);
 
     // 6) Exit boot services (retry if memory map changed)
     Status = reacquire_memory_map_and_exit_boot_services(
@@ -252,6 +775,7 @@ efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable)
     );
     if (EFI_ERROR(Status))
         error_freeze(SystemTable->ConOut, Status);
+    BOOT_STAMP(BOOT_TSC_EXIT_BOOT_SERVICES);
 
     // 7) Refresh params in case map grew
     g_kernel_params.memory_info.memory_map        = MemoryMap;
@@ -260,8 +784,12 @@ efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable)
     g_kernel_params.memory_info.descriptor_size   = DescriptorSize;
     g_kernel_params.memory_info.descriptor_version= DescriptorVersion;
 
-    // 8) Jump into your kernel!
-    kernel_main_t entry = (kernel_main_t)(UINTN)KernelImageAddr;
+    // 8) Switch to the loader's tables if a segment needed mapping, then
+    //    jump into your kernel!
+    if (g_kernel_pml4)
+        __asm__ volatile("mov %0, %%cr3" : : "r"((UINT64)(UINTN)g_kernel_pml4) : "memory");
+    kernel_main_t entry = (kernel_main_t)(UINTN)KernelEntry;
+    BOOT_STAMP(BOOT_TSC_KERNEL_JUMP);
     entry(&g_kernel_params);
 
     // Should never return; if it does, halt forever
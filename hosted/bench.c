@@ -0,0 +1,519 @@
+#define _GNU_SOURCE
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "shim.h"
+#include "cpu.h"
+#include "error.h"
+#include "font.h"
+#include "framebuffer.h"
+#include "glyph_cache.h"
+#include "kernel.h"
+#include "raster.h"
+#include "util.h"
+
+// Microbenchmarks over the hosted kernel modules. Each benchmark is sized
+// so that one repetition runs for --min-ms, then timed over --reps
+// repetitions; the report gives the median with its spread, the fastest
+// repetition, TSC cycles per operation and the rates at which the operation
+// writes its output, in bytes and in pixels.
+
+#define DEFAULT_REPS        11
+#define DEFAULT_MIN_MS      20
+#define DEFAULT_WIDTH       1920
+#define DEFAULT_HEIGHT      1080
+#define MAX_REPS            101
+#define COPY_BYTES          (1U << 20)
+#define SPRITE_SIZE         256
+#define ICON_SIZE           32
+#define LINE_COUNT          64
+
+typedef struct {
+    const char *name;
+    uint64_t (*bytes_per_op)(void);     // NULL if a rate means nothing
+    uint64_t (*pixels_per_op)(void);
+    void (*run)(uint64_t iterations);
+} bench_t;
+
+static unsigned int g_width = DEFAULT_WIDTH;
+static unsigned int g_height = DEFAULT_HEIGHT;
+static char g_page_line[DEFAULT_WIDTH];
+static unsigned int g_page_cols;
+static unsigned int g_page_rows;
+static uint8_t *g_copy_src;
+static uint8_t *g_copy_dst;
+static fb_surface_t g_screen;
+static fb_surface_t g_sprite;           // ARGB with mixed alpha
+static int g_line_ends[LINE_COUNT][2];
+static uint64_t g_line_pixels;          // over all LINE_COUNT lines
+static uint8_t g_big_glyphs[128][16][2];
+static font_t g_big_font;               // g_font doubled to 16x16
+static unsigned int g_text_len;         // glyphs in g_text_line
+static unsigned int g_text_glyphs;      // per text_page() call
+
+static const char g_text_line[] = "Caf\xC3\xA9 cr\xC3\xA8me: 42, status ok [0x1F] -> next; ";
+static volatile uint64_t g_sink;
+
+static uint64_t frame_bytes(void) {
+    return (uint64_t)g_height * g_framebuffer.framebuffer_pitch;
+}
+
+static uint64_t glyph_bytes(void) {
+    return 8 * 8 * 4;
+}
+
+static uint64_t line_bytes(void) {
+    return 80 * glyph_bytes();
+}
+
+static uint64_t page_bytes(void) {
+    return (uint64_t)g_page_cols * g_page_rows * glyph_bytes();
+}
+
+static uint64_t frame_pixels(void) {
+    return (uint64_t)g_width * g_height;
+}
+
+static uint64_t glyph_pixels(void) {
+    return 8 * 8;
+}
+
+static uint64_t line_pixels(void) {
+    return 80 * glyph_pixels();
+}
+
+static uint64_t page_pixels(void) {
+    return (uint64_t)g_page_cols * g_page_rows * glyph_pixels();
+}
+
+static uint64_t tile_pixels(void) {
+    return 16 * 16;
+}
+
+static uint64_t icon_pixels(void) {
+    return ICON_SIZE * ICON_SIZE;
+}
+
+static uint64_t sprite_pixels(void) {
+    return SPRITE_SIZE * SPRITE_SIZE;
+}
+
+static uint64_t tile_bytes(void) {
+    return tile_pixels() * 4;
+}
+
+static uint64_t icon_bytes(void) {
+    return icon_pixels() * 4;
+}
+
+static uint64_t sprite_bytes(void) {
+    return sprite_pixels() * 4;
+}
+
+static uint64_t star_pixels(void) {
+    return g_line_pixels;
+}
+
+static uint64_t star_bytes(void) {
+    return g_line_pixels * 4;
+}
+
+static uint64_t cell_pixels(void) {
+    return FONT_WIDTH * FONT_LINE_HEIGHT;
+}
+
+static uint64_t cell_bytes(void) {
+    return cell_pixels() * 4;
+}
+
+static uint64_t text_pixels(void) {
+    return (uint64_t)g_text_glyphs * g_big_font.width * g_big_font.line_height;
+}
+
+static uint64_t text_bytes(void) {
+    return text_pixels() * 4;
+}
+
+static uint64_t hex_bytes(void) {
+    return 18;
+}
+
+static uint64_t copy_bytes(void) {
+    return COPY_BYTES;
+}
+
+static void run_clear_screen(uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) clear_screen(i & 1 ? COLOR_BLACK : COLOR_BLUE);
+}
+
+// Glyphs walk the screen so that the working set is the whole back buffer
+static void run_draw_char(uint64_t n) {
+    unsigned int cols = g_width / 8, rows = g_height / 10, x = 0, y = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        draw_char(x * 8, y * 10, (char)(33 + i % 94), COLOR_WHITE);
+        if (++x == cols) {
+            x = 0;
+            if (++y == rows) y = 0;
+        }
+    }
+}
+
+static void run_draw_string_80(uint64_t n) {
+    static const char line[81] =
+        "The quick brown fox jumps over the lazy dog 0123456789 !\"#$%&'()*+,-./:;<=>?@[]";
+    unsigned int rows = g_height / 10;
+    for (uint64_t i = 0; i < n; i++) draw_string(10, (unsigned int)(i % rows) * 10, line, COLOR_GREEN);
+}
+
+static void run_draw_string_page(uint64_t n) {
+    for (uint64_t i = 0; i < n; i++)
+        for (unsigned int r = 0; r < g_page_rows; r++) draw_string(0, r * 10, g_page_line, COLOR_WHITE);
+}
+
+// Console-style cells: a few colours over the printable range
+static void run_draw_cell(uint64_t n) {
+    unsigned int cols = g_width / FONT_WIDTH, rows = g_height / FONT_LINE_HEIGHT, x = 0, y = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        draw_cell(x * FONT_WIDTH, y * FONT_LINE_HEIGHT, (char)(33 + i % 94), i % 7 ? COLOR_WHITE : COLOR_CYAN,
+                  COLOR_BLACK);
+        if (++x == cols) {
+            x = 0;
+            if (++y == rows) y = 0;
+        }
+    }
+}
+
+// A screen of opaque UTF-8 text in the 16x16 font; returns the glyphs drawn
+static unsigned int text_page(void) {
+    unsigned int glyphs = 0, step = g_text_len * 16;
+    draw_set_font(&g_big_font);
+    for (unsigned int y = 0; y + 16 <= g_height; y += 16)
+        for (unsigned int x = 0; x + step + 16 <= g_width; x += step) {
+            draw_text(x, y, g_text_line, COLOR_WHITE, COLOR_BLUE);
+            glyphs += g_text_len;
+        }
+    draw_set_font(0);
+    return glyphs;
+}
+
+static void run_draw_text_tiles(uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) text_page();
+}
+
+static void run_draw_text_bits(uint64_t n) {
+    int was = glyph_cache_set_enabled(0);
+    for (uint64_t i = 0; i < n; i++) text_page();
+    glyph_cache_set_enabled(was);
+}
+
+static void run_fb_flush(uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+        fb_damage_all();
+        fb_flush();
+    }
+}
+
+static void run_format_hex(uint64_t n) {
+    char buf[19];
+    for (uint64_t i = 0; i < n; i++) {
+        format_hex(buf, i * 0x9E3779B97F4A7C15UL);
+        g_sink += (uint8_t)buf[17];
+    }
+}
+
+static void run_ksnprintf(uint64_t n) {
+    char buf[64];
+    for (uint64_t i = 0; i < n; i++)
+        g_sink += ksnprintf(buf, sizeof(buf), "RIP: 0x%016lx %u", i * 0x9E3779B97F4A7C15UL, (unsigned int)i);
+}
+
+static void run_memset32(uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) memset32((uint32_t *)g_copy_dst, (uint32_t)i, COPY_BYTES / 4);
+}
+
+static void run_memcpy(uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) memcpy(g_copy_dst, g_copy_src, COPY_BYTES);
+}
+
+// Rectangles walk the screen on a grid of their own size
+static void walk(uint64_t i, unsigned int size, int *x, int *y) {
+    unsigned int cols = g_width / size, rows = g_height / size;
+    *x = (int)(i % cols * size);
+    *y = (int)(i / cols % rows * size);
+}
+
+static void run_raster_fill_16(uint64_t n) {
+    int x, y;
+    for (uint64_t i = 0; i < n; i++) {
+        walk(i, 16, &x, &y);
+        raster_fill_rect(&g_screen, x, y, 16, 16, (uint32_t)i);
+    }
+}
+
+static void run_raster_fill_256(uint64_t n) {
+    int x, y;
+    for (uint64_t i = 0; i < n; i++) {
+        walk(i, SPRITE_SIZE, &x, &y);
+        raster_fill_rect(&g_screen, x, y, SPRITE_SIZE, SPRITE_SIZE, (uint32_t)i);
+    }
+}
+
+static void run_raster_fill_full(uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) raster_fill_rect(&g_screen, 0, 0, g_width, g_height, (uint32_t)i);
+}
+
+static void run_raster_blit_256(uint64_t n) {
+    int x, y;
+    for (uint64_t i = 0; i < n; i++) {
+        walk(i, SPRITE_SIZE, &x, &y);
+        raster_blit(&g_screen, x, y, &g_sprite, 0, 0, SPRITE_SIZE, SPRITE_SIZE);
+    }
+}
+
+// Scroll the whole screen up by one text line within the same surface
+static void run_raster_blit_scroll(uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) raster_blit(&g_screen, 0, 0, &g_screen, 0, 10, g_width, g_height - 10);
+}
+
+static void run_raster_blend_32(uint64_t n) {
+    int x, y;
+    for (uint64_t i = 0; i < n; i++) {
+        walk(i, ICON_SIZE, &x, &y);
+        raster_blend(&g_screen, x, y, &g_sprite, (int)(i % 8) * ICON_SIZE, 0, ICON_SIZE, ICON_SIZE);
+    }
+}
+
+static void run_raster_blend_256(uint64_t n) {
+    int x, y;
+    for (uint64_t i = 0; i < n; i++) {
+        walk(i, SPRITE_SIZE, &x, &y);
+        raster_blend(&g_screen, x, y, &g_sprite, 0, 0, SPRITE_SIZE, SPRITE_SIZE);
+    }
+}
+
+// A star of LINE_COUNT lines from the screen centre
+static void run_raster_line(uint64_t n) {
+    int cx = g_width / 2, cy = g_height / 2;
+    for (uint64_t i = 0; i < n; i++)
+        for (unsigned int l = 0; l < LINE_COUNT; l++)
+            raster_line(&g_screen, cx, cy, g_line_ends[l][0], g_line_ends[l][1], (uint32_t)(i + l));
+}
+
+static void run_raster_line_aa(uint64_t n) {
+    int cx = g_width / 2, cy = g_height / 2;
+    for (uint64_t i = 0; i < n; i++)
+        for (unsigned int l = 0; l < LINE_COUNT; l++)
+            raster_line_aa(&g_screen, cx, cy, g_line_ends[l][0], g_line_ends[l][1], (uint32_t)(i + l));
+}
+
+static const bench_t g_benches[] = {
+    { "clear_screen",       frame_bytes,    frame_pixels,   run_clear_screen },
+    { "draw_char",          glyph_bytes,    glyph_pixels,   run_draw_char },
+    { "draw_string/80",     line_bytes,     line_pixels,    run_draw_string_80 },
+    { "draw_string/page",   page_bytes,     page_pixels,    run_draw_string_page },
+    { "draw_cell",          cell_bytes,     cell_pixels,    run_draw_cell },
+    { "draw_text/16x16",    text_bytes,     text_pixels,    run_draw_text_tiles },
+    { "draw_text/16x16-bits", text_bytes,   text_pixels,    run_draw_text_bits },
+    { "fb_flush/full",      frame_bytes,    frame_pixels,   run_fb_flush },
+    { "raster_fill/16",     tile_bytes,     tile_pixels,    run_raster_fill_16 },
+    { "raster_fill/256",    sprite_bytes,   sprite_pixels,  run_raster_fill_256 },
+    { "raster_fill/full",   frame_bytes,    frame_pixels,   run_raster_fill_full },
+    { "raster_blit/256",    sprite_bytes,   sprite_pixels,  run_raster_blit_256 },
+    { "raster_blit/scroll", frame_bytes,    frame_pixels,   run_raster_blit_scroll },
+    { "raster_blend/32",    icon_bytes,     icon_pixels,    run_raster_blend_32 },
+    { "raster_blend/256",   sprite_bytes,   sprite_pixels,  run_raster_blend_256 },
+    { "raster_line/star",   star_bytes,     star_pixels,    run_raster_line },
+    { "raster_line_aa/star", star_bytes,    star_pixels,    run_raster_line_aa },
+    { "format_hex",         hex_bytes,      0,              run_format_hex },
+    { "ksnprintf/reg",      0,              0,              run_ksnprintf },
+    { "memset32/1M",        copy_bytes,     0,              run_memset32 },
+    { "memcpy/1M",          copy_bytes,     0,              run_memcpy },
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Double the count until a run is long enough to time, then scale it to
+// the target repetition length
+static uint64_t calibrate(const bench_t *b, uint64_t min_ns) {
+    uint64_t n = 1;
+    while (1) {
+        uint64_t t0 = now_ns();
+        b->run(n);
+        uint64_t elapsed = now_ns() - t0;
+        if (elapsed >= min_ns / 8 || n >= (1ULL << 40)) {
+            uint64_t scaled = elapsed ? (uint64_t)((double)n * min_ns / elapsed) : n;
+            return scaled ? scaled : 1;
+        }
+        n *= 2;
+    }
+}
+
+static void run_bench(const bench_t *b, unsigned int reps, uint64_t min_ns) {
+    double ns_op[MAX_REPS], cycles_op[MAX_REPS];
+
+    uint64_t n = calibrate(b, min_ns);
+    b->run(n);      // warm the caches and the branch predictors
+    for (unsigned int r = 0; r < reps; r++) {
+        uint64_t t0 = now_ns(), c0 = rdtsc();
+        b->run(n);
+        uint64_t c1 = rdtsc(), t1 = now_ns();
+        ns_op[r] = (double)(t1 - t0) / n;
+        cycles_op[r] = (double)(c1 - c0) / n;
+    }
+
+    qsort(ns_op, reps, sizeof(double), compare_double);
+    qsort(cycles_op, reps, sizeof(double), compare_double);
+    double median = ns_op[reps / 2];
+
+    // Median absolute deviation, as a share of the median
+    double dev[MAX_REPS];
+    for (unsigned int r = 0; r < reps; r++) dev[r] = ns_op[r] > median ? ns_op[r] - median : median - ns_op[r];
+    qsort(dev, reps, sizeof(double), compare_double);
+    double spread = median > 0 ? 100.0 * dev[reps / 2] / median : 0;
+
+    printf("%-20s %12.1f %12.1f %6.1f%% %12.0f", b->name, median, ns_op[0], spread, cycles_op[reps / 2]);
+    if (b->bytes_per_op && median > 0)
+        printf(" %10.0f", (double)b->bytes_per_op() / median * 1000.0);     // MB/s
+    else
+        printf(" %10s", "-");
+    if (b->pixels_per_op && median > 0)
+        printf(" %10.1f", (double)b->pixels_per_op() / median * 1000.0);  // Mpix/s
+    else
+        printf(" %10s", "-");
+    printf(" %12lu\n", (unsigned long)n);
+}
+
+static int setup_screen(void) {
+    uint32_t pitch = g_width * 4;
+    void *front = aligned_alloc(4096, ((uint64_t)pitch * g_height + 4095) & ~4095UL);
+    if (!front) return -1;
+
+    g_framebuffer = (framebuffer_info_t){ (uint64_t)front, g_width, g_height, pitch, 32 };
+    fb_init(&g_framebuffer);
+    if (fb_enable_backbuffer() != 0) return -1;
+    draw_init();
+    clear_screen(COLOR_BLACK);
+
+    g_page_cols = g_width / 8 - 1;
+    if (g_page_cols >= sizeof(g_page_line)) g_page_cols = sizeof(g_page_line) - 1;
+    g_page_rows = g_height / 10;
+    for (unsigned int i = 0; i < g_page_cols; i++) g_page_line[i] = (char)(33 + i % 94);
+    g_page_line[g_page_cols] = '\0';
+
+    g_copy_src = aligned_alloc(4096, COPY_BYTES);
+    g_copy_dst = aligned_alloc(4096, COPY_BYTES);
+    if (!g_copy_src || !g_copy_dst) return -1;
+    memset(g_copy_src, 0x5A, COPY_BYTES);
+
+    if (glyph_cache_init() != 0) return -1;
+
+    // The 8x8 font doubled, with no codepoint map: ASCII only
+    for (unsigned int g = 0; g < 128; g++)
+        for (unsigned int row = 0; row < 16; row++)
+            for (unsigned int col = 0; col < 16; col++)
+                if (g_font[g][row / 2] & (0x80 >> (col / 2))) g_big_glyphs[g][row][col / 8] |= 0x80 >> (col % 8);
+    g_big_font = (font_t){ .name = "builtin 16x16", .id = 1, .width = 16, .height = 16, .line_height = 16,
+                           .bytes_per_row = 2, .bytes_per_glyph = 32, .glyph_count = 128,
+                           .glyphs = &g_big_glyphs[0][0][0], .fallback = '?' };
+    g_text_len = 0;
+    for (const char *p = g_text_line; utf8_next(&p);) g_text_len++;
+    g_text_glyphs = text_page();
+
+    raster_screen(&g_screen);
+    g_sprite = (fb_surface_t){ aligned_alloc(4096, sprite_bytes()), SPRITE_SIZE, SPRITE_SIZE, SPRITE_SIZE };
+    if (!g_sprite.pixels) return -1;
+    for (unsigned int y = 0; y < SPRITE_SIZE; y++)
+        for (unsigned int x = 0; x < SPRITE_SIZE; x++)
+            g_sprite.pixels[y * SPRITE_SIZE + x] = (x ^ y) << 24 | x << 16 | y << 8 | (x + y) / 2;
+
+    // Line ends on a rectangle inside the screen, every direction covered;
+    // Bresenham and Wu both touch max(|dx|, |dy|) + 1 columns or rows
+    g_line_pixels = 0;
+    for (unsigned int l = 0; l < LINE_COUNT; l++) {
+        unsigned int t = l * (2 * (g_width + g_height) - 8) / LINE_COUNT, w = g_width - 2, h = g_height - 2;
+        int x = t < w ? (int)t : t < w + h ? (int)w : t < 2 * w + h ? (int)(2 * w + h - t) : 0;
+        int y = t < w ? 0 : t < w + h ? (int)(t - w) : t < 2 * w + h ? (int)h : (int)(2 * (w + h) - t);
+        int dx = x - (int)g_width / 2, dy = y - (int)g_height / 2;
+        g_line_ends[l][0] = x;
+        g_line_ends[l][1] = y;
+        g_line_pixels += (dx < 0 ? -dx : dx) > (dy < 0 ? -dy : dy) ? (dx < 0 ? -dx : dx) + 1 : (dy < 0 ? -dy : dy) + 1;
+    }
+    return 0;
+}
+
+// Stay on one CPU so that migrations do not show up as noise
+static void pin_cpu(void) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(sched_getcpu(), &set);
+    sched_setaffinity(0, sizeof(set), &set);
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [--filter SUBSTR] [--reps N] [--min-ms MS] [--simd scalar|sse2|avx|avx2]\n"
+            "          [--size WxH] [--list]\n"
+            "--size takes at least %ux%u, the largest tile a benchmark walks the screen with\n",
+            argv0, SPRITE_SIZE, SPRITE_SIZE);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const char *filter = 0, *simd = 0;
+    unsigned int reps = DEFAULT_REPS, min_ms = DEFAULT_MIN_MS;
+    int list = 0;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *val = i + 1 < argc ? argv[i + 1] : 0;
+        if (!strcmp(arg, "--list")) {
+            list = 1;
+            continue;
+        }
+        if (!val) usage(argv[0]);
+        if (!strcmp(arg, "--filter")) filter = val;
+        else if (!strcmp(arg, "--reps")) reps = (unsigned int)atoi(val);
+        else if (!strcmp(arg, "--min-ms")) min_ms = (unsigned int)atoi(val);
+        else if (!strcmp(arg, "--simd")) simd = val;
+        else if (!strcmp(arg, "--size")) {
+            if (sscanf(val, "%ux%u", &g_width, &g_height) != 2 || g_width < SPRITE_SIZE || g_height < SPRITE_SIZE)
+                usage(argv[0]);
+        } else usage(argv[0]);
+        i++;
+    }
+    if (reps < 1 || reps > MAX_REPS || !min_ms) usage(argv[0]);
+
+    if (list) {
+        for (size_t i = 0; i < sizeof(g_benches) / sizeof(g_benches[0]); i++) printf("%s\n", g_benches[i].name);
+        return 0;
+    }
+    if (shim_init(simd) != 0) usage(argv[0]);
+    if (setup_screen() != 0) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    pin_cpu();
+
+    printf("# %ux%u, memops %s, raster %s, TSC %lu MHz, %u reps of >= %u ms\n", g_width, g_height,
+           memops_variant(), raster_variant(), (unsigned long)(shim_tsc_hz() / 1000000), reps, min_ms);
+    printf("%-20s %12s %12s %7s %12s %10s %10s %12s\n", "benchmark", "ns/op", "min ns/op", "+/-", "cycles/op",
+           "MB/s", "Mpix/s", "ops/rep");
+    for (size_t i = 0; i < sizeof(g_benches) / sizeof(g_benches[0]); i++) {
+        if (filter && !strstr(g_benches[i].name, filter)) continue;
+        run_bench(&g_benches[i], reps, (uint64_t)min_ms * 1000000);
+    }
+    return 0;
+}
@@ -0,0 +1,145 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shim.h"
+#include "cpu.h"
+#include "fpu.h"
+#include "kernel.h"
+#include "klog.h"
+#include "ksym.h"
+#include "pmm.h"
+#include "raster.h"
+#include "tsc.h"
+#include "util.h"
+
+#define CALIBRATE_NS    50000000UL
+
+framebuffer_info_t g_framebuffer;
+unsigned int g_cpu_simd;
+
+static uint64_t g_tsc_hz;
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static void calibrate_tsc(void) {
+    uint64_t ns0 = monotonic_ns(), tsc0 = rdtsc();
+    while (monotonic_ns() - ns0 < CALIBRATE_NS) ;
+    uint64_t ns1 = monotonic_ns(), tsc1 = rdtsc();
+    g_tsc_hz = muldiv64(tsc1 - tsc0, 1000000000UL, ns1 - ns0);
+}
+
+static uint64_t xgetbv0(void) {
+    uint32_t lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// fpu_init() without the control register writes: the OS decides what is
+// enabled, XCR0 only tells us whether it saves AVX state
+static unsigned int detect_simd(void) {
+    uint32_t a, b, c, d, max_leaf;
+    unsigned int simd = 0;
+
+    cpuid(0, 0, &max_leaf, &b, &c, &d);
+    cpuid(1, 0, &a, &b, &c, &d);
+    if (d & (1U << 26)) simd |= SIMD_SSE2;
+    int os_avx = (c & (1U << 27)) && (c & (1U << 28)) && (xgetbv0() & 6) == 6;
+    if (os_avx) simd |= SIMD_AVX;
+
+    if (max_leaf >= 7) {
+        cpuid(7, 0, &a, &b, &c, &d);
+        if (b & (1U << 9)) simd |= SIMD_ERMS;
+        if (os_avx && (b & (1U << 5))) simd |= SIMD_AVX2;
+    }
+    return simd;
+}
+
+int shim_init(const char *simd_cap) {
+    unsigned int simd = detect_simd();
+
+    if (simd_cap) {
+        if (!strcmp(simd_cap, "scalar")) simd &= ~(SIMD_SSE2 | SIMD_AVX | SIMD_AVX2);
+        else if (!strcmp(simd_cap, "sse2")) simd &= ~(SIMD_AVX | SIMD_AVX2);
+        else if (!strcmp(simd_cap, "avx")) simd &= ~SIMD_AVX2;
+        else if (strcmp(simd_cap, "avx2")) return -1;
+    }
+    g_cpu_simd = simd;
+    memops_init();
+    raster_init();
+    calibrate_tsc();
+    return 0;
+}
+
+uint64_t shim_tsc_hz(void) {
+    return g_tsc_hz;
+}
+
+void kernel_fpu_begin(void) {
+}
+
+void kernel_fpu_end(void) {
+}
+
+uint64_t pmm_alloc_pages(unsigned int order) {
+    void *p = aligned_alloc(PAGE_SIZE, PAGE_SIZE << order);
+    return (uint64_t)p;
+}
+
+void pmm_free_pages(uint64_t phys, unsigned int order) {
+    (void)order;
+    free((void *)phys);
+}
+
+unsigned int pmm_order_for_size(uint64_t size) {
+    unsigned int order = 0;
+    while ((PAGE_SIZE << order) < size) order++;
+    return order;
+}
+
+uint64_t tsc_hz(void) {
+    return g_tsc_hz;
+}
+
+uint64_t tsc_cycles_to_ns(uint64_t cycles) {
+    if (!g_tsc_hz) return 0;
+    return muldiv64(cycles, 1000000000UL, g_tsc_hz);
+}
+
+uint64_t tsc_ns_to_cycles(uint64_t ns) {
+    return muldiv64(ns, g_tsc_hz, 1000000000UL);
+}
+
+uint64_t tsc_rate_per_sec(uint64_t ops, uint64_t cycles) {
+    if (!g_tsc_hz || !cycles) return 0;
+    return muldiv64(ops, g_tsc_hz, cycles);
+}
+
+void klog_text(int level, const char *text) {
+    fprintf(stderr, "<%d> %s\n", level, text);
+}
+
+void klog_flush_sync(void) {
+    fflush(stderr);
+}
+
+void klog_write_raw(const char *buf, size_t len) {
+    fwrite(buf, 1, len, stderr);
+}
+
+int ksym_format(char *buf, size_t size, uint64_t addr) {
+    return ksnprintf(buf, size, "0x%lx", addr);
+}
+
+void boot_print(const char *str, unsigned int color) {
+    (void)color;
+    printf("%s\n", str);
+}
@@ -0,0 +1,23 @@
+#ifndef SHIM_H
+#define SHIM_H
+
+#include <stdint.h>
+#include "kernel.h"
+
+// Stand-ins for the kernel services the hosted modules call: page
+// allocation from the C heap, a TSC calibrated against CLOCK_MONOTONIC,
+// klog and boot_print() on stderr/stdout, and no-op FPU sections (Linux
+// already preserves vector registers).
+
+// The screen the hosted modules draw to; error.c refers to it by name
+extern framebuffer_info_t g_framebuffer;
+
+// Detect SIMD features the way fpu_init() does, optionally capped at
+// "scalar", "sse2", "avx" or "avx2", then select the memops and raster
+// kernels. Returns -1 for an unknown cap.
+int shim_init(const char *simd_cap);
+
+// Frequency the TSC was calibrated at
+uint64_t shim_tsc_hz(void);
+
+#endif // SHIM_H
@@ -0,0 +1,102 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <stdint.h>
+#include "cpu.h"
+
+// ACPI table discovery. The bootloader passes the RSDP from the EFI
+// configuration table; acpi_init() walks the XSDT (or RSDT) once, verifies
+// checksums and condenses MADT, HPET, MCFG and SRAT into acpi_info_t so
+// that later subsystems never rescan firmware memory.
+
+#define ACPI_MAX_TABLES         32
+#define ACPI_MAX_IOAPICS        8
+#define ACPI_MAX_ECAM           4
+#define ACPI_MAX_MEM_RANGES     32
+#define ACPI_ISA_IRQS           16
+#define ACPI_NO_DOMAIN          0xFFFFFFFFU
+
+// Interrupt polarity/trigger flags (MPS INTI encoding from the MADT)
+#define ACPI_IRQ_ACTIVE_LOW     (1U << 0)
+#define ACPI_IRQ_LEVEL          (1U << 1)
+
+typedef struct __attribute__((packed)) {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} acpi_header_t;
+
+typedef struct {
+    uint32_t apic_id;
+    uint32_t acpi_uid;
+    uint32_t domain;            // SRAT proximity domain, ACPI_NO_DOMAIN if unknown
+} acpi_cpu_t;
+
+typedef struct {
+    uint32_t id;
+    uint32_t gsi_base;
+    uint64_t address;
+} acpi_ioapic_t;
+
+typedef struct {
+    uint32_t gsi;
+    uint32_t flags;             // ACPI_IRQ_*
+} acpi_irq_route_t;
+
+typedef struct {
+    uint64_t base;
+    uint16_t segment;
+    uint8_t bus_start;
+    uint8_t bus_end;
+} acpi_ecam_t;
+
+typedef struct {
+    uint64_t base;
+    uint64_t length;
+    uint32_t domain;
+} acpi_mem_range_t;
+
+typedef struct {
+    uint8_t revision;           // RSDP revision: 0 for ACPI 1.0, 2 for XSDT
+    uint64_t lapic_address;
+    int has_8259;               // MADT PC-AT compatibility flag
+
+    unsigned int cpu_count;
+    acpi_cpu_t cpus[MAX_CPUS];
+
+    unsigned int ioapic_count;
+    acpi_ioapic_t ioapics[ACPI_MAX_IOAPICS];
+
+    // ISA IRQ routing with MADT overrides applied; identity by default
+    acpi_irq_route_t isa_irqs[ACPI_ISA_IRQS];
+
+    uint64_t hpet_address;      // 0 if no HPET table
+
+    unsigned int ecam_count;
+    acpi_ecam_t ecam[ACPI_MAX_ECAM];
+
+    unsigned int domain_count;  // 0 without an SRAT
+    unsigned int mem_range_count;
+    acpi_mem_range_t mem_ranges[ACPI_MAX_MEM_RANGES];
+
+    unsigned int table_count;
+    const acpi_header_t *tables[ACPI_MAX_TABLES];
+} acpi_info_t;
+
+// Parse the tables below the RSDP; needs kmalloc. Returns -1 if the RSDP or
+// root table is missing or corrupt.
+int acpi_init(uint64_t rsdp_phys);
+
+// NULL until acpi_init() succeeded
+const acpi_info_t *acpi_get_info(void);
+
+// Checksum-verified table by signature, e.g. "FACP"
+const acpi_header_t *acpi_find_table(const char *signature);
+
+#endif // ACPI_H
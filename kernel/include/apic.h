@@ -0,0 +1,59 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include <stdint.h>
+
+// Local APIC driver. x2APIC (MSR access) is used when the CPU supports it,
+// xAPIC MMIO otherwise. The legacy 8259 PICs are remapped away from the
+// exception vectors and fully masked: device interrupts arrive through the
+// local APIC (and later the IOAPIC) only.
+
+#define APIC_TIMER_VECTOR       0xF0
+#define APIC_ERROR_VECTOR       0xFE
+#define APIC_SPURIOUS_VECTOR    0xFF
+
+// Register offsets (xAPIC MMIO layout; x2APIC MSR = 0x800 + offset / 16)
+#define APIC_REG_ID             0x020
+#define APIC_REG_VERSION        0x030
+#define APIC_REG_TPR            0x080
+#define APIC_REG_EOI            0x0B0
+#define APIC_REG_SVR            0x0F0
+#define APIC_REG_ESR            0x280
+#define APIC_REG_ICR_LOW        0x300
+#define APIC_REG_ICR_HIGH       0x310
+#define APIC_REG_LVT_TIMER      0x320
+#define APIC_REG_LVT_PERF       0x340
+#define APIC_REG_LVT_LINT0      0x350
+#define APIC_REG_LVT_LINT1      0x360
+#define APIC_REG_LVT_ERROR      0x370
+#define APIC_REG_TIMER_INIT     0x380
+#define APIC_REG_TIMER_CURRENT  0x390
+#define APIC_REG_TIMER_DIVIDE   0x3E0
+
+#define APIC_LVT_MASKED         (1U << 16)
+#define APIC_LVT_DELIVERY_NMI   (4U << 8)
+#define APIC_TIMER_ONESHOT      (0U << 17)
+#define APIC_TIMER_PERIODIC     (1U << 17)
+#define APIC_TIMER_TSC_DEADLINE (2U << 17)
+
+// Detect the APIC and mask the PICs; returns -1 without a local APIC
+int apic_init(void);
+
+// Enable the calling CPU's local APIC (BSP from apic_init(), APs at boot)
+void apic_init_cpu(void);
+
+int apic_is_x2apic(void);
+uint32_t apic_id(void);
+uint64_t apic_error_count(void);
+
+uint32_t apic_read(unsigned int reg);
+void apic_write(unsigned int reg, uint32_t val);
+
+static inline void apic_eoi(void) {
+    apic_write(APIC_REG_EOI, 0);
+}
+
+// Send an IPI; `icr` holds the low ICR word (vector, delivery mode, flags)
+void apic_send_ipi(uint32_t dest_apic_id, uint32_t icr);
+
+#endif // APIC_H
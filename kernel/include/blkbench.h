@@ -0,0 +1,11 @@
+#ifndef BLKBENCH_H
+#define BLKBENCH_H
+
+// fio-style block benchmark over virtio-blk: 4 KiB random reads at a deep
+// queue and large sequential reads, one worker thread per queue, each in
+// interrupt and in poll completion mode. Reports IOPS, bandwidth and
+// latency percentiles per run via boot_print(). Needs the scheduler and
+// virtio_blk_init().
+void blkbench_run(void);
+
+#endif // BLKBENCH_H
@@ -0,0 +1,21 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+// Build-time switches; override with -DCONFIG_xxx=0 in KERNEL_CFLAGS
+
+// Run subsystem self-tests and benchmarks during boot
+#ifndef CONFIG_SELFTEST
+#define CONFIG_SELFTEST 1
+#endif
+
+// Compile in the tracepoints of trace.h; off, TRACE_* expand to nothing
+#ifndef CONFIG_TRACE
+#define CONFIG_TRACE 1
+#endif
+
+// Sample the boot self-tests with the profiler and dump folded stacks
+#ifndef CONFIG_PROFILE
+#define CONFIG_PROFILE 1
+#endif
+
+#endif // CONFIG_H
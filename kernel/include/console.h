@@ -0,0 +1,122 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "font.h"
+#include "spinlock.h"
+
+// Text console over the framebuffer: a grid of character cells with a
+// cursor, a subset of the VT100/ANSI escapes, and a scrollback ring.
+//
+// Writing only touches the ring. Lines are numbered from the start of
+// output; line n lives in ring slot n % ring_lines, so scrolling advances
+// a number instead of moving text. console_render() maps each screen row
+// to its line and compares the line's generation with what the row last
+// showed; rows that match are skipped, the others are compared cell by
+// cell against a shadow copy of the screen and only differing cells are
+// redrawn. However many lines were written between two renders, a render
+// costs at most one screen of glyphs.
+//
+// Escapes: CSI n m (SGR 0, 1, 22, 30-37, 39, 40-47, 49, 90-97, 100-107),
+// CSI r;c H, CSI n A/B/C/D, CSI n J (0-2), CSI n K (0-2), CSI ?25 h/l.
+// '\n' also returns the carriage, as the kernel's log lines expect.
+
+#define CONSOLE_MARGIN          10          // pixels around the grid
+#define CONSOLE_SCROLLBACK      2048        // lines once scrollback is enabled
+#define CONSOLE_MAX_PARAMS      8
+
+// Character in the low byte, then the foreground and background palette
+// indices in one nibble each
+typedef uint16_t console_cell_t;
+
+typedef struct {
+    uint64_t bytes;
+    uint64_t lines;             // newlines, including scrolls
+    uint64_t renders;
+    uint64_t rows_skipped;      // unchanged since the last render
+    uint64_t cells_drawn;
+    uint64_t render_cycles;
+} console_stats_t;
+
+typedef struct {
+    spinlock_t lock;
+    unsigned int x, y;          // pixel origin of the grid
+    unsigned int width, height; // pixel rectangle the grid is laid out in
+    const font_t *font;         // cells are font->width x font->line_height
+    unsigned int cols, rows;
+
+    console_cell_t *ring;       // ring_lines lines of cols cells
+    uint32_t *ring_gen;         // bumped whenever a line changes
+    unsigned int ring_lines;
+    uint64_t bottom;            // line at the last screen row
+    unsigned int view;          // lines scrolled back from the bottom
+
+    // What the screen shows: per row the line, its generation and the
+    // cursor column drawn on it (-1 for none), then the cells themselves
+    console_cell_t *shadow;
+    uint64_t *shadow_line;
+    uint32_t *shadow_gen;
+    int *shadow_cursor;
+
+    unsigned int cx, cy;        // cursor, in screen cells
+    uint8_t attr;               // current fg | bg << 4
+    int bold;                   // SGR 1: colours 30-37 select the bright half
+    int cursor_visible;
+    int clear;                  // font changed: blank the rectangle on render
+
+    int esc_state;
+    unsigned int params[CONSOLE_MAX_PARAMS];
+    unsigned int param_count;
+    int private_mode;           // CSI '?'
+
+    console_stats_t stats;
+} console_t;
+
+// Bytes of buffer console_init() needs for a grid of `font` cells over
+// `width` x `height` pixels with `ring_lines` lines of scrollback
+size_t console_buffer_size(const font_t *font, unsigned int width, unsigned int height, unsigned int ring_lines);
+
+// Lay out a console in `font` over the pixel rectangle and carve its ring
+// and screen shadow out of `buffer`; -1 if the buffer holds fewer lines
+// than the screen has rows
+int console_init(console_t *con, const font_t *font, unsigned int x, unsigned int y, unsigned int width,
+                 unsigned int height, void *buffer, size_t size);
+
+// Move to a larger buffer, keeping the newest lines
+int console_resize(console_t *con, void *buffer, size_t size);
+
+// Re-lay out the rectangle in another font, moving to `buffer` (which must
+// not overlap the current one). Lines keep their text, cut to the new width.
+int console_set_font(console_t *con, const font_t *font, void *buffer, size_t size);
+
+void console_write(console_t *con, const char *buf, size_t len);
+
+// Redraw what changed into the current draw target and record damage
+void console_render(console_t *con);
+
+// Scroll the view `delta` lines back (positive) or forward; clamped to the
+// ring and to the live screen
+void console_scroll_view(console_t *con, int delta);
+
+void console_get_stats(console_t *con, console_stats_t *stats);
+
+// The boot console, over the whole screen. It starts in a static buffer
+// with a screen or two of history and moves into CONSOLE_SCROLLBACK lines
+// once console_enable_scrollback() can allocate.
+extern console_t g_console;
+
+void console_boot_init(void);
+int console_enable_scrollback(void);
+
+// Switch the boot console to `font` (0 for the built-in one); needs the
+// page allocator
+int console_use_font(const font_t *font);
+void console_puts(const char *str);
+
+// Render the boot console and flush the framebuffer
+void console_flush(void);
+
+void console_selftest(void);
+
+#endif // CONSOLE_H
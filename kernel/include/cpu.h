@@ -0,0 +1,121 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdint.h>
+
+// Upper bound on CPUs tracked by per-CPU structures
+#define MAX_CPUS 64
+
+// Control register bits
+#define CR0_MP          (1UL << 1)
+#define CR0_EM          (1UL << 2)
+#define CR0_TS          (1UL << 3)
+#define CR0_NE          (1UL << 5)
+#define CR4_OSFXSR      (1UL << 9)
+#define CR4_OSXMMEXCPT  (1UL << 10)
+#define CR4_OSXSAVE     (1UL << 18)
+
+#define RFLAGS_IF       (1UL << 9)
+
+#define MSR_EFER        0xC0000080
+#define MSR_GS_BASE     0xC0000101
+
+// Thin wrappers around privileged and timing instructions
+
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void outb(uint16_t port, uint8_t val) {
+    __asm__ volatile("outb %0, %1" : : "a"(val), "Nd"(port));
+}
+
+static inline uint8_t inb(uint16_t port) {
+    uint8_t val;
+    __asm__ volatile("inb %1, %0" : "=a"(val) : "Nd"(port));
+    return val;
+}
+
+static inline void cpuid(uint32_t leaf, uint32_t subleaf,
+                         uint32_t *a, uint32_t *b, uint32_t *c, uint32_t *d) {
+    __asm__ volatile("cpuid"
+                     : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d)
+                     : "a"(leaf), "c"(subleaf));
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t val) {
+    __asm__ volatile("wrmsr" : : "c"(msr), "a"((uint32_t)val), "d"((uint32_t)(val >> 32)));
+}
+
+#define DEFINE_CR_ACCESSORS(n)                                          \
+    static inline unsigned long read_cr##n(void) {                      \
+        unsigned long val;                                              \
+        __asm__ volatile("mov %%cr" #n ", %0" : "=r"(val));             \
+        return val;                                                     \
+    }                                                                   \
+    static inline void write_cr##n(unsigned long val) {                 \
+        __asm__ volatile("mov %0, %%cr" #n : : "r"(val) : "memory");    \
+    }
+
+DEFINE_CR_ACCESSORS(0)
+DEFINE_CR_ACCESSORS(2)
+DEFINE_CR_ACCESSORS(3)
+DEFINE_CR_ACCESSORS(4)
+
+static inline uint64_t xgetbv(uint32_t index) {
+    uint32_t lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(index));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void xsetbv(uint32_t index, uint64_t val) {
+    __asm__ volatile("xsetbv" : : "c"(index), "a"((uint32_t)val), "d"((uint32_t)(val >> 32)));
+}
+
+static inline void cpu_pause(void) {
+    __asm__ volatile("pause" ::: "memory");
+}
+
+static inline void cpu_halt(void) {
+    __asm__ volatile("hlt" ::: "memory");
+}
+
+static inline void irq_disable(void) {
+    __asm__ volatile("cli" ::: "memory");
+}
+
+static inline void irq_enable(void) {
+    __asm__ volatile("sti" ::: "memory");
+}
+
+// Disable interrupts and return the previous RFLAGS for irq_restore()
+static inline unsigned long irq_save(void) {
+    unsigned long flags;
+    __asm__ volatile("pushfq\n\tpopq %0\n\tcli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void irq_restore(unsigned long flags) {
+    if (flags & RFLAGS_IF)
+        __asm__ volatile("sti" ::: "memory");
+}
+
+// GS points at the executing CPU's percpu_t (percpu.h); the CPU index sits
+// at a fixed offset so this header does not need the full definition
+#define PERCPU_OFFSET_CPU_ID 8
+
+static inline unsigned int this_cpu_id(void) {
+    unsigned int id;
+    __asm__ volatile("movl %%gs:%c1, %0" : "=r"(id) : "i"(PERCPU_OFFSET_CPU_ID));
+    return id;
+}
+
+#endif // CPU_H
@@ -37,8 +37,12 @@ typedef struct {
     unsigned long r15;
     unsigned long rflags;  // CPU flags
     unsigned int error_code; // Error code if applicable
+    unsigned int vector;     // Exception vector, CPU_STATE_NO_VECTOR for panic()
+    unsigned long cr2;       // Faulting address for page faults
 } cpu_state_t;
 
+#define CPU_STATE_NO_VECTOR 0xFFFFFFFFU
+
 // Stack frame for unwinding
 typedef struct {
     unsigned long return_addr;
@@ -46,10 +50,13 @@ typedef struct {
 } stack_frame_t;
 
 // Function prototypes
-void panic(const char *message);
-void panic_with_state(const char *message, cpu_state_t *state);
+void panic(const char *message) __attribute__((noreturn));
+void panic_with_state(const char *message, cpu_state_t *state) __attribute__((noreturn));
 void capture_cpu_state(cpu_state_t *state);
 void print_stacktrace(unsigned long rbp, unsigned int max_frames);
 void display_error_screen(const char *message, cpu_state_t *state);
 
+// "0x" and 16 lowercase hex digits; `buf` needs 19 bytes
+void format_hex(char *buf, unsigned long val);
+
 #endif // ERROR_H
\ No newline at end of file
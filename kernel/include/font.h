@@ -4,6 +4,61 @@
 #include <stdint.h>
 
 // 8×8 bitmap font for ASCII 0…127
+#define FONT_WIDTH          8
+#define FONT_HEIGHT         8
+#define FONT_LINE_HEIGHT    10      // glyph rows plus spacing between lines
+
+#define UNICODE_REPLACEMENT 0xFFFD
+
 extern const uint8_t g_font[128][8];
 
+// A bitmap font in PSF2 layout: glyph_count glyphs of `height` rows, each
+// row bytes_per_row bytes with the leftmost pixel in bit 7 of its first
+// byte. Codepoints map to glyphs through a sparse open-addressing table;
+// without one, glyph index and codepoint are the same.
+typedef struct {
+    const char *name;
+    unsigned int id;                // unique per font; keys the glyph cache
+    unsigned int width;
+    unsigned int height;
+    unsigned int line_height;       // height plus spacing between lines
+    unsigned int bytes_per_row;
+    unsigned int bytes_per_glyph;
+    unsigned int glyph_count;
+    const uint8_t *glyphs;
+
+    uint32_t *map_keys;             // codepoint + 1, 0 for an empty slot
+    uint32_t *map_glyphs;
+    unsigned int map_mask;          // slots - 1; slots is a power of two
+    unsigned int map_entries;
+    unsigned int fallback;          // glyph for unmapped codepoints
+} font_t;
+
+// g_font as a font_t: id 0, ASCII only, FONT_LINE_HEIGHT line spacing
+extern const font_t g_font_builtin;
+
+unsigned int font_glyph(const font_t *font, uint32_t codepoint);
+
+static inline const uint8_t *font_bitmap(const font_t *font, unsigned int glyph) {
+    return font->glyphs + (uint64_t)glyph * font->bytes_per_glyph;
+}
+
+// Decode the UTF-8 sequence at *str and step past it. Overlong forms,
+// surrogates and stray or truncated bytes decode to UNICODE_REPLACEMENT
+// one byte at a time; the terminating NUL is returned but not passed.
+uint32_t utf8_next(const char **str);
+
+// Font-aware drawing (draw.c). draw_string() renders in the current font,
+// the built-in one until draw_set_font().
+void draw_set_font(const font_t *font);
+const font_t *draw_get_font(void);
+
+// Opaque glyph cell of font->width x font->line_height from the glyph
+// cache; records no damage
+void draw_glyph(unsigned int x, unsigned int y, const font_t *font, unsigned int glyph,
+                unsigned int fg, unsigned int bg);
+
+// Opaque UTF-8 text in the current font, wrapping like draw_string()
+void draw_text(unsigned int x, unsigned int y, const char *str, unsigned int fg, unsigned int bg);
+
 #endif // FONT_H
@@ -0,0 +1,61 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include <stdint.h>
+
+// SIMD state management. The kernel is built with -mno-sse, so ordinary code
+// never touches vector registers; SIMD kernels are compiled per function with
+// target attributes and must run between kernel_fpu_begin() and
+// kernel_fpu_end(). Sections may be interrupted, and an interrupt handler may
+// open its own section: the interrupted registers are then saved with XSAVE
+// (FXSAVE on CPUs without it) and restored when the nested section ends.
+//
+// FPU_POLICY_EAGER saves the interrupted state as soon as a nested section
+// opens. FPU_POLICY_LAZY only sets CR0.TS and defers the save to the #NM trap
+// raised by the nested section's first SIMD instruction, so nested sections
+// that end up not using SIMD pay nothing.
+//
+// Sections disable preemption and must not yield, so threads carry no SIMD
+// state across context switches.
+
+// Detected features (g_cpu_simd bits)
+#define SIMD_SSE2       (1U << 0)
+#define SIMD_AVX        (1U << 1)
+#define SIMD_AVX2       (1U << 2)
+#define SIMD_ERMS       (1U << 3)   // fast REP MOVSB/STOSB
+#define SIMD_XSAVE      (1U << 4)
+#define SIMD_XSAVEOPT   (1U << 5)
+
+#define FPU_POLICY_EAGER 0
+#define FPU_POLICY_LAZY  1
+
+// Nested sections per CPU (thread level plus interrupt levels)
+#define FPU_MAX_NESTING 4
+
+typedef struct {
+    uint64_t sections;      // kernel_fpu_begin() calls
+    uint64_t saves;         // interrupted states written out
+    uint64_t restores;
+    uint64_t lazy_traps;    // #NM traps taken under the lazy policy
+} fpu_stats_t;
+
+extern unsigned int g_cpu_simd;
+
+// Enable x87/SSE/AVX on the calling CPU (CR0, CR4, XCR0)
+void fpu_init(void);
+
+// Allocate the per-CPU nested save areas; needs kmalloc
+void fpu_init_state(void);
+
+int fpu_set_policy(int policy);
+unsigned int fpu_xsave_size(void);
+
+void kernel_fpu_begin(void);
+void kernel_fpu_end(void);
+
+// Device-not-available (#NM) handler body for the lazy policy
+void fpu_handle_nm(void);
+
+void fpu_get_stats(fpu_stats_t *stats);
+
+#endif // FPU_H
@@ -0,0 +1,60 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <stdint.h>
+#include "kernel.h"
+
+// Drawing goes to g_fb_draw: the GOP framebuffer itself until a RAM back
+// buffer is available, then the back buffer. Primitives report what they
+// touched with fb_damage() and fb_flush() copies only those rectangles out.
+
+#define FB_MAX_DAMAGE 16
+
+typedef struct {
+    unsigned int x0, y0;    // inclusive
+    unsigned int x1, y1;    // exclusive
+} fb_rect_t;
+
+typedef struct {
+    uint64_t flushes;
+    uint64_t rects;
+    uint64_t pixels;
+    uint64_t cycles;
+} fb_stats_t;
+
+// Off-screen render target for fb_set_target()
+typedef struct {
+    unsigned int *pixels;
+    unsigned int width;
+    unsigned int height;
+    unsigned int stride;    // pixels per scanline
+} fb_surface_t;
+
+extern unsigned int *g_fb_draw;
+extern unsigned int g_fb_stride;    // pixels per scanline of g_fb_draw
+extern unsigned int g_fb_width;     // clip bounds of g_fb_draw
+extern unsigned int g_fb_height;
+
+void fb_init(framebuffer_info_t *framebuffer);
+
+// Allocate the back buffer and seed it with the current screen contents
+int fb_enable_backbuffer(void);
+int fb_has_backbuffer(void);
+
+// Redirect drawing to an off-screen surface (no damage is recorded);
+// NULL switches back to the screen
+void fb_set_target(const fb_surface_t *surface);
+
+void fb_damage(unsigned int x, unsigned int y, unsigned int w, unsigned int h);
+void fb_damage_all(void);
+
+// Copy all damaged rectangles to the screen with non-temporal stores
+void fb_flush(void);
+
+void fb_get_stats(fb_stats_t *stats);
+
+// Fill the screen `passes` times directly and return the write bandwidth in
+// MB/s; the previous contents are restored from the back buffer afterwards
+uint64_t fb_measure_fill_bandwidth(unsigned int passes);
+
+#endif // FRAMEBUFFER_H
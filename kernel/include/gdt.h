@@ -0,0 +1,37 @@
+#ifndef GDT_H
+#define GDT_H
+
+#include <stdint.h>
+
+// Kernel-owned GDT and TSS, one pair per CPU. The firmware's GDT has no TSS,
+// and without one there are no interrupt stack tables: a double fault on an
+// overflowed stack would triple-fault instead of reaching the panic screen.
+
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+#define GDT_TSS         0x18
+
+// Interrupt stack table slots (1-based, as used in IDT gates)
+#define IST_DOUBLE_FAULT    1
+#define IST_NMI             2
+#define IST_MACHINE_CHECK   3
+
+#define IST_STACK_ORDER     2       // 16 KiB per IST stack
+
+typedef struct __attribute__((packed)) {
+    uint32_t reserved0;
+    uint64_t rsp[3];
+    uint64_t reserved1;
+    uint64_t ist[7];
+    uint64_t reserved2;
+    uint16_t reserved3;
+    uint16_t iomap_base;
+} tss_t;
+
+// Build and load the calling CPU's GDT and TSS, reloading all segment
+// registers; needs kmalloc and the PMM
+void gdt_init_cpu(void);
+
+tss_t *gdt_cpu_tss(unsigned int cpu);
+
+#endif // GDT_H
@@ -0,0 +1,39 @@
+#ifndef GLYPH_CACHE_H
+#define GLYPH_CACHE_H
+
+#include <stdint.h>
+#include "font.h"
+
+// Pre-rasterized glyph tiles: a glyph in one foreground and background
+// colour as font->width x font->line_height pixels, ready to be copied row
+// by row. Tiles are keyed by (font id, glyph, fg, bg) in a set-associative
+// table with least-recently-used replacement within a set, so a console's
+// working set of characters and colours stays resident.
+//
+// Like the rest of the drawing code the cache takes no lock; callers that
+// draw from several CPUs serialise, as the console does.
+
+#define GLYPH_CACHE_SETS        256
+#define GLYPH_CACHE_WAYS        4
+#define GLYPH_TILE_MAX_PIXELS   (16 * 32)   // larger glyphs are drawn uncached
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t uncached;          // cache down, disabled or glyph too large
+} glyph_cache_stats_t;
+
+// Allocate the tile arena; needs the page allocator. Until then every
+// lookup misses and callers rasterize directly.
+int glyph_cache_init(void);
+
+// Tile for the glyph, rasterizing it on a miss; NULL if it cannot be cached
+const uint32_t *glyph_cache_get(const font_t *font, unsigned int glyph, uint32_t fg, uint32_t bg);
+
+// Turn lookups off (or back on) for comparisons; returns the previous state
+int glyph_cache_set_enabled(int enabled);
+
+void glyph_cache_get_stats(glyph_cache_stats_t *stats);
+
+#endif // GLYPH_CACHE_H
@@ -0,0 +1,34 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+// Power-of-two latency histogram: bucket i counts samples in [2^(i-1), 2^i),
+// bucket 0 counts zeros. Used by the boot-time benchmarks and selftests.
+
+#define HIST_BUCKETS 40
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+} histogram_t;
+
+void hist_reset(histogram_t *h);
+void hist_add(histogram_t *h, uint64_t value);
+
+// Accumulate `src` into `dst`, e.g. per-CPU histograms into a total
+void hist_merge(histogram_t *dst, const histogram_t *src);
+
+// Upper bound of the bucket holding the given percentile
+uint64_t hist_percentile(const histogram_t *h, unsigned int pct);
+
+static inline uint64_t hist_mean(const histogram_t *h) {
+    return h->count ? h->sum / h->count : 0;
+}
+
+// Print "label: buckets..." lines of the non-empty buckets via boot_print()
+void hist_print(const histogram_t *h, const char *label, const char *unit);
+
+#endif // HISTOGRAM_H
@@ -0,0 +1,20 @@
+#ifndef HPET_H
+#define HPET_H
+
+#include <stdint.h>
+
+// High Precision Event Timer, used as a calibration reference. Only the main
+// counter is used; comparators stay disabled.
+
+// Where chipsets (and QEMU's q35/pc) place the first HPET block
+#define HPET_DEFAULT_BASE 0xFED00000UL
+
+// Map and start the counter at `base`; returns -1 if no HPET answers there
+int hpet_init(uint64_t base);
+int hpet_available(void);
+
+uint64_t hpet_counter(void);
+uint64_t hpet_ticks_since(uint64_t start);     // wrap-safe for 32-bit counters
+uint64_t hpet_period_fs(void);      // counter tick length in femtoseconds
+
+#endif // HPET_H
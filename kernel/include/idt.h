@@ -0,0 +1,78 @@
+#ifndef IDT_H
+#define IDT_H
+
+#include <stdint.h>
+
+// Interrupt descriptor table and dispatch. Every vector enters through a
+// small assembly stub (interrupt_stubs.asm) that saves the general purpose
+// registers into an interrupt_frame_t and calls interrupt_dispatch(), which
+// runs the handler registered for the vector. Exceptions without a handler
+// end in panic_with_state() with the faulting state.
+
+#define IDT_VECTORS 256
+
+// Exception vectors
+#define EXC_DIVIDE_ERROR        0
+#define EXC_DEBUG               1
+#define EXC_NMI                 2
+#define EXC_BREAKPOINT          3
+#define EXC_OVERFLOW            4
+#define EXC_BOUND_RANGE         5
+#define EXC_INVALID_OPCODE      6
+#define EXC_DEVICE_NOT_AVAIL    7
+#define EXC_DOUBLE_FAULT        8
+#define EXC_INVALID_TSS         10
+#define EXC_SEGMENT_NOT_PRESENT 11
+#define EXC_STACK_FAULT         12
+#define EXC_GENERAL_PROTECTION  13
+#define EXC_PAGE_FAULT          14
+#define EXC_X87_FP              16
+#define EXC_ALIGNMENT_CHECK     17
+#define EXC_MACHINE_CHECK       18
+#define EXC_SIMD_FP             19
+#define EXC_VIRTUALIZATION      20
+#define EXC_CONTROL_PROTECTION  21
+
+// First vector available for device interrupts
+#define IRQ_VECTOR_BASE 32
+
+// Saved state as laid out on the stack by the entry stubs
+typedef struct {
+    uint64_t rax, rbx, rcx, rdx, rsi, rdi, rbp;
+    uint64_t r8, r9, r10, r11, r12, r13, r14, r15;
+    uint64_t vector;
+    uint64_t error_code;        // 0 for vectors without one
+    uint64_t rip, cs, rflags, rsp, ss;
+} interrupt_frame_t;
+
+typedef void (*interrupt_handler_t)(interrupt_frame_t *frame);
+
+typedef struct {
+    uint64_t count;
+    uint64_t latency_cycles;    // stub entry to handler call, summed
+    uint64_t latency_max;
+} interrupt_stats_t;
+
+// Build the IDT and load it on the calling CPU
+void idt_init(void);
+
+// Load the already built IDT on a secondary CPU
+void idt_load_cpu(void);
+
+// Install a handler; returns -1 if the vector already has one
+int interrupt_register(unsigned int vector, interrupt_handler_t handler);
+void interrupt_unregister(unsigned int vector);
+
+// The panic screen for an exception nobody handled
+void exception_panic(interrupt_frame_t *frame, uint64_t cr2) __attribute__((noreturn));
+
+// Called from the entry stubs with the stub's entry timestamp
+void interrupt_dispatch(interrupt_frame_t *frame, uint64_t entry_tsc);
+
+void interrupt_get_stats(unsigned int vector, interrupt_stats_t *stats);
+
+const char *exception_name(unsigned int vector);
+
+void idt_selftest(void);
+
+#endif // IDT_H
@@ -0,0 +1,44 @@
+#ifndef INITRD_H
+#define INITRD_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "kernel.h"
+
+// Read-only file system over the boot modules. A module holding a cpio
+// archive ("newc" format, as `cpio -H newc` writes) or a ustar archive
+// contributes its regular files; any other module appears as one file named
+// after it. Contents are never copied: a file's data points into the module
+// as the loader placed it. Paths are indexed in an open-addressing hash table
+// built once at boot; when several modules hold the same path, the later
+// module wins, so a small archive can override files of a larger one.
+//
+// Paths are relative to the archive root. Lookups accept, and the index
+// drops, leading "/" and "./" components.
+
+typedef struct {
+    const char *path;
+    const void *data;
+    uint64_t size;
+    uint64_t hash;
+    uint32_t mode;              // from the archive header; 0 for a plain module
+    uint32_t module;            // index into kernel_params_t.modules
+} initrd_file_t;
+
+// Index the boot modules; needs kmalloc
+void initrd_init(const kernel_params_t *params);
+
+// NULL if there is no such file
+const initrd_file_t *initrd_lookup(const char *path);
+
+// Files in index order, for listing; NULL past the end
+const initrd_file_t *initrd_file(unsigned int index);
+unsigned int initrd_count(void);
+
+// Bytes of file data across all indexed files
+uint64_t initrd_bytes(void);
+
+void initrd_selftest(void);
+
+#endif // INITRD_H
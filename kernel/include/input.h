@@ -0,0 +1,128 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdint.h>
+#include "histogram.h"
+
+// Input events from interrupt handlers to one consumer. Every source owns
+// a single-producer/single-consumer ring: the producer (an IRQ handler)
+// only advances `head`, the consumer only advances `tail`, so neither side
+// takes a lock or disables interrupts. A full ring drops the new event and
+// counts it. Each event carries the TSC read on IRQ entry; the consumer
+// records how long it waited to be dequeued and to reach the screen.
+//
+// The consumer is CPU 0's boot context: input_run() replaces sched_idle()
+// and sleeps in sched_wait_for() on a count of pending events, so it runs
+// threads while waiting and takes no timer ticks when nothing is typed.
+// Like any idle task it consumes once CPU 0 has no runnable thread.
+// Events go to a sink, the boot console unless input_set_sink() picks
+// another.
+
+#define INPUT_QUEUE_SIZE        256         // events per source, power of two
+
+#define INPUT_SOURCE_KEYBOARD   0
+#define INPUT_SOURCE_MOUSE      1
+#define INPUT_SOURCES           2
+
+#define INPUT_EV_KEY            1
+#define INPUT_EV_MOUSE          2
+
+// input_event_t.flags
+#define INPUT_KEY_RELEASED      (1U << 0)
+#define INPUT_MOD_SHIFT         (1U << 1)
+#define INPUT_MOD_CTRL          (1U << 2)
+#define INPUT_MOD_ALT           (1U << 3)
+#define INPUT_MOD_CAPSLOCK      (1U << 4)
+
+// input_event_t.buttons
+#define INPUT_BUTTON_LEFT       (1U << 0)
+#define INPUT_BUTTON_RIGHT      (1U << 1)
+#define INPUT_BUTTON_MIDDLE     (1U << 2)
+
+// Key codes are scancode set 1 make codes, with 0x80 set for the keys the
+// keyboard prefixes with 0xE0
+#define KEY_ESC                 0x01
+#define KEY_BACKSPACE           0x0E
+#define KEY_TAB                 0x0F
+#define KEY_ENTER               0x1C
+#define KEY_LCTRL               0x1D
+#define KEY_LSHIFT              0x2A
+#define KEY_RSHIFT              0x36
+#define KEY_LALT                0x38
+#define KEY_SPACE               0x39
+#define KEY_CAPSLOCK            0x3A
+#define KEY_F1                  0x3B        // F1-F10 are consecutive
+#define KEY_F10                 0x44
+#define KEY_F11                 0x57
+#define KEY_F12                 0x58
+#define KEY_KP_ENTER            0x9C
+#define KEY_RCTRL               0x9D
+#define KEY_KP_SLASH            0xB5
+#define KEY_RALT                0xB8
+#define KEY_HOME                0xC7
+#define KEY_UP                  0xC8
+#define KEY_PGUP                0xC9
+#define KEY_LEFT                0xCB
+#define KEY_RIGHT               0xCD
+#define KEY_END                 0xCF
+#define KEY_DOWN                0xD0
+#define KEY_PGDN                0xD1
+#define KEY_INSERT              0xD2
+#define KEY_DELETE              0xD3
+
+typedef struct {
+    uint64_t tsc;               // IRQ entry
+    uint8_t type;               // INPUT_EV_*
+    uint8_t key;                // KEY_*; key events
+    uint8_t ascii;              // key presses that type a character, else 0
+    uint8_t flags;              // INPUT_KEY_RELEASED | INPUT_MOD_*
+    int16_t dx, dy;             // mouse motion; dy grows downwards
+    int8_t wheel;               // positive scrolls towards the user
+    uint8_t buttons;            // INPUT_BUTTON_* held after this packet
+} input_event_t;
+
+typedef struct {
+    input_event_t events[INPUT_QUEUE_SIZE];
+    // Free-running; the producer's and the consumer's index live on
+    // separate cache lines so that neither write invalidates the other
+    uint32_t head __attribute__((aligned(64)));
+    uint32_t tail __attribute__((aligned(64)));
+    uint64_t dropped;           // written by the producer only
+} input_queue_t;
+
+// Lock-free for one producer and one consumer; push returns -1 when full,
+// pop when empty
+int input_queue_push(input_queue_t *q, const input_event_t *ev);
+int input_queue_pop(input_queue_t *q, input_event_t *ev);
+
+typedef struct {
+    uint64_t posted[INPUT_SOURCES];
+    uint64_t dropped[INPUT_SOURCES];
+    uint64_t consumed;
+    uint64_t wakeups;           // returns from sched_wait_for() with events
+    histogram_t queue_cycles;   // IRQ entry to dequeue
+    histogram_t display_cycles; // IRQ entry to the sink returning, console flushed
+} input_stats_t;
+
+typedef void (*input_sink_t)(const input_event_t *ev);
+
+// Producer side, from the source's IRQ handler: queue the event and wake
+// the consumer
+void input_post(unsigned int source, const input_event_t *ev);
+
+// Set the sink; 0 restores the console. Call from the consumer's CPU
+// before input_run() or from a sink.
+void input_set_sink(input_sink_t sink);
+
+// Consume events forever on the calling boot context, which becomes its
+// CPU's idle task as with sched_idle()
+void input_run(void) __attribute__((noreturn));
+
+void input_get_stats(input_stats_t *stats);
+
+// Print event counts and latency percentiles via boot_print()
+void input_report(void);
+
+void input_selftest(void);
+
+#endif // INPUT_H
@@ -0,0 +1,32 @@
+#ifndef IOAPIC_H
+#define IOAPIC_H
+
+#include <stdint.h>
+
+// I/O APIC routing of device interrupts. Pins are located through the MADT
+// entries in acpi_info_t; ISA IRQs go through the MADT source overrides, so
+// callers ask for "IRQ 4" and get whatever GSI, polarity and trigger mode
+// the firmware reported. Every pin starts masked.
+
+// Fixed vectors for the 16 ISA IRQs
+#define IRQ_ISA_VECTOR_BASE     0x30
+#define IRQ_ISA_VECTOR(irq)     (IRQ_ISA_VECTOR_BASE + (irq))
+
+#define ISA_IRQ_KEYBOARD        1
+#define ISA_IRQ_COM1            4
+#define ISA_IRQ_MOUSE           12
+
+// Mask all pins of the I/O APICs listed by ACPI; returns -1 if there are none
+int ioapic_init(void);
+int ioapic_available(void);
+
+// Deliver `gsi` as `vector` to the local APIC `dest_apic_id`; flags are
+// ACPI_IRQ_*. Returns -1 if no I/O APIC serves the GSI.
+int ioapic_route_gsi(uint32_t gsi, unsigned int vector, uint32_t dest_apic_id, uint32_t flags);
+
+// Route ISA `irq` to IRQ_ISA_VECTOR(irq) with the firmware's overrides
+int ioapic_route_isa(unsigned int irq, uint32_t dest_apic_id);
+
+void ioapic_mask_gsi(uint32_t gsi, int masked);
+
+#endif // IOAPIC_H
@@ -13,6 +13,36 @@ typedef struct {
     unsigned int descriptor_version;
 } memory_info_t;
 
+// UEFI memory descriptor as laid out in memory_info_t.memory_map; entries
+// are descriptor_size bytes apart, which may exceed sizeof(efi_memory_descriptor_t)
+typedef struct {
+    unsigned int type;
+    unsigned int pad;
+    unsigned long long physical_start;
+    unsigned long long virtual_start;
+    unsigned long long number_of_pages;
+    unsigned long long attribute;
+} efi_memory_descriptor_t;
+
+// UEFI memory types used by the kernel
+#define EFI_RESERVED_MEMORY_TYPE        0
+#define EFI_LOADER_CODE                 1
+#define EFI_LOADER_DATA                 2
+#define EFI_BOOT_SERVICES_CODE          3
+#define EFI_BOOT_SERVICES_DATA          4
+#define EFI_RUNTIME_SERVICES_CODE       5
+#define EFI_RUNTIME_SERVICES_DATA       6
+#define EFI_CONVENTIONAL_MEMORY         7
+#define EFI_UNUSABLE_MEMORY             8
+#define EFI_ACPI_RECLAIM_MEMORY         9
+#define EFI_ACPI_MEMORY_NVS             10
+#define EFI_MEMORY_MAPPED_IO            11
+#define EFI_MEMORY_MAPPED_IO_PORT_SPACE 12
+#define EFI_PAL_CODE                    13
+#define EFI_PERSISTENT_MEMORY           14
+
+#define EFI_PAGE_SIZE 4096
+
 // Framebuffer information structure
 typedef struct {
     unsigned long long framebuffer_base;
@@ -22,22 +52,97 @@ typedef struct {
     unsigned int framebuffer_bpp;
 } framebuffer_info_t;
 
+// Bootloader step timestamps (RDTSC), mirrored from bootloader.h
+#define BOOT_TIMING_VERSION         4
+
+#define BOOT_TSC_EFI_ENTRY          0
+#define BOOT_TSC_LOGO               1
+#define BOOT_TSC_MEMORY_MAP         2
+#define BOOT_TSC_GRAPHICS           3
+#define BOOT_TSC_KERNEL_LOADED      4
+#define BOOT_TSC_EXIT_BOOT_SERVICES 5
+#define BOOT_TSC_KERNEL_JUMP        6
+#define BOOT_TSC_COUNT              7
+
+#define BOOT_KERNEL_RAW             0
+#define BOOT_KERNEL_LZ4             1
+
+typedef struct {
+    unsigned int version;               // BOOT_TIMING_VERSION, 0 from older loaders
+    unsigned int exit_retries;
+    unsigned long long tsc[BOOT_TSC_COUNT];
+    // Version 2
+    unsigned int kernel_format;         // BOOT_KERNEL_*
+    unsigned int kernel_async_reads;
+    unsigned long long kernel_file_bytes;
+    unsigned long long kernel_image_bytes;
+    unsigned long long kernel_read_tsc;
+    unsigned long long kernel_inflate_tsc;
+    // Version 3
+    unsigned long long kernel_place_tsc;
+    unsigned long long kernel_bss_bytes;
+    // Version 4
+    unsigned long long modules_read_tsc;
+} boot_timing_t;
+
+// The kernel's ELF section headers as copied by the loader, with the symbol
+// and string tables alongside; sections == 0 if there were none
+typedef struct {
+    unsigned long long sections;        // physical address of the Elf64_Shdr array
+    unsigned int section_count;
+    unsigned int section_size;
+    unsigned int section_names;         // index of .shstrtab
+    unsigned int reserved;
+} kernel_elf_info_t;
+
+// Files the loader read from \EFI\BOOT\modules, each at a page-aligned
+// physical address
+#define BOOT_MODULE_MAX             16
+#define BOOT_MODULE_NAME_MAX        48
+
+typedef struct {
+    unsigned long long base;
+    unsigned long long size;
+    char name[BOOT_MODULE_NAME_MAX];
+} boot_module_t;
+
+// The loader's own memory type for the kernel's segments, page tables,
+// section copies and boot modules. It is none of the types init_memory()
+// reclaims.
+#define EFI_KERNEL_MEMORY_TYPE          0x80000000U
+
 // Kernel parameters structure passed from bootloader
 typedef struct {
     memory_info_t memory_info;
     framebuffer_info_t framebuffer;
     unsigned char acpi_enabled;
     unsigned char apic_enabled;
+    unsigned long long rsdp_address;    // physical, 0 if the firmware had none
+    boot_timing_t timing;
+    kernel_elf_info_t elf;
+    unsigned int module_count;
+    boot_module_t modules[BOOT_MODULE_MAX];
 } kernel_params_t;
 
 // Function prototypes
 void kernel_main(kernel_params_t *params);
 void init_console(framebuffer_info_t *framebuffer);
+
+// Drawing primitives (draw.c); draw_init() builds the glyph tables and must
+// run before the first draw_char() or draw_string()
+void draw_init(void);
 void clear_screen(unsigned int color);
 void draw_pixel(unsigned int x, unsigned int y, unsigned int color);
+void draw_char(unsigned int x, unsigned int y, char c, unsigned int color);
 void draw_string(unsigned int x, unsigned int y, const char *str, unsigned int color);
+
+// Opaque glyph over a FONT_WIDTH x FONT_LINE_HEIGHT cell, background
+// included; records no damage, callers batch it per row
+void draw_cell(unsigned int x, unsigned int y, char c, unsigned int fg, unsigned int bg);
 void init_memory(memory_info_t *memory_info);
+void init_acpi(kernel_params_t *params);
 void init_interrupts(void);
+void boot_print(const char *str, unsigned int color);
 
 // Color definitions
 #define COLOR_BLACK   0x00000000
@@ -0,0 +1,91 @@
+#ifndef KLOG_H
+#define KLOG_H
+
+#include <stdint.h>
+#include "util.h"
+
+// Kernel log. Each CPU appends fixed-size records to its own ring, a
+// single-producer/single-consumer queue that needs no lock: the owning CPU
+// advances the head with interrupts briefly disabled, and the drain side
+// advances the tail. Records are formatted later, not when they are logged:
+// klog() stores the format pointer and up to KLOG_MAX_ARGS raw arguments, so
+// a hot path pays for a handful of stores. The drain runs on the BSP. It
+// merges the rings in TSC order, copies each line to the QEMU debug console
+// (port 0xE9), and feeds the 16550's TX FIFO from its THRE interrupt. Full
+// rings drop new records and count them; producers never wait.
+//
+// Format strings must be literals. %s arguments are read at drain time and
+// must stay valid until then; use klog_text() for text in temporary buffers.
+
+#define KLOG_ERR        0
+#define KLOG_WARN       1
+#define KLOG_INFO       2
+#define KLOG_DEBUG      3
+
+#define KLOG_MAX_ARGS   5
+#define KLOG_TEXT_MAX   40          // text bytes per record; longer text spans records
+#define KLOG_RING_ORDER 2           // 16 KiB: 256 records per CPU
+
+#define KLOG_IPI_VECTOR 0xF2        // drain kick to the BSP
+
+typedef struct {
+    uint64_t records;               // written to the rings
+    uint64_t dropped;               // lost to full rings or before klog_init()
+    uint64_t drained;
+    uint64_t bytes;                 // formatted output
+    uint64_t kicks;                 // IPIs that restarted an idle drain
+    uint64_t uart_irqs;
+} klog_stats_t;
+
+// Allocate the BSP ring; needs the page allocator
+void klog_init(void);
+void klog_init_cpu(void);
+
+// Set up COM1 and its interrupt and start draining on the calling CPU (the
+// BSP); needs the local APIC, the I/O APIC and the timer
+void klog_start(void);
+
+void klog_write(int level, const char *fmt, unsigned int nargs, const uint64_t *args);
+
+// Copy `text` into the ring, splitting it across records as needed
+void klog_text(int level, const char *text);
+
+// Write everything still queued by polling the ports; for panic paths
+void klog_flush_sync(void);
+
+// Write bytes straight to both ports, bypassing the rings, by polling the
+// UART; for bulk dumps after klog_flush_sync()
+void klog_write_raw(const char *buf, size_t len);
+
+void klog_get_stats(klog_stats_t *stats);
+
+void klog_selftest(void);
+
+// Argument plumbing: every argument is widened to 64 bits and stored as is
+#define KLOG_ARG(x)             ((uint64_t)(uintptr_t)(x))
+#define KLOG_MAP0()
+#define KLOG_MAP1(a)            KLOG_ARG(a)
+#define KLOG_MAP2(a, ...)       KLOG_ARG(a), KLOG_MAP1(__VA_ARGS__)
+#define KLOG_MAP3(a, ...)       KLOG_ARG(a), KLOG_MAP2(__VA_ARGS__)
+#define KLOG_MAP4(a, ...)       KLOG_ARG(a), KLOG_MAP3(__VA_ARGS__)
+#define KLOG_MAP5(a, ...)       KLOG_ARG(a), KLOG_MAP4(__VA_ARGS__)
+#define KLOG_NTH(_0, _1, _2, _3, _4, _5, n, ...) n
+#define KLOG_NARGS(...)         KLOG_NTH(_0, ##__VA_ARGS__, 5, 4, 3, 2, 1, 0)
+#define KLOG_CAT(a, b)          a##b
+#define KLOG_MAP(n)             KLOG_CAT(KLOG_MAP, n)
+
+// The unevaluated ksnprintf() keeps printf-style checking of the arguments
+#define klog(level, fmt, ...)                                                   \
+    do {                                                                        \
+        (void)sizeof(ksnprintf(0, 0, fmt, ##__VA_ARGS__));                      \
+        klog_write((level), (fmt), KLOG_NARGS(__VA_ARGS__),                     \
+                   (const uint64_t[KLOG_MAX_ARGS]){                             \
+                       KLOG_MAP(KLOG_NARGS(__VA_ARGS__))(__VA_ARGS__) });       \
+    } while (0)
+
+#define klog_err(fmt, ...)      klog(KLOG_ERR, fmt, ##__VA_ARGS__)
+#define klog_warn(fmt, ...)     klog(KLOG_WARN, fmt, ##__VA_ARGS__)
+#define klog_info(fmt, ...)     klog(KLOG_INFO, fmt, ##__VA_ARGS__)
+#define klog_debug(fmt, ...)    klog(KLOG_DEBUG, fmt, ##__VA_ARGS__)
+
+#endif // KLOG_H
@@ -0,0 +1,35 @@
+#ifndef KSYM_H
+#define KSYM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "kernel.h"
+
+// Kernel symbol table. The image is linked twice: the first link produces an
+// ELF whose code symbols tools/gen_ksyms.sh turns into a table sorted by
+// address, and the second link places that table in .ksyms, after .data, so
+// no code moves between the two. Lookups are a binary search. An image linked
+// only once has an empty table; ksym_init() then sorts the code symbols of
+// the ELF .symtab the loader passed on instead.
+
+// Fall back to the loader's copy of .symtab if the embedded table is empty;
+// needs kmalloc
+void ksym_init(const kernel_elf_info_t *elf);
+
+// Name of the function containing `addr` and the offset into it; 0 if the
+// address is not in kernel code or the table is empty
+const char *ksym_lookup(uint64_t addr, uint64_t *offset);
+
+// "name+0x1f", or the bare address when it has no symbol
+int ksym_format(char *buf, size_t size, uint64_t addr);
+
+// Whether `addr` lies in the kernel's .text; cheap enough for stack walks
+int ksym_in_text(uint64_t addr);
+
+uint64_t ksym_count(void);
+
+// "embedded" or "ELF .symtab"
+const char *ksym_source(void);
+
+#endif // KSYM_H
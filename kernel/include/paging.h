@@ -0,0 +1,64 @@
+#ifndef PAGING_H
+#define PAGING_H
+
+#include <stdint.h>
+#include "kernel.h"
+
+// Kernel-owned 4-level page tables. All RAM and the low 4 GiB are identity
+// mapped (virtual == physical) with the largest pages alignment allows;
+// cache types come from the PAT, which is reprogrammed so that one PTE bit
+// combination selects write-combining for the framebuffer.
+
+#define PTE_PRESENT     (1UL << 0)
+#define PTE_WRITE       (1UL << 1)
+#define PTE_USER        (1UL << 2)
+#define PTE_PWT         (1UL << 3)
+#define PTE_PCD         (1UL << 4)
+#define PTE_ACCESSED    (1UL << 5)
+#define PTE_DIRTY       (1UL << 6)
+#define PTE_HUGE        (1UL << 7)      // PS bit in PDPTEs and PDEs
+#define PTE_PAT_4K      (1UL << 7)
+#define PTE_GLOBAL      (1UL << 8)
+#define PTE_PAT_HUGE    (1UL << 12)
+#define PTE_NX          (1UL << 63)
+#define PTE_ADDR_MASK   0x000FFFFFFFFFF000UL
+
+#define PAGE_SIZE_2M    (1UL << 21)
+#define PAGE_SIZE_1G    (1UL << 30)
+
+// Cache types, numbered by their PAT slot
+typedef enum {
+    PAGE_CACHE_WB = 0,
+    PAGE_CACHE_WC = 1,
+    PAGE_CACHE_UC_MINUS = 2,
+    PAGE_CACHE_UC = 3,
+} page_cache_t;
+
+typedef struct {
+    uint64_t tables;        // page-table pages allocated
+    uint64_t pages_1g;
+    uint64_t pages_2m;
+    uint64_t pages_4k;
+    int pcid;               // CR4.PCIDE enabled
+    int invpcid;
+} paging_stats_t;
+
+// Build the direct map, program the PAT and switch to the new tables
+int paging_init(memory_info_t *memory_info, framebuffer_info_t *framebuffer);
+
+// PAT, PGE/PCIDE and CR3 setup for a CPU joining after paging_init()
+void paging_init_cpu(void);
+
+// Identity map a device range with the given cache type (e.g. 64-bit BARs)
+int paging_map_mmio(uint64_t phys, uint64_t size, page_cache_t cache);
+
+// Load an address space; with PCIDs the TLB entries of other spaces survive
+void paging_load(uint64_t pml4_phys, uint16_t pcid);
+
+void paging_invalidate(uint64_t virt);
+void paging_flush_all(void);
+
+uint64_t paging_kernel_pml4(void);
+void paging_get_stats(paging_stats_t *stats);
+
+#endif // PAGING_H
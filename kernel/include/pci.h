@@ -0,0 +1,175 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include <stdint.h>
+
+// PCI Express bus layer. pci_init() walks the ECAM windows from the ACPI
+// MCFG once, reading each function's configuration space straight through
+// memory, and caches what drivers ask for (ids, class, BAR sizes,
+// capability offsets) in a device table; nothing rescans the bus later.
+//
+// Interrupts are message signalled only. pci_alloc_irqs() takes vectors from
+// a shared pool and points each at the least loaded online CPU, so the
+// queues of a multi-queue device land on different CPUs. MSI-X is preferred;
+// plain MSI gets a single vector unless the device can take an aligned block.
+// Legacy INTx is disabled on any function that gets vectors.
+
+#define PCI_MAX_DEVICES         64
+#define PCI_MAX_BARS            6
+#define PCI_MAX_IRQS            16          // vectors per function
+
+// Vectors handed out for MSI/MSI-X, between the ISA block and the fixed
+// system vectors at 0xF0
+#define PCI_IRQ_VECTOR_FIRST    0x40
+#define PCI_IRQ_VECTOR_LAST     0xEF
+
+// Configuration space offsets
+#define PCI_CFG_VENDOR_ID       0x00
+#define PCI_CFG_DEVICE_ID       0x02
+#define PCI_CFG_COMMAND         0x04
+#define PCI_CFG_STATUS          0x06
+#define PCI_CFG_REVISION        0x08
+#define PCI_CFG_HEADER_TYPE     0x0E
+#define PCI_CFG_BAR0            0x10
+#define PCI_CFG_SUBSYSTEM_VENDOR 0x2C
+#define PCI_CFG_SUBSYSTEM_ID    0x2E
+#define PCI_CFG_CAP_PTR         0x34
+
+#define PCI_COMMAND_IO          (1U << 0)
+#define PCI_COMMAND_MEMORY      (1U << 1)
+#define PCI_COMMAND_BUS_MASTER  (1U << 2)
+#define PCI_COMMAND_INTX_OFF    (1U << 10)
+
+#define PCI_STATUS_CAP_LIST     (1U << 4)
+
+// Capability ids
+#define PCI_CAP_MSI             0x05
+#define PCI_CAP_VENDOR          0x09
+#define PCI_CAP_PCIE            0x10
+#define PCI_CAP_MSIX            0x11
+
+#define PCI_IRQ_NONE            0
+#define PCI_IRQ_MSI             1
+#define PCI_IRQ_MSIX            2
+
+typedef struct {
+    uint64_t base;              // physical
+    uint64_t size;              // 0 if the BAR is unimplemented
+    uint8_t io;                 // I/O port space rather than memory
+    uint8_t is_64;              // takes this slot and the next
+    uint8_t prefetchable;
+    uint8_t mapped;
+} pci_bar_t;
+
+typedef void (*pci_irq_handler_t)(void *ctx);
+
+typedef struct {
+    uint8_t vector;
+    uint8_t cpu;                // CPU id the vector targets
+    pci_irq_handler_t handler;
+    void *ctx;
+} pci_irq_t;
+
+typedef struct {
+    volatile uint8_t *config;   // this function's 4 KiB of ECAM
+    uint16_t segment;
+    uint8_t bus;
+    uint8_t dev;
+    uint8_t func;
+    uint8_t header_type;        // without the multi-function bit
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint16_t subsystem_vendor;
+    uint16_t subsystem_id;
+    uint8_t class_code;
+    uint8_t subclass;
+    uint8_t prog_if;
+    uint8_t revision;
+    uint8_t msi_cap;            // capability offsets, 0 if absent
+    uint8_t msix_cap;
+    uint8_t pcie_cap;
+    uint16_t msix_entries;
+    pci_bar_t bars[PCI_MAX_BARS];
+    volatile uint32_t *msix_table;  // mapped by pci_alloc_irqs()
+
+    unsigned int irq_mode;      // PCI_IRQ_*
+    unsigned int irq_count;
+    pci_irq_t irqs[PCI_MAX_IRQS];
+} pci_device_t;
+
+typedef struct {
+    uint64_t enumerate_cycles;
+    uint64_t functions_probed;  // vendor id reads, absent functions included
+    unsigned int vectors_used;
+    unsigned int vectors_free;
+} pci_stats_t;
+
+// Enumerate every ECAM window; needs ACPI and paging. Returns the number of
+// functions found, -1 without an MCFG table.
+int pci_init(void);
+
+unsigned int pci_device_count(void);
+pci_device_t *pci_get_device(unsigned int index);
+
+// Next function after `from` (NULL to start) matching the ids or the class;
+// 0xFFFF and 0xFF act as wildcards
+pci_device_t *pci_find_device(uint16_t vendor_id, uint16_t device_id, pci_device_t *from);
+pci_device_t *pci_find_class(uint8_t class_code, uint8_t subclass, pci_device_t *from);
+
+static inline uint8_t pci_read8(const pci_device_t *dev, unsigned int off) {
+    return *(volatile uint8_t *)(dev->config + off);
+}
+
+static inline uint16_t pci_read16(const pci_device_t *dev, unsigned int off) {
+    return *(volatile uint16_t *)(dev->config + off);
+}
+
+static inline uint32_t pci_read32(const pci_device_t *dev, unsigned int off) {
+    return *(volatile uint32_t *)(dev->config + off);
+}
+
+static inline void pci_write8(pci_device_t *dev, unsigned int off, uint8_t val) {
+    *(volatile uint8_t *)(dev->config + off) = val;
+}
+
+static inline void pci_write16(pci_device_t *dev, unsigned int off, uint16_t val) {
+    *(volatile uint16_t *)(dev->config + off) = val;
+}
+
+static inline void pci_write32(pci_device_t *dev, unsigned int off, uint32_t val) {
+    *(volatile uint32_t *)(dev->config + off) = val;
+}
+
+// Offset of the next capability `id` after offset `after` (0 to start); 0
+// when there are no more. Vendor capabilities (virtio) can repeat.
+unsigned int pci_next_capability(const pci_device_t *dev, unsigned int id, unsigned int after);
+
+// Turn on memory decoding and bus mastering (and I/O decoding if any BAR
+// needs it)
+void pci_enable_device(pci_device_t *dev);
+
+// Identity map a memory BAR uncached and return it; NULL for I/O or
+// unimplemented BARs
+volatile void *pci_map_bar(pci_device_t *dev, unsigned int bar);
+
+// Allocate between 1 and `count` vectors, MSI-X first, then MSI. Every
+// vector starts masked with no handler. Returns the number allocated, -1 if
+// the function has neither capability or the pool is exhausted.
+int pci_alloc_irqs(pci_device_t *dev, unsigned int count);
+
+// Attach a handler to vector `index` and unmask it. Handlers run in
+// interrupt context; the EOI is sent after they return.
+int pci_request_irq(pci_device_t *dev, unsigned int index, pci_irq_handler_t handler, void *ctx);
+
+// Mask or unmask one MSI-X entry, or the whole function for MSI without
+// per-vector masking
+void pci_mask_irq(pci_device_t *dev, unsigned int index, int masked);
+
+// Disable MSI/MSI-X and give the vectors back
+void pci_free_irqs(pci_device_t *dev);
+
+void pci_get_stats(pci_stats_t *stats);
+
+void pci_selftest(void);
+
+#endif // PCI_H
@@ -0,0 +1,51 @@
+#ifndef PERCPU_H
+#define PERCPU_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "cpu.h"
+
+// Per-CPU data block, reached through the GS base of each CPU. The BSP's
+// block is static so it exists before the allocators; AP blocks are
+// allocated by smp.c.
+
+typedef struct percpu {
+    struct percpu *self;        // %gs:0, for turning GS into a pointer
+    unsigned int cpu_id;        // %gs:PERCPU_OFFSET_CPU_ID
+    unsigned int preempt_count; // %gs:PERCPU_OFFSET_PREEMPT, see sched.h
+    volatile int need_resched;  // reschedule at the next preemption point
+    uint32_t apic_id;
+    uint64_t stack_top;
+    void *current_task;         // owned by the scheduler
+    void *runqueue;
+    void *irq_frame;            // innermost interrupt being handled, if any
+    uint64_t boot_cycles;       // INIT IPI to online, in TSC cycles (APs)
+    volatile int online;
+} percpu_t;
+
+#define PERCPU_OFFSET_PREEMPT 12
+
+_Static_assert(offsetof(percpu_t, cpu_id) == PERCPU_OFFSET_CPU_ID, "percpu_t layout");
+_Static_assert(offsetof(percpu_t, preempt_count) == PERCPU_OFFSET_PREEMPT, "percpu_t layout");
+
+static inline percpu_t *this_cpu(void) {
+    percpu_t *p;
+    __asm__ volatile("movq %%gs:0, %0" : "=r"(p));
+    return p;
+}
+
+// Point GS at the BSP block; first thing in kernel_main()
+void percpu_init_bsp(void);
+
+// Register `p` as CPU `cpu_id` and load it into the calling CPU's GS base
+void percpu_install(percpu_t *p, unsigned int cpu_id);
+
+// Mark the calling CPU ready; smp.c waits for this after each start-up IPI
+void percpu_set_online(percpu_t *p);
+
+percpu_t *percpu_get(unsigned int cpu_id);
+
+// CPUs that have come online, the BSP included
+unsigned int percpu_online_count(void);
+
+#endif // PERCPU_H
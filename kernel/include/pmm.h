@@ -0,0 +1,71 @@
+#ifndef PMM_H
+#define PMM_H
+
+#include <stdint.h>
+#include "kernel.h"
+
+// Physical page-frame allocator: a binary buddy system over the UEFI memory
+// map, handing out naturally aligned blocks of 2^order 4 KiB pages.
+
+#define PAGE_SHIFT      12
+#define PAGE_SIZE       (1UL << PAGE_SHIFT)
+
+#define PMM_ORDER_4K    0
+#define PMM_ORDER_2M    9
+#define PMM_ORDER_1G    18
+#define PMM_MAX_ORDER   PMM_ORDER_1G
+
+// Memory below 1 MiB is never handed out (real-mode trampolines, legacy areas)
+#define PMM_LOW_LIMIT   0x100000UL
+
+// End of conventional memory below 1 MiB; the EBDA and VGA hole follow
+#define PMM_LOW_END     0x9F000UL
+
+// Maximum number of ranges that can be excluded from the allocator
+#define PMM_MAX_RESERVED 32
+
+typedef struct {
+    uint64_t total_pages;       // pages managed by the allocator
+    uint64_t free_pages;
+    uint64_t reclaimed_pages;   // pages taken back from loader/boot services regions
+    uint64_t free_blocks[PMM_MAX_ORDER + 1];
+} pmm_stats_t;
+
+// Exclude [base, base + size) from the allocator; must be called before pmm_init()
+void pmm_add_reserved(uint64_t base, uint64_t size);
+
+// Build the free lists from the memory map. The map is copied into allocator
+// owned memory and memory_info is updated to point at the copy.
+int pmm_init(memory_info_t *memory_info);
+
+// Hand the firmware's boot services memory to the allocator, once the
+// kernel's own page tables, GDT and IDT are loaded. Returns the pages added.
+uint64_t pmm_release_boot_services(void);
+
+// Returns the physical address of a 2^order page block, or 0 when exhausted
+uint64_t pmm_alloc_pages(unsigned int order);
+void pmm_free_pages(uint64_t phys, unsigned int order);
+
+static inline uint64_t pmm_alloc_page(void) { return pmm_alloc_pages(PMM_ORDER_4K); }
+static inline void pmm_free_page(uint64_t phys) { pmm_free_pages(phys, PMM_ORDER_4K); }
+
+// Permanently take `pages` usable pages below PMM_LOW_END, for code that must
+// run in real mode. Returns 0 if none are left; there is no free.
+uint64_t pmm_alloc_low(unsigned int pages);
+
+// Order of the allocated block starting at `phys`, or -1 if no block starts there
+int pmm_block_order(uint64_t phys);
+
+// Smallest order whose block holds `size` bytes
+unsigned int pmm_order_for_size(uint64_t size);
+
+// RAM is identity mapped, so physical addresses are directly usable
+static inline void *phys_to_virt(uint64_t phys) { return (void *)phys; }
+static inline uint64_t virt_to_phys(const void *virt) { return (uint64_t)virt; }
+
+void pmm_get_stats(pmm_stats_t *stats);
+
+// Allocation/free throughput benchmark for every block size
+void pmm_selftest(void);
+
+#endif // PMM_H
@@ -0,0 +1,44 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+
+// Sampling profiler. While it runs, every online CPU periodically records
+// the interrupted RIP and the frame-pointer chain above it. Where the CPU
+// has architectural performance monitoring (version 2 or later), samples
+// come from an overflow NMI on unhalted core cycles, which also lands in
+// code running with interrupts disabled. Elsewhere a per-CPU timer event
+// takes them, and so only sees code that runs with interrupts enabled.
+//
+// profile_dump() folds the samples by function into "outer;inner;leaf N"
+// lines, the input format of flamegraph.pl, and writes them to the serial
+// port between PROFILE-BEGIN and PROFILE-END markers.
+
+#define PROFILE_MAX_DEPTH       15          // frames per sample, the RIP included
+#define PROFILE_BUFFER_ORDER    5           // 128 KiB per CPU: 1024 samples
+#define PROFILE_DEFAULT_HZ      997         // prime, so it won't beat with periodic work
+#define PROFILE_IPI_VECTOR      0xF3        // start or stop sampling on another CPU
+
+typedef struct {
+    uint64_t samples;
+    uint64_t dropped;           // taken with a full buffer
+    uint64_t truncated;         // chains cut at PROFILE_MAX_DEPTH
+} profile_stats_t;
+
+// Pick the sample source and register its handlers; needs the local APIC,
+// timer_init() and kmalloc
+void profile_init(void);
+
+// Clear the buffers and start sampling on all online CPUs at `hz`; returns
+// -1 if already running or out of memory
+int profile_start(unsigned int hz);
+
+void profile_stop(void);
+
+// Write the folded stacks collected so far; call after profile_stop()
+void profile_dump(void);
+
+void profile_get_stats(profile_stats_t *stats);
+const char *profile_source(void);
+
+#endif // PROFILE_H
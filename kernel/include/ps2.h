@@ -0,0 +1,65 @@
+#ifndef PS2_H
+#define PS2_H
+
+#include <stdint.h>
+#include "input.h"
+
+// i8042 PS/2 controller with a keyboard on the first port and a mouse on
+// the second. The controller translates the keyboard to scancode set 1.
+// Both IRQs (ISA 1 and 12) are routed through the I/O APIC to the CPU that
+// calls ps2_init(); the handlers decode bytes into input_event_t and
+// input_post() them. A wheel mouse (IntelliMouse, 4-byte packets) is used
+// when the device accepts the magic sample-rate sequence.
+
+#define PS2_DATA                0x60
+#define PS2_STATUS              0x64        // read
+#define PS2_COMMAND             0x64        // write
+
+#define PS2_STATUS_OUTPUT_FULL  (1U << 0)
+#define PS2_STATUS_INPUT_FULL   (1U << 1)
+#define PS2_STATUS_AUX_DATA     (1U << 5)   // the output byte is from the mouse
+
+// Packets whose bytes are further apart than this are abandoned, so that a
+// lost byte cannot shift every later packet
+#define PS2_MOUSE_RESYNC_NS     50000000UL
+
+typedef struct {
+    uint8_t extended;           // saw 0xE0
+    uint8_t skip;               // bytes left of a Pause sequence
+    uint8_t held;               // modifier keys down, one bit per key
+    uint8_t capslock;
+} ps2_kbd_state_t;
+
+typedef struct {
+    uint8_t packet[4];
+    uint8_t index;
+    uint8_t size;               // 3, or 4 with a wheel
+    uint64_t last_tsc;
+    uint64_t resync_cycles;     // PS2_MOUSE_RESYNC_NS; 0 never times out
+    uint64_t resyncs;
+} ps2_mouse_state_t;
+
+typedef struct {
+    int keyboard;
+    int mouse;
+    int wheel;
+    uint64_t keyboard_irqs;
+    uint64_t mouse_irqs;
+    uint64_t spurious;          // IRQs that found no byte to read
+    uint64_t mouse_resyncs;     // bytes dropped to find the next packet start
+} ps2_stats_t;
+
+// Set the controller up and route its IRQs to the calling CPU; returns -1
+// without a controller, a keyboard or an I/O APIC
+int ps2_init(void);
+
+// Decode one byte; returns 1 and fills `ev` once it completes an event.
+// Pure functions of their state, shared by the IRQ handlers and the selftest.
+int ps2_kbd_decode(ps2_kbd_state_t *s, uint8_t byte, uint64_t tsc, input_event_t *ev);
+int ps2_mouse_decode(ps2_mouse_state_t *s, uint8_t byte, uint64_t tsc, input_event_t *ev);
+
+void ps2_get_stats(ps2_stats_t *stats);
+
+void ps2_selftest(void);
+
+#endif // PS2_H
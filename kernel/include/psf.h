@@ -0,0 +1,44 @@
+#ifndef PSF_H
+#define PSF_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "font.h"
+
+// PC Screen Font version 2, as shipped in kbd's consolefonts (uncompressed).
+// Glyph bitmaps are used in place; only the codepoint map is allocated.
+
+#define PSF2_MAGIC              0x864AB572
+#define PSF2_HAS_UNICODE_TABLE  0x01
+#define PSF2_SEPARATOR          0xFF        // ends a glyph's entries in the table
+#define PSF2_START_SEQ          0xFE        // starts a multi-codepoint sequence
+
+#define PSF_MAX_WIDTH           64
+#define PSF_MAX_HEIGHT          64
+
+// Fonts the boot looks for in the initrd
+#define PSF_DEFAULT_PATH        "fonts/default.psf"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;       // offset of the glyph bitmaps
+    uint32_t flags;
+    uint32_t glyph_count;
+    uint32_t bytes_per_glyph;
+    uint32_t height;
+    uint32_t width;
+} psf2_header_t;
+
+// Parse a font image; -1 if it is not a well-formed PSF2 font or the
+// codepoint map cannot be allocated. The image must outlive the font.
+int psf_parse(const void *data, size_t size, const char *name, font_t *font);
+
+// psf_parse() over a file from the initrd
+int psf_load(const char *path, font_t *font);
+
+void psf_free(font_t *font);
+
+void psf_selftest(void);
+
+#endif // PSF_H
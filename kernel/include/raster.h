@@ -0,0 +1,44 @@
+#ifndef RASTER_H
+#define RASTER_H
+
+#include <stdint.h>
+#include "framebuffer.h"
+
+// 2D raster primitives over ARGB surfaces (alpha in the top byte, 0xFF
+// opaque). Rows are fb_surface_t.stride pixels apart, so the screen's
+// framebuffer_pitch and padded off-screen surfaces work unchanged.
+// Everything is clipped to the destination (and for blits, the source)
+// surface. Nothing records damage: callers drawing to the screen pass the
+// rectangle they touched to fb_damage().
+//
+// Fills, copies and blends run row kernels selected by raster_init():
+// AVX2, SSE2 or scalar. All variants produce bit-identical results.
+
+// Blending: out = src * a + dst * (255 - a), per channel, divided by 255
+// and rounded the same way in every variant; the output alpha is
+// a + dst_alpha * (255 - a) / 255
+
+// The current draw target (screen, back buffer or fb_set_target() surface)
+void raster_screen(fb_surface_t *surface);
+
+void raster_init(void);
+const char *raster_variant(void);
+
+void raster_fill_rect(const fb_surface_t *dst, int x, int y, int w, int h, uint32_t color);
+
+// Opaque copy; source and destination may be the same surface and overlap
+void raster_blit(const fb_surface_t *dst, int dx, int dy, const fb_surface_t *src, int sx, int sy, int w, int h);
+
+// Composite the source over the destination using the source's alpha
+void raster_blend(const fb_surface_t *dst, int dx, int dy, const fb_surface_t *src, int sx, int sy, int w, int h);
+
+// Bresenham line including both endpoints
+void raster_line(const fb_surface_t *dst, int x0, int y0, int x1, int y1, uint32_t color);
+
+// Antialiased (Wu) line: the colour's RGB is blended with each pixel's
+// coverage as alpha; the colour's own alpha byte is ignored
+void raster_line_aa(const fb_surface_t *dst, int x0, int y0, int x1, int y1, uint32_t color);
+
+void raster_selftest(void);
+
+#endif // RASTER_H
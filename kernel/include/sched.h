@@ -0,0 +1,107 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+#include "histogram.h"
+#include "idt.h"
+#include "percpu.h"
+
+// Preemptive kernel threads. Every CPU has its own run queue and turns its
+// boot context into an idle task. Threads are preempted at interrupt exit
+// once their time slice expires. The slice timer is only armed while other
+// threads wait on the same queue, so a CPU running a single thread stays
+// tickless. An idle CPU steals half of the unpinned threads of the first
+// queue that has some, and otherwise sleeps: in MWAIT on its run queue
+// where available, else in HLT, woken by a reschedule IPI.
+//
+// There is no per-thread SIMD state: kernel_fpu_begin() disables preemption
+// until kernel_fpu_end(), so a switch never happens inside a section.
+
+#define SCHED_STACK_ORDER   2           // 16 KiB per thread
+#define SCHED_SLICE_NS      4000000UL
+#define SCHED_IPI_VECTOR    0xF1
+
+#define TASK_RUNNING        0
+#define TASK_RUNNABLE       1
+#define TASK_DEAD           2
+
+typedef void (*task_fn_t)(void *arg);
+
+typedef struct task {
+    uint64_t rsp;               // saved by context_switch() while switched out
+    struct task *next;          // run queue link
+    unsigned int id;
+    unsigned int cpu;           // CPU it runs or last ran on
+    int state;                  // TASK_*
+    int idle;                   // a CPU's boot context; never queued
+    int pinned;                 // runs on `cpu` only; never stolen
+    task_fn_t fn;
+    void *arg;
+    uint64_t stack;             // physical base, 0 for idle tasks
+    uint64_t enqueue_tsc;       // when it last became runnable
+    const char *name;
+} task_t;
+
+typedef struct {
+    uint64_t spawned;
+    uint64_t exited;
+    uint64_t switches;
+    uint64_t preemptions;       // switches forced by an expired slice
+    uint64_t steals;            // threads taken from other CPUs' queues
+    uint64_t idle_sleeps;
+    uint64_t lock_acquires;     // run queue locks, all CPUs
+    uint64_t lock_contended;    // acquisitions that found the lock held
+    uint64_t lock_spin_cycles;
+    histogram_t switch_cycles;  // schedule() entry to the next thread running
+    histogram_t latency_ns;     // runnable to running
+} sched_stats_t;
+
+// Register the reschedule IPI, pick the idle method and set up the BSP;
+// needs kmalloc and timer_init()
+void sched_init(void);
+
+// Turn the calling context into this CPU's idle task
+void sched_init_cpu(void);
+
+// Queue a new thread on the calling CPU; returns -1 without memory
+int sched_spawn(const char *name, task_fn_t fn, void *arg);
+
+// Queue a new thread on `cpu`, which it never leaves: idle CPUs do not
+// steal it. Returns -1 without memory or if the CPU has no scheduler.
+int sched_spawn_on(unsigned int cpu, const char *name, task_fn_t fn, void *arg);
+
+void sched_yield(void);
+void sched_exit(void) __attribute__((noreturn));
+task_t *sched_current(void);
+
+// Idle loop for a CPU's boot context once its initialisation is done
+void sched_idle(void) __attribute__((noreturn));
+
+// Preemption points: the interrupt exit path and preempt_enable()
+void sched_irq_exit(interrupt_frame_t *frame);
+void sched_preempt(void);
+
+// Let a boot context run threads, or sleep, until `*counter` reaches
+// `target`. Threads that advance the counter must sched_kick() the waiting
+// CPU, since a sleeping CPU only notices a store to its own run queue.
+void sched_wait_for(unsigned int *counter, unsigned int target);
+void sched_kick(unsigned int cpu);
+
+void sched_get_stats(sched_stats_t *stats);
+const char *sched_idle_method(void);
+
+void sched_selftest(void);
+
+// Nestable; a single GS-relative instruction so that the count cannot move
+// to another CPU halfway through the update
+static inline void preempt_disable(void) {
+    __asm__ volatile("incl %%gs:%c0" : : "i"(PERCPU_OFFSET_PREEMPT) : "memory");
+}
+
+static inline void preempt_enable(void) {
+    __asm__ volatile("decl %%gs:%c0" : : "i"(PERCPU_OFFSET_PREEMPT) : "memory");
+    percpu_t *cpu = this_cpu();
+    if (!cpu->preempt_count && cpu->need_resched) sched_preempt();
+}
+
+#endif // SCHED_H
@@ -0,0 +1,60 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Object caches on top of the page allocator. Every cache carves fixed-size
+// objects out of SLAB_SIZE-aligned slabs; each CPU keeps two magazines of
+// cached objects so the common alloc/free path never touches the cache lock.
+
+#define SLAB_ORDER          4
+#define SLAB_SIZE           (4096UL << SLAB_ORDER)
+
+// Power-of-two kmalloc classes from 16 bytes to 8 KiB; larger requests go
+// straight to the page allocator
+#define KMALLOC_MIN_SHIFT   4
+#define KMALLOC_MAX_SHIFT   13
+#define KMALLOC_MAX_SIZE    (1UL << KMALLOC_MAX_SHIFT)
+#define KMALLOC_CLASSES     (KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1)
+
+// Objects per magazine and full magazines parked in a cache's depot
+#define MAGAZINE_SIZE       32
+#define DEPOT_MAX_FULL      8
+
+// Cache flags
+#define KMEM_CACHE_NO_MAGAZINE  0x1
+
+typedef struct kmem_cache kmem_cache_t;
+
+typedef struct {
+    const char *name;
+    size_t object_size;
+    size_t stride;                  // object size rounded up to the alignment
+    unsigned int objects_per_slab;
+    uint64_t slabs;
+    uint64_t objects_total;         // capacity of all slabs
+    uint64_t objects_active;        // currently owned by callers
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t magazine_hits;         // allocations served without the cache lock
+    unsigned int fragmentation_pct; // slab bytes not holding live payload
+} kmem_cache_stats_t;
+
+void slab_init(void);
+
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align, unsigned int flags);
+void *kmem_cache_alloc(kmem_cache_t *cache);
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+void kmem_cache_get_stats(kmem_cache_t *cache, kmem_cache_stats_t *stats);
+
+void *kmalloc(size_t size);
+void *kzalloc(size_t size);
+void kfree(void *ptr);
+
+kmem_cache_t *kmalloc_cache(unsigned int index);
+
+// Latency/throughput benchmark over mixed allocation sizes
+void slab_selftest(void);
+
+#endif // SLAB_H
@@ -0,0 +1,12 @@
+#ifndef SMP_H
+#define SMP_H
+
+// Application processor bring-up. The BSP starts every enabled CPU from the
+// MADT, one at a time, with INIT-SIPI-SIPI through a real-mode trampoline
+// that switches to long mode on the kernel's page tables.
+
+// Start all APs and report per-CPU start-up times; needs ACPI, the local
+// APIC and a calibrated TSC
+void smp_init(void);
+
+#endif // SMP_H
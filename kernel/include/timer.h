@@ -0,0 +1,51 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+// Per-CPU clock events on the local APIC timer. The kernel is tickless: the
+// timer is armed in one-shot or TSC-deadline mode for the earliest pending
+// event only, and an idle CPU with no events sleeps until a device interrupt.
+// Periodic mode exists for measuring tick jitter.
+
+#define TIMER_MODE_ONESHOT      0
+#define TIMER_MODE_TSC_DEADLINE 1
+#define TIMER_MODE_PERIODIC     2
+
+struct timer_event;
+typedef void (*timer_fn_t)(struct timer_event *ev, uint64_t now);
+
+typedef struct timer_event {
+    uint64_t deadline;          // TSC value
+    timer_fn_t fn;              // runs in interrupt context on the arming CPU
+    void *arg;
+    struct timer_event *next;
+} timer_event_t;
+
+// Calibrate the LAPIC timer against the TSC and set up the BSP; needs
+// apic_init() and a calibrated TSC
+void timer_init(void);
+void timer_init_cpu(void);
+
+// Queue `ev` on the calling CPU; re-arming a queued event moves it
+void timer_schedule(timer_event_t *ev, uint64_t deadline_tsc);
+void timer_cancel(timer_event_t *ev);
+
+// Periodic interrupts for jitter measurement; pending events keep running
+void timer_start_periodic(uint64_t period_ns);
+void timer_stop_periodic(void);
+
+// Sleep until the next interrupt. Call with interrupts disabled after
+// checking the wake-up condition; returns with them disabled again.
+static inline void timer_idle(void) {
+    // STI's one-instruction shadow lets HLT start before a pending interrupt
+    __asm__ volatile("sti\n\thlt\n\tcli" ::: "memory");
+}
+
+int timer_mode(void);
+const char *timer_mode_name(void);
+uint64_t timer_lapic_hz(void);
+
+void timer_selftest(void);
+
+#endif // TIMER_H
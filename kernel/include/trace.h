@@ -0,0 +1,70 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include "config.h"
+
+// Static tracepoints. Each records a 32-byte binary event (TSC, CPU, event
+// id, phase, two arguments) into the calling CPU's ring, which keeps the
+// newest TRACE_RING_EVENTS and overwrites older ones. The BSP starts on a
+// small static ring so that boot phases before the page allocator are
+// covered. trace_dump() writes every ring to the serial port and debug
+// console as hex lines. tools/trace2json.py turns those lines in
+// serial.log into Chrome trace / Perfetto JSON.
+//
+// With CONFIG_TRACE=0 the TRACE_* macros expand to nothing.
+
+#define TRACE_RING_ORDER    3           // 32 KiB: 1024 events per CPU
+#define TRACE_EARLY_EVENTS  64
+
+#define TRACE_PHASE_BEGIN   'B'
+#define TRACE_PHASE_END     'E'
+#define TRACE_PHASE_INSTANT 'i'
+
+// Event ids; names live in trace.c and are dumped with the events
+enum {
+    TRACE_BOOT_CONSOLE,
+    TRACE_BOOT_MEMORY,
+    TRACE_BOOT_ACPI,
+    TRACE_BOOT_INTERRUPTS,
+    TRACE_BOOT_SMP,
+    TRACE_BOOT_PCI,
+    TRACE_BOOT_STORAGE,
+    TRACE_INTERRUPT,            // a0: vector, a1: interrupted RIP
+    TRACE_SCHED_SWITCH,         // a0: previous task id, a1: next task id
+    TRACE_EVENT_COUNT
+};
+
+typedef struct {
+    uint64_t tsc;
+    uint16_t id;
+    uint16_t cpu;
+    uint8_t phase;
+    uint8_t pad[3];
+    uint64_t a0;
+    uint64_t a1;
+} trace_event_t;
+
+// Move the BSP's early events into an allocated ring; needs the page allocator
+void trace_init(void);
+void trace_init_cpu(void);
+
+void trace_record(unsigned int id, unsigned int phase, uint64_t tsc, uint64_t a0, uint64_t a1);
+
+// Write all rings out by polling the ports; safe on panic paths
+void trace_dump(void);
+
+#if CONFIG_TRACE
+#define TRACE_BEGIN(id, a0, a1) trace_record((id), TRACE_PHASE_BEGIN, rdtsc(), (a0), (a1))
+#define TRACE_END(id, a0, a1)   trace_record((id), TRACE_PHASE_END, rdtsc(), (a0), (a1))
+#define TRACE_INSTANT(id, a0, a1) trace_record((id), TRACE_PHASE_INSTANT, rdtsc(), (a0), (a1))
+// Begin with a timestamp taken earlier, e.g. in an entry stub
+#define TRACE_BEGIN_AT(id, tsc, a0, a1) trace_record((id), TRACE_PHASE_BEGIN, (tsc), (a0), (a1))
+#else
+#define TRACE_BEGIN(id, a0, a1)         ((void)0)
+#define TRACE_END(id, a0, a1)           ((void)0)
+#define TRACE_INSTANT(id, a0, a1)       ((void)0)
+#define TRACE_BEGIN_AT(id, tsc, a0, a1) ((void)0)
+#endif
+
+#endif // TRACE_H
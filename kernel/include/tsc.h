@@ -0,0 +1,20 @@
+#ifndef TSC_H
+#define TSC_H
+
+#include <stdint.h>
+
+// Calibrate the TSC against the HPET once hpet_init() found one, PIT
+// channel 2 otherwise; returns the measured frequency in Hz
+uint64_t tsc_calibrate(void);
+const char *tsc_calibration_source(void);
+
+// Calibrated TSC frequency (0 until tsc_calibrate() ran)
+uint64_t tsc_hz(void);
+
+uint64_t tsc_cycles_to_ns(uint64_t cycles);
+uint64_t tsc_ns_to_cycles(uint64_t ns);
+
+// Convert an operation count measured over `cycles` into operations per second
+uint64_t tsc_rate_per_sec(uint64_t ops, uint64_t cycles);
+
+#endif // TSC_H
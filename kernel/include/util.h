@@ -0,0 +1,43 @@
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <stddef.h>
+#include <stdarg.h>
+
+#include <stdint.h>
+
+// Freestanding replacements for the libc routines GCC may emit calls to.
+// memset/memcpy/memmove and the helpers below live in memops.c and switch to
+// SSE2/AVX kernels for large sizes once memops_init() has probed the CPU.
+void *memset(void *dst, int value, size_t n);
+void *memcpy(void *dst, const void *src, size_t n);
+void *memmove(void *dst, const void *src, size_t n);
+int memcmp(const void *a, const void *b, size_t n);
+
+// Fill `count` 32-bit words (pixels) with `value`
+void memset32(uint32_t *dst, uint32_t value, size_t count);
+
+// Copy with non-temporal stores that bypass the cache; for write-only
+// destinations such as the framebuffer
+void memcpy_nt(void *dst, const void *src, size_t n);
+
+// Select the SIMD kernels; call after fpu_init()
+void memops_init(void);
+const char *memops_variant(void);
+size_t strlen(const char *str);
+
+// Minimal printf-style formatter: %s %c %d %i %u %x %X %p %%, with
+// optional '-', '0', width and l/ll/z length modifiers
+int kvsnprintf(char *buf, size_t size, const char *fmt, va_list args);
+int ksnprintf(char *buf, size_t size, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+// a * b / c with a 128-bit intermediate; the quotient must fit in 64 bits.
+// Open-coded because the compiler would call libgcc's __udivti3.
+static inline uint64_t muldiv64(uint64_t a, uint64_t b, uint64_t c) {
+    uint64_t q, r;
+    __asm__("mulq %3\n\tdivq %4" : "=a"(q), "=&d"(r) : "a"(a), "rm"(b), "rm"(c) : "cc");
+    (void)r;
+    return q;
+}
+
+#endif // UTIL_H
@@ -0,0 +1,102 @@
+#ifndef VIRTIO_BLK_H
+#define VIRTIO_BLK_H
+
+#include <stdint.h>
+
+// virtio-blk over the modern (virtio 1.0) PCI transport. Each CPU gets its
+// own split virtqueue where the device offers enough of them, each with its
+// own MSI-X vector aimed at the CPU that submits on it, so neither the ring
+// lock nor the completion cache lines move between CPUs in the common case.
+//
+// Requests are submitted in batches: one ring index update and at most one
+// doorbell write per call. Completions are reaped either by the queue's
+// interrupt handler or by virtio_blk_poll(); in poll mode the vectors stay
+// masked and the submitter spins on the used ring instead, which trades a
+// CPU for the interrupt round trip. A request carries its own header and
+// status byte, so submission allocates nothing.
+
+#define BLK_SECTOR_SIZE         512
+#define BLK_MAX_QUEUES          16
+#define BLK_QUEUE_SIZE          256         // descriptors per queue, at most
+
+#define BLK_STATUS_OK           0
+#define BLK_STATUS_IOERR        1
+#define BLK_STATUS_UNSUPP       2
+#define BLK_STATUS_PENDING      (-1)
+
+#define BLK_MODE_IRQ            0
+#define BLK_MODE_POLL           1
+
+typedef struct {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+} __attribute__((packed)) virtio_blk_header_t;
+
+typedef struct blk_request {
+    uint64_t sector;
+    void *buffer;               // identity mapped, physically contiguous
+    uint32_t sectors;
+    uint8_t write;
+    volatile int status;        // BLK_STATUS_*; PENDING until reaped
+    uint64_t submit_tsc;
+    uint64_t complete_tsc;
+    void *ctx;                  // for the submitter
+
+    // Read by the device
+    virtio_blk_header_t header;
+    volatile uint8_t device_status;
+} blk_request_t;
+
+typedef struct {
+    uint64_t submitted;
+    uint64_t completed;
+    uint64_t notifies;          // doorbell writes
+    uint64_t interrupts;
+    uint64_t polls;             // virtio_blk_poll() calls that reaped something
+} blk_queue_stats_t;
+
+// Find and start the first virtio-blk function; needs pci_init() and the
+// APs online. Returns 0, or -1 if there is none or it cannot be driven.
+int virtio_blk_init(void);
+
+int virtio_blk_present(void);
+uint64_t virtio_blk_capacity(void);     // in sectors
+unsigned int virtio_blk_queue_count(void);
+int virtio_blk_has_irqs(void);
+int virtio_blk_read_only(void);
+
+// Device block size in bytes, a power of two from BLK_SECTOR_SIZE to a
+// page. Requests cover whole blocks: virtio_blk_read() and _write() refuse
+// others with BLK_STATUS_UNSUPP.
+uint32_t virtio_blk_block_size(void);
+
+// Queue the calling CPU submits on by default
+unsigned int virtio_blk_cpu_queue(void);
+
+// CPU whose interrupts complete `queue`, which is best placed to submit on it
+unsigned int virtio_blk_queue_cpu(unsigned int queue);
+
+// Submit up to `count` requests on queue `queue`; returns how many fit in
+// the ring. Requests stay owned by the driver until their status leaves
+// BLK_STATUS_PENDING.
+unsigned int virtio_blk_submit(unsigned int queue, blk_request_t *const *reqs, unsigned int count);
+
+// Reap whatever the device has completed on `queue`; returns the count
+unsigned int virtio_blk_poll(unsigned int queue);
+
+// BLK_MODE_IRQ (the default when MSI-X is available) or BLK_MODE_POLL;
+// returns -1 if interrupts were asked for but the device has none
+int virtio_blk_set_mode(int mode);
+int virtio_blk_mode(void);
+
+// Synchronous transfer on the calling CPU's queue, polling for completion.
+// Returns the BLK_STATUS_* of the request.
+int virtio_blk_read(uint64_t sector, void *buffer, uint32_t sectors);
+int virtio_blk_write(uint64_t sector, const void *buffer, uint32_t sectors);
+
+void virtio_blk_get_stats(unsigned int queue, blk_queue_stats_t *stats);
+
+void virtio_blk_selftest(void);
+
+#endif // VIRTIO_BLK_H
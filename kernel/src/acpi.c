@@ -0,0 +1,234 @@
+#include "../include/acpi.h"
+#include "../include/pmm.h"
+#include "../include/slab.h"
+#include "../include/util.h"
+
+typedef struct __attribute__((packed)) {
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+    // ACPI 2.0+
+    uint32_t length;
+    uint64_t xsdt_address;
+    uint8_t extended_checksum;
+    uint8_t reserved[3];
+} acpi_rsdp_t;
+
+typedef struct __attribute__((packed)) {
+    acpi_header_t header;
+    uint32_t lapic_address;
+    uint32_t flags;
+} acpi_madt_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t type;
+    uint8_t length;
+} acpi_subtable_t;
+
+#define MADT_LAPIC              0
+#define MADT_IOAPIC             1
+#define MADT_ISO                2
+#define MADT_LAPIC_OVERRIDE     5
+#define MADT_X2APIC             9
+
+#define MADT_PCAT_COMPAT        (1U << 0)
+#define MADT_CPU_ENABLED        (1U << 0)
+#define MADT_CPU_ONLINE_CAPABLE (1U << 1)
+
+#define SRAT_CPU                0
+#define SRAT_MEMORY             1
+#define SRAT_X2APIC             2
+#define SRAT_ENABLED            (1U << 0)
+
+// MPS INTI flags in interrupt source overrides
+#define MPS_POLARITY_MASK       0x3
+#define MPS_POLARITY_LOW        0x3
+#define MPS_TRIGGER_MASK        0xC
+#define MPS_TRIGGER_LEVEL       0xC
+
+static acpi_info_t *g_acpi;
+// Signatures of g_acpi->tables as little-endian words, so that a lookup
+// scans one small array instead of touching every table header
+static uint32_t g_signatures[ACPI_MAX_TABLES];
+
+static int checksum_ok(const void *data, uint32_t length) {
+    const uint8_t *p = data;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < length; i++) sum += p[i];
+    return sum == 0;
+}
+
+static uint32_t signature_word(const char *sig) {
+    uint32_t word;
+    memcpy(&word, sig, 4);
+    return word;
+}
+
+// Iterate over the variable-length subtables that follow a fixed header
+#define FOR_EACH_SUBTABLE(sub, table, offset)                                       \
+    for (const acpi_subtable_t *sub = (const void *)((const uint8_t *)(table) + (offset)); \
+         (const uint8_t *)sub + sizeof(acpi_subtable_t) <=                          \
+             (const uint8_t *)(table) + (table)->length && sub->length;            \
+         sub = (const void *)((const uint8_t *)sub + sub->length))
+
+static void add_cpu(uint32_t apic_id, uint32_t uid, uint32_t flags) {
+    if (!(flags & (MADT_CPU_ENABLED | MADT_CPU_ONLINE_CAPABLE))) return;
+    if (g_acpi->cpu_count >= MAX_CPUS) return;
+    acpi_cpu_t *cpu = &g_acpi->cpus[g_acpi->cpu_count++];
+    cpu->apic_id = apic_id;
+    cpu->acpi_uid = uid;
+    cpu->domain = ACPI_NO_DOMAIN;
+}
+
+static void parse_madt(const acpi_header_t *table) {
+    const acpi_madt_t *madt = (const void *)table;
+    g_acpi->lapic_address = madt->lapic_address;
+    g_acpi->has_8259 = (madt->flags & MADT_PCAT_COMPAT) != 0;
+
+    FOR_EACH_SUBTABLE(sub, table, sizeof(acpi_madt_t)) {
+        const uint8_t *p = (const uint8_t *)sub;
+        switch (sub->type) {
+        case MADT_LAPIC:
+            // uid u8, apic id u8, flags u32
+            add_cpu(p[3], p[2], *(const uint32_t *)(p + 4));
+            break;
+        case MADT_X2APIC:
+            // reserved u16, x2apic id u32, flags u32, uid u32
+            add_cpu(*(const uint32_t *)(p + 4), *(const uint32_t *)(p + 12), *(const uint32_t *)(p + 8));
+            break;
+        case MADT_IOAPIC:
+            if (g_acpi->ioapic_count < ACPI_MAX_IOAPICS) {
+                acpi_ioapic_t *io = &g_acpi->ioapics[g_acpi->ioapic_count++];
+                io->id = p[2];
+                io->address = *(const uint32_t *)(p + 4);
+                io->gsi_base = *(const uint32_t *)(p + 8);
+            }
+            break;
+        case MADT_ISO: {
+            // bus u8, source u8, gsi u32, flags u16
+            uint8_t irq = p[3];
+            uint16_t mps = *(const uint16_t *)(p + 8);
+            if (irq >= ACPI_ISA_IRQS) break;
+            g_acpi->isa_irqs[irq].gsi = *(const uint32_t *)(p + 4);
+            g_acpi->isa_irqs[irq].flags =
+                ((mps & MPS_POLARITY_MASK) == MPS_POLARITY_LOW ? ACPI_IRQ_ACTIVE_LOW : 0) |
+                ((mps & MPS_TRIGGER_MASK) == MPS_TRIGGER_LEVEL ? ACPI_IRQ_LEVEL : 0);
+            break;
+        }
+        case MADT_LAPIC_OVERRIDE:
+            g_acpi->lapic_address = *(const uint64_t *)(p + 4);
+            break;
+        }
+    }
+}
+
+static void parse_hpet(const acpi_header_t *table) {
+    // Event timer block id u32, then a generic address structure whose
+    // 64-bit address sits 4 bytes in
+    const uint8_t *p = (const uint8_t *)table + sizeof(acpi_header_t);
+    g_acpi->hpet_address = *(const uint64_t *)(p + 8);
+}
+
+static void parse_mcfg(const acpi_header_t *table) {
+    // 8 reserved bytes, then 16-byte allocation entries
+    const uint8_t *p = (const uint8_t *)table + sizeof(acpi_header_t) + 8;
+    const uint8_t *end = (const uint8_t *)table + table->length;
+
+    for (; p + 16 <= end && g_acpi->ecam_count < ACPI_MAX_ECAM; p += 16) {
+        acpi_ecam_t *e = &g_acpi->ecam[g_acpi->ecam_count++];
+        e->base = *(const uint64_t *)p;
+        e->segment = *(const uint16_t *)(p + 8);
+        e->bus_start = p[10];
+        e->bus_end = p[11];
+    }
+}
+
+static void set_cpu_domain(uint32_t apic_id, uint32_t domain) {
+    for (unsigned int i = 0; i < g_acpi->cpu_count; i++)
+        if (g_acpi->cpus[i].apic_id == apic_id) g_acpi->cpus[i].domain = domain;
+    if (domain + 1 > g_acpi->domain_count) g_acpi->domain_count = domain + 1;
+}
+
+static void parse_srat(const acpi_header_t *table) {
+    // 12 reserved bytes follow the header
+    FOR_EACH_SUBTABLE(sub, table, sizeof(acpi_header_t) + 12) {
+        const uint8_t *p = (const uint8_t *)sub;
+        switch (sub->type) {
+        case SRAT_CPU:
+            // domain bits 0-7 at 2, apic id at 3, flags u32 at 4, domain bits 8-31 at 9
+            if (!(*(const uint32_t *)(p + 4) & SRAT_ENABLED)) break;
+            set_cpu_domain(p[3], p[2] | (uint32_t)p[9] << 8 | (uint32_t)p[10] << 16 | (uint32_t)p[11] << 24);
+            break;
+        case SRAT_X2APIC:
+            // domain u32 at 4, x2apic id u32 at 8, flags u32 at 12
+            if (!(*(const uint32_t *)(p + 12) & SRAT_ENABLED)) break;
+            set_cpu_domain(*(const uint32_t *)(p + 8), *(const uint32_t *)(p + 4));
+            break;
+        case SRAT_MEMORY: {
+            // domain u32 at 2, base u64 at 8, length u64 at 16, flags u32 at 28
+            if (!(*(const uint32_t *)(p + 28) & SRAT_ENABLED)) break;
+            if (g_acpi->mem_range_count >= ACPI_MAX_MEM_RANGES) break;
+            acpi_mem_range_t *r = &g_acpi->mem_ranges[g_acpi->mem_range_count++];
+            r->domain = *(const uint32_t *)(p + 2);
+            r->base = *(const uint64_t *)(p + 8);
+            r->length = *(const uint64_t *)(p + 16);
+            if (r->domain + 1 > g_acpi->domain_count) g_acpi->domain_count = r->domain + 1;
+            break;
+        }
+        }
+    }
+}
+
+static void add_table(uint64_t phys) {
+    const acpi_header_t *h = phys_to_virt(phys);
+    if (!phys || !checksum_ok(h, h->length)) return;
+    if (g_acpi->table_count >= ACPI_MAX_TABLES) return;
+    g_signatures[g_acpi->table_count] = signature_word(h->signature);
+    g_acpi->tables[g_acpi->table_count++] = h;
+}
+
+int acpi_init(uint64_t rsdp_phys) {
+    if (!rsdp_phys) return -1;
+    const acpi_rsdp_t *rsdp = phys_to_virt(rsdp_phys);
+    if (memcmp(rsdp->signature, "RSD PTR ", 8) != 0 || !checksum_ok(rsdp, 20)) return -1;
+
+    int use_xsdt = rsdp->revision >= 2 && rsdp->xsdt_address && checksum_ok(rsdp, rsdp->length);
+    const acpi_header_t *root = phys_to_virt(use_xsdt ? rsdp->xsdt_address : rsdp->rsdt_address);
+    if (!checksum_ok(root, root->length)) return -1;
+
+    g_acpi = kzalloc(sizeof(acpi_info_t));
+    if (!g_acpi) return -1;
+    g_acpi->revision = rsdp->revision;
+    for (unsigned int irq = 0; irq < ACPI_ISA_IRQS; irq++) g_acpi->isa_irqs[irq].gsi = irq;
+
+    // XSDT entries are 64-bit but only 4-byte aligned
+    const uint8_t *entries = (const uint8_t *)root + sizeof(acpi_header_t);
+    unsigned int entry_size = use_xsdt ? 8 : 4;
+    unsigned int count = (root->length - sizeof(acpi_header_t)) / entry_size;
+    for (unsigned int i = 0; i < count; i++) {
+        uint64_t phys = use_xsdt ? *(const uint64_t *)(entries + i * 8)
+                                 : *(const uint32_t *)(entries + i * 4);
+        add_table(phys);
+    }
+
+    const acpi_header_t *t;
+    if ((t = acpi_find_table("APIC"))) parse_madt(t);
+    if ((t = acpi_find_table("HPET"))) parse_hpet(t);
+    if ((t = acpi_find_table("MCFG"))) parse_mcfg(t);
+    if ((t = acpi_find_table("SRAT"))) parse_srat(t);
+    return 0;
+}
+
+const acpi_info_t *acpi_get_info(void) {
+    return g_acpi;
+}
+
+const acpi_header_t *acpi_find_table(const char *signature) {
+    if (!g_acpi) return 0;
+    uint32_t word = signature_word(signature);
+    for (unsigned int i = 0; i < g_acpi->table_count; i++)
+        if (g_signatures[i] == word) return g_acpi->tables[i];
+    return 0;
+}
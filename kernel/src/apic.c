@@ -0,0 +1,133 @@
+#include "../include/apic.h"
+#include "../include/cpu.h"
+#include "../include/idt.h"
+#include "../include/paging.h"
+
+#define MSR_APIC_BASE           0x1B
+#define APIC_BASE_ENABLE        (1UL << 11)
+#define APIC_BASE_X2APIC        (1UL << 10)
+#define APIC_BASE_ADDR_MASK     0xFFFFFF000UL
+#define MSR_X2APIC_BASE         0x800
+#define MSR_X2APIC_ICR          0x830
+
+#define APIC_SVR_ENABLE         (1U << 8)
+#define APIC_ICR_PENDING        (1U << 12)
+
+#define PIC1_COMMAND            0x20
+#define PIC1_DATA               0x21
+#define PIC2_COMMAND            0xA0
+#define PIC2_DATA               0xA1
+#define PIC_VECTOR_BASE         0x20    // spurious PIC IRQs land on 0x27/0x2F
+
+static volatile uint32_t *g_apic_mmio;
+static int g_x2apic;
+static uint64_t g_apic_errors;
+
+// Remap both 8259s off the exception vectors, then mask every line. Even
+// masked, a PIC can raise a spurious IRQ7/15, which must not look like #DF.
+static void pic_disable(void) {
+    outb(PIC1_COMMAND, 0x11);           // ICW1: init, expect ICW4
+    outb(PIC2_COMMAND, 0x11);
+    outb(PIC1_DATA, PIC_VECTOR_BASE);   // ICW2: vector offsets
+    outb(PIC2_DATA, PIC_VECTOR_BASE + 8);
+    outb(PIC1_DATA, 0x04);              // ICW3: slave on IRQ2
+    outb(PIC2_DATA, 0x02);
+    outb(PIC1_DATA, 0x01);              // ICW4: 8086 mode
+    outb(PIC2_DATA, 0x01);
+    outb(PIC1_DATA, 0xFF);
+    outb(PIC2_DATA, 0xFF);
+}
+
+uint32_t apic_read(unsigned int reg) {
+    if (g_x2apic) return (uint32_t)rdmsr(MSR_X2APIC_BASE + (reg >> 4));
+    return g_apic_mmio[reg / 4];
+}
+
+void apic_write(unsigned int reg, uint32_t val) {
+    if (g_x2apic)
+        wrmsr(MSR_X2APIC_BASE + (reg >> 4), val);
+    else
+        g_apic_mmio[reg / 4] = val;
+}
+
+static void handle_apic_error(interrupt_frame_t *frame) {
+    (void)frame;
+    // ESR latches on write; the read then returns the errors seen
+    apic_write(APIC_REG_ESR, 0);
+    apic_read(APIC_REG_ESR);
+    g_apic_errors++;
+    apic_eoi();
+}
+
+static void handle_spurious(interrupt_frame_t *frame) {
+    // Spurious vectors are not in service and must not be EOI'd
+    (void)frame;
+}
+
+void apic_init_cpu(void) {
+    uint64_t base = rdmsr(MSR_APIC_BASE) | APIC_BASE_ENABLE;
+    if (g_x2apic) base |= APIC_BASE_X2APIC;
+    wrmsr(MSR_APIC_BASE, base);
+
+    apic_write(APIC_REG_SVR, APIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+    apic_write(APIC_REG_TPR, 0);
+    apic_write(APIC_REG_LVT_TIMER, APIC_LVT_MASKED);
+    apic_write(APIC_REG_LVT_PERF, APIC_LVT_MASKED);
+    apic_write(APIC_REG_LVT_LINT0, APIC_LVT_MASKED);
+    apic_write(APIC_REG_LVT_LINT1, APIC_LVT_DELIVERY_NMI);
+    apic_write(APIC_REG_LVT_ERROR, APIC_ERROR_VECTOR);
+
+    // Clear stale errors and anything the firmware left in service
+    apic_write(APIC_REG_ESR, 0);
+    apic_write(APIC_REG_ESR, 0);
+    apic_eoi();
+}
+
+int apic_init(void) {
+    uint32_t a, b, c, d;
+    cpuid(1, 0, &a, &b, &c, &d);
+    if (!(d & (1U << 9))) return -1;
+    g_x2apic = (c & (1U << 21)) != 0;
+
+    pic_disable();
+
+    if (!g_x2apic) {
+        uint64_t phys = rdmsr(MSR_APIC_BASE) & APIC_BASE_ADDR_MASK;
+        if (paging_map_mmio(phys, 0x1000, PAGE_CACHE_UC) != 0) return -1;
+        g_apic_mmio = (volatile uint32_t *)phys;
+    }
+
+    interrupt_register(APIC_ERROR_VECTOR, handle_apic_error);
+    interrupt_register(APIC_SPURIOUS_VECTOR, handle_spurious);
+    apic_init_cpu();
+    return 0;
+}
+
+int apic_is_x2apic(void) {
+    return g_x2apic;
+}
+
+uint64_t apic_error_count(void) {
+    return g_apic_errors;
+}
+
+uint32_t apic_id(void) {
+    uint32_t id = apic_read(APIC_REG_ID);
+    return g_x2apic ? id : id >> 24;
+}
+
+void apic_send_ipi(uint32_t dest_apic_id, uint32_t icr) {
+    if (g_x2apic) {
+        // x2APIC MSR writes are not serializing; order prior stores first
+        __asm__ volatile("mfence" ::: "memory");
+        wrmsr(MSR_X2APIC_ICR, ((uint64_t)dest_apic_id << 32) | icr);
+        return;
+    }
+
+    unsigned long flags = irq_save();
+    apic_write(APIC_REG_ICR_HIGH, dest_apic_id << 24);
+    apic_write(APIC_REG_ICR_LOW, icr);
+    while (apic_read(APIC_REG_ICR_LOW) & APIC_ICR_PENDING)
+        cpu_pause();
+    irq_restore(flags);
+}
@@ -0,0 +1,215 @@
+#include "../include/blkbench.h"
+#include "../include/cpu.h"
+#include "../include/histogram.h"
+#include "../include/kernel.h"
+#include "../include/percpu.h"
+#include "../include/pmm.h"
+#include "../include/sched.h"
+#include "../include/slab.h"
+#include "../include/tsc.h"
+#include "../include/util.h"
+#include "../include/virtio_blk.h"
+
+#define BLKBENCH_RUNTIME_NS     500000000UL     // per job and mode
+#define BLKBENCH_MAX_DEPTH      32
+
+typedef struct {
+    const char *name;
+    int random;
+    uint32_t block_size;
+    unsigned int iodepth;
+} blkbench_job_t;
+
+static const blkbench_job_t g_jobs[] = {
+    { "randread", 1, 4096, 32 },
+    { "read", 0, 128 * 1024, 4 },
+};
+
+typedef struct {
+    const blkbench_job_t *job;
+    unsigned int queue;
+    int poll;
+    uint64_t first_sector;      // sequential jobs: this worker's region
+    uint64_t region_sectors;
+    uint64_t seed;
+
+    uint64_t ios;
+    uint64_t bytes;
+    uint64_t errors;
+    uint64_t elapsed_ns;
+    histogram_t latency_ns;
+} blkbench_worker_t;
+
+static unsigned int g_workers_done;
+static unsigned int g_waiter;
+
+static uint64_t next_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static uint64_t next_sector(blkbench_worker_t *w, uint64_t *cursor) {
+    uint64_t sectors = w->job->block_size / BLK_SECTOR_SIZE;
+    uint64_t blocks = w->region_sectors / sectors;
+    if (!blocks) return w->first_sector;
+    uint64_t block = w->job->random ? next_random(&w->seed) % blocks : (*cursor)++ % blocks;
+    return w->first_sector + block * sectors;
+}
+
+static unsigned int buffer_order(uint32_t bytes) {
+    unsigned int order = 0;
+    while ((PAGE_SIZE << order) < bytes) order++;
+    return order;
+}
+
+// Keeps `iodepth` requests in flight until the runtime is up. Completed
+// slots are resubmitted together, so a burst of completions costs one
+// doorbell. In poll mode the worker reaps its own queue; otherwise it only
+// watches the status words the interrupt handler writes.
+static void worker_thread(void *arg) {
+    blkbench_worker_t *w = arg;
+    const blkbench_job_t *job = w->job;
+    unsigned int depth = job->iodepth;
+    unsigned int order = buffer_order(job->block_size);
+    blk_request_t *reqs = kzalloc(depth * sizeof(blk_request_t));
+    blk_request_t *batch[BLKBENCH_MAX_DEPTH];
+    uint8_t busy[BLKBENCH_MAX_DEPTH] = { 0 };
+    uint64_t cursor = 0;
+
+    unsigned int slots = 0;
+    while (reqs && slots < depth) {
+        uint64_t phys = pmm_alloc_pages(order);
+        if (!phys) break;
+        reqs[slots].buffer = phys_to_virt(phys);
+        reqs[slots].sectors = job->block_size / BLK_SECTOR_SIZE;
+        slots++;
+    }
+
+    uint64_t start = rdtsc();
+    uint64_t deadline = start + tsc_ns_to_cycles(BLKBENCH_RUNTIME_NS);
+    unsigned int in_flight = 0;
+    int running = slots != 0;
+
+    while (running || in_flight) {
+        if (w->poll) virtio_blk_poll(w->queue);
+        running = running && rdtsc() < deadline;
+
+        unsigned int ready = 0;
+        for (unsigned int i = 0; i < slots; i++) {
+            blk_request_t *req = &reqs[i];
+            if (busy[i]) {
+                if (__atomic_load_n(&req->status, __ATOMIC_ACQUIRE) == BLK_STATUS_PENDING) continue;
+                busy[i] = 0;
+                in_flight--;
+                hist_add(&w->latency_ns, tsc_cycles_to_ns(req->complete_tsc - req->submit_tsc));
+                if (req->status == BLK_STATUS_OK) {
+                    w->ios++;
+                    w->bytes += job->block_size;
+                } else {
+                    w->errors++;
+                }
+            }
+            if (running) {
+                req->sector = next_sector(w, &cursor);
+                batch[ready++] = req;
+            }
+        }
+
+        if (ready) {
+            unsigned int sent = virtio_blk_submit(w->queue, batch, ready);
+            // Whatever did not fit in the ring waits for the next round
+            for (unsigned int i = 0; i < sent; i++) busy[batch[i] - reqs] = 1;
+            in_flight += sent;
+        } else {
+            cpu_pause();
+        }
+    }
+    w->elapsed_ns = tsc_cycles_to_ns(rdtsc() - start);
+
+    for (unsigned int i = 0; i < slots; i++) pmm_free_pages(virt_to_phys(reqs[i].buffer), order);
+    kfree(reqs);
+    __atomic_fetch_add(&g_workers_done, 1, __ATOMIC_RELEASE);
+    sched_kick(g_waiter);
+}
+
+static void run_job(const blkbench_job_t *job, int mode, blkbench_worker_t *workers, unsigned int count) {
+    char line[160];
+    blk_queue_stats_t stats;
+    uint64_t irqs_before = 0, irqs_after = 0;
+
+    virtio_blk_set_mode(mode);
+    for (unsigned int i = 0; i < count; i++) {
+        virtio_blk_get_stats(i, &stats);
+        irqs_before += stats.interrupts;
+    }
+
+    // Sequential workers read disjoint slices so that the device cannot
+    // serve one worker from another's readahead
+    uint64_t slice = virtio_blk_capacity() / count;
+    slice -= slice % (job->block_size / BLK_SECTOR_SIZE);
+    for (unsigned int i = 0; i < count; i++) {
+        blkbench_worker_t *w = &workers[i];
+        memset(w, 0, sizeof(*w));
+        w->job = job;
+        w->queue = i;
+        w->poll = mode == BLK_MODE_POLL;
+        w->first_sector = job->random ? 0 : slice * i;
+        w->region_sectors = job->random ? virtio_blk_capacity() : slice;
+        w->seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+        hist_reset(&w->latency_ns);
+    }
+
+    g_waiter = this_cpu_id();
+    g_workers_done = 0;
+    unsigned int spawned = 0;
+    // Each worker stays on the CPU its queue's completions are aimed at
+    for (unsigned int i = 0; i < count; i++)
+        if (sched_spawn_on(virtio_blk_queue_cpu(i), "blkbench", worker_thread, &workers[i]) == 0) spawned++;
+    sched_wait_for(&g_workers_done, spawned);
+
+    histogram_t latency;
+    hist_reset(&latency);
+    uint64_t iops = 0, bandwidth = 0, errors = 0;
+    for (unsigned int i = 0; i < spawned; i++) {
+        blkbench_worker_t *w = &workers[i];
+        hist_merge(&latency, &w->latency_ns);
+        if (w->elapsed_ns) {
+            iops += w->ios * 1000000000UL / w->elapsed_ns;
+            bandwidth += w->bytes * 1000 / w->elapsed_ns;       // MB/s
+        }
+        errors += w->errors;
+    }
+    for (unsigned int i = 0; i < count; i++) {
+        virtio_blk_get_stats(i, &stats);
+        irqs_after += stats.interrupts;
+    }
+
+    ksnprintf(line, sizeof(line),
+              "blk: %s bs=%uk qd=%u x%u %s: %lu IOPS, %lu MB/s, lat mean %lu p50 %lu p99 %lu us, %lu irqs%s",
+              job->name, job->block_size / 1024, job->iodepth, spawned, mode == BLK_MODE_POLL ? "poll" : "irq",
+              iops, bandwidth, hist_mean(&latency) / 1000, hist_percentile(&latency, 50) / 1000,
+              hist_percentile(&latency, 99) / 1000, irqs_after - irqs_before, errors ? ", ERRORS" : "");
+    boot_print(line, errors || spawned != count ? COLOR_RED : COLOR_CYAN);
+}
+
+void blkbench_run(void) {
+    if (!virtio_blk_present()) return;
+
+    // One worker per queue, and no more workers than CPUs to run them
+    unsigned int count = virtio_blk_queue_count();
+    if (count > percpu_online_count()) count = percpu_online_count();
+    blkbench_worker_t *workers = kzalloc(count * sizeof(blkbench_worker_t));
+    if (!workers) return;
+
+    int initial_mode = virtio_blk_mode();
+    for (unsigned int j = 0; j < sizeof(g_jobs) / sizeof(g_jobs[0]); j++) {
+        if (g_jobs[j].block_size % virtio_blk_block_size()) continue;
+        if (virtio_blk_has_irqs()) run_job(&g_jobs[j], BLK_MODE_IRQ, workers, count);
+        run_job(&g_jobs[j], BLK_MODE_POLL, workers, count);
+    }
+    virtio_blk_set_mode(initial_mode);
+    kfree(workers);
+}
@@ -0,0 +1,567 @@
+#include "../include/console.h"
+#include "../include/cpu.h"
+#include "../include/font.h"
+#include "../include/framebuffer.h"
+#include "../include/kernel.h"
+#include "../include/pmm.h"
+#include "../include/raster.h"
+#include "../include/tsc.h"
+#include "../include/util.h"
+
+// Screen and a couple of screens of history for a 1080p framebuffer, and at
+// least a screen for 4K, before the page allocator is up
+#define CONSOLE_EARLY_BYTES     (512 * 1024)
+
+#define ESC_NONE                0
+#define ESC_START               1
+#define ESC_CSI                 2
+
+#define ATTR_DEFAULT            0x07        // light grey on black
+#define CELL_INVALID            0xFFFF      // never stored: characters are 7-bit
+#define LINE_INVALID            (~0ULL)
+
+#define CELL(ch, attr)          ((console_cell_t)((uint8_t)(ch) | (attr) << 8))
+#define CELL_CHAR(cell)         ((char)((cell) & 0xFF))
+#define CELL_FG(cell)           (((cell) >> 8) & 0xF)
+#define CELL_BG(cell)           ((cell) >> 12)
+
+// VGA colours for the normal half; the bright half matches the COLOR_*
+// constants so boot_print() output keeps its look
+static const unsigned int g_palette[16] = {
+    0x00000000, 0x00AA0000, 0x0000AA00, 0x00AA5500, 0x000000AA, 0x00AA00AA, 0x0000AAAA, 0x00AAAAAA,
+    0x00555555, COLOR_RED, COLOR_GREEN, COLOR_YELLOW, COLOR_BLUE, COLOR_MAGENTA, COLOR_CYAN, COLOR_WHITE,
+};
+
+console_t g_console;
+static int g_console_ready;
+static uint8_t g_console_early[CONSOLE_EARLY_BYTES] __attribute__((aligned(8)));
+static uint64_t g_console_phys;             // page-allocated buffer, 0 while in the static one
+static unsigned int g_console_order;
+
+static size_t screen_bytes(unsigned int cols, unsigned int rows) {
+    size_t bytes = (size_t)rows * (sizeof(uint64_t) + sizeof(uint32_t) + sizeof(int));
+    bytes += (size_t)rows * cols * sizeof(console_cell_t);
+    return (bytes + 7) & ~(size_t)7;
+}
+
+static size_t line_bytes(unsigned int cols) {
+    return cols * sizeof(console_cell_t) + sizeof(uint32_t);
+}
+
+size_t console_buffer_size(const font_t *font, unsigned int width, unsigned int height, unsigned int ring_lines) {
+    unsigned int cols = width / font->width, rows = height / font->line_height;
+    return screen_bytes(cols, rows) + (size_t)ring_lines * line_bytes(cols);
+}
+
+static inline console_cell_t *line_cells(console_t *con, uint64_t line) {
+    return con->ring + (line % con->ring_lines) * con->cols;
+}
+
+static inline void touch_line(console_t *con, uint64_t line) {
+    con->ring_gen[line % con->ring_lines]++;
+}
+
+// Oldest line still in the ring
+static inline uint64_t first_line(const console_t *con) {
+    return con->bottom + 1 > con->ring_lines ? con->bottom + 1 - con->ring_lines : 0;
+}
+
+static inline uint64_t screen_line(const console_t *con, unsigned int row) {
+    return con->bottom - (con->rows - 1) + row;
+}
+
+static inline console_cell_t blank(const console_t *con) {
+    return CELL(' ', con->attr & 0xF0);
+}
+
+static void invalidate(console_t *con) {
+    for (unsigned int r = 0; r < con->rows; r++) {
+        con->shadow_line[r] = LINE_INVALID;
+        con->shadow_cursor[r] = -1;
+    }
+    for (size_t i = 0; i < (size_t)con->rows * con->cols; i++) con->shadow[i] = CELL_INVALID;
+}
+
+// Carve the screen shadow and the ring out of `buffer`; returns the number
+// of ring lines it holds
+static unsigned int carve(console_t *con, void *buffer, size_t size) {
+    size_t head = screen_bytes(con->cols, con->rows);
+    if (size < head) return 0;
+
+    uint8_t *p = buffer;
+    con->shadow_line = (uint64_t *)p;
+    p += con->rows * sizeof(uint64_t);
+    con->shadow_gen = (uint32_t *)p;
+    p += con->rows * sizeof(uint32_t);
+    con->shadow_cursor = (int *)p;
+    p += con->rows * sizeof(int);
+    con->shadow = (console_cell_t *)p;
+
+    unsigned int lines = (size - head) / line_bytes(con->cols);
+    p = (uint8_t *)buffer + head;
+    con->ring_gen = (uint32_t *)p;
+    con->ring = (console_cell_t *)(p + lines * sizeof(uint32_t));
+    return lines;
+}
+
+int console_init(console_t *con, const font_t *font, unsigned int x, unsigned int y, unsigned int width,
+                 unsigned int height, void *buffer, size_t size) {
+    memset(con, 0, sizeof(*con));
+    con->x = x;
+    con->y = y;
+    con->width = width;
+    con->height = height;
+    con->font = font;
+    con->cols = width / font->width;
+    con->rows = height / font->line_height;
+    if (!con->cols || !con->rows) return -1;
+
+    con->ring_lines = carve(con, buffer, size);
+    if (con->ring_lines < con->rows) return -1;
+
+    con->attr = ATTR_DEFAULT;
+    con->cursor_visible = 1;
+    con->bottom = con->rows - 1;
+    console_cell_t b = blank(con);
+    for (size_t i = 0; i < (size_t)con->ring_lines * con->cols; i++) con->ring[i] = b;
+    memset(con->ring_gen, 0, con->ring_lines * sizeof(uint32_t));
+    invalidate(con);
+    return 0;
+}
+
+// Move into `buffer` with `font`'s cells over the same rectangle. The
+// newest lines that fit are copied, cut or padded to the new width, and
+// the cursor stays on its line.
+static int relayout(console_t *con, const font_t *font, void *buffer, size_t size) {
+    unsigned long flags = spin_lock_irqsave(&con->lock);
+    console_t old = *con;
+
+    con->font = font;
+    con->cols = con->width / font->width;
+    con->rows = con->height / font->line_height;
+    unsigned int lines = con->cols && con->rows ? carve(con, buffer, size) : 0;
+    if (lines < con->rows) {
+        *con = old;
+        spin_unlock_irqrestore(&con->lock, flags);
+        return -1;
+    }
+    con->ring_lines = lines;
+
+    // A taller screen than the output so far starts with blank lines below
+    uint64_t cursor_line = screen_line(&old, old.cy);
+    if (con->bottom < con->rows - 1) con->bottom = con->rows - 1;
+    uint64_t top = con->bottom - (con->rows - 1);
+    con->cy = cursor_line >= top ? (unsigned int)(cursor_line - top) : 0;
+    if (con->cx > con->cols) con->cx = con->cols;
+
+    uint64_t first = first_line(&old);
+    if (con->bottom + 1 - first > lines) first = con->bottom + 1 - lines;
+    unsigned int width = old.cols < con->cols ? old.cols : con->cols;
+    console_cell_t b = CELL(' ', ATTR_DEFAULT & 0xF0);
+    for (size_t i = 0; i < (size_t)lines * con->cols; i++) con->ring[i] = b;
+    memset(con->ring_gen, 0, lines * sizeof(uint32_t));
+    for (uint64_t line = first; line <= old.bottom; line++)
+        memcpy(line_cells(con, line), line_cells(&old, line), width * sizeof(console_cell_t));
+    con->view = 0;
+    con->clear = font != old.font;
+    invalidate(con);
+    spin_unlock_irqrestore(&con->lock, flags);
+    return 0;
+}
+
+int console_resize(console_t *con, void *buffer, size_t size) {
+    return relayout(con, con->font, buffer, size);
+}
+
+int console_set_font(console_t *con, const font_t *font, void *buffer, size_t size) {
+    return relayout(con, font, buffer, size);
+}
+
+static void newline(console_t *con) {
+    con->cx = 0;
+    con->stats.lines++;
+    if (con->cy + 1 < con->rows) {
+        con->cy++;
+        return;
+    }
+
+    // Scrolling is a new bottom line; the line leaving the ring is the
+    // slot it reuses
+    con->bottom++;
+    console_cell_t *cells = line_cells(con, con->bottom);
+    console_cell_t b = blank(con);
+    for (unsigned int i = 0; i < con->cols; i++) cells[i] = b;
+    touch_line(con, con->bottom);
+}
+
+static void clear_cells(console_t *con, unsigned int row, unsigned int from, unsigned int to) {
+    uint64_t line = screen_line(con, row);
+    console_cell_t *cells = line_cells(con, line);
+    console_cell_t b = blank(con);
+    for (unsigned int i = from; i < to && i < con->cols; i++) cells[i] = b;
+    touch_line(con, line);
+}
+
+static void put_char(console_t *con, char c) {
+    if (con->cx >= con->cols) newline(con);
+    uint64_t line = screen_line(con, con->cy);
+    line_cells(con, line)[con->cx++] = CELL((unsigned char)c > 127 ? '?' : c, con->attr);
+    touch_line(con, line);
+}
+
+static unsigned int param(const console_t *con, unsigned int i, unsigned int fallback) {
+    return i < con->param_count && con->params[i] ? con->params[i] : fallback;
+}
+
+static void set_fg(console_t *con, unsigned int fg) {
+    con->attr = (con->attr & 0xF0) | (fg & 0xF);
+}
+
+static void set_bg(console_t *con, unsigned int bg) {
+    con->attr = (con->attr & 0x0F) | (bg & 0xF) << 4;
+}
+
+static void select_graphic_rendition(console_t *con) {
+    if (!con->param_count) con->param_count = 1, con->params[0] = 0;
+
+    for (unsigned int i = 0; i < con->param_count; i++) {
+        unsigned int p = con->params[i];
+        if (p == 0) {
+            con->attr = ATTR_DEFAULT;
+            con->bold = 0;
+        } else if (p == 1) {
+            con->bold = 1;
+            if ((con->attr & 0xF) < 8) set_fg(con, (con->attr & 0xF) + 8);
+        } else if (p == 22) {
+            con->bold = 0;
+        } else if (p >= 30 && p <= 37) {
+            set_fg(con, p - 30 + (con->bold ? 8 : 0));
+        } else if (p == 39) {
+            set_fg(con, ATTR_DEFAULT & 0xF);
+        } else if (p >= 40 && p <= 47) {
+            set_bg(con, p - 40);
+        } else if (p == 49) {
+            set_bg(con, ATTR_DEFAULT >> 4);
+        } else if (p >= 90 && p <= 97) {
+            set_fg(con, p - 90 + 8);
+        } else if (p >= 100 && p <= 107) {
+            set_bg(con, p - 100 + 8);
+        }
+    }
+}
+
+static void execute_csi(console_t *con, char final) {
+    unsigned int n = param(con, 0, 1);
+
+    switch (final) {
+    case 'm':
+        select_graphic_rendition(con);
+        break;
+    case 'H':
+    case 'f':
+        con->cy = param(con, 0, 1) - 1;
+        con->cx = param(con, 1, 1) - 1;
+        if (con->cy >= con->rows) con->cy = con->rows - 1;
+        if (con->cx >= con->cols) con->cx = con->cols - 1;
+        break;
+    case 'A':
+        con->cy = n > con->cy ? 0 : con->cy - n;
+        break;
+    case 'B':
+        con->cy = con->cy + n >= con->rows ? con->rows - 1 : con->cy + n;
+        break;
+    case 'C':
+        con->cx = con->cx + n >= con->cols ? con->cols - 1 : con->cx + n;
+        break;
+    case 'D':
+        if (con->cx >= con->cols) con->cx = con->cols - 1;
+        con->cx = n > con->cx ? 0 : con->cx - n;
+        break;
+    case 'J': {
+        unsigned int mode = param(con, 0, 0);
+        unsigned int from = mode == 0 ? con->cy + 1 : 0, to = mode == 1 ? con->cy : con->rows;
+        if (mode == 0) clear_cells(con, con->cy, con->cx, con->cols);
+        if (mode == 1) clear_cells(con, con->cy, 0, con->cx + 1);
+        for (unsigned int row = from; row < to; row++) clear_cells(con, row, 0, con->cols);
+        break;
+    }
+    case 'K': {
+        unsigned int mode = param(con, 0, 0);
+        clear_cells(con, con->cy, mode == 0 ? con->cx : 0, mode == 1 ? con->cx + 1 : con->cols);
+        break;
+    }
+    case 'h':
+    case 'l':
+        if (con->private_mode && param(con, 0, 0) == 25) con->cursor_visible = final == 'h';
+        break;
+    }
+}
+
+static void feed(console_t *con, char c) {
+    if (con->esc_state == ESC_START) {
+        con->esc_state = c == '[' ? ESC_CSI : ESC_NONE;
+        con->param_count = 0;
+        con->private_mode = 0;
+        return;
+    }
+    if (con->esc_state == ESC_CSI) {
+        if (c >= '0' && c <= '9') {
+            if (!con->param_count) con->params[con->param_count++] = 0;
+            unsigned int *p = &con->params[con->param_count - 1];
+            if (*p < 10000) *p = *p * 10 + (c - '0');
+        } else if (c == ';') {
+            if (!con->param_count) con->params[con->param_count++] = 0;
+            if (con->param_count < CONSOLE_MAX_PARAMS) con->params[con->param_count++] = 0;
+        } else if (c == '?') {
+            con->private_mode = 1;
+        } else if (c >= 0x40 && c <= 0x7E) {
+            execute_csi(con, c);
+            con->esc_state = ESC_NONE;
+        } else {
+            con->esc_state = ESC_NONE;
+        }
+        return;
+    }
+
+    switch (c) {
+    case '\n':
+        newline(con);
+        break;
+    case '\r':
+        con->cx = 0;
+        break;
+    case '\t':
+        do put_char(con, ' '); while (con->cx % 8 && con->cx < con->cols);
+        break;
+    case '\b':
+        if (con->cx) con->cx--;
+        break;
+    case 0x1B:
+        con->esc_state = ESC_START;
+        break;
+    default:
+        if ((unsigned char)c >= 0x20) put_char(con, c);
+        break;
+    }
+}
+
+void console_write(console_t *con, const char *buf, size_t len) {
+    unsigned long flags = spin_lock_irqsave(&con->lock);
+    for (size_t i = 0; i < len; i++) feed(con, buf[i]);
+    con->stats.bytes += len;
+    con->view = 0;
+    spin_unlock_irqrestore(&con->lock, flags);
+}
+
+static void render_row(console_t *con, unsigned int row, uint64_t line, uint32_t gen, int cursor) {
+    const console_cell_t *src = line >= first_line(con) ? line_cells(con, line) : 0;
+    console_cell_t *shadow = con->shadow + (size_t)row * con->cols;
+    const font_t *font = con->font;
+    unsigned int py = con->y + row * font->line_height;
+    unsigned int lo = con->cols, hi = 0;
+
+    for (unsigned int col = 0; col < con->cols; col++) {
+        console_cell_t cell = src ? src[col] : CELL(' ', ATTR_DEFAULT & 0xF0);
+        if ((int)col == cursor) cell = CELL(CELL_CHAR(cell), CELL_BG(cell) | CELL_FG(cell) << 4);
+        if (shadow[col] == cell) continue;
+
+        draw_glyph(con->x + col * font->width, py, font, font_glyph(font, (unsigned char)CELL_CHAR(cell)),
+                   g_palette[CELL_FG(cell)], g_palette[CELL_BG(cell)]);
+        shadow[col] = cell;
+        if (col < lo) lo = col;
+        hi = col;
+        con->stats.cells_drawn++;
+    }
+    if (lo <= hi) fb_damage(con->x + lo * font->width, py, (hi - lo + 1) * font->width, font->line_height);
+
+    con->shadow_line[row] = line;
+    con->shadow_gen[row] = gen;
+    con->shadow_cursor[row] = cursor;
+}
+
+void console_render(console_t *con) {
+    unsigned long flags = spin_lock_irqsave(&con->lock);
+    uint64_t start = rdtsc();
+    uint64_t top = con->bottom - (con->rows - 1) - con->view;
+    int live = con->view == 0 && con->cursor_visible;
+    unsigned int cursor_col = con->cx < con->cols ? con->cx : con->cols - 1;
+
+    // The old font's grid may reach past the new one's
+    if (con->clear) {
+        fb_surface_t target;
+        raster_screen(&target);
+        raster_fill_rect(&target, con->x, con->y, con->width, con->height, g_palette[0]);
+        fb_damage(con->x, con->y, con->width, con->height);
+        con->clear = 0;
+    }
+
+    for (unsigned int row = 0; row < con->rows; row++) {
+        uint64_t line = top + row;
+        uint32_t gen = line >= first_line(con) ? con->ring_gen[line % con->ring_lines] : 0;
+        int cursor = live && row == con->cy ? (int)cursor_col : -1;
+        if (con->shadow_line[row] == line && con->shadow_gen[row] == gen && con->shadow_cursor[row] == cursor) {
+            con->stats.rows_skipped++;
+            continue;
+        }
+        render_row(con, row, line, gen, cursor);
+    }
+    con->stats.renders++;
+    con->stats.render_cycles += rdtsc() - start;
+    spin_unlock_irqrestore(&con->lock, flags);
+}
+
+void console_scroll_view(console_t *con, int delta) {
+    unsigned long flags = spin_lock_irqsave(&con->lock);
+    uint64_t top = con->bottom - (con->rows - 1);
+    uint64_t max = top - (top < first_line(con) ? top : first_line(con));
+    int64_t view = (int64_t)con->view + delta;
+    if (view < 0) view = 0;
+    if ((uint64_t)view > max) view = max;
+    con->view = (unsigned int)view;
+    spin_unlock_irqrestore(&con->lock, flags);
+}
+
+void console_get_stats(console_t *con, console_stats_t *stats) {
+    unsigned long flags = spin_lock_irqsave(&con->lock);
+    *stats = con->stats;
+    spin_unlock_irqrestore(&con->lock, flags);
+}
+
+void console_boot_init(void) {
+    unsigned int width = g_fb_width > 2 * CONSOLE_MARGIN ? g_fb_width - 2 * CONSOLE_MARGIN : 0;
+    unsigned int height = g_fb_height > 2 * CONSOLE_MARGIN ? g_fb_height - 2 * CONSOLE_MARGIN : 0;
+    g_console_ready = console_init(&g_console, &g_font_builtin, CONSOLE_MARGIN, CONSOLE_MARGIN, width, height,
+                                   g_console_early, sizeof(g_console_early)) == 0;
+}
+
+// Give the boot console a page-allocated buffer with CONSOLE_SCROLLBACK
+// lines in `font`, freeing the previous one unless it is the static buffer
+static int boot_relayout(const font_t *font) {
+    if (!g_console_ready) return -1;
+
+    size_t size = console_buffer_size(font, g_console.width, g_console.height, CONSOLE_SCROLLBACK);
+    unsigned int order = pmm_order_for_size(size);
+    uint64_t phys = pmm_alloc_pages(order);
+    if (!phys) return -1;
+    if (relayout(&g_console, font, phys_to_virt(phys), PAGE_SIZE << order) != 0) {
+        pmm_free_pages(phys, order);
+        return -1;
+    }
+    if (g_console_phys) pmm_free_pages(g_console_phys, g_console_order);
+    g_console_phys = phys;
+    g_console_order = order;
+    return 0;
+}
+
+int console_enable_scrollback(void) {
+    return g_console_ready ? boot_relayout(g_console.font) : -1;
+}
+
+int console_use_font(const font_t *font) {
+    return boot_relayout(font ? font : &g_font_builtin);
+}
+
+void console_puts(const char *str) {
+    if (g_console_ready) console_write(&g_console, str, strlen(str));
+}
+
+void console_flush(void) {
+    if (g_console_ready) console_render(&g_console);
+    fb_flush();
+}
+
+#define SELFTEST_LINES          20000
+#define SELFTEST_UNBATCHED      500
+#define SELFTEST_BATCH          64
+#define SELFTEST_WIDTH          1920
+#define SELFTEST_HEIGHT         1080
+
+// Write `lines` coloured log lines, rendering after every `batch`; returns
+// the cycles taken
+static uint64_t stream_lines(console_t *con, unsigned int lines, unsigned int batch) {
+    char line[160];
+    uint64_t start = rdtsc();
+    for (unsigned int i = 0; i < lines; i++) {
+        int n = ksnprintf(line, sizeof(line),
+                          "\x1b[%um[%6u.%06u]\x1b[0m cpu%u: stream test line %u, some payload to fill the row\n",
+                          31 + i % 7, i / 1000, i % 1000 * 1000, i % 4, i);
+        console_write(con, line, n);
+        if ((i + 1) % batch == 0) console_render(con);
+    }
+    console_render(con);
+    return rdtsc() - start;
+}
+
+static int line_starts_with(console_t *con, uint64_t line, const char *text) {
+    const console_cell_t *cells = line_cells(con, line);
+    for (unsigned int i = 0; text[i]; i++)
+        if (i >= con->cols || CELL_CHAR(cells[i]) != text[i]) return 0;
+    return 1;
+}
+
+// Stream log lines into a private console drawing off screen, batched the
+// way console_flush() is used and with a render per line for comparison
+void console_selftest(void) {
+    char report[160];
+    console_t con;
+    console_stats_t stats;
+
+    size_t surface_bytes = (uint64_t)SELFTEST_WIDTH * SELFTEST_HEIGHT * 4;
+    size_t buffer_bytes = console_buffer_size(&g_font_builtin, SELFTEST_WIDTH, SELFTEST_HEIGHT, CONSOLE_SCROLLBACK);
+    uint64_t surface_phys = pmm_alloc_pages(pmm_order_for_size(surface_bytes));
+    uint64_t buffer_phys = pmm_alloc_pages(pmm_order_for_size(buffer_bytes));
+    if (!surface_phys || !buffer_phys) {
+        if (surface_phys) pmm_free_pages(surface_phys, pmm_order_for_size(surface_bytes));
+        if (buffer_phys) pmm_free_pages(buffer_phys, pmm_order_for_size(buffer_bytes));
+        boot_print("Console: out of memory, selftest skipped", COLOR_YELLOW);
+        return;
+    }
+
+    fb_surface_t surface = { phys_to_virt(surface_phys), SELFTEST_WIDTH, SELFTEST_HEIGHT, SELFTEST_WIDTH };
+    fb_set_target(&surface);
+    console_init(&con, &g_font_builtin, 0, 0, SELFTEST_WIDTH, SELFTEST_HEIGHT, phys_to_virt(buffer_phys),
+                 PAGE_SIZE << pmm_order_for_size(buffer_bytes));
+
+    uint64_t batched = stream_lines(&con, SELFTEST_LINES, SELFTEST_BATCH);
+    console_get_stats(&con, &stats);
+    uint64_t renders = stats.renders, render_cycles = stats.render_cycles;
+    uint64_t unbatched = stream_lines(&con, SELFTEST_UNBATCHED, 1);
+
+    // The newest line sits above the cursor's empty row; the ring reaches
+    // back CONSOLE_SCROLLBACK lines
+    int ok = line_starts_with(&con, con.bottom - 1, "[     0.499000] cpu3: stream test line 499,");
+    console_scroll_view(&con, 1 << 30);
+    ok = ok && con.view == con.bottom - (con.rows - 1) - first_line(&con);
+    console_render(&con);
+    console_scroll_view(&con, -(1 << 30));
+    ok = ok && con.view == 0;
+
+    // Twice as wide cells: the text stays on its lines, cut to half the
+    // columns, and the cursor keeps its line
+    // (id: one psf_parse() never hands out, so no cached tiles are shared)
+    static const uint8_t blank_glyph[2 * 16];
+    const font_t wide = {
+        .name = "selftest", .id = ~1U, .width = 16, .height = 16, .line_height = 20,
+        .bytes_per_row = 2, .bytes_per_glyph = sizeof(blank_glyph), .glyph_count = 1, .glyphs = blank_glyph,
+    };
+    size_t wide_bytes = console_buffer_size(&wide, SELFTEST_WIDTH, SELFTEST_HEIGHT, CONSOLE_SCROLLBACK);
+    uint64_t wide_phys = pmm_alloc_pages(pmm_order_for_size(wide_bytes));
+    if (wide_phys) {
+        uint64_t cursor_line = screen_line(&con, con.cy);
+        ok = ok && console_set_font(&con, &wide, phys_to_virt(wide_phys), PAGE_SIZE << pmm_order_for_size(wide_bytes)) == 0;
+        ok = ok && con.cols == SELFTEST_WIDTH / 16 && screen_line(&con, con.cy) == cursor_line;
+        ok = ok && line_starts_with(&con, con.bottom - 1, "[     0.499000] cpu3: stream test line 499,");
+        console_render(&con);
+        pmm_free_pages(wide_phys, pmm_order_for_size(wide_bytes));
+    }
+
+    fb_set_target(0);
+    pmm_free_pages(surface_phys, pmm_order_for_size(surface_bytes));
+    pmm_free_pages(buffer_phys, pmm_order_for_size(buffer_bytes));
+
+    ksnprintf(report, sizeof(report),
+              "Console: %lu lines/s rendering every %u, %lu lines/s every line, render %lu us, %s",
+              tsc_rate_per_sec(SELFTEST_LINES, batched), SELFTEST_BATCH, tsc_rate_per_sec(SELFTEST_UNBATCHED, unbatched),
+              renders ? tsc_cycles_to_ns(render_cycles / renders) / 1000 : 0, ok ? "ok" : "FAILED");
+    boot_print(report, ok ? COLOR_CYAN : COLOR_RED);
+}
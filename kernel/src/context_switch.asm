@@ -0,0 +1,29 @@
+BITS 64
+GLOBAL context_switch
+
+SECTION .text
+
+; void context_switch(uint64_t *save_rsp, uint64_t next_rsp)
+;
+; Push the callee-saved registers, park the stack pointer in *save_rsp and
+; continue on next_rsp, which holds the same layout. Everything else is
+; caller-saved under the SysV ABI, and RFLAGS travels with the interrupt
+; disable in schedule(). A new thread's stack is built by sched_spawn() so
+; that the final RET lands in its entry function.
+context_switch:
+    PUSH    RBX
+    PUSH    RBP
+    PUSH    R12
+    PUSH    R13
+    PUSH    R14
+    PUSH    R15
+    MOV     [RDI], RSP
+
+    MOV     RSP, RSI
+    POP     R15
+    POP     R14
+    POP     R13
+    POP     R12
+    POP     RBP
+    POP     RBX
+    RET
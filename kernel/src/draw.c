@@ -0,0 +1,231 @@
+#include "../include/kernel.h"
+#include "../include/font.h"
+#include "../include/framebuffer.h"
+#include "../include/glyph_cache.h"
+#include "../include/util.h"
+
+// Text and pixel primitives over g_fb_draw. Nothing here depends on the
+// rest of the kernel beyond the framebuffer layer and the glyph cache, so
+// the hosted build (hosted/) compiles this file unchanged.
+
+// Two adjacent 32-bit pixels, accessed through the pixel buffer's type
+typedef uint64_t __attribute__((may_alias, aligned(4))) pixel_pair_t;
+
+// For every 8-bit font row, four pixel-pair masks with all-ones lanes where
+// the bit is set (bit 7 is the leftmost pixel)
+static uint64_t g_glyph_masks[256][4];
+
+static const font_t *g_draw_font = &g_font_builtin;
+
+void draw_init(void) {
+    for (unsigned int bits = 0; bits < 256; bits++) {
+        for (unsigned int pair = 0; pair < 4; pair++) {
+            uint64_t mask = 0;
+            if (bits & (0x80 >> (pair * 2)))     mask |= 0x00000000FFFFFFFFUL;
+            if (bits & (0x80 >> (pair * 2 + 1))) mask |= 0xFFFFFFFF00000000UL;
+            g_glyph_masks[bits][pair] = mask;
+        }
+    }
+}
+
+static inline void put_pixel(unsigned int x, unsigned int y, unsigned int color) {
+    g_fb_draw[y * g_fb_stride + x] = color;
+}
+
+void draw_pixel(unsigned int x, unsigned int y, unsigned int color) {
+    if (x >= g_fb_width || y >= g_fb_height) return;
+    put_pixel(x, y, color);
+    fb_damage(x, y, 1, 1);
+}
+
+void clear_screen(unsigned int color) {
+    memset32(g_fb_draw, color, (uint64_t)g_fb_height * g_fb_stride);
+    fb_damage_all();
+}
+
+// Draw one glyph without recording damage. Glyphs fully on screen take the
+// fast path: one mask lookup per row and four masked pixel-pair stores.
+static void blit_glyph(unsigned int x, unsigned int y, unsigned char c, unsigned int color) {
+    if (c > 127) c = '?';
+    const uint8_t *bitmap = g_font[c];
+
+    if (x + 8 <= g_fb_width && y + 8 <= g_fb_height) {
+        uint64_t color2 = ((uint64_t)color << 32) | color;
+        unsigned int *dst = g_fb_draw + y * g_fb_stride + x;
+
+        for (unsigned int row = 0; row < 8; row++, dst += g_fb_stride) {
+            if (!bitmap[row]) continue;
+            const uint64_t *mask = g_glyph_masks[bitmap[row]];
+            pixel_pair_t *d = (pixel_pair_t *)dst;
+            d[0] = (d[0] & ~mask[0]) | (color2 & mask[0]);
+            d[1] = (d[1] & ~mask[1]) | (color2 & mask[1]);
+            d[2] = (d[2] & ~mask[2]) | (color2 & mask[2]);
+            d[3] = (d[3] & ~mask[3]) | (color2 & mask[3]);
+        }
+        return;
+    }
+
+    // Clipped at the right or bottom edge
+    if (x >= g_fb_width || y >= g_fb_height) return;
+    for (unsigned int row = 0; row < 8 && y + row < g_fb_height; row++) {
+        for (unsigned int col = 0; col < 8 && x + col < g_fb_width; col++) {
+            if (bitmap[row] & (1 << (7 - col))) {
+                put_pixel(x + col, y + row, color);
+            }
+        }
+    }
+}
+
+void draw_cell(unsigned int x, unsigned int y, char c, unsigned int fg, unsigned int bg) {
+    unsigned char ch = (unsigned char)c > 127 ? '?' : (unsigned char)c;
+    const uint8_t *bitmap = g_font[ch];
+
+    if (x + FONT_WIDTH <= g_fb_width && y + FONT_LINE_HEIGHT <= g_fb_height) {
+        uint64_t fg2 = ((uint64_t)fg << 32) | fg;
+        uint64_t bg2 = ((uint64_t)bg << 32) | bg;
+        unsigned int *dst = g_fb_draw + y * g_fb_stride + x;
+
+        for (unsigned int row = 0; row < FONT_LINE_HEIGHT; row++, dst += g_fb_stride) {
+            pixel_pair_t *d = (pixel_pair_t *)dst;
+            if (row >= FONT_HEIGHT || !bitmap[row]) {
+                d[0] = d[1] = d[2] = d[3] = bg2;
+                continue;
+            }
+            const uint64_t *mask = g_glyph_masks[bitmap[row]];
+            d[0] = (bg2 & ~mask[0]) | (fg2 & mask[0]);
+            d[1] = (bg2 & ~mask[1]) | (fg2 & mask[1]);
+            d[2] = (bg2 & ~mask[2]) | (fg2 & mask[2]);
+            d[3] = (bg2 & ~mask[3]) | (fg2 & mask[3]);
+        }
+        return;
+    }
+
+    for (unsigned int row = 0; row < FONT_LINE_HEIGHT && y + row < g_fb_height; row++) {
+        uint8_t bits = row < FONT_HEIGHT ? bitmap[row] : 0;
+        for (unsigned int col = 0; col < FONT_WIDTH && x + col < g_fb_width; col++)
+            put_pixel(x + col, y + row, bits & (0x80 >> col) ? fg : bg);
+    }
+}
+
+// Copy a cached tile of w x h pixels to the draw target; the caller checked
+// that it fits
+static void copy_tile(unsigned int x, unsigned int y, const uint32_t *tile, unsigned int w, unsigned int h) {
+    unsigned int *dst = g_fb_draw + y * g_fb_stride + x;
+    for (unsigned int row = 0; row < h; row++, dst += g_fb_stride, tile += w) {
+        pixel_pair_t *d = (pixel_pair_t *)dst;
+        const pixel_pair_t *s = (const pixel_pair_t *)tile;
+        unsigned int col = 0;
+        for (; col + 2 <= w; col += 2) *d++ = *s++;
+        if (col < w) dst[col] = tile[col];
+    }
+}
+
+void draw_glyph(unsigned int x, unsigned int y, const font_t *font, unsigned int glyph,
+                unsigned int fg, unsigned int bg) {
+    // Eight-pixel rows are four masked stores, cheaper than a cache lookup
+    if (font == &g_font_builtin) {
+        draw_cell(x, y, (char)glyph, fg, bg);
+        return;
+    }
+
+    if (x + font->width <= g_fb_width && y + font->line_height <= g_fb_height) {
+        const uint32_t *tile = glyph_cache_get(font, glyph, fg, bg);
+        if (tile) {
+            copy_tile(x, y, tile, font->width, font->line_height);
+            return;
+        }
+    }
+
+    // Uncached or clipped: test every bit
+    if (glyph >= font->glyph_count) glyph = font->fallback;
+    const uint8_t *bitmap = font_bitmap(font, glyph);
+    for (unsigned int row = 0; row < font->line_height && y + row < g_fb_height; row++) {
+        const uint8_t *bits = bitmap + row * font->bytes_per_row;
+        for (unsigned int col = 0; col < font->width && x + col < g_fb_width; col++)
+            put_pixel(x + col, y + row, row < font->height && bits[col >> 3] & (0x80 >> (col & 7)) ? fg : bg);
+    }
+}
+
+// Transparent glyph of any width: each bitmap byte is eight pixels of
+// masked pair stores, as in blit_glyph()
+static void blit_font_glyph(unsigned int x, unsigned int y, const font_t *font, unsigned int glyph,
+                            unsigned int color) {
+    if (glyph >= font->glyph_count) glyph = font->fallback;
+    const uint8_t *bitmap = font_bitmap(font, glyph);
+
+    if (x + font->bytes_per_row * 8 <= g_fb_width && y + font->height <= g_fb_height) {
+        uint64_t color2 = ((uint64_t)color << 32) | color;
+        unsigned int *dst = g_fb_draw + y * g_fb_stride + x;
+
+        for (unsigned int row = 0; row < font->height; row++, dst += g_fb_stride, bitmap += font->bytes_per_row) {
+            for (unsigned int b = 0; b < font->bytes_per_row; b++) {
+                if (!bitmap[b]) continue;
+                const uint64_t *mask = g_glyph_masks[bitmap[b]];
+                pixel_pair_t *d = (pixel_pair_t *)(dst + b * 8);
+                d[0] = (d[0] & ~mask[0]) | (color2 & mask[0]);
+                d[1] = (d[1] & ~mask[1]) | (color2 & mask[1]);
+                d[2] = (d[2] & ~mask[2]) | (color2 & mask[2]);
+                d[3] = (d[3] & ~mask[3]) | (color2 & mask[3]);
+            }
+        }
+        return;
+    }
+
+    if (x >= g_fb_width || y >= g_fb_height) return;
+    for (unsigned int row = 0; row < font->height && y + row < g_fb_height; row++, bitmap += font->bytes_per_row)
+        for (unsigned int col = 0; col < font->width && x + col < g_fb_width; col++)
+            if (bitmap[col >> 3] & (0x80 >> (col & 7))) put_pixel(x + col, y + row, color);
+}
+
+void draw_set_font(const font_t *font) {
+    g_draw_font = font ? font : &g_font_builtin;
+}
+
+const font_t *draw_get_font(void) {
+    return g_draw_font;
+}
+
+void draw_char(unsigned int x, unsigned int y, char c, unsigned int color) {
+    blit_glyph(x, y, (unsigned char)c, color);
+    fb_damage(x, y, 8, 8);
+}
+
+// Walk UTF-8 text in the current font, wrapping at '\n' and the right
+// edge; damage is recorded once per drawn line run. `bg` is only used when
+// `opaque` is set.
+static void draw_utf8(unsigned int x, unsigned int y, const char *str, unsigned int fg, unsigned int bg,
+                      int opaque) {
+    const font_t *font = g_draw_font;
+    unsigned int h = opaque ? font->line_height : font->height;
+    unsigned int cx = x;
+
+    while (*str) {
+        uint32_t cp = utf8_next(&str);
+        if (cp == '\n') {
+            fb_damage(x, y, cx - x, h);
+            cx = x;
+            y += font->line_height;
+            continue;
+        }
+
+        unsigned int glyph = font_glyph(font, cp);
+        if (opaque) draw_glyph(cx, y, font, glyph, fg, bg);
+        else if (font == &g_font_builtin) blit_glyph(cx, y, (unsigned char)glyph, fg);
+        else blit_font_glyph(cx, y, font, glyph, fg);
+        cx += font->width;
+        if (cx >= g_fb_width - font->width) {
+            fb_damage(x, y, cx - x, h);
+            cx = x;
+            y += font->line_height;
+        }
+    }
+    fb_damage(x, y, cx - x, h);
+}
+
+void draw_string(unsigned int x, unsigned int y, const char *str, unsigned int color) {
+    draw_utf8(x, y, str, color, 0, 0);
+}
+
+void draw_text(unsigned int x, unsigned int y, const char *str, unsigned int fg, unsigned int bg) {
+    draw_utf8(x, y, str, fg, bg, 1);
+}
@@ -1,5 +1,10 @@
 #include "../include/error.h"
 #include "../include/kernel.h"
+#include "../include/font.h"
+#include "../include/framebuffer.h"
+#include "../include/klog.h"
+#include "../include/ksym.h"
+#include "../include/trace.h"
 
 static cpu_state_t g_panic_state;
 extern framebuffer_info_t g_framebuffer;
@@ -42,7 +47,7 @@ void capture_cpu_state(cpu_state_t *state) {
     );
 }
 
-static void format_hex(char *buf, unsigned long val) {
+void format_hex(char *buf, unsigned long val) {
     int i;
     buf[0] = '0'; buf[1] = 'x';
     for (i = 15; i >= 0; i--) {
@@ -68,9 +73,15 @@ void print_stacktrace(unsigned long rbp, unsigned int max_frames) {
     for (unsigned int i = 0; i < max_frames && frame; i++) {
         if ((unsigned long)frame < 0x1000 || (unsigned long)frame & 0x7) break;
         
-        char buf[32];
+        // The screen may be gone; the serial log gets the same lines
+        char buf[96];
         format_hex(buf, frame->return_addr);
+        buf[18] = ' ';
+        ksym_format(buf + 19, sizeof(buf) - 20, frame->return_addr);
         draw_string(10, y, buf, COLOR_CYAN);
+        size_t len = strlen(buf);
+        buf[len++] = '\n';
+        klog_write_raw(buf, len);
         
         stack_frame_t *next = (stack_frame_t *)frame->frame_pointer;
         if (next == frame) break;
@@ -81,6 +92,8 @@ void print_stacktrace(unsigned long rbp, unsigned int max_frames) {
 }
 
 void display_error_screen(const char *message, cpu_state_t *state) {
+    // The layout below assumes 8x8 glyphs on 10-pixel rows
+    draw_set_font(&g_font_builtin);
     clear_screen(COLOR_BLACK);
     
     draw_string(10, 10, "KERNEL PANIC", COLOR_RED);
@@ -100,20 +113,47 @@ void display_error_screen(const char *message, cpu_state_t *state) {
     format_reg(buf, "RDI", state->rdi); draw_string(410, 100, buf, COLOR_CYAN);
     format_reg(buf, "R8 ", state->r8);  draw_string(410, 110, buf, COLOR_CYAN);
     format_reg(buf, "R9 ", state->r9);  draw_string(410, 120, buf, COLOR_CYAN);
+    format_reg(buf, "RFL", state->rflags); draw_string(410, 130, buf, COLOR_CYAN);
+
+    if (state->vector != CPU_STATE_NO_VECTOR) {
+        format_reg(buf, "VEC", state->vector);     draw_string(10, 150, buf, COLOR_CYAN);
+        format_reg(buf, "ERR", state->error_code); draw_string(210, 150, buf, COLOR_CYAN);
+        format_reg(buf, "CR2", state->cr2);        draw_string(410, 150, buf, COLOR_CYAN);
+    }
     
+    char where[80] = "In: ";
+    ksym_format(where + 4, sizeof(where) - 5, state->rip);
+    draw_string(10, 170, where, COLOR_CYAN);
+    size_t len = strlen(where);
+    where[len++] = '\n';
+    klog_write_raw(where, len);
+
     print_stacktrace(state->rbp, MAX_STACKTRACE_DEPTH);
     draw_string(10, g_framebuffer.framebuffer_height - 20, "System halted", COLOR_RED);
+    fb_flush();
 }
 
 void panic(const char *message) {
     __asm__ volatile ("cli");
     capture_cpu_state(&g_panic_state);
+    g_panic_state.vector = CPU_STATE_NO_VECTOR;
+    // The drain may never run again: push the log out by polling
+    klog_text(KLOG_ERR, message);
+    klog_flush_sync();
+#if CONFIG_TRACE
+    trace_dump();
+#endif
     display_error_screen(message, &g_panic_state);
     while (1) __asm__ volatile ("hlt");
 }
 
 void panic_with_state(const char *message, cpu_state_t *state) {
     __asm__ volatile ("cli");
+    klog_text(KLOG_ERR, message);
+    klog_flush_sync();
+#if CONFIG_TRACE
+    trace_dump();
+#endif
     display_error_screen(message, state);
     while (1) __asm__ volatile ("hlt");
 }
\ No newline at end of file
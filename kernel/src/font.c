@@ -100,3 +100,66 @@ const uint8_t g_font[128][8] = {
     [126] = {0x6E, 0x3B, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
     [127] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}
 };
+
+const font_t g_font_builtin = {
+    .name = "builtin 8x8",
+    .id = 0,
+    .width = FONT_WIDTH,
+    .height = FONT_HEIGHT,
+    .line_height = FONT_LINE_HEIGHT,
+    .bytes_per_row = 1,
+    .bytes_per_glyph = 8,
+    .glyph_count = 128,
+    .glyphs = &g_font[0][0],
+    .fallback = '?',
+};
+
+unsigned int font_glyph(const font_t *font, uint32_t codepoint) {
+    if (!font->map_keys) return codepoint < font->glyph_count ? codepoint : font->fallback;
+
+    for (unsigned int slot = (codepoint * 0x9E3779B1U) & font->map_mask;; slot = (slot + 1) & font->map_mask) {
+        if (font->map_keys[slot] == codepoint + 1) return font->map_glyphs[slot];
+        if (!font->map_keys[slot]) return font->fallback;
+    }
+}
+
+uint32_t utf8_next(const char **str) {
+    const unsigned char *s = (const unsigned char *)*str;
+    uint32_t cp, min;
+    unsigned int extra;
+
+    if (s[0] < 0x80) {
+        if (s[0]) (*str)++;
+        return s[0];
+    }
+    if ((s[0] & 0xE0) == 0xC0) {
+        cp = s[0] & 0x1F;
+        extra = 1;
+        min = 0x80;
+    } else if ((s[0] & 0xF0) == 0xE0) {
+        cp = s[0] & 0x0F;
+        extra = 2;
+        min = 0x800;
+    } else if ((s[0] & 0xF8) == 0xF0) {
+        cp = s[0] & 0x07;
+        extra = 3;
+        min = 0x10000;
+    } else {
+        (*str)++;
+        return UNICODE_REPLACEMENT;
+    }
+
+    for (unsigned int i = 1; i <= extra; i++) {
+        if ((s[i] & 0xC0) != 0x80) {
+            (*str)++;
+            return UNICODE_REPLACEMENT;
+        }
+        cp = cp << 6 | (s[i] & 0x3F);
+    }
+    if (cp < min || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) {
+        (*str)++;
+        return UNICODE_REPLACEMENT;
+    }
+    *str += extra + 1;
+    return cp;
+}
@@ -0,0 +1,193 @@
+#include "../include/fpu.h"
+#include "../include/cpu.h"
+#include "../include/slab.h"
+#include "../include/error.h"
+#include "../include/sched.h"
+
+#define XCR0_X87    (1UL << 0)
+#define XCR0_SSE    (1UL << 1)
+#define XCR0_AVX    (1UL << 2)
+
+typedef struct {
+    unsigned int depth;                 // open sections on this CPU
+    unsigned int pending;               // lazy: section level whose parent's save is deferred
+    uint8_t *area[FPU_MAX_NESTING];     // area[i]: state of level i while level i+1 runs
+    uint8_t saved[FPU_MAX_NESTING];
+    fpu_stats_t stats;
+} fpu_cpu_t;
+
+unsigned int g_cpu_simd;
+
+static fpu_cpu_t g_fpu_cpu[MAX_CPUS];
+static unsigned int g_xsave_size = 512;
+static uint64_t g_xcr0;
+static int g_policy = FPU_POLICY_EAGER;
+
+void fpu_init(void) {
+    uint32_t a, b, c, d, max_leaf;
+    unsigned int simd = 0;
+
+    cpuid(0, 0, &max_leaf, &b, &c, &d);
+    cpuid(1, 0, &a, &b, &c, &d);
+    if (d & (1U << 26)) simd |= SIMD_SSE2;
+    if (c & (1U << 26)) simd |= SIMD_XSAVE;
+    int has_avx = (c & (1U << 28)) != 0;
+
+    if (max_leaf >= 7) {
+        cpuid(7, 0, &a, &b, &c, &d);
+        if (b & (1U << 9)) simd |= SIMD_ERMS;
+        if (has_avx && (b & (1U << 5))) simd |= SIMD_AVX2;
+    }
+
+    write_cr0((read_cr0() & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+    unsigned long cr4 = read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT;
+    if (simd & SIMD_XSAVE) cr4 |= CR4_OSXSAVE;
+    write_cr4(cr4);
+
+    if (simd & SIMD_XSAVE) {
+        g_xcr0 = XCR0_X87 | XCR0_SSE;
+        if (has_avx) {
+            g_xcr0 |= XCR0_AVX;
+            simd |= SIMD_AVX;
+        }
+        xsetbv(0, g_xcr0);
+
+        // EBX reports the area size for the components enabled in XCR0
+        cpuid(0xD, 0, &a, &b, &c, &d);
+        g_xsave_size = b;
+        cpuid(0xD, 1, &a, &b, &c, &d);
+        if (a & 1) simd |= SIMD_XSAVEOPT;
+    } else {
+        simd &= ~SIMD_AVX2;
+    }
+
+    uint32_t mxcsr = 0x1F80;    // all exceptions masked, round to nearest
+    __asm__ volatile("fninit\n\tldmxcsr %0" : : "m"(mxcsr));
+
+    g_cpu_simd = simd;
+}
+
+void fpu_init_state(void) {
+    fpu_cpu_t *cpu = &g_fpu_cpu[this_cpu_id()];
+
+    // One save area per interruptible level; XSAVE needs 64-byte alignment,
+    // which kmalloc guarantees for these sizes
+    for (unsigned int i = 0; i < FPU_MAX_NESTING - 1; i++) {
+        if (cpu->area[i]) continue;
+        cpu->area[i] = kzalloc(g_xsave_size);
+        if (!cpu->area[i]) panic("fpu_init_state: out of memory");
+    }
+}
+
+int fpu_set_policy(int policy) {
+    if (policy != FPU_POLICY_EAGER && policy != FPU_POLICY_LAZY) return -1;
+    g_policy = policy;
+    return 0;
+}
+
+unsigned int fpu_xsave_size(void) {
+    return g_xsave_size;
+}
+
+static void save_state(uint8_t *area) {
+    uint32_t lo = (uint32_t)g_xcr0, hi = (uint32_t)(g_xcr0 >> 32);
+
+    if (g_cpu_simd & SIMD_XSAVEOPT)
+        __asm__ volatile("xsaveopt64 (%0)" : : "r"(area), "a"(lo), "d"(hi) : "memory");
+    else if (g_cpu_simd & SIMD_XSAVE)
+        __asm__ volatile("xsave64 (%0)" : : "r"(area), "a"(lo), "d"(hi) : "memory");
+    else
+        __asm__ volatile("fxsave64 (%0)" : : "r"(area) : "memory");
+}
+
+static void restore_state(uint8_t *area) {
+    uint32_t lo = (uint32_t)g_xcr0, hi = (uint32_t)(g_xcr0 >> 32);
+
+    if (g_cpu_simd & SIMD_XSAVE)
+        __asm__ volatile("xrstor64 (%0)" : : "r"(area), "a"(lo), "d"(hi) : "memory");
+    else
+        __asm__ volatile("fxrstor64 (%0)" : : "r"(area) : "memory");
+}
+
+// Write out the parent state a lazy section has not saved yet
+static void resolve_pending(fpu_cpu_t *cpu) {
+    unsigned int level = cpu->pending;
+
+    __asm__ volatile("clts");
+    save_state(cpu->area[level - 1]);
+    cpu->saved[level - 1] = 1;
+    cpu->pending = 0;
+    cpu->stats.saves++;
+}
+
+void kernel_fpu_begin(void) {
+    // The section's registers live only in this CPU's register file
+    preempt_disable();
+    unsigned long flags = irq_save();
+    fpu_cpu_t *cpu = &g_fpu_cpu[this_cpu_id()];
+    unsigned int level = cpu->depth;
+
+    if (level >= FPU_MAX_NESTING) panic("kernel_fpu_begin: sections nested too deep");
+    cpu->stats.sections++;
+
+    // A lazy parent that never used SIMD still holds its grandparent's state
+    if (cpu->pending) resolve_pending(cpu);
+
+    if (level > 0) {
+        if (!cpu->area[level - 1]) panic("kernel_fpu_begin: nested section before fpu_init_state");
+        if (g_policy == FPU_POLICY_LAZY) {
+            cpu->pending = level;
+            write_cr0(read_cr0() | CR0_TS);
+        } else {
+            save_state(cpu->area[level - 1]);
+            cpu->saved[level - 1] = 1;
+            cpu->stats.saves++;
+        }
+    }
+
+    cpu->depth = level + 1;
+    irq_restore(flags);
+}
+
+void kernel_fpu_end(void) {
+    unsigned long flags = irq_save();
+    fpu_cpu_t *cpu = &g_fpu_cpu[this_cpu_id()];
+
+    if (!cpu->depth) panic("kernel_fpu_end: no open section");
+    unsigned int level = --cpu->depth;
+
+    if (level > 0) {
+        if (cpu->pending == level) {
+            // The section never touched SIMD: the parent's registers are intact
+            cpu->pending = 0;
+            __asm__ volatile("clts");
+        } else if (cpu->saved[level - 1]) {
+            restore_state(cpu->area[level - 1]);
+            cpu->saved[level - 1] = 0;
+            cpu->stats.restores++;
+        }
+    }
+    irq_restore(flags);
+    preempt_enable();
+}
+
+void fpu_handle_nm(void) {
+    fpu_cpu_t *cpu = &g_fpu_cpu[this_cpu_id()];
+
+    if (cpu->pending) {
+        cpu->stats.lazy_traps++;
+        resolve_pending(cpu);
+    } else {
+        __asm__ volatile("clts");
+    }
+}
+
+void fpu_get_stats(fpu_stats_t *stats) {
+    stats->sections = stats->saves = stats->restores = stats->lazy_traps = 0;
+    for (unsigned int i = 0; i < MAX_CPUS; i++) {
+        stats->sections += g_fpu_cpu[i].stats.sections;
+        stats->saves += g_fpu_cpu[i].stats.saves;
+        stats->restores += g_fpu_cpu[i].stats.restores;
+        stats->lazy_traps += g_fpu_cpu[i].stats.lazy_traps;
+    }
+}
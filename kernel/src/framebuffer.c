@@ -0,0 +1,167 @@
+#include "../include/framebuffer.h"
+#include "../include/pmm.h"
+#include "../include/cpu.h"
+#include "../include/tsc.h"
+#include "../include/util.h"
+
+unsigned int *g_fb_draw;
+unsigned int g_fb_stride;
+unsigned int g_fb_width;
+unsigned int g_fb_height;
+
+static framebuffer_info_t g_front;
+static unsigned int *g_back;
+static fb_rect_t g_damage[FB_MAX_DAMAGE];
+static unsigned int g_damage_count;
+static fb_stats_t g_fb_stats;
+
+void fb_init(framebuffer_info_t *framebuffer) {
+    g_front = *framebuffer;
+    g_fb_draw = (unsigned int *)g_front.framebuffer_base;
+    g_fb_stride = g_front.framebuffer_pitch / 4;
+    g_fb_width = g_front.framebuffer_width;
+    g_fb_height = g_front.framebuffer_height;
+}
+
+int fb_enable_backbuffer(void) {
+    uint64_t size = (uint64_t)g_front.framebuffer_height * g_front.framebuffer_pitch;
+    uint64_t phys = pmm_alloc_pages(pmm_order_for_size(size));
+    if (!phys) return -1;
+
+    // Same stride as the screen so rectangles map 1:1 onto scanlines. The one
+    // read back from the framebuffer here is the only one we ever do.
+    g_back = phys_to_virt(phys);
+    memcpy(g_back, (void *)g_front.framebuffer_base, size);
+    g_fb_draw = g_back;
+    return 0;
+}
+
+int fb_has_backbuffer(void) {
+    return g_back != 0;
+}
+
+void fb_set_target(const fb_surface_t *surface) {
+    if (surface) {
+        g_fb_draw = surface->pixels;
+        g_fb_stride = surface->stride;
+        g_fb_width = surface->width;
+        g_fb_height = surface->height;
+    } else {
+        g_fb_draw = g_back ? g_back : (unsigned int *)g_front.framebuffer_base;
+        g_fb_stride = g_front.framebuffer_pitch / 4;
+        g_fb_width = g_front.framebuffer_width;
+        g_fb_height = g_front.framebuffer_height;
+    }
+}
+
+static uint64_t rect_area(const fb_rect_t *r) {
+    return (uint64_t)(r->x1 - r->x0) * (r->y1 - r->y0);
+}
+
+static void rect_union(fb_rect_t *dst, const fb_rect_t *a, const fb_rect_t *b) {
+    dst->x0 = a->x0 < b->x0 ? a->x0 : b->x0;
+    dst->y0 = a->y0 < b->y0 ? a->y0 : b->y0;
+    dst->x1 = a->x1 > b->x1 ? a->x1 : b->x1;
+    dst->y1 = a->y1 > b->y1 ? a->y1 : b->y1;
+}
+
+// Overlapping or edge-adjacent rectangles merge for free
+static int rect_touches(const fb_rect_t *a, const fb_rect_t *b) {
+    return a->x0 <= b->x1 && b->x0 <= a->x1 && a->y0 <= b->y1 && b->y0 <= a->y1;
+}
+
+void fb_damage(unsigned int x, unsigned int y, unsigned int w, unsigned int h) {
+    if (!g_back || g_fb_draw != g_back) return;
+    if (x >= g_front.framebuffer_width || y >= g_front.framebuffer_height || !w || !h) return;
+
+    fb_rect_t r = { x, y, x + w, y + h };
+    if (r.x1 > g_front.framebuffer_width) r.x1 = g_front.framebuffer_width;
+    if (r.y1 > g_front.framebuffer_height) r.y1 = g_front.framebuffer_height;
+
+    // Absorb every rectangle the new one touches; merging can create new
+    // contacts, so rescan until stable
+    unsigned int i = 0;
+    while (i < g_damage_count) {
+        if (rect_touches(&g_damage[i], &r)) {
+            rect_union(&r, &r, &g_damage[i]);
+            g_damage[i] = g_damage[--g_damage_count];
+            i = 0;
+        } else {
+            i++;
+        }
+    }
+
+    if (g_damage_count == FB_MAX_DAMAGE) {
+        // Out of slots: fold into the rectangle that grows the least
+        unsigned int best = 0;
+        uint64_t best_growth = ~0UL;
+        for (i = 0; i < g_damage_count; i++) {
+            fb_rect_t u;
+            rect_union(&u, &g_damage[i], &r);
+            uint64_t growth = rect_area(&u) - rect_area(&g_damage[i]);
+            if (growth < best_growth) {
+                best_growth = growth;
+                best = i;
+            }
+        }
+        rect_union(&r, &r, &g_damage[best]);
+        g_damage[best] = g_damage[--g_damage_count];
+    }
+
+    g_damage[g_damage_count++] = r;
+}
+
+void fb_damage_all(void) {
+    if (!g_back || g_fb_draw != g_back) return;
+    g_damage[0].x0 = 0;
+    g_damage[0].y0 = 0;
+    g_damage[0].x1 = g_front.framebuffer_width;
+    g_damage[0].y1 = g_front.framebuffer_height;
+    g_damage_count = 1;
+}
+
+void fb_flush(void) {
+    if (!g_back || !g_damage_count) return;
+
+    uint64_t start = rdtsc();
+    unsigned int *front = (unsigned int *)g_front.framebuffer_base;
+    unsigned int stride = g_front.framebuffer_pitch / 4;
+
+    for (unsigned int i = 0; i < g_damage_count; i++) {
+        fb_rect_t *r = &g_damage[i];
+        uint64_t offset = (uint64_t)r->y0 * stride + r->x0;
+
+        if (r->x0 == 0 && r->x1 == g_front.framebuffer_width) {
+            // Full-width rectangles are one contiguous span including padding
+            memcpy_nt(front + offset, g_back + offset, (uint64_t)(r->y1 - r->y0) * stride * 4);
+        } else {
+            // Non-temporal stores bypass the cache and fill whole write-combine
+            // buffers instead of reading lines for ownership
+            for (unsigned int y = r->y0; y < r->y1; y++, offset += stride)
+                memcpy_nt(front + offset, g_back + offset, (r->x1 - r->x0) * 4);
+        }
+        g_fb_stats.pixels += rect_area(r);
+    }
+    g_fb_stats.rects += g_damage_count;
+    g_fb_stats.flushes++;
+    g_fb_stats.cycles += rdtsc() - start;
+    g_damage_count = 0;
+}
+
+void fb_get_stats(fb_stats_t *stats) {
+    *stats = g_fb_stats;
+}
+
+uint64_t fb_measure_fill_bandwidth(unsigned int passes) {
+    unsigned int *front = (unsigned int *)g_front.framebuffer_base;
+    uint64_t pixels = (uint64_t)g_front.framebuffer_height * (g_front.framebuffer_pitch / 4);
+
+    uint64_t start = rdtsc();
+    for (unsigned int i = 0; i < passes; i++)
+        memset32(front, i & 1 ? 0x00202020 : 0x00101010, pixels);
+    uint64_t cycles = rdtsc() - start;
+
+    fb_damage_all();
+    fb_flush();
+    return tsc_rate_per_sec(pixels * 4 * passes, cycles) >> 20;
+}
@@ -0,0 +1,76 @@
+#include "../include/gdt.h"
+#include "../include/cpu.h"
+#include "../include/error.h"
+#include "../include/pmm.h"
+#include "../include/slab.h"
+
+#define GDT_ENTRIES 5       // null, code, data, 16-byte TSS descriptor
+
+typedef struct {
+    uint64_t gdt[GDT_ENTRIES];
+    tss_t tss;
+} cpu_gdt_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t limit;
+    uint64_t base;
+} gdt_pointer_t;
+
+static cpu_gdt_t *g_cpu_gdt[MAX_CPUS];
+
+static uint64_t alloc_ist_stack(void) {
+    uint64_t phys = pmm_alloc_pages(IST_STACK_ORDER);
+    if (!phys) panic("gdt_init_cpu: out of memory for IST stacks");
+    return (uint64_t)phys_to_virt(phys) + (PAGE_SIZE << IST_STACK_ORDER);
+}
+
+void gdt_init_cpu(void) {
+    unsigned int cpu = this_cpu_id();
+    cpu_gdt_t *g = kzalloc(sizeof(cpu_gdt_t));
+    if (!g) panic("gdt_init_cpu: out of memory");
+
+    g->gdt[0] = 0;
+    g->gdt[1] = 0x00AF9A000000FFFFUL;      // 64-bit code, DPL 0
+    g->gdt[2] = 0x00CF92000000FFFFUL;      // data, DPL 0
+
+    uint64_t base = (uint64_t)&g->tss;
+    uint64_t limit = sizeof(tss_t) - 1;
+    g->gdt[3] = (limit & 0xFFFF) | ((base & 0xFFFFFF) << 16) | (0x89UL << 40) |
+                (((limit >> 16) & 0xF) << 48) | (((base >> 24) & 0xFF) << 56);
+    g->gdt[4] = base >> 32;
+
+    g->tss.ist[IST_DOUBLE_FAULT - 1] = alloc_ist_stack();
+    g->tss.ist[IST_NMI - 1] = alloc_ist_stack();
+    g->tss.ist[IST_MACHINE_CHECK - 1] = alloc_ist_stack();
+    g->tss.iomap_base = sizeof(tss_t);     // no I/O permission bitmap
+
+    gdt_pointer_t gdtr = { sizeof(g->gdt) - 1, (uint64_t)g->gdt };
+
+    // Loading a null GS selector may clear the GS base holding percpu data
+    uint64_t gs_base = rdmsr(MSR_GS_BASE);
+
+    // CS can only be reloaded through a far return
+    __asm__ volatile(
+        "lgdt %0\n\t"
+        "pushq %1\n\t"
+        "leaq 1f(%%rip), %%rax\n\t"
+        "pushq %%rax\n\t"
+        "lretq\n"
+        "1:\n\t"
+        "movw %w2, %%ds\n\t"
+        "movw %w2, %%es\n\t"
+        "movw %w2, %%ss\n\t"
+        "xorl %%eax, %%eax\n\t"
+        "movw %%ax, %%fs\n\t"
+        "movw %%ax, %%gs\n\t"
+        "ltr %w3"
+        : : "m"(gdtr), "i"(GDT_KERNEL_CODE), "r"(GDT_KERNEL_DATA), "r"(GDT_TSS)
+        : "rax", "memory");
+    wrmsr(MSR_GS_BASE, gs_base);
+
+    g_cpu_gdt[cpu] = g;
+}
+
+tss_t *gdt_cpu_tss(unsigned int cpu) {
+    return g_cpu_gdt[cpu] ? &g_cpu_gdt[cpu]->tss : 0;
+}
@@ -0,0 +1,79 @@
+#include "../include/glyph_cache.h"
+#include "../include/pmm.h"
+
+typedef struct {
+    uint32_t fg;
+    uint32_t bg;
+    uint32_t glyph;
+    uint32_t font;              // font id + 1, 0 for an empty way
+    uint32_t last_use;
+} glyph_tag_t;
+
+static glyph_tag_t g_tags[GLYPH_CACHE_SETS][GLYPH_CACHE_WAYS];
+static uint32_t *g_tiles;
+static uint32_t g_clock;
+static int g_enabled = 1;
+static glyph_cache_stats_t g_stats;
+
+int glyph_cache_init(void) {
+    uint64_t bytes = (uint64_t)GLYPH_CACHE_SETS * GLYPH_CACHE_WAYS * GLYPH_TILE_MAX_PIXELS * 4;
+    uint64_t phys = pmm_alloc_pages(pmm_order_for_size(bytes));
+    if (!phys) return -1;
+    g_tiles = phys_to_virt(phys);
+    return 0;
+}
+
+static inline uint32_t *tile_at(unsigned int set, unsigned int way) {
+    return g_tiles + ((uint64_t)set * GLYPH_CACHE_WAYS + way) * GLYPH_TILE_MAX_PIXELS;
+}
+
+static void rasterize(uint32_t *tile, const font_t *font, unsigned int glyph, uint32_t fg, uint32_t bg) {
+    const uint8_t *bitmap = font_bitmap(font, glyph);
+    for (unsigned int row = 0; row < font->line_height; row++) {
+        const uint8_t *bits = bitmap + row * font->bytes_per_row;
+        for (unsigned int col = 0; col < font->width; col++)
+            *tile++ = row < font->height && bits[col >> 3] & (0x80 >> (col & 7)) ? fg : bg;
+    }
+}
+
+const uint32_t *glyph_cache_get(const font_t *font, unsigned int glyph, uint32_t fg, uint32_t bg) {
+    if (!g_tiles || !g_enabled || font->width * font->line_height > GLYPH_TILE_MAX_PIXELS ||
+        glyph >= font->glyph_count) {
+        g_stats.uncached++;
+        return 0;
+    }
+
+    uint32_t hash = (glyph * 0x9E3779B1U) ^ (fg * 0x85EBCA77U) ^ (bg * 0xC2B2AE3DU) ^ (font->id * 0x27D4EB2FU);
+    unsigned int set = (hash >> 16 ^ hash) & (GLYPH_CACHE_SETS - 1);
+    glyph_tag_t *tags = g_tags[set];
+    unsigned int victim = 0;
+
+    g_clock++;
+    for (unsigned int way = 0; way < GLYPH_CACHE_WAYS; way++) {
+        glyph_tag_t *t = &tags[way];
+        if (t->font == font->id + 1 && t->glyph == glyph && t->fg == fg && t->bg == bg) {
+            t->last_use = g_clock;
+            g_stats.hits++;
+            return tile_at(set, way);
+        }
+        if (!tags[victim].font) continue;
+        if (!t->font || t->last_use < tags[victim].last_use) victim = way;
+    }
+
+    g_stats.misses++;
+    if (tags[victim].font) g_stats.evictions++;
+    tags[victim] = (glyph_tag_t){ fg, bg, glyph, font->id + 1, g_clock };
+    uint32_t *tile = tile_at(set, victim);
+    rasterize(tile, font, glyph, fg, bg);
+    return tile;
+}
+
+int glyph_cache_set_enabled(int enabled) {
+    int previous = g_enabled;
+    g_enabled = enabled;
+    return previous;
+}
+
+void glyph_cache_get_stats(glyph_cache_stats_t *stats) {
+    *stats = g_stats;
+}
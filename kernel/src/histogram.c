@@ -0,0 +1,48 @@
+#include "../include/histogram.h"
+#include "../include/kernel.h"
+#include "../include/util.h"
+
+void hist_reset(histogram_t *h) {
+    memset(h, 0, sizeof(*h));
+}
+
+void hist_add(histogram_t *h, uint64_t value) {
+    unsigned int bucket = value ? 64 - (unsigned int)__builtin_clzl(value) : 0;
+    if (bucket >= HIST_BUCKETS) bucket = HIST_BUCKETS - 1;
+    h->buckets[bucket]++;
+    h->count++;
+    h->sum += value;
+    if (value > h->max) h->max = value;
+}
+
+void hist_merge(histogram_t *dst, const histogram_t *src) {
+    for (unsigned int i = 0; i < HIST_BUCKETS; i++) dst->buckets[i] += src->buckets[i];
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->max > dst->max) dst->max = src->max;
+}
+
+uint64_t hist_percentile(const histogram_t *h, unsigned int pct) {
+    uint64_t target = (h->count * pct + 99) / 100, seen = 0;
+    for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= target) return 1UL << i;
+    }
+    return 1UL << (HIST_BUCKETS - 1);
+}
+
+void hist_print(const histogram_t *h, const char *label, const char *unit) {
+    char line[128];
+    int len = ksnprintf(line, sizeof(line), "  %s (<%s):", label, unit);
+
+    for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+        if (!h->buckets[i]) continue;
+        // Flush before a bucket could be truncated
+        if (len > (int)sizeof(line) - 40) {
+            boot_print(line, COLOR_CYAN);
+            len = ksnprintf(line, sizeof(line), "   ");
+        }
+        len += ksnprintf(line + len, sizeof(line) - len, " %lu:%lu", 1UL << i, h->buckets[i]);
+    }
+    boot_print(line, COLOR_CYAN);
+}
@@ -0,0 +1,58 @@
+#include "../include/hpet.h"
+#include "../include/paging.h"
+
+#define HPET_GCAP_ID        0x000
+#define HPET_GEN_CONF       0x010
+#define HPET_MAIN_COUNTER   0x0F0
+
+#define HPET_CAP_COUNT_64   (1UL << 13)
+#define HPET_CONF_ENABLE    (1UL << 0)
+
+// The specification caps the tick length at 100 ns
+#define HPET_MAX_PERIOD_FS  100000000UL
+
+static volatile uint64_t *g_hpet;
+static uint64_t g_period_fs;
+static uint64_t g_counter_mask;
+
+static inline uint64_t hpet_read(unsigned int reg) {
+    return g_hpet[reg / 8];
+}
+
+static inline void hpet_write(unsigned int reg, uint64_t val) {
+    g_hpet[reg / 8] = val;
+}
+
+int hpet_init(uint64_t base) {
+    if (!base || paging_map_mmio(base, 0x400, PAGE_CACHE_UC) != 0) return -1;
+    g_hpet = (volatile uint64_t *)base;
+
+    // Unclaimed MMIO reads back as all ones
+    uint64_t cap = hpet_read(HPET_GCAP_ID);
+    uint64_t period = cap >> 32;
+    if (!period || period > HPET_MAX_PERIOD_FS) {
+        g_hpet = 0;
+        return -1;
+    }
+    g_period_fs = period;
+    g_counter_mask = (cap & HPET_CAP_COUNT_64) ? ~0UL : 0xFFFFFFFFUL;
+
+    hpet_write(HPET_GEN_CONF, hpet_read(HPET_GEN_CONF) | HPET_CONF_ENABLE);
+    return 0;
+}
+
+int hpet_available(void) {
+    return g_hpet != 0;
+}
+
+uint64_t hpet_counter(void) {
+    return hpet_read(HPET_MAIN_COUNTER) & g_counter_mask;
+}
+
+uint64_t hpet_ticks_since(uint64_t start) {
+    return (hpet_counter() - start) & g_counter_mask;
+}
+
+uint64_t hpet_period_fs(void) {
+    return g_period_fs;
+}
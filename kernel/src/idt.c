@@ -0,0 +1,200 @@
+#include "../include/idt.h"
+#include "../include/gdt.h"
+#include "../include/cpu.h"
+#include "../include/error.h"
+#include "../include/fpu.h"
+#include "../include/sched.h"
+#include "../include/trace.h"
+#include "../include/util.h"
+
+#define GATE_INTERRUPT  0x8E    // present, DPL 0, 64-bit interrupt gate
+
+typedef struct __attribute__((packed)) {
+    uint16_t offset_low;
+    uint16_t selector;
+    uint8_t ist;
+    uint8_t type_attr;
+    uint16_t offset_mid;
+    uint32_t offset_high;
+    uint32_t reserved;
+} idt_entry_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t limit;
+    uint64_t base;
+} idt_pointer_t;
+
+// Entry stub addresses, one per vector (interrupt_stubs.asm)
+extern const uint64_t isr_stub_table[IDT_VECTORS];
+
+static idt_entry_t g_idt[IDT_VECTORS] __attribute__((aligned(16)));
+static interrupt_handler_t g_handlers[IDT_VECTORS];
+static interrupt_stats_t g_interrupt_stats[IDT_VECTORS];
+
+static const char *const g_exception_names[32] = {
+    "Divide error", "Debug", "NMI", "Breakpoint", "Overflow", "BOUND range exceeded",
+    "Invalid opcode", "Device not available", "Double fault", "Coprocessor segment overrun",
+    "Invalid TSS", "Segment not present", "Stack-segment fault", "General protection fault",
+    "Page fault", "Reserved", "x87 floating-point error", "Alignment check", "Machine check",
+    "SIMD floating-point error", "Virtualization exception", "Control protection exception",
+    "Reserved", "Reserved", "Reserved", "Reserved", "Reserved", "Reserved",
+    "Hypervisor injection", "VMM communication", "Security exception", "Reserved",
+};
+
+static void set_gate(unsigned int vector, uint64_t handler, uint8_t ist) {
+    idt_entry_t *e = &g_idt[vector];
+    e->offset_low = handler & 0xFFFF;
+    e->selector = GDT_KERNEL_CODE;
+    e->ist = ist;
+    e->type_attr = GATE_INTERRUPT;
+    e->offset_mid = (handler >> 16) & 0xFFFF;
+    e->offset_high = handler >> 32;
+    e->reserved = 0;
+}
+
+static void handle_nm(interrupt_frame_t *frame) {
+    (void)frame;
+    fpu_handle_nm();
+}
+
+void idt_load_cpu(void) {
+    idt_pointer_t idtr = { sizeof(g_idt) - 1, (uint64_t)g_idt };
+    __asm__ volatile("lidt %0" : : "m"(idtr));
+}
+
+void idt_init(void) {
+    for (unsigned int i = 0; i < IDT_VECTORS; i++)
+        set_gate(i, isr_stub_table[i], 0);
+
+    // Faults that may hit with a broken kernel stack get known-good ones
+    g_idt[EXC_DOUBLE_FAULT].ist = IST_DOUBLE_FAULT;
+    g_idt[EXC_NMI].ist = IST_NMI;
+    g_idt[EXC_MACHINE_CHECK].ist = IST_MACHINE_CHECK;
+
+    interrupt_register(EXC_DEVICE_NOT_AVAIL, handle_nm);
+    idt_load_cpu();
+}
+
+int interrupt_register(unsigned int vector, interrupt_handler_t handler) {
+    if (vector >= IDT_VECTORS) return -1;
+    interrupt_handler_t expected = 0;
+    return __atomic_compare_exchange_n(&g_handlers[vector], &expected, handler, 0,
+                                       __ATOMIC_RELEASE, __ATOMIC_RELAXED) ? 0 : -1;
+}
+
+void interrupt_unregister(unsigned int vector) {
+    if (vector < IDT_VECTORS) __atomic_store_n(&g_handlers[vector], 0, __ATOMIC_RELEASE);
+}
+
+const char *exception_name(unsigned int vector) {
+    return vector < 32 ? g_exception_names[vector] : "Interrupt";
+}
+
+void exception_panic(interrupt_frame_t *frame, uint64_t cr2) {
+    static cpu_state_t state;
+    static char message[96];
+
+    state.rip = frame->rip;
+    state.rsp = frame->rsp;
+    state.rbp = frame->rbp;
+    state.rax = frame->rax;
+    state.rbx = frame->rbx;
+    state.rcx = frame->rcx;
+    state.rdx = frame->rdx;
+    state.rsi = frame->rsi;
+    state.rdi = frame->rdi;
+    state.r8 = frame->r8;
+    state.r9 = frame->r9;
+    state.r10 = frame->r10;
+    state.r11 = frame->r11;
+    state.r12 = frame->r12;
+    state.r13 = frame->r13;
+    state.r14 = frame->r14;
+    state.r15 = frame->r15;
+    state.rflags = frame->rflags;
+    state.error_code = frame->error_code;
+    state.vector = frame->vector;
+    state.cr2 = cr2;
+
+    ksnprintf(message, sizeof(message), "Unhandled exception: %s", exception_name(frame->vector));
+    panic_with_state(message, &state);
+}
+
+void interrupt_dispatch(interrupt_frame_t *frame, uint64_t entry_tsc) {
+    unsigned int vector = frame->vector & (IDT_VECTORS - 1);
+
+    // Read CR2 before anything else can fault and overwrite it
+    uint64_t cr2 = vector == EXC_PAGE_FAULT ? read_cr2() : 0;
+    // trace_record() only masks interrupts, so an NMI landing inside it
+    // would share the slot it claims; NMIs are not traced
+    int traced = vector != EXC_NMI;
+    if (traced) TRACE_BEGIN_AT(TRACE_INTERRUPT, entry_tsc, vector, frame->rip);
+
+    interrupt_stats_t *stats = &g_interrupt_stats[vector];
+    uint64_t latency = rdtsc() - entry_tsc;
+    __atomic_fetch_add(&stats->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->latency_cycles, latency, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&stats->latency_max, __ATOMIC_RELAXED);
+    while (latency > max &&
+           !__atomic_compare_exchange_n(&stats->latency_max, &max, latency, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+
+    // Timer callbacks reach the interrupted context through the CPU block
+    percpu_t *cpu = this_cpu();
+    void *outer = cpu->irq_frame;
+    cpu->irq_frame = frame;
+
+    interrupt_handler_t handler = __atomic_load_n(&g_handlers[vector], __ATOMIC_ACQUIRE);
+    if (handler) {
+        handler(frame);
+    } else if (vector < IRQ_VECTOR_BASE) {
+        exception_panic(frame, cr2);
+    }
+    cpu->irq_frame = outer;
+    // Unclaimed device vectors are only counted
+    if (traced) TRACE_END(TRACE_INTERRUPT, vector, 0);
+
+    // Handlers have sent their EOI; an expired slice switches threads here,
+    // leaving this frame on the preempted thread's stack
+    if (vector >= IRQ_VECTOR_BASE) sched_irq_exit(frame);
+}
+
+void interrupt_get_stats(unsigned int vector, interrupt_stats_t *stats) {
+    if (vector >= IDT_VECTORS) {
+        stats->count = stats->latency_cycles = stats->latency_max = 0;
+        return;
+    }
+    *stats = g_interrupt_stats[vector];
+}
+
+#define SELFTEST_TRAPS 10000
+
+static volatile uint64_t g_selftest_hits;
+
+static void selftest_breakpoint(interrupt_frame_t *frame) {
+    (void)frame;
+    g_selftest_hits++;
+}
+
+void idt_selftest(void) {
+    char line[96];
+    interrupt_stats_t before, after;
+
+    if (interrupt_register(EXC_BREAKPOINT, selftest_breakpoint) != 0) return;
+    interrupt_get_stats(EXC_BREAKPOINT, &before);
+
+    uint64_t start = rdtsc();
+    for (unsigned int i = 0; i < SELFTEST_TRAPS; i++)
+        __asm__ volatile("int3" ::: "memory");
+    uint64_t cycles = rdtsc() - start;
+
+    interrupt_get_stats(EXC_BREAKPOINT, &after);
+    interrupt_unregister(EXC_BREAKPOINT);
+
+    uint64_t count = after.count - before.count;
+    ksnprintf(line, sizeof(line), "IDT: %lu/%u traps, %lu cycles round trip, dispatch %lu avg / %lu max",
+              (uint64_t)g_selftest_hits, SELFTEST_TRAPS, cycles / SELFTEST_TRAPS,
+              count ? (after.latency_cycles - before.latency_cycles) / count : 0, after.latency_max);
+    boot_print(line, count == SELFTEST_TRAPS ? COLOR_CYAN : COLOR_RED);
+}
@@ -0,0 +1,347 @@
+#include "../include/initrd.h"
+#include "../include/cpu.h"
+#include "../include/histogram.h"
+#include "../include/klog.h"
+#include "../include/slab.h"
+#include "../include/util.h"
+
+#define CPIO_HEADER_SIZE    110         // "070701" and 13 fields of 8 hex digits
+#define CPIO_TRAILER        "TRAILER!!!"
+#define TAR_BLOCK           512
+
+#define MODE_TYPE_MASK      0170000
+#define MODE_REGULAR        0100000
+
+#define INDEX_MIN_FILES     16
+
+typedef struct {
+    initrd_file_t *files;
+    unsigned int count;
+    unsigned int capacity;
+    uint32_t *slots;            // file index + 1, 0 if empty; twice capacity
+    uint64_t bytes;
+} file_index_t;
+
+static file_index_t g_index;
+
+// FNV-1a
+static uint64_t path_hash(const char *path) {
+    uint64_t hash = 0xCBF29CE484222325UL;
+    while (*path) {
+        hash ^= (uint8_t)*path++;
+        hash *= 0x100000001B3UL;
+    }
+    return hash;
+}
+
+static int path_equal(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+static const char *skip_root(const char *path) {
+    for (;;) {
+        if (path[0] == '/') path++;
+        else if (path[0] == '.' && path[1] == '/') path += 2;
+        else return path;
+    }
+}
+
+static uint32_t *find_slot(const file_index_t *index, const char *path, uint64_t hash) {
+    unsigned int mask = index->capacity * 2 - 1;
+    for (unsigned int slot = hash & mask;; slot = (slot + 1) & mask) {
+        uint32_t *entry = &index->slots[slot];
+        if (!*entry) return entry;
+        const initrd_file_t *file = &index->files[*entry - 1];
+        if (file->hash == hash && path_equal(file->path, path)) return entry;
+    }
+}
+
+static int index_grow(file_index_t *index) {
+    unsigned int capacity = index->capacity ? index->capacity * 2 : INDEX_MIN_FILES;
+    initrd_file_t *files = kmalloc(capacity * sizeof(*files));
+    uint32_t *slots = kmalloc(capacity * 2 * sizeof(*slots));
+    if (!files || !slots) {
+        kfree(files);
+        kfree(slots);
+        return -1;
+    }
+    memcpy(files, index->files, index->count * sizeof(*files));
+    memset(slots, 0, capacity * 2 * sizeof(*slots));
+    kfree(index->files);
+    kfree(index->slots);
+    index->files = files;
+    index->slots = slots;
+    index->capacity = capacity;
+
+    for (unsigned int i = 0; i < index->count; i++)
+        *find_slot(index, files[i].path, files[i].hash) = i + 1;
+    return 0;
+}
+
+static int index_add(file_index_t *index, const char *path, const void *data, uint64_t size,
+                     uint32_t mode, uint32_t module) {
+    path = skip_root(path);
+    if (!*path) return 0;
+    if (index->count == index->capacity && index_grow(index) != 0) return -1;
+
+    uint64_t hash = path_hash(path);
+    uint32_t *slot = find_slot(index, path, hash);
+    initrd_file_t *file;
+    if (*slot) {
+        // A later copy of the path replaces the earlier one
+        file = &index->files[*slot - 1];
+        index->bytes -= file->size;
+    } else {
+        file = &index->files[index->count++];
+        *slot = index->count;
+    }
+    file->path = path;
+    file->data = data;
+    file->size = size;
+    file->hash = hash;
+    file->mode = mode;
+    file->module = module;
+    index->bytes += size;
+    return 0;
+}
+
+static const initrd_file_t *index_find(const file_index_t *index, const char *path) {
+    if (!index->count) return 0;
+    path = skip_root(path);
+    uint32_t slot = *find_slot(index, path, path_hash(path));
+    return slot ? &index->files[slot - 1] : 0;
+}
+
+static void index_free(file_index_t *index) {
+    kfree(index->files);
+    kfree(index->slots);
+    memset(index, 0, sizeof(*index));
+}
+
+static uint64_t align_up(uint64_t value, uint64_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+// Fixed-width hex field of a cpio header; ~0 if it is not all hex digits
+static uint64_t parse_hex(const char *s) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        char c = s[i];
+        unsigned int digit;
+        if (c >= '0' && c <= '9') digit = c - '0';
+        else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+        else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+        else return ~0UL;
+        value = value << 4 | digit;
+    }
+    return value;
+}
+
+// Octal tar field, ended by NUL or space
+static uint64_t parse_octal(const char *s, size_t len) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < len && s[i] >= '0' && s[i] <= '7'; i++)
+        value = value << 3 | (uint64_t)(s[i] - '0');
+    return value;
+}
+
+static int is_cpio(const uint8_t *base, uint64_t size) {
+    return size >= CPIO_HEADER_SIZE &&
+           (!memcmp(base, "070701", 6) || !memcmp(base, "070702", 6));
+}
+
+static int is_tar(const uint8_t *base, uint64_t size) {
+    return size >= TAR_BLOCK && !memcmp(base + 257, "ustar", 5);
+}
+
+static int add_cpio(file_index_t *index, const uint8_t *base, uint64_t size, uint32_t module) {
+    uint64_t off = 0;
+    while (size - off >= CPIO_HEADER_SIZE) {
+        const char *header = (const char *)base + off;
+        if (memcmp(header, "070701", 6) && memcmp(header, "070702", 6)) return -1;
+
+        uint64_t mode = parse_hex(header + 14);
+        uint64_t file_size = parse_hex(header + 54);
+        uint64_t name_size = parse_hex(header + 94);
+        if (mode == ~0UL || file_size == ~0UL || name_size == ~0UL || !name_size) return -1;
+
+        uint64_t name_off = off + CPIO_HEADER_SIZE;
+        if (name_size > size - name_off) return -1;
+        const char *name = (const char *)base + name_off;
+        if (name[name_size - 1]) return -1;
+
+        uint64_t data_off = align_up(name_off + name_size, 4);
+        if (data_off > size || file_size > size - data_off) return -1;
+        if (path_equal(name, CPIO_TRAILER)) return 0;
+
+        if ((mode & MODE_TYPE_MASK) == MODE_REGULAR &&
+            index_add(index, name, base + data_off, file_size, mode, module) != 0)
+            return -1;
+        off = align_up(data_off + file_size, 4);
+        if (off > size) return -1;
+    }
+    // No trailer
+    return -1;
+}
+
+// ustar splits long paths into prefix and name, neither NUL-terminated when
+// full; those are joined into a copy, the rest point into the header
+static const char *tar_path(const char *header) {
+    const char *name = header, *prefix = header + 345;
+    size_t name_len = 0, prefix_len = 0;
+    while (name_len < 100 && name[name_len]) name_len++;
+    while (prefix_len < 155 && prefix[prefix_len]) prefix_len++;
+    if (!prefix_len && name_len < 100) return name;
+
+    char *path = kmalloc(prefix_len + name_len + 2);
+    if (!path) return 0;
+    size_t len = 0;
+    if (prefix_len) {
+        memcpy(path, prefix, prefix_len);
+        path[prefix_len] = '/';
+        len = prefix_len + 1;
+    }
+    memcpy(path + len, name, name_len);
+    path[len + name_len] = 0;
+    return path;
+}
+
+static int add_tar(file_index_t *index, const uint8_t *base, uint64_t size, uint32_t module) {
+    uint64_t off = 0;
+    while (size - off >= TAR_BLOCK) {
+        const char *header = (const char *)base + off;
+        // A zero block ends the archive
+        if (!header[0]) return 0;
+        if (memcmp(header + 257, "ustar", 5)) return -1;
+
+        uint64_t file_size = parse_octal(header + 124, 12);
+        uint64_t data_off = off + TAR_BLOCK;
+        if (file_size > size - data_off) return -1;
+
+        char type = header[156];
+        if (type == '0' || type == 0) {
+            const char *path = tar_path(header);
+            if (!path) return -1;
+            uint32_t mode = MODE_REGULAR | (uint32_t)parse_octal(header + 100, 8);
+            if (index_add(index, path, base + data_off, file_size, mode, module) != 0) return -1;
+        }
+        off = data_off + align_up(file_size, TAR_BLOCK);
+        if (off > size) return -1;
+    }
+    return 0;
+}
+
+void initrd_init(const kernel_params_t *params) {
+    for (unsigned int i = 0; i < params->module_count && i < BOOT_MODULE_MAX; i++) {
+        const boot_module_t *module = &params->modules[i];
+        const uint8_t *base = (const uint8_t *)module->base;
+        int ret;
+
+        if (is_cpio(base, module->size)) {
+            ret = add_cpio(&g_index, base, module->size, i);
+        } else if (is_tar(base, module->size)) {
+            ret = add_tar(&g_index, base, module->size, i);
+        } else {
+            ret = index_add(&g_index, module->name, base, module->size, 0, i);
+        }
+        if (ret != 0)
+            klog_warn("initrd: %s is truncated or malformed, indexed up to the bad entry", module->name);
+    }
+}
+
+const initrd_file_t *initrd_lookup(const char *path) {
+    return index_find(&g_index, path);
+}
+
+const initrd_file_t *initrd_file(unsigned int index) {
+    return index < g_index.count ? &g_index.files[index] : 0;
+}
+
+unsigned int initrd_count(void) {
+    return g_index.count;
+}
+
+uint64_t initrd_bytes(void) {
+    return g_index.bytes;
+}
+
+#define SELFTEST_ARCHIVE_SIZE   4096
+#define SELFTEST_BLOB_SIZE      1000
+#define SELFTEST_LOOKUPS        4096
+
+static uint64_t put_cpio(uint8_t *buf, uint64_t off, const char *name, uint32_t mode,
+                         const void *data, uint32_t size) {
+    uint32_t name_size = strlen(name) + 1;
+    ksnprintf((char *)buf + off, CPIO_HEADER_SIZE + 1,
+              "070701%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X",
+              0, mode, 0, 0, 1, 0, size, 0, 0, 0, 0, name_size, 0);
+    off += CPIO_HEADER_SIZE;
+    memcpy(buf + off, name, name_size);
+    off = align_up(off + name_size, 4);
+    memcpy(buf + off, data, size);
+    return align_up(off + size, 4);
+}
+
+// Index a small cpio archive built in memory and time lookups in it
+void initrd_selftest(void) {
+    char line[128];
+    static const char motd_old[] = "old motd\n", motd[] = "hello from the initrd\n";
+    uint8_t *archive = kmalloc(SELFTEST_ARCHIVE_SIZE);
+    uint8_t *blob = kmalloc(SELFTEST_BLOB_SIZE);
+    if (!archive || !blob) {
+        kfree(archive);
+        kfree(blob);
+        boot_print("initrd: selftest out of memory", COLOR_RED);
+        return;
+    }
+    memset(archive, 0, SELFTEST_ARCHIVE_SIZE);
+    for (unsigned int i = 0; i < SELFTEST_BLOB_SIZE; i++) blob[i] = (uint8_t)(i * 7);
+
+    uint64_t off = 0;
+    off = put_cpio(archive, off, ".", 0040755, 0, 0);
+    off = put_cpio(archive, off, "etc", 0040755, 0, 0);
+    off = put_cpio(archive, off, "./etc/motd", MODE_REGULAR | 0644, motd_old, sizeof(motd_old) - 1);
+    off = put_cpio(archive, off, "data/blob", MODE_REGULAR | 0644, blob, SELFTEST_BLOB_SIZE);
+    uint64_t motd_off = off;
+    off = put_cpio(archive, off, "etc/motd", MODE_REGULAR | 0600, motd, sizeof(motd) - 1);
+    off = put_cpio(archive, off, CPIO_TRAILER, 0, 0, 0);
+
+    file_index_t index = { 0 };
+    int ok = add_cpio(&index, archive, off, 0) == 0 && index.count == 2;
+
+    const initrd_file_t *file = index_find(&index, "/etc/motd");
+    ok = ok && file && file->size == sizeof(motd) - 1 && (file->mode & 0777) == 0600 &&
+         (const uint8_t *)file->data > archive + motd_off && (const uint8_t *)file->data < archive + off &&
+         !memcmp(file->data, motd, sizeof(motd) - 1);
+    file = index_find(&index, "./data/blob");
+    ok = ok && file && file->size == SELFTEST_BLOB_SIZE && !memcmp(file->data, blob, SELFTEST_BLOB_SIZE);
+    ok = ok && !index_find(&index, "etc") && !index_find(&index, "data/blob2") &&
+         index.bytes == SELFTEST_BLOB_SIZE + sizeof(motd) - 1;
+
+    // Truncating the archive must not index past the end
+    file_index_t cut = { 0 };
+    ok = ok && add_cpio(&cut, archive, motd_off + CPIO_HEADER_SIZE, 0) != 0 && cut.count == 2;
+    index_free(&cut);
+
+    static const char *const paths[] = { "etc/motd", "/data/blob", "etc/missing" };
+    histogram_t cost;
+    hist_reset(&cost);
+    for (unsigned int i = 0; i < SELFTEST_LOOKUPS; i++) {
+        uint64_t t0 = rdtsc();
+        file = index_find(&index, paths[i % 3]);
+        hist_add(&cost, rdtsc() - t0);
+        __asm__ volatile("" : : "r"(file));
+    }
+
+    ksnprintf(line, sizeof(line), "initrd: selftest %s, lookup mean %lu cycles (p99 <%lu)",
+              ok ? "ok" : "FAILED", hist_mean(&cost), hist_percentile(&cost, 99));
+    boot_print(line, ok ? COLOR_CYAN : COLOR_RED);
+
+    index_free(&index);
+    kfree(blob);
+    kfree(archive);
+}
@@ -0,0 +1,199 @@
+#include "../include/input.h"
+#include "../include/console.h"
+#include "../include/cpu.h"
+#include "../include/kernel.h"
+#include "../include/sched.h"
+#include "../include/slab.h"
+#include "../include/tsc.h"
+#include "../include/util.h"
+
+#define INPUT_BATCH             32          // events per console flush
+#define INPUT_WHEEL_LINES       3
+
+static input_queue_t g_queues[INPUT_SOURCES];
+static unsigned int g_pending;              // events queued since the consumer last looked
+static unsigned int g_consumer_cpu;
+static input_sink_t g_sink;
+static input_stats_t g_stats;               // consumer side only
+
+int input_queue_push(input_queue_t *q, const input_event_t *ev) {
+    uint32_t head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    uint32_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+    if (head - tail >= INPUT_QUEUE_SIZE) {
+        q->dropped++;
+        return -1;
+    }
+    q->events[head & (INPUT_QUEUE_SIZE - 1)] = *ev;
+    // Publishes the event; pairs with the consumer's acquire of head
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int input_queue_pop(input_queue_t *q, input_event_t *ev) {
+    uint32_t tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    if (tail == __atomic_load_n(&q->head, __ATOMIC_ACQUIRE)) return -1;
+    *ev = q->events[tail & (INPUT_QUEUE_SIZE - 1)];
+    // The slot may be reused once tail has moved past it
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void input_post(unsigned int source, const input_event_t *ev) {
+    if (input_queue_push(&g_queues[source], ev) != 0) return;
+    __atomic_fetch_add(&g_pending, 1, __ATOMIC_RELEASE);
+    // An interrupt on the consumer's own CPU already ends its HLT or MWAIT
+    unsigned int consumer = __atomic_load_n(&g_consumer_cpu, __ATOMIC_RELAXED);
+    if (this_cpu_id() != consumer) sched_kick(consumer);
+}
+
+// Typed characters are echoed, PgUp/PgDn and the wheel scroll the history
+// and F12 prints the latency statistics
+static void console_sink(const input_event_t *ev) {
+    if (ev->type == INPUT_EV_MOUSE) {
+        if (ev->wheel) console_scroll_view(&g_console, -ev->wheel * INPUT_WHEEL_LINES);
+        return;
+    }
+    if (ev->flags & INPUT_KEY_RELEASED) return;
+
+    switch (ev->key) {
+    case KEY_PGUP:
+        console_scroll_view(&g_console, (int)g_console.rows / 2);
+        return;
+    case KEY_PGDN:
+        console_scroll_view(&g_console, -(int)g_console.rows / 2);
+        return;
+    case KEY_F12:
+        input_report();
+        return;
+    }
+
+    char c = (char)ev->ascii;
+    if (c == '\b') {
+        console_puts("\b \b");
+    } else if (c == '\n' || c == '\t' || (c >= 0x20 && c < 0x7F)) {
+        char str[2] = { c, 0 };
+        console_puts(str);
+    }
+}
+
+void input_set_sink(input_sink_t sink) {
+    g_sink = sink ? sink : console_sink;
+}
+
+// Pop up to `max` events, alternating between the sources
+static unsigned int pop_batch(input_event_t *events, unsigned int max) {
+    unsigned int count = 0;
+    int progress = 1;
+    while (progress && count < max) {
+        progress = 0;
+        for (unsigned int s = 0; s < INPUT_SOURCES && count < max; s++)
+            if (input_queue_pop(&g_queues[s], &events[count]) == 0) {
+                count++;
+                progress = 1;
+            }
+    }
+    return count;
+}
+
+void input_run(void) {
+    input_event_t events[INPUT_BATCH];
+
+    if (!g_sink) g_sink = console_sink;
+    __atomic_store_n(&g_consumer_cpu, this_cpu_id(), __ATOMIC_RELEASE);
+
+    while (1) {
+        // Runs this CPU's threads or sleeps until an IRQ posts. The count
+        // is cleared before the rings are read, so that an event posted
+        // after they were found empty sets it again; being reset every
+        // round, it never wraps.
+        sched_wait_for(&g_pending, 1);
+        __atomic_exchange_n(&g_pending, 0, __ATOMIC_SEQ_CST);
+        g_stats.wakeups++;
+
+        unsigned int count;
+        while ((count = pop_batch(events, INPUT_BATCH)) != 0) {
+            uint64_t now = rdtsc();
+            for (unsigned int i = 0; i < count; i++) hist_add(&g_stats.queue_cycles, now - events[i].tsc);
+            for (unsigned int i = 0; i < count; i++) g_sink(&events[i]);
+            // One render for the whole batch; it also flushes whatever a
+            // non-console sink drew into the back buffer
+            console_flush();
+            now = rdtsc();
+            for (unsigned int i = 0; i < count; i++) hist_add(&g_stats.display_cycles, now - events[i].tsc);
+            g_stats.consumed += count;
+        }
+    }
+}
+
+void input_get_stats(input_stats_t *stats) {
+    *stats = g_stats;
+    for (unsigned int s = 0; s < INPUT_SOURCES; s++) {
+        stats->posted[s] = __atomic_load_n(&g_queues[s].head, __ATOMIC_ACQUIRE);
+        stats->dropped[s] = g_queues[s].dropped;
+    }
+}
+
+void input_report(void) {
+    char line[160];
+    input_stats_t stats;
+
+    input_get_stats(&stats);
+    ksnprintf(line, sizeof(line),
+              "Input: %lu key, %lu mouse events, %lu dropped, %lu wakeups; IRQ to dequeue p50 %lu p99 %lu ns, "
+              "to screen p50 %lu p99 %lu us",
+              stats.posted[INPUT_SOURCE_KEYBOARD], stats.posted[INPUT_SOURCE_MOUSE],
+              stats.dropped[INPUT_SOURCE_KEYBOARD] + stats.dropped[INPUT_SOURCE_MOUSE], stats.wakeups,
+              tsc_cycles_to_ns(hist_percentile(&stats.queue_cycles, 50)),
+              tsc_cycles_to_ns(hist_percentile(&stats.queue_cycles, 99)),
+              tsc_cycles_to_ns(hist_percentile(&stats.display_cycles, 50)) / 1000,
+              tsc_cycles_to_ns(hist_percentile(&stats.display_cycles, 99)) / 1000);
+    boot_print(line, COLOR_CYAN);
+}
+
+#define SELFTEST_ROUNDS         100000
+
+void input_selftest(void) {
+    char line[128];
+    input_event_t ev;
+    const char *failed = 0;
+
+    input_queue_t *q = kzalloc(sizeof(input_queue_t));
+    if (!q) {
+        boot_print("Input: out of memory, selftest skipped", COLOR_YELLOW);
+        return;
+    }
+
+    // Fill, overflow by one, then drain in order; twice, starting just
+    // below the 32-bit wrap of the indices the second time
+    for (int pass = 0; pass < 2 && !failed; pass++) {
+        uint32_t start = pass ? 0xFFFFFFFFU - INPUT_QUEUE_SIZE / 2 : 0;
+        q->head = q->tail = start;
+        q->dropped = 0;
+        memset(&ev, 0, sizeof(ev));
+        for (unsigned int i = 0; i < INPUT_QUEUE_SIZE; i++) {
+            ev.tsc = i;
+            if (input_queue_push(q, &ev) != 0) failed = "push into free slot";
+        }
+        if (input_queue_push(q, &ev) == 0 || q->dropped != 1) failed = "push into full queue";
+        for (unsigned int i = 0; i < INPUT_QUEUE_SIZE && !failed; i++)
+            if (input_queue_pop(q, &ev) != 0 || ev.tsc != i) failed = "FIFO order";
+        if (!failed && input_queue_pop(q, &ev) == 0) failed = "pop from empty queue";
+    }
+
+    // Uncontended cost of one event through the ring
+    q->head = q->tail = 0;
+    uint64_t start = rdtsc();
+    for (unsigned int i = 0; i < SELFTEST_ROUNDS; i++) {
+        ev.tsc = i;
+        input_queue_push(q, &ev);
+        input_queue_pop(q, &ev);
+    }
+    uint64_t cycles = rdtsc() - start;
+    kfree(q);
+
+    if (failed)
+        ksnprintf(line, sizeof(line), "Input: queue selftest FAILED (%s)", failed);
+    else
+        ksnprintf(line, sizeof(line), "Input: queue selftest ok, push+pop %lu cycles", cycles / SELFTEST_ROUNDS);
+    boot_print(line, failed ? COLOR_RED : COLOR_CYAN);
+}
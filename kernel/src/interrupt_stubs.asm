@@ -0,0 +1,83 @@
+BITS 64
+GLOBAL isr_stub_table
+EXTERN interrupt_dispatch
+
+; Vectors for which the CPU pushes an error code
+%define HAS_ERROR_CODE(n) ((n) == 8 || ((n) >= 10 && (n) <= 14) || (n) == 17 || (n) == 21 || (n) == 29 || (n) == 30)
+
+SECTION .text
+
+; One stub per vector: even out the frame with a dummy error code where the
+; CPU pushed none, record the vector and join the common path
+%assign vec 0
+%rep 256
+ALIGN 16
+isr_stub_ %+ vec:
+%if !HAS_ERROR_CODE(vec)
+    PUSH    QWORD 0
+%endif
+    PUSH    QWORD vec
+    JMP     isr_common
+%assign vec vec + 1
+%endrep
+
+; Stack on entry: vector, error code, then the CPU frame (RIP, CS, RFLAGS,
+; RSP, SS). The pushes below complete an interrupt_frame_t.
+isr_common:
+    PUSH    R15
+    PUSH    R14
+    PUSH    R13
+    PUSH    R12
+    PUSH    R11
+    PUSH    R10
+    PUSH    R9
+    PUSH    R8
+    PUSH    RBP
+    PUSH    RDI
+    PUSH    RSI
+    PUSH    RDX
+    PUSH    RCX
+    PUSH    RBX
+    PUSH    RAX
+
+    ; Entry timestamp for the dispatch latency counters
+    RDTSC
+    SHL     RDX, 32
+    OR      RAX, RDX
+
+    CLD
+    MOV     RDI, RSP
+    MOV     RSI, RAX
+    MOV     RBX, RSP
+    AND     RSP, -16
+    CALL    interrupt_dispatch
+    MOV     RSP, RBX
+
+    POP     RAX
+    POP     RBX
+    POP     RCX
+    POP     RDX
+    POP     RSI
+    POP     RDI
+    POP     RBP
+    POP     R8
+    POP     R9
+    POP     R10
+    POP     R11
+    POP     R12
+    POP     R13
+    POP     R14
+    POP     R15
+
+    ; Drop vector and error code
+    ADD     RSP, 16
+    IRETQ
+
+SECTION .rodata
+ALIGN 8
+isr_stub_table:
+%assign vec 0
+%rep 256
+    DQ      isr_stub_ %+ vec
+%assign vec vec + 1
+%endrep
@@ -0,0 +1,105 @@
+#include "../include/ioapic.h"
+#include "../include/acpi.h"
+#include "../include/pmm.h"
+#include "../include/spinlock.h"
+
+// MMIO offsets in bytes
+#define IOAPIC_REGSEL       0x00
+#define IOAPIC_WINDOW       0x10
+
+#define IOAPIC_REG_VERSION  0x01
+#define IOAPIC_REG_REDIR    0x10    // two registers per pin
+
+#define REDIR_ACTIVE_LOW    (1U << 13)
+#define REDIR_LEVEL         (1U << 15)
+#define REDIR_MASKED        (1U << 16)
+
+typedef struct {
+    volatile uint32_t *regs;
+    uint32_t gsi_base;
+    unsigned int pins;
+} ioapic_t;
+
+static ioapic_t g_ioapics[ACPI_MAX_IOAPICS];
+static unsigned int g_ioapic_count;
+static spinlock_t g_ioapic_lock = SPINLOCK_INIT;
+
+static uint32_t ioapic_read(ioapic_t *io, unsigned int reg) {
+    io->regs[IOAPIC_REGSEL / 4] = reg;
+    return io->regs[IOAPIC_WINDOW / 4];
+}
+
+static void ioapic_write(ioapic_t *io, unsigned int reg, uint32_t val) {
+    io->regs[IOAPIC_REGSEL / 4] = reg;
+    io->regs[IOAPIC_WINDOW / 4] = val;
+}
+
+static ioapic_t *find_ioapic(uint32_t gsi, unsigned int *pin) {
+    for (unsigned int i = 0; i < g_ioapic_count; i++) {
+        ioapic_t *io = &g_ioapics[i];
+        if (gsi >= io->gsi_base && gsi < io->gsi_base + io->pins) {
+            *pin = gsi - io->gsi_base;
+            return io;
+        }
+    }
+    return 0;
+}
+
+int ioapic_init(void) {
+    const acpi_info_t *acpi = acpi_get_info();
+    if (!acpi || !acpi->ioapic_count) return -1;
+
+    for (unsigned int i = 0; i < acpi->ioapic_count; i++) {
+        ioapic_t *io = &g_ioapics[g_ioapic_count++];
+        io->regs = phys_to_virt(acpi->ioapics[i].address);
+        io->gsi_base = acpi->ioapics[i].gsi_base;
+        io->pins = ((ioapic_read(io, IOAPIC_REG_VERSION) >> 16) & 0xFF) + 1;
+
+        for (unsigned int pin = 0; pin < io->pins; pin++) {
+            ioapic_write(io, IOAPIC_REG_REDIR + pin * 2, REDIR_MASKED);
+            ioapic_write(io, IOAPIC_REG_REDIR + pin * 2 + 1, 0);
+        }
+    }
+    return 0;
+}
+
+int ioapic_available(void) {
+    return g_ioapic_count != 0;
+}
+
+int ioapic_route_gsi(uint32_t gsi, unsigned int vector, uint32_t dest_apic_id, uint32_t flags) {
+    unsigned int pin;
+    ioapic_t *io = find_ioapic(gsi, &pin);
+    if (!io) return -1;
+
+    // Fixed delivery, physical destination; xAPIC-style 8-bit destination
+    // because the kernel does not set up interrupt remapping
+    uint32_t low = vector & 0xFF;
+    if (flags & ACPI_IRQ_ACTIVE_LOW) low |= REDIR_ACTIVE_LOW;
+    if (flags & ACPI_IRQ_LEVEL) low |= REDIR_LEVEL;
+
+    unsigned long irq = spin_lock_irqsave(&g_ioapic_lock);
+    ioapic_write(io, IOAPIC_REG_REDIR + pin * 2, REDIR_MASKED);
+    ioapic_write(io, IOAPIC_REG_REDIR + pin * 2 + 1, (dest_apic_id & 0xFF) << 24);
+    ioapic_write(io, IOAPIC_REG_REDIR + pin * 2, low);
+    spin_unlock_irqrestore(&g_ioapic_lock, irq);
+    return 0;
+}
+
+int ioapic_route_isa(unsigned int irq, uint32_t dest_apic_id) {
+    const acpi_info_t *acpi = acpi_get_info();
+    if (!acpi || irq >= ACPI_ISA_IRQS) return -1;
+    return ioapic_route_gsi(acpi->isa_irqs[irq].gsi, IRQ_ISA_VECTOR(irq), dest_apic_id,
+                            acpi->isa_irqs[irq].flags);
+}
+
+void ioapic_mask_gsi(uint32_t gsi, int masked) {
+    unsigned int pin;
+    ioapic_t *io = find_ioapic(gsi, &pin);
+    if (!io) return;
+
+    unsigned long irq = spin_lock_irqsave(&g_ioapic_lock);
+    uint32_t low = ioapic_read(io, IOAPIC_REG_REDIR + pin * 2);
+    ioapic_write(io, IOAPIC_REG_REDIR + pin * 2, masked ? low | REDIR_MASKED : low & ~REDIR_MASKED);
+    spin_unlock_irqrestore(&g_ioapic_lock, irq);
+}
@@ -3,12 +3,29 @@ BITS 64
 GLOBAL _start
 EXTERN kernel_main
 
-SECTION .text
+KERNEL_STACK_SIZE EQU 16384
+
+SECTION .text.entry
 _start:
     ; RDI already contains our &kernel_params from the loader’s call
+    MOV     R12, RDI
+
+    ; The loader has already zeroed .bss, this stack included
+
+    ; Leave the firmware stack so its boot services pages can be reclaimed
+    MOV     RSP, kernel_stack_top
+    XOR     EBP, EBP
+
+    MOV     RDI, R12
     CALL    kernel_main
 
 .halt:
     CLI
     HLT
     JMP     .halt
+
+SECTION .bss
+ALIGNB 16
+kernel_stack:
+    RESB    KERNEL_STACK_SIZE
+kernel_stack_top:
@@ -0,0 +1,449 @@
+#include "../include/klog.h"
+#include "../include/apic.h"
+#include "../include/cpu.h"
+#include "../include/histogram.h"
+#include "../include/idt.h"
+#include "../include/ioapic.h"
+#include "../include/kernel.h"
+#include "../include/pmm.h"
+#include "../include/slab.h"
+#include "../include/timer.h"
+#include "../include/tsc.h"
+
+#define RING_SLOTS      ((PAGE_SIZE << KLOG_RING_ORDER) / sizeof(klog_record_t))
+#define RING_MASK       (RING_SLOTS - 1)
+
+#define COM1            0x3F8
+#define UART_DATA       0
+#define UART_IER        1
+#define UART_IIR        2           // FCR on write
+#define UART_LCR        3
+#define UART_MCR        4
+#define UART_LSR        5
+#define UART_SCRATCH    7
+#define UART_IER_THRE   0x02
+#define UART_LSR_THRE   0x20        // transmit FIFO empty
+#define UART_FIFO_SIZE  16
+
+#define DEBUGCON_PORT   0xE9
+
+#define LINE_MAX        160
+#define TX_SIZE         2048        // formatted bytes waiting for the UART
+#define DRAIN_BATCH     32          // records per drain pass, bounds IRQ-off time
+#define POLL_NS         1000000     // re-drain period without a UART interrupt
+
+typedef struct {
+    uint64_t tsc;
+    const char *fmt;                // NULL for text records
+    uint8_t level;
+    uint8_t count;                  // arguments, or text bytes
+    uint8_t more;                   // text continues in the next record
+    uint8_t pad[5];
+    union {
+        uint64_t args[KLOG_MAX_ARGS];
+        char text[KLOG_TEXT_MAX];
+    };
+} klog_record_t;
+
+_Static_assert(sizeof(klog_record_t) == 64, "one record per cache line");
+
+// Producer and consumer indices sit on separate cache lines; both are
+// free-running and wrap through RING_MASK
+typedef struct {
+    volatile uint32_t head __attribute__((aligned(64)));
+    uint64_t records;
+    uint64_t dropped;
+    klog_record_t *slots;
+    volatile uint32_t tail __attribute__((aligned(64)));
+} klog_ring_t;
+
+static klog_ring_t *g_rings[MAX_CPUS];
+static uint64_t g_early_dropped;
+
+// Drain state, owned by the BSP
+static int g_started;
+static int g_uart_present;
+static int g_uart_irq;
+static uint32_t g_drain_apic_id;
+static volatile int g_drain_active;     // a drain is running or will run
+static timer_event_t g_poll_event;
+static char *g_tx;
+static unsigned int g_tx_head, g_tx_tail;
+static klog_stats_t g_stats;
+
+void klog_init_cpu(void) {
+    klog_ring_t *r = kzalloc(sizeof(klog_ring_t));
+    uint64_t slots = pmm_alloc_pages(KLOG_RING_ORDER);
+    if (!r || !slots) return;       // this CPU's records are dropped
+
+    r->slots = phys_to_virt(slots);
+    __atomic_store_n(&g_rings[this_cpu_id()], r, __ATOMIC_RELEASE);
+}
+
+void klog_init(void) {
+    klog_init_cpu();
+}
+
+static void kick_drain(void) {
+    // Pairs with the drain's seq_cst clear of the flag before its last
+    // look at the rings: publish the record before trusting the flag
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&g_drain_active, __ATOMIC_RELAXED)) return;
+    if (__atomic_exchange_n(&g_drain_active, 1, __ATOMIC_ACQ_REL)) return;
+
+    // Before klog_start() the flag just stays set; the first drain picks up
+    if (!__atomic_load_n(&g_started, __ATOMIC_ACQUIRE)) return;
+    __atomic_fetch_add(&g_stats.kicks, 1, __ATOMIC_RELAXED);
+    apic_send_ipi(g_drain_apic_id, KLOG_IPI_VECTOR);
+}
+
+// Reserve `n` consecutive records on this CPU's ring; interrupts disabled.
+// Returns the head index or -1 if the ring is full.
+static int64_t reserve(klog_ring_t *r, unsigned int n) {
+    uint32_t head = r->head;
+    if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) + n > RING_SLOTS) {
+        r->dropped += n;
+        return -1;
+    }
+    return head;
+}
+
+static void commit(klog_ring_t *r, uint32_t head, unsigned int n) {
+    __atomic_store_n(&r->head, head + n, __ATOMIC_RELEASE);
+    r->records += n;
+}
+
+void klog_write(int level, const char *fmt, unsigned int nargs, const uint64_t *args) {
+    unsigned long flags = irq_save();
+    klog_ring_t *r = g_rings[this_cpu_id()];
+    if (!r) {
+        __atomic_fetch_add(&g_early_dropped, 1, __ATOMIC_RELAXED);
+        irq_restore(flags);
+        return;
+    }
+
+    int64_t head = reserve(r, 1);
+    if (head >= 0) {
+        klog_record_t *rec = &r->slots[head & RING_MASK];
+        rec->tsc = rdtsc();
+        rec->fmt = fmt;
+        rec->level = (uint8_t)level;
+        rec->count = (uint8_t)nargs;
+        for (unsigned int i = 0; i < nargs; i++) rec->args[i] = args[i];
+        commit(r, (uint32_t)head, 1);
+    }
+    irq_restore(flags);
+    if (head >= 0) kick_drain();
+}
+
+void klog_text(int level, const char *text) {
+    size_t len = strlen(text);
+    unsigned int n = len ? (unsigned int)((len + KLOG_TEXT_MAX - 1) / KLOG_TEXT_MAX) : 1;
+
+    unsigned long flags = irq_save();
+    klog_ring_t *r = g_rings[this_cpu_id()];
+    if (!r) {
+        __atomic_fetch_add(&g_early_dropped, n, __ATOMIC_RELAXED);
+        irq_restore(flags);
+        return;
+    }
+
+    int64_t head = n <= RING_SLOTS ? reserve(r, n) : -1;
+    if (head >= 0) {
+        uint64_t now = rdtsc();
+        for (unsigned int i = 0; i < n; i++) {
+            klog_record_t *rec = &r->slots[(head + i) & RING_MASK];
+            size_t chunk = len > KLOG_TEXT_MAX ? KLOG_TEXT_MAX : len;
+            rec->tsc = now;
+            rec->fmt = 0;
+            rec->level = (uint8_t)level;
+            rec->count = (uint8_t)chunk;
+            rec->more = i + 1 < n;
+            memcpy(rec->text, text, chunk);
+            text += chunk;
+            len -= chunk;
+        }
+        commit(r, (uint32_t)head, n);
+    }
+    irq_restore(flags);
+    if (head >= 0) kick_drain();
+}
+
+// Expand one deferred record. Each conversion is handed to ksnprintf()
+// separately with its stored argument; on x86-64 a 64-bit slot read as int
+// yields the low half, which is what the caller passed.
+static size_t format_args(char *buf, size_t size, const klog_record_t *rec) {
+    const char *fmt = rec->fmt;
+    size_t len = 0;
+    unsigned int arg = 0;
+
+    while (*fmt && len + 1 < size) {
+        if (*fmt != '%') {
+            buf[len++] = *fmt++;
+            continue;
+        }
+
+        char spec[16];
+        size_t n = 0;
+        spec[n++] = *fmt++;
+        while (*fmt && n < sizeof(spec) - 2 &&
+               (*fmt == '-' || *fmt == 'l' || *fmt == 'z' || (*fmt >= '0' && *fmt <= '9')))
+            spec[n++] = *fmt++;
+        if (!*fmt) break;
+        spec[n++] = *fmt++;
+        spec[n] = '\0';
+
+        int written;
+        if (spec[n - 1] == '%') written = ksnprintf(buf + len, size - len, "%%");
+        else written = ksnprintf(buf + len, size - len, spec, arg < rec->count ? rec->args[arg++] : 0);
+        len += (size_t)written;
+        if (len >= size) len = size - 1;
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+// Format the record at the ring's tail and consume it, with any text
+// continuation records; returns the line length
+static size_t format_record(klog_ring_t *r, unsigned int cpu, char *line) {
+    static const char level_char[] = "EWID";
+    uint32_t tail = r->tail;
+    const klog_record_t *rec = &r->slots[tail & RING_MASK];
+
+    uint64_t us = tsc_cycles_to_ns(rec->tsc) / 1000;
+    size_t len = (size_t)ksnprintf(line, LINE_MAX, "[%5lu.%06lu] %u %c ", us / 1000000, us % 1000000,
+                                   cpu, level_char[rec->level & 3]);
+
+    if (rec->fmt) {
+        len += format_args(line + len, LINE_MAX - len - 1, rec);
+        tail++;
+    } else {
+        for (;;) {
+            rec = &r->slots[tail++ & RING_MASK];
+            size_t chunk = rec->count;
+            if (len + chunk > LINE_MAX - 2) chunk = LINE_MAX - 2 - len;
+            memcpy(line + len, rec->text, chunk);
+            len += chunk;
+            if (!rec->more || tail == r->head) break;
+        }
+    }
+    line[len++] = '\n';
+
+    __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+    g_stats.drained++;
+    g_stats.bytes += len;
+    return len;
+}
+
+// The ring holding the oldest pending record
+static klog_ring_t *oldest_ring(unsigned int *cpu) {
+    klog_ring_t *best = 0;
+    uint64_t best_tsc = ~0UL;
+
+    for (unsigned int i = 0; i < MAX_CPUS; i++) {
+        klog_ring_t *r = __atomic_load_n(&g_rings[i], __ATOMIC_ACQUIRE);
+        if (!r || r->tail == __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)) continue;
+        uint64_t tsc = r->slots[r->tail & RING_MASK].tsc;
+        if (tsc < best_tsc) {
+            best = r;
+            best_tsc = tsc;
+            *cpu = i;
+        }
+    }
+    return best;
+}
+
+static void debugcon_write(const char *s, size_t n) {
+    __asm__ volatile("rep outsb" : "+S"(s), "+c"(n) : "d"(DEBUGCON_PORT) : "memory");
+}
+
+static unsigned int tx_used(void) {
+    return g_tx_head - g_tx_tail;
+}
+
+static void tx_append(const char *s, size_t n) {
+    for (size_t i = 0; i < n; i++) g_tx[g_tx_head++ % TX_SIZE] = s[i];
+}
+
+// Top up the UART FIFO; returns 1 if bytes went out, so a THRE interrupt follows
+static int uart_fill(void) {
+    if (!tx_used() || !(inb(COM1 + UART_LSR) & UART_LSR_THRE)) return 0;
+    for (unsigned int i = 0; i < UART_FIFO_SIZE && tx_used(); i++)
+        outb(COM1 + UART_DATA, (uint8_t)g_tx[g_tx_tail++ % TX_SIZE]);
+    return 1;
+}
+
+// Runs on the BSP with interrupts disabled: from the kick IPI, the UART
+// interrupt and the poll timer
+static void drain(void) {
+    char line[LINE_MAX];
+
+again:
+    for (unsigned int i = 0; i < DRAIN_BATCH; i++) {
+        if (g_uart_present && TX_SIZE - tx_used() < LINE_MAX) break;
+        unsigned int cpu;
+        klog_ring_t *r = oldest_ring(&cpu);
+        if (!r) break;
+
+        size_t len = format_record(r, cpu, line);
+        debugcon_write(line, len);
+        if (g_uart_present) tx_append(line, len);
+    }
+
+    int thre_pending = g_uart_present && uart_fill() && g_uart_irq;
+    unsigned int cpu;
+    int records_left = oldest_ring(&cpu) != 0;
+
+    if (!records_left && !tx_used()) {
+        __atomic_store_n(&g_drain_active, 0, __ATOMIC_SEQ_CST);
+        // A producer that still saw the drain active sent no kick
+        if (oldest_ring(&cpu) && !__atomic_exchange_n(&g_drain_active, 1, __ATOMIC_ACQ_REL))
+            goto again;
+        return;
+    }
+    if (!thre_pending) timer_schedule(&g_poll_event, rdtsc() + tsc_ns_to_cycles(POLL_NS));
+}
+
+static void handle_kick(interrupt_frame_t *frame) {
+    (void)frame;
+    apic_eoi();
+    drain();
+}
+
+static void handle_uart(interrupt_frame_t *frame) {
+    (void)frame;
+    (void)inb(COM1 + UART_IIR);     // acknowledge
+    g_stats.uart_irqs++;
+    apic_eoi();
+    drain();
+}
+
+static void poll_expired(timer_event_t *ev, uint64_t now) {
+    (void)ev;
+    (void)now;
+    drain();
+}
+
+static int uart_init(void) {
+    outb(COM1 + UART_SCRATCH, 0x5A);
+    if (inb(COM1 + UART_SCRATCH) != 0x5A) return -1;
+
+    outb(COM1 + UART_IER, 0);
+    outb(COM1 + UART_LCR, 0x80);        // divisor latch
+    outb(COM1 + UART_DATA, 1);          // 115200 baud
+    outb(COM1 + UART_IER, 0);
+    outb(COM1 + UART_LCR, 0x03);        // 8N1
+    outb(COM1 + UART_IIR, 0xC7);        // enable and clear FIFOs
+    outb(COM1 + UART_MCR, 0x0B);        // DTR, RTS, OUT2 gates the IRQ line
+    return 0;
+}
+
+void klog_start(void) {
+    unsigned long flags = irq_save();
+
+    g_tx = kmalloc(TX_SIZE);
+    g_uart_present = g_tx && uart_init() == 0;
+    g_drain_apic_id = apic_id();
+    g_poll_event.fn = poll_expired;
+    interrupt_register(KLOG_IPI_VECTOR, handle_kick);
+
+    if (g_uart_present && ioapic_available() &&
+        interrupt_register(IRQ_ISA_VECTOR(ISA_IRQ_COM1), handle_uart) == 0 &&
+        ioapic_route_isa(ISA_IRQ_COM1, g_drain_apic_id) == 0) {
+        g_uart_irq = 1;
+        outb(COM1 + UART_IER, UART_IER_THRE);
+    }
+
+    __atomic_store_n(&g_started, 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&g_drain_active, 1, __ATOMIC_RELEASE);
+    drain();
+    irq_restore(flags);
+}
+
+static void uart_write_polled(const char *buf, size_t len) {
+    for (size_t i = 0; g_uart_present && i < len; i++) {
+        while (!(inb(COM1 + UART_LSR) & UART_LSR_THRE)) cpu_pause();
+        outb(COM1 + UART_DATA, (uint8_t)buf[i]);
+    }
+}
+
+void klog_flush_sync(void) {
+    char line[LINE_MAX];
+    unsigned int cpu;
+    klog_ring_t *r;
+
+    while (g_tx && tx_used()) {
+        while (!(inb(COM1 + UART_LSR) & UART_LSR_THRE)) cpu_pause();
+        outb(COM1 + UART_DATA, (uint8_t)g_tx[g_tx_tail++ % TX_SIZE]);
+    }
+    while ((r = oldest_ring(&cpu))) {
+        size_t len = format_record(r, cpu, line);
+        debugcon_write(line, len);
+        uart_write_polled(line, len);
+    }
+}
+
+void klog_write_raw(const char *buf, size_t len) {
+    debugcon_write(buf, len);
+    uart_write_polled(buf, len);
+}
+
+void klog_get_stats(klog_stats_t *stats) {
+    *stats = g_stats;
+    stats->records = 0;
+    stats->dropped = __atomic_load_n(&g_early_dropped, __ATOMIC_RELAXED);
+    for (unsigned int i = 0; i < MAX_CPUS; i++) {
+        klog_ring_t *r = __atomic_load_n(&g_rings[i], __ATOMIC_ACQUIRE);
+        if (!r) continue;
+        stats->records += r->records;
+        stats->dropped += r->dropped;
+    }
+}
+
+#define SELFTEST_RECORDS    200
+#define SELFTEST_TIMEOUT_MS 500
+
+static void selftest_timeout(timer_event_t *ev, uint64_t now) {
+    (void)ev;
+    (void)now;
+}
+
+void klog_selftest(void) {
+    char line[128];
+    histogram_t cost;
+    klog_stats_t before, after;
+
+    hist_reset(&cost);
+    klog_get_stats(&before);
+    uint64_t start = rdtsc();
+    for (unsigned int i = 0; i < SELFTEST_RECORDS; i++) {
+        uint64_t t0 = rdtsc();
+        klog_debug("klog selftest %u/%u", i + 1, SELFTEST_RECORDS);
+        hist_add(&cost, rdtsc() - t0);
+    }
+
+    // Producers never wait; the drain catches up from its interrupts, which
+    // the BSP only takes while idle
+    timer_event_t timeout = { 0, selftest_timeout, 0, 0 };
+    uint64_t deadline = start + tsc_ns_to_cycles(SELFTEST_TIMEOUT_MS * 1000000UL);
+    unsigned long flags = irq_save();
+    timer_schedule(&timeout, deadline);
+    for (;;) {
+        klog_get_stats(&after);
+        if (after.drained - before.drained >= SELFTEST_RECORDS || rdtsc() >= deadline) break;
+        timer_idle();
+    }
+    timer_cancel(&timeout);
+    irq_restore(flags);
+    uint64_t drain_us = tsc_cycles_to_ns(rdtsc() - start) / 1000;
+
+    ksnprintf(line, sizeof(line), "klog: %u records, mean %lu cycles (p99 <%lu), drained in %lu us, %lu dropped",
+              SELFTEST_RECORDS, hist_mean(&cost), hist_percentile(&cost, 99), drain_us,
+              after.dropped - before.dropped);
+    boot_print(line, after.drained - before.drained >= SELFTEST_RECORDS ? COLOR_CYAN : COLOR_YELLOW);
+
+    ksnprintf(line, sizeof(line), "klog: %s, %lu UART IRQs, %lu kicks",
+              g_uart_irq ? "COM1 IRQ-driven + 0xE9" : g_uart_present ? "COM1 polled + 0xE9" : "0xE9 only",
+              after.uart_irqs, after.kicks);
+    boot_print(line, COLOR_CYAN);
+}
@@ -0,0 +1,189 @@
+#include "../include/ksym.h"
+#include "../include/slab.h"
+#include "../include/util.h"
+
+// Emitted by tools/gen_ksyms.sh into .ksyms
+extern const uint64_t ksyms_count;
+extern const uint64_t ksyms_addrs[];
+extern const uint32_t ksyms_names[];
+extern const char ksyms_strings[];
+
+extern char _text_start[];
+extern char _text_end[];
+
+#define SHT_SYMTAB      2
+#define STT_NOTYPE      0
+#define STT_FUNC        2
+
+typedef struct {
+    uint32_t name;
+    uint32_t type;
+    uint64_t flags;
+    uint64_t addr;
+    uint64_t offset;
+    uint64_t size;
+    uint32_t link;
+    uint32_t info;
+    uint64_t addralign;
+    uint64_t entsize;
+} elf64_shdr_t;
+
+typedef struct {
+    uint32_t name;
+    uint8_t info;
+    uint8_t other;
+    uint16_t shndx;
+    uint64_t value;
+    uint64_t size;
+} elf64_sym_t;
+
+// The table in use: the embedded one, or one built from the ELF .symtab
+static const uint64_t *g_addrs = ksyms_addrs;
+static const uint32_t *g_names = ksyms_names;
+static const char *g_strings = ksyms_strings;
+static uint64_t g_elf_count;
+static int g_from_elf;
+
+static uint64_t table_count(void) {
+    return g_from_elf ? g_elf_count : ksyms_count;
+}
+
+int ksym_in_text(uint64_t addr) {
+    return addr >= (uint64_t)_text_start && addr < (uint64_t)_text_end;
+}
+
+const char *ksym_lookup(uint64_t addr, uint64_t *offset) {
+    uint64_t count = table_count();
+    if (!count || !ksym_in_text(addr) || addr < g_addrs[0]) return 0;
+
+    // Last symbol at or below `addr`; it runs up to the next one or _text_end
+    uint64_t lo = 0, hi = count - 1;
+    while (lo < hi) {
+        uint64_t mid = (lo + hi + 1) / 2;
+        if (g_addrs[mid] <= addr) lo = mid;
+        else hi = mid - 1;
+    }
+    if (offset) *offset = addr - g_addrs[lo];
+    return g_strings + g_names[lo];
+}
+
+int ksym_format(char *buf, size_t size, uint64_t addr) {
+    uint64_t offset;
+    const char *name = ksym_lookup(addr, &offset);
+    if (!name) return ksnprintf(buf, size, "0x%lx", addr);
+    if (!offset) return ksnprintf(buf, size, "%s", name);
+    return ksnprintf(buf, size, "%s+0x%lx", name, offset);
+}
+
+uint64_t ksym_count(void) {
+    return table_count();
+}
+
+const char *ksym_source(void) {
+    return g_from_elf ? "ELF .symtab" : "embedded";
+}
+
+static const char *skip_prefix(const char *s, const char *prefix) {
+    while (*prefix)
+        if (*s++ != *prefix++) return 0;
+    return s;
+}
+
+// Linker script markers such as _text_start, which gen_ksyms.sh also skips
+static int is_section_marker(const char *name) {
+    static const char *const markers[] = { "_kernel_", "_text_", "_rodata_", "_data_", "_bss_" };
+    for (size_t i = 0; i < sizeof(markers) / sizeof(markers[0]); i++) {
+        const char *rest = skip_prefix(name, markers[i]);
+        if (!rest) continue;
+        const char *tail = skip_prefix(rest, "start");
+        if (!tail) tail = skip_prefix(rest, "end");
+        return tail && !*tail;
+    }
+    return 0;
+}
+
+void ksym_init(const kernel_elf_info_t *elf) {
+    if (ksyms_count || !elf->sections || elf->section_size != sizeof(elf64_shdr_t)) return;
+
+    const elf64_shdr_t *sections = (const elf64_shdr_t *)elf->sections;
+    const elf64_shdr_t *symtab = 0;
+    for (unsigned int i = 0; i < elf->section_count; i++) {
+        if (sections[i].type == SHT_SYMTAB && sections[i].addr) {
+            symtab = &sections[i];
+            break;
+        }
+    }
+    if (!symtab || symtab->link >= elf->section_count || !sections[symtab->link].addr) return;
+
+    const elf64_sym_t *syms = (const elf64_sym_t *)symtab->addr;
+    const char *strings = (const char *)sections[symtab->link].addr;
+    uint64_t nsyms = symtab->size / sizeof(elf64_sym_t);
+
+    uint64_t count = 0;
+    for (uint64_t i = 0; i < nsyms; i++) {
+        unsigned int type = syms[i].info & 0xF;
+        if ((type == STT_FUNC || type == STT_NOTYPE) && syms[i].shndx && syms[i].name &&
+            ksym_in_text(syms[i].value) && !is_section_marker(strings + syms[i].name))
+            count++;
+    }
+    if (!count) return;
+
+    uint64_t *addrs = kmalloc(count * sizeof(*addrs));
+    uint32_t *names = kmalloc(count * sizeof(*names));
+    uint8_t *funcs = kmalloc(count);
+    if (!addrs || !names || !funcs) {
+        kfree(addrs);
+        kfree(names);
+        kfree(funcs);
+        return;
+    }
+
+    uint64_t n = 0;
+    for (uint64_t i = 0; i < nsyms; i++) {
+        unsigned int type = syms[i].info & 0xF;
+        if ((type == STT_FUNC || type == STT_NOTYPE) && syms[i].shndx && syms[i].name &&
+            ksym_in_text(syms[i].value) && !is_section_marker(strings + syms[i].name)) {
+            addrs[n] = syms[i].value;
+            names[n] = syms[i].name;
+            funcs[n] = type == STT_FUNC;
+            n++;
+        }
+    }
+
+    // Shell sort by address, functions ahead of plain labels at the same one
+    static const uint64_t gaps[] = { 701, 301, 132, 57, 23, 10, 4, 1 };
+    for (size_t g = 0; g < sizeof(gaps) / sizeof(gaps[0]); g++) {
+        uint64_t gap = gaps[g];
+        for (uint64_t i = gap; i < n; i++) {
+            uint64_t addr = addrs[i];
+            uint32_t name = names[i];
+            uint8_t func = funcs[i];
+            uint64_t j = i;
+            while (j >= gap && (addrs[j - gap] > addr || (addrs[j - gap] == addr && func > funcs[j - gap]))) {
+                addrs[j] = addrs[j - gap];
+                names[j] = names[j - gap];
+                funcs[j] = funcs[j - gap];
+                j -= gap;
+            }
+            addrs[j] = addr;
+            names[j] = name;
+            funcs[j] = func;
+        }
+    }
+
+    // One name per address, as in the embedded table
+    uint64_t unique = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        if (unique && addrs[unique - 1] == addrs[i]) continue;
+        addrs[unique] = addrs[i];
+        names[unique] = names[i];
+        unique++;
+    }
+    kfree(funcs);
+
+    g_addrs = addrs;
+    g_names = names;
+    g_strings = strings;
+    g_elf_count = unique;
+    g_from_elf = 1;
+}
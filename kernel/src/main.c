@@ -1,22 +1,52 @@
 #include "../include/kernel.h"
+#include "../include/acpi.h"
+#include "../include/apic.h"
+#include "../include/blkbench.h"
 #include "../include/error.h"
 #include "../include/font.h"
+#include "../include/config.h"
+#include "../include/console.h"
+#include "../include/cpu.h"
+#include "../include/framebuffer.h"
+#include "../include/fpu.h"
+#include "../include/gdt.h"
+#include "../include/glyph_cache.h"
+#include "../include/hpet.h"
+#include "../include/idt.h"
+#include "../include/initrd.h"
+#include "../include/input.h"
+#include "../include/ioapic.h"
+#include "../include/klog.h"
+#include "../include/ksym.h"
+#include "../include/paging.h"
+#include "../include/pci.h"
+#include "../include/percpu.h"
+#include "../include/pmm.h"
+#include "../include/profile.h"
+#include "../include/ps2.h"
+#include "../include/psf.h"
+#include "../include/raster.h"
+#include "../include/sched.h"
+#include "../include/slab.h"
+#include "../include/smp.h"
+#include "../include/timer.h"
+#include "../include/trace.h"
+#include "../include/tsc.h"
+#include "../include/util.h"
+#include "../include/virtio_blk.h"
 
 
 framebuffer_info_t g_framebuffer;
 
-void draw_pixel(unsigned int x, unsigned int y, unsigned int color) {
-    if (x >= g_framebuffer.framebuffer_width || y >= g_framebuffer.framebuffer_height) return;
-    ((unsigned int *)g_framebuffer.framebuffer_base)[y * (g_framebuffer.framebuffer_pitch / 4) + x] = color;
-}
+// Boot parameters live in the bootloader image, which init_memory() reclaims
+static kernel_params_t g_boot_params;
 
-void clear_screen(unsigned int color) {
-    unsigned int *fb = (unsigned int *)g_framebuffer.framebuffer_base;
-    unsigned int pixels = g_framebuffer.framebuffer_height * (g_framebuffer.framebuffer_pitch / 4);
-    while (pixels--) *fb++ = color;
-}
+// PSF_DEFAULT_PATH from the initrd, if there is one
+static font_t g_boot_font;
 
-void draw_char(unsigned int x, unsigned int y, char c, unsigned int color) {
+#if CONFIG_SELFTEST
+// The pre-blitter glyph loop: 64 bounds-checked draw_pixel() calls per glyph
+static void draw_char_per_pixel(unsigned int x, unsigned int y, char c, unsigned int color) {
     if ((unsigned char)c > 127) c = '?';
     const uint8_t *bitmap = g_font[(unsigned char)c];
     for (unsigned int row = 0; row < 8; row++) {
@@ -28,68 +58,368 @@ void draw_char(unsigned int x, unsigned int y, char c, unsigned int color) {
     }
 }
 
-void draw_string(unsigned int x, unsigned int y, const char *str, unsigned int color) {
-    unsigned int cx = x;
-    while (*str) {
-        if (*str == '\n') {
-            cx = x;
-            y += 10;
-        } else {
-            draw_char(cx, y, *str, color);
-            cx += 8;
-            if (cx >= g_framebuffer.framebuffer_width - 8) {
-                cx = x;
-                y += 10;
-            }
-        }
-        str++;
-    }
+// Fill an off-screen 1920x1080 surface with text using both glyph paths
+static void text_selftest(void) {
+    const unsigned int width = 1920, height = 1080;
+    const unsigned int cols = width / 8 - 1, rows = height / 10;
+    char line[256];
+    char report[128];
+
+    uint64_t phys = pmm_alloc_pages(pmm_order_for_size((uint64_t)width * height * 4));
+    if (!phys) return;
+
+    for (unsigned int i = 0; i < cols; i++) line[i] = (char)(33 + i % 94);
+    line[cols] = '\0';
+
+    fb_surface_t surface = { phys_to_virt(phys), width, height, width };
+    fb_set_target(&surface);
+
+    uint64_t t0 = rdtsc();
+    for (unsigned int r = 0; r < rows; r++)
+        for (unsigned int c = 0; c < cols; c++)
+            draw_char_per_pixel(c * 8, r * 10, line[c], COLOR_WHITE);
+    uint64_t t1 = rdtsc();
+    for (unsigned int r = 0; r < rows; r++)
+        draw_string(0, r * 10, line, COLOR_WHITE);
+    uint64_t t2 = rdtsc();
+
+    fb_set_target(0);
+    pmm_free_pages(phys, pmm_order_for_size((uint64_t)width * height * 4));
+
+    uint64_t slow = t1 - t0, fast = (t2 - t1) ? t2 - t1 : 1;
+    ksnprintf(report, sizeof(report), "Text fill 1920x1080 (%u glyphs): per-pixel %lu us, blitter %lu us (x%lu.%lu)",
+              cols * rows, tsc_cycles_to_ns(slow) / 1000, tsc_cycles_to_ns(fast) / 1000,
+              slow / fast, slow * 10 / fast % 10);
+    boot_print(report, COLOR_CYAN);
 }
+#endif
 
 void init_console(framebuffer_info_t *framebuffer) {
     g_framebuffer = *framebuffer;
+    fb_init(framebuffer);
+    draw_init();
     clear_screen(COLOR_BLACK);
-    draw_string(10, 10, "VisualOS Kernel", COLOR_WHITE);
-    draw_string(10, 30, "Version 0.1", COLOR_GREEN);
+    console_boot_init();
+    console_puts("\x1b[97mVisualOS Kernel\n\x1b[92mVersion 0.1\x1b[0m\n\n");
+}
+
+// SGR code selecting the bright palette entry that matches a COLOR_* value
+static unsigned int color_sgr(unsigned int color) {
+    switch (color) {
+    case COLOR_RED:     return 91;
+    case COLOR_GREEN:   return 92;
+    case COLOR_YELLOW:  return 93;
+    case COLOR_BLUE:    return 94;
+    case COLOR_MAGENTA: return 95;
+    case COLOR_CYAN:    return 96;
+    case COLOR_WHITE:   return 97;
+    default:            return 0;
+    }
+}
+
+void boot_print(const char *str, unsigned int color) {
+    char line[256];
+
+    klog_text(color == COLOR_RED ? KLOG_ERR : color == COLOR_YELLOW ? KLOG_WARN : KLOG_INFO, str);
+    ksnprintf(line, sizeof(line), "\x1b[%um%s\x1b[0m\n", color_sgr(color), str);
+    console_puts(line);
+
+    // Without a back buffer there is no flush to wait for
+    if (!fb_has_backbuffer()) console_render(&g_console);
 }
 
 void init_memory(memory_info_t *memory_info) {
-    char mem_str[32];
-    unsigned long kb = memory_info->map_size / 1024;
-    unsigned int i = 0, j = 0;
-    unsigned long t = kb;
-    
-    char *s = mem_str;
-    s[j++] = 'M'; s[j++] = 'e'; s[j++] = 'm'; s[j++] = ':'; s[j++] = ' ';
-    
-    char num[16];
-    do {
-        num[i++] = '0' + (t % 10);
-        t /= 10;
-    } while (t);
-    
-    while (i > 0) s[j++] = num[--i];
-    s[j++] = ' '; s[j++] = 'K'; s[j++] = 'B'; s[j] = '\0';
-    
-    draw_string(10, 50, mem_str, COLOR_CYAN);
+    char mem_str[96];
+
+    if (pmm_init(memory_info) != 0)
+        panic("init_memory: no room for page frame metadata");
+    slab_init();
+    klog_init();
+    trace_init();
+    fpu_init_state();
+
+    // From here on drawing lands in RAM and reaches the screen via fb_flush()
+    fb_enable_backbuffer();
+    if (console_enable_scrollback() != 0) boot_print("Console: no memory for scrollback", COLOR_YELLOW);
+    if (glyph_cache_init() != 0) boot_print("Glyph cache: out of memory, text is drawn uncached", COLOR_YELLOW);
+
+#if CONFIG_SELFTEST
+    uint64_t fb_bw_before = fb_has_backbuffer() ? fb_measure_fill_bandwidth(8) : 0;
+#endif
+    if (paging_init(memory_info, &g_framebuffer) != 0)
+        panic("init_memory: out of memory building page tables");
+
+    pmm_stats_t stats;
+    pmm_get_stats(&stats);
+    ksnprintf(mem_str, sizeof(mem_str), "Mem: %lu MB free (%lu MB reclaimed from the loader)",
+              stats.free_pages >> (20 - PAGE_SHIFT), stats.reclaimed_pages >> (20 - PAGE_SHIFT));
+    boot_print(mem_str, COLOR_CYAN);
+
+    ksnprintf(mem_str, sizeof(mem_str), "SIMD: %s memops, %u byte XSAVE area", memops_variant(), fpu_xsave_size());
+    boot_print(mem_str, COLOR_CYAN);
+
+    paging_stats_t pg;
+    paging_get_stats(&pg);
+    ksnprintf(mem_str, sizeof(mem_str), "Paging: %lu x 1G, %lu x 2M, %lu x 4K in %lu tables%s",
+              pg.pages_1g, pg.pages_2m, pg.pages_4k, pg.tables, pg.pcid ? ", PCID" : "");
+    boot_print(mem_str, COLOR_CYAN);
+
+#if CONFIG_SELFTEST
+    if (fb_bw_before) {
+        ksnprintf(mem_str, sizeof(mem_str), "FB fill: %lu MB/s -> %lu MB/s (write-combining)",
+                  fb_bw_before, fb_measure_fill_bandwidth(8));
+        boot_print(mem_str, COLOR_CYAN);
+    }
+    pmm_selftest();
+    slab_selftest();
+    text_selftest();
+    raster_selftest();
+    console_selftest();
+#endif
+    console_flush();
+}
+
+void init_acpi(kernel_params_t *params) {
+    char line[96];
+
+    if (acpi_init(params->rsdp_address) != 0) {
+        boot_print("ACPI: no valid RSDP, using defaults", COLOR_YELLOW);
+        return;
+    }
+
+    const acpi_info_t *acpi = acpi_get_info();
+    ksnprintf(line, sizeof(line), "ACPI: rev %u, %u tables, %u CPUs, %u IOAPICs, %u ECAM, %u NUMA domains",
+              acpi->revision, acpi->table_count, acpi->cpu_count, acpi->ioapic_count,
+              acpi->ecam_count, acpi->domain_count);
+    boot_print(line, COLOR_CYAN);
 }
 
 void init_interrupts(void) {
-    draw_string(10, 70, "Interrupts initialized", COLOR_YELLOW);
+    char line[96];
+
+    gdt_init_cpu();
+    idt_init();
+
+    // CR3, GDTR and IDTR no longer point into firmware memory
+    uint64_t released = pmm_release_boot_services();
+    ksnprintf(line, sizeof(line), "Mem: %lu MB reclaimed from boot services", released >> (20 - PAGE_SHIFT));
+    boot_print(line, COLOR_CYAN);
+
+    if (apic_init() != 0)
+        panic("init_interrupts: no local APIC");
+    int have_ioapic = ioapic_init() == 0;
+
+    // The early PIT calibration was good enough for boot statistics; redo
+    // it against the HPET before timer deadlines depend on it
+    const acpi_info_t *acpi = acpi_get_info();
+    hpet_init(acpi && acpi->hpet_address ? acpi->hpet_address : HPET_DEFAULT_BASE);
+    tsc_calibrate();
+    timer_init();
+    klog_start();
+    boot_print("Interrupts initialized", COLOR_YELLOW);
+
+    ksnprintf(line, sizeof(line), "Timer: %s on %s, LAPIC %lu kHz, TSC %lu kHz (%s)",
+              timer_mode_name(), apic_is_x2apic() ? "x2APIC" : "xAPIC", timer_lapic_hz() / 1000,
+              tsc_hz() / 1000, tsc_calibration_source());
+    boot_print(line, COLOR_CYAN);
+    if (!have_ioapic) boot_print("IOAPIC: none, device interrupts unavailable", COLOR_YELLOW);
+
+#if CONFIG_SELFTEST
+    idt_selftest();
+    timer_selftest();
+    klog_selftest();
+#endif
+    console_flush();
+}
+
+static uint64_t boot_us(const boot_timing_t *t, unsigned int from, unsigned int to) {
+    return tsc_cycles_to_ns(t->tsc[to] - t->tsc[from]) / 1000;
+}
+
+// Where the time between efi_main() and kernel_main() went
+static void report_boot_timing(const boot_timing_t *t, uint64_t kernel_entry_tsc) {
+    char line[128];
+
+    if (t->version < 1) {
+        boot_print("Boot: loader passed no timing", COLOR_YELLOW);
+        return;
+    }
+    // The loader's last stamp is taken right before the jump, so the gap
+    // to kernel_main is the kernel's own entry path
+    ksnprintf(line, sizeof(line), "Boot: efi_main at TSC+%lu ms, loader %lu us, kernel_main %lu us after the jump",
+              tsc_cycles_to_ns(t->tsc[BOOT_TSC_EFI_ENTRY]) / 1000000,
+              boot_us(t, BOOT_TSC_EFI_ENTRY, BOOT_TSC_KERNEL_JUMP),
+              tsc_cycles_to_ns(kernel_entry_tsc - t->tsc[BOOT_TSC_KERNEL_JUMP]) / 1000);
+    boot_print(line, COLOR_CYAN);
+    ksnprintf(line, sizeof(line), "Loader us: logo %lu, map %lu, GOP %lu, load %lu, exit %lu (%u retries), jump %lu",
+              boot_us(t, BOOT_TSC_EFI_ENTRY, BOOT_TSC_LOGO),
+              boot_us(t, BOOT_TSC_LOGO, BOOT_TSC_MEMORY_MAP),
+              boot_us(t, BOOT_TSC_MEMORY_MAP, BOOT_TSC_GRAPHICS),
+              boot_us(t, BOOT_TSC_GRAPHICS, BOOT_TSC_KERNEL_LOADED),
+              boot_us(t, BOOT_TSC_KERNEL_LOADED, BOOT_TSC_EXIT_BOOT_SERVICES), t->exit_retries,
+              boot_us(t, BOOT_TSC_EXIT_BOOT_SERVICES, BOOT_TSC_KERNEL_JUMP));
+    boot_print(line, COLOR_CYAN);
+    if (t->version < 2) return;
+
+    ksnprintf(line, sizeof(line), "Kernel load: %s %llu -> %llu KB, read %lu us, inflate %lu us, %u async",
+              t->kernel_format == BOOT_KERNEL_LZ4 ? "LZ4" : "raw",
+              t->kernel_file_bytes >> 10, t->kernel_image_bytes >> 10,
+              tsc_cycles_to_ns(t->kernel_read_tsc) / 1000, tsc_cycles_to_ns(t->kernel_inflate_tsc) / 1000,
+              t->kernel_async_reads);
+    boot_print(line, COLOR_CYAN);
+    if (t->version < 3) return;
+
+    ksnprintf(line, sizeof(line), "Kernel place: segments %lu us, %llu KB .bss zeroed by the loader",
+              tsc_cycles_to_ns(t->kernel_place_tsc) / 1000, t->kernel_bss_bytes >> 10);
+    boot_print(line, COLOR_CYAN);
+    if (t->version < 4) return;
+
+    ksnprintf(line, sizeof(line), "Modules: read in %lu us", tsc_cycles_to_ns(t->modules_read_tsc) / 1000);
+    boot_print(line, COLOR_CYAN);
+}
+
+static void init_symbols(const kernel_elf_info_t *elf) {
+    char line[64];
+
+    ksym_init(elf);
+    ksnprintf(line, sizeof(line), "Symbols: %lu from %s", ksym_count(), ksym_source());
+    boot_print(line, ksym_count() ? COLOR_CYAN : COLOR_YELLOW);
+}
+
+static void init_modules(const kernel_params_t *params) {
+    char line[128];
+
+    initrd_init(params);
+    ksnprintf(line, sizeof(line), "Initrd: %u files, %lu KB from %u modules",
+              initrd_count(), initrd_bytes() >> 10, params->module_count);
+    boot_print(line, COLOR_CYAN);
+
+    if (psf_load(PSF_DEFAULT_PATH, &g_boot_font) == 0) {
+        if (console_use_font(&g_boot_font) != 0)
+            boot_print("Font: out of memory, the console keeps the built-in font", COLOR_YELLOW);
+        ksnprintf(line, sizeof(line), "Font: %s, %ux%u, %u glyphs, %u codepoints", g_boot_font.name,
+                  g_boot_font.width, g_boot_font.height, g_boot_font.glyph_count, g_boot_font.map_entries);
+        boot_print(line, COLOR_CYAN);
+    }
+#if CONFIG_SELFTEST
+    initrd_selftest();
+    psf_selftest();
+#endif
+}
+
+static void init_pci(void) {
+    char line[64];
+
+    int count = pci_init();
+    if (count < 0) {
+        boot_print("PCI: no MCFG table, no ECAM", COLOR_YELLOW);
+        return;
+    }
+    ksnprintf(line, sizeof(line), "PCI: %d functions", count);
+    boot_print(line, COLOR_CYAN);
+#if CONFIG_SELFTEST
+    pci_selftest();
+#endif
+}
+
+static void init_storage(void) {
+    char line[80];
+
+    if (virtio_blk_init() < 0) {
+        boot_print("Disk: no virtio-blk device", COLOR_YELLOW);
+        return;
+    }
+    ksnprintf(line, sizeof(line), "Disk: virtio-blk, %lu MiB, %u queues, %s%s",
+              virtio_blk_capacity() * BLK_SECTOR_SIZE >> 20, virtio_blk_queue_count(),
+              virtio_blk_has_irqs() ? "MSI-X" : "polled", virtio_blk_read_only() ? ", read-only" : "");
+    boot_print(line, COLOR_CYAN);
+#if CONFIG_SELFTEST
+    virtio_blk_selftest();
+    blkbench_run();
+#endif
+}
+
+static void init_input(void) {
+    char line[96];
+    ps2_stats_t ps2;
+
+    if (ps2_init() != 0) {
+        boot_print("Input: no PS/2 controller", COLOR_YELLOW);
+    } else {
+        ps2_get_stats(&ps2);
+        ksnprintf(line, sizeof(line), "Input: PS/2 %s%s%s, IRQs to CPU %u", ps2.keyboard ? "keyboard" : "",
+                  ps2.keyboard && ps2.mouse ? " and " : "", ps2.mouse ? (ps2.wheel ? "wheel mouse" : "mouse") : "",
+                  this_cpu_id());
+        boot_print(line, COLOR_CYAN);
+    }
+#if CONFIG_SELFTEST
+    ps2_selftest();
+    input_selftest();
+#endif
 }
 
 void kernel_main(kernel_params_t *params) {
+    uint64_t entry_tsc = rdtsc();
+
+    g_boot_params = *params;
+    params = &g_boot_params;
+
+    // GS must point at CPU 0's percpu block before anything asks this_cpu_id()
+    percpu_init_bsp();
+    fpu_init();
+    memops_init();
+    raster_init();
+
+    TRACE_BEGIN(TRACE_BOOT_CONSOLE, 0, 0);
     init_console(&params->framebuffer);
+    TRACE_END(TRACE_BOOT_CONSOLE, 0, 0);
+    tsc_calibrate();
+    TRACE_BEGIN(TRACE_BOOT_MEMORY, 0, 0);
     init_memory(&params->memory_info);
+    TRACE_END(TRACE_BOOT_MEMORY, 0, 0);
+    TRACE_BEGIN(TRACE_BOOT_ACPI, 0, 0);
+    init_acpi(params);
+    TRACE_END(TRACE_BOOT_ACPI, 0, 0);
+    TRACE_BEGIN(TRACE_BOOT_INTERRUPTS, 0, 0);
     init_interrupts();
+    TRACE_END(TRACE_BOOT_INTERRUPTS, 0, 0);
+    report_boot_timing(&params->timing, entry_tsc);
+    init_symbols(&params->elf);
+    init_modules(params);
+    sched_init();
+#if CONFIG_PROFILE
+    profile_init();
+#endif
+    TRACE_BEGIN(TRACE_BOOT_SMP, 0, 0);
+    smp_init();
+    TRACE_END(TRACE_BOOT_SMP, 0, 0);
+    TRACE_BEGIN(TRACE_BOOT_PCI, 0, 0);
+    init_pci();
+    TRACE_END(TRACE_BOOT_PCI, 0, 0);
+    TRACE_BEGIN(TRACE_BOOT_STORAGE, 0, 0);
+    init_storage();
+    TRACE_END(TRACE_BOOT_STORAGE, 0, 0);
+    init_input();
+#if CONFIG_PROFILE
+    profile_start(PROFILE_DEFAULT_HZ);
+#endif
+#if CONFIG_SELFTEST
+    sched_selftest();
+#endif
+#if CONFIG_PROFILE
+    profile_stop();
+    profile_dump();
+#endif
+    boot_print(acpi_get_info() ? "ACPI: Enabled" : "ACPI: Disabled", COLOR_MAGENTA);
+    boot_print(params->apic_enabled ? "APIC: Enabled" : "APIC: Disabled", COLOR_MAGENTA);
+    boot_print("Welcome to VisualOS!", COLOR_WHITE);
+    boot_print("Kernel initialized successfully", COLOR_GREEN);
+    console_flush();
     
-    draw_string(10, 90, params->acpi_enabled ? "ACPI: Enabled" : "ACPI: Disabled", COLOR_MAGENTA);
-    draw_string(10, 110, params->apic_enabled ? "APIC: Enabled" : "APIC: Disabled", COLOR_MAGENTA);
-    
-    draw_string(g_framebuffer.framebuffer_width / 2 - 80, g_framebuffer.framebuffer_height / 2 - 10, 
-               "Welcome to VisualOS!", COLOR_WHITE);
-    
-    draw_string(10, g_framebuffer.framebuffer_height - 20, "Kernel initialized successfully", COLOR_GREEN);
-    
-    while (1) __asm__ volatile("hlt");
+#if CONFIG_TRACE
+    trace_dump();
+#endif
+
+    // The boot context becomes CPU 0's idle task and consumes input events
+    input_run();
 }
\ No newline at end of file
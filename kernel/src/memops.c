@@ -0,0 +1,285 @@
+#include "../include/util.h"
+#include "../include/fpu.h"
+
+// Below this size the FPU section bookkeeping costs more than SIMD saves
+#define SIMD_THRESHOLD 512
+
+typedef long long v2di __attribute__((vector_size(16)));
+typedef long long v2di_u __attribute__((vector_size(16), aligned(1), may_alias));
+typedef long long v4di __attribute__((vector_size(32)));
+typedef long long v4di_u __attribute__((vector_size(32), aligned(1), may_alias));
+typedef unsigned int v4si __attribute__((vector_size(16), may_alias));
+typedef unsigned int v8si __attribute__((vector_size(32), may_alias));
+
+typedef void (*copy_fn_t)(unsigned char *dst, const unsigned char *src, size_t n);
+typedef void (*fill32_fn_t)(uint32_t *dst, uint32_t value, size_t count);
+
+static copy_fn_t g_copy;
+static copy_fn_t g_copy_nt;
+static copy_fn_t g_move_back;
+static fill32_fn_t g_fill32;
+static const char *g_variant = "scalar";
+
+static inline void rep_movsb(unsigned char *dst, const unsigned char *src, size_t n) {
+    __asm__ volatile("rep movsb" : "+D"(dst), "+S"(src), "+c"(n) : : "memory");
+}
+
+static inline void rep_stosb(unsigned char *dst, unsigned char value, size_t n) {
+    __asm__ volatile("rep stosb" : "+D"(dst), "+c"(n) : "a"(value) : "memory");
+}
+
+static inline void rep_stosl(uint32_t *dst, uint32_t value, size_t n) {
+    __asm__ volatile("rep stosl" : "+D"(dst), "+c"(n) : "a"(value) : "memory");
+}
+
+static void copy_scalar(unsigned char *dst, const unsigned char *src, size_t n) {
+    if (!(g_cpu_simd & SIMD_ERMS) && n >= 64) {
+        size_t words = n / 8;
+        __asm__ volatile("rep movsq" : "+D"(dst), "+S"(src), "+c"(words) : : "memory");
+        n &= 7;
+    }
+    rep_movsb(dst, src, n);
+}
+
+// Overlapping copy towards higher addresses
+static void move_back_scalar(unsigned char *dst, const unsigned char *src, size_t n) {
+    if (!n) return;
+    dst += n - 1;
+    src += n - 1;
+    __asm__ volatile("std\n\trep movsb\n\tcld" : "+D"(dst), "+S"(src), "+c"(n) : : "memory");
+}
+
+static void copy_nt_scalar(unsigned char *dst, const unsigned char *src, size_t n) {
+    size_t head = (-(uint64_t)dst) & 7;
+    if (head > n) head = n;
+    rep_movsb(dst, src, head);
+    dst += head;
+    src += head;
+    n -= head;
+
+    for (; n >= 8; n -= 8, dst += 8, src += 8)
+        __asm__ volatile("movnti %1, %0" : "=m"(*(uint64_t *)dst) : "r"(*(const uint64_t *)src));
+    rep_movsb(dst, src, n);
+}
+
+__attribute__((target("sse2")))
+static void copy_sse2(unsigned char *dst, const unsigned char *src, size_t n) {
+    size_t head = (-(uint64_t)dst) & 15;
+    rep_movsb(dst, src, head);
+    dst += head;
+    src += head;
+    n -= head;
+
+    for (; n >= 64; n -= 64, dst += 64, src += 64) {
+        v2di a = *(const v2di_u *)(src + 0), b = *(const v2di_u *)(src + 16);
+        v2di c = *(const v2di_u *)(src + 32), d = *(const v2di_u *)(src + 48);
+        *(v2di *)(dst + 0) = a;
+        *(v2di *)(dst + 16) = b;
+        *(v2di *)(dst + 32) = c;
+        *(v2di *)(dst + 48) = d;
+    }
+    rep_movsb(dst, src, n);
+}
+
+__attribute__((target("sse2")))
+static void copy_nt_sse2(unsigned char *dst, const unsigned char *src, size_t n) {
+    size_t head = (-(uint64_t)dst) & 15;
+    rep_movsb(dst, src, head);
+    dst += head;
+    src += head;
+    n -= head;
+
+    for (; n >= 64; n -= 64, dst += 64, src += 64) {
+        v2di a = *(const v2di_u *)(src + 0), b = *(const v2di_u *)(src + 16);
+        v2di c = *(const v2di_u *)(src + 32), d = *(const v2di_u *)(src + 48);
+        __builtin_ia32_movntdq((v2di *)(dst + 0), a);
+        __builtin_ia32_movntdq((v2di *)(dst + 16), b);
+        __builtin_ia32_movntdq((v2di *)(dst + 32), c);
+        __builtin_ia32_movntdq((v2di *)(dst + 48), d);
+    }
+    __asm__ volatile("sfence" ::: "memory");
+    rep_movsb(dst, src, n);
+}
+
+// Loads of a block happen before its stores, so dst > src overlap is safe
+__attribute__((target("sse2")))
+static void move_back_sse2(unsigned char *dst, const unsigned char *src, size_t n) {
+    for (; n >= 64; n -= 64) {
+        v2di a = *(const v2di_u *)(src + n - 16), b = *(const v2di_u *)(src + n - 32);
+        v2di c = *(const v2di_u *)(src + n - 48), d = *(const v2di_u *)(src + n - 64);
+        *(v2di_u *)(dst + n - 16) = a;
+        *(v2di_u *)(dst + n - 32) = b;
+        *(v2di_u *)(dst + n - 48) = c;
+        *(v2di_u *)(dst + n - 64) = d;
+    }
+    move_back_scalar(dst, src, n);
+}
+
+__attribute__((target("sse2")))
+static void fill32_sse2(uint32_t *dst, uint32_t value, size_t count) {
+    while (((uint64_t)dst & 15) && count) {
+        *dst++ = value;
+        count--;
+    }
+
+    v4si v = { value, value, value, value };
+    for (; count >= 16; count -= 16, dst += 16) {
+        *(v4si *)(dst + 0) = v;
+        *(v4si *)(dst + 4) = v;
+        *(v4si *)(dst + 8) = v;
+        *(v4si *)(dst + 12) = v;
+    }
+    rep_stosl(dst, value, count);
+}
+
+__attribute__((target("avx")))
+static void copy_avx(unsigned char *dst, const unsigned char *src, size_t n) {
+    size_t head = (-(uint64_t)dst) & 31;
+    rep_movsb(dst, src, head);
+    dst += head;
+    src += head;
+    n -= head;
+
+    for (; n >= 128; n -= 128, dst += 128, src += 128) {
+        v4di a = *(const v4di_u *)(src + 0), b = *(const v4di_u *)(src + 32);
+        v4di c = *(const v4di_u *)(src + 64), d = *(const v4di_u *)(src + 96);
+        *(v4di *)(dst + 0) = a;
+        *(v4di *)(dst + 32) = b;
+        *(v4di *)(dst + 64) = c;
+        *(v4di *)(dst + 96) = d;
+    }
+    rep_movsb(dst, src, n);
+}
+
+__attribute__((target("avx")))
+static void copy_nt_avx(unsigned char *dst, const unsigned char *src, size_t n) {
+    size_t head = (-(uint64_t)dst) & 31;
+    rep_movsb(dst, src, head);
+    dst += head;
+    src += head;
+    n -= head;
+
+    for (; n >= 128; n -= 128, dst += 128, src += 128) {
+        v4di a = *(const v4di_u *)(src + 0), b = *(const v4di_u *)(src + 32);
+        v4di c = *(const v4di_u *)(src + 64), d = *(const v4di_u *)(src + 96);
+        __builtin_ia32_movntdq256((v4di *)(dst + 0), a);
+        __builtin_ia32_movntdq256((v4di *)(dst + 32), b);
+        __builtin_ia32_movntdq256((v4di *)(dst + 64), c);
+        __builtin_ia32_movntdq256((v4di *)(dst + 96), d);
+    }
+    __asm__ volatile("sfence" ::: "memory");
+    rep_movsb(dst, src, n);
+}
+
+__attribute__((target("avx")))
+static void move_back_avx(unsigned char *dst, const unsigned char *src, size_t n) {
+    for (; n >= 128; n -= 128) {
+        v4di a = *(const v4di_u *)(src + n - 32), b = *(const v4di_u *)(src + n - 64);
+        v4di c = *(const v4di_u *)(src + n - 96), d = *(const v4di_u *)(src + n - 128);
+        *(v4di_u *)(dst + n - 32) = a;
+        *(v4di_u *)(dst + n - 64) = b;
+        *(v4di_u *)(dst + n - 96) = c;
+        *(v4di_u *)(dst + n - 128) = d;
+    }
+    move_back_scalar(dst, src, n);
+}
+
+__attribute__((target("avx")))
+static void fill32_avx(uint32_t *dst, uint32_t value, size_t count) {
+    while (((uint64_t)dst & 31) && count) {
+        *dst++ = value;
+        count--;
+    }
+
+    v8si v = { value, value, value, value, value, value, value, value };
+    for (; count >= 32; count -= 32, dst += 32) {
+        *(v8si *)(dst + 0) = v;
+        *(v8si *)(dst + 8) = v;
+        *(v8si *)(dst + 16) = v;
+        *(v8si *)(dst + 24) = v;
+    }
+    rep_stosl(dst, value, count);
+}
+
+void memops_init(void) {
+    if (g_cpu_simd & SIMD_AVX) {
+        g_copy = copy_avx;
+        g_copy_nt = copy_nt_avx;
+        g_move_back = move_back_avx;
+        g_fill32 = fill32_avx;
+        g_variant = "avx";
+    } else if (g_cpu_simd & SIMD_SSE2) {
+        g_copy = copy_sse2;
+        g_copy_nt = copy_nt_sse2;
+        g_move_back = move_back_sse2;
+        g_fill32 = fill32_sse2;
+        g_variant = "sse2";
+    }
+}
+
+const char *memops_variant(void) {
+    return g_variant;
+}
+
+void *memcpy(void *dst, const void *src, size_t n) {
+    if (n >= SIMD_THRESHOLD && g_copy) {
+        kernel_fpu_begin();
+        g_copy(dst, src, n);
+        kernel_fpu_end();
+    } else {
+        copy_scalar(dst, src, n);
+    }
+    return dst;
+}
+
+void *memmove(void *dst, const void *src, size_t n) {
+    unsigned char *d = dst;
+    const unsigned char *s = src;
+
+    if (d <= s || d >= s + n) return memcpy(dst, src, n);
+
+    if (n >= SIMD_THRESHOLD && g_move_back) {
+        kernel_fpu_begin();
+        g_move_back(d, s, n);
+        kernel_fpu_end();
+    } else {
+        move_back_scalar(d, s, n);
+    }
+    return dst;
+}
+
+void memset32(uint32_t *dst, uint32_t value, size_t count) {
+    if (count * 4 >= SIMD_THRESHOLD && g_fill32) {
+        kernel_fpu_begin();
+        g_fill32(dst, value, count);
+        kernel_fpu_end();
+    } else {
+        rep_stosl(dst, value, count);
+    }
+}
+
+void *memset(void *dst, int value, size_t n) {
+    unsigned char *d = dst;
+
+    if (n < SIMD_THRESHOLD || !g_fill32) {
+        rep_stosb(d, (unsigned char)value, n);
+        return dst;
+    }
+
+    size_t head = (-(uint64_t)d) & 3;
+    rep_stosb(d, (unsigned char)value, head);
+    memset32((uint32_t *)(d + head), (unsigned char)value * 0x01010101U, (n - head) / 4);
+    rep_stosb(d + n - ((n - head) & 3), (unsigned char)value, (n - head) & 3);
+    return dst;
+}
+
+void memcpy_nt(void *dst, const void *src, size_t n) {
+    if (n >= SIMD_THRESHOLD && g_copy_nt) {
+        kernel_fpu_begin();
+        g_copy_nt(dst, src, n);
+        kernel_fpu_end();
+    } else {
+        copy_nt_scalar(dst, src, n);
+        __asm__ volatile("sfence" ::: "memory");
+    }
+}
@@ -0,0 +1,240 @@
+#include "../include/paging.h"
+#include "../include/pmm.h"
+#include "../include/cpu.h"
+#include "../include/spinlock.h"
+#include "../include/util.h"
+
+#define MSR_IA32_PAT    0x277
+#define CR4_PGE         (1UL << 7)
+#define CR4_PCIDE       (1UL << 17)
+#define CR3_NOFLUSH     (1UL << 63)
+
+// PAT memory types
+#define PAT_UC          0x00
+#define PAT_WC          0x01
+#define PAT_WT          0x04
+#define PAT_WP          0x05
+#define PAT_WB          0x06
+#define PAT_UC_MINUS    0x07
+
+// Slot i is selected by PAT:PCD:PWT == i; page_cache_t mirrors slots 0-3
+#define PAT_VALUE ((uint64_t)PAT_WB | (uint64_t)PAT_WC << 8 | (uint64_t)PAT_UC_MINUS << 16 | \
+                   (uint64_t)PAT_UC << 24 | (uint64_t)PAT_WB << 32 | (uint64_t)PAT_WP << 40 | \
+                   (uint64_t)PAT_UC_MINUS << 48 | (uint64_t)PAT_WT << 56)
+
+#define LOW_4G          0x100000000UL
+
+static uint64_t *g_pml4;
+static int g_has_1g_pages;
+static int g_has_pcid;
+static int g_has_invpcid;
+static paging_stats_t g_paging_stats;
+static spinlock_t g_paging_lock = SPINLOCK_INIT;
+
+static uint64_t *alloc_table(void) {
+    uint64_t phys = pmm_alloc_page();
+    if (!phys) return 0;
+    uint64_t *table = phys_to_virt(phys);
+    memset(table, 0, PAGE_SIZE);
+    g_paging_stats.tables++;
+    return table;
+}
+
+static uint64_t cache_bits(page_cache_t cache) {
+    return ((cache & 1) ? PTE_PWT : 0) | ((cache & 2) ? PTE_PCD : 0);
+}
+
+// Replace a huge leaf at `level` (3: 1 GiB, 2: 2 MiB) with a table of
+// next-size leaves carrying the same attributes
+static uint64_t *split_huge(uint64_t *entry, unsigned int level) {
+    uint64_t *table = alloc_table();
+    if (!table) return 0;
+
+    uint64_t size = level == 3 ? PAGE_SIZE_1G : PAGE_SIZE_2M;
+    uint64_t child_size = level == 3 ? PAGE_SIZE_2M : PAGE_SIZE;
+    uint64_t base = *entry & PTE_ADDR_MASK & ~(size - 1);
+    uint64_t flags = *entry & ~PTE_ADDR_MASK;
+
+    // The PAT bit lives at bit 12 in huge entries and bit 7 in 4K entries
+    if (level == 3) {
+        flags |= *entry & PTE_PAT_HUGE;
+    } else {
+        flags &= ~PTE_HUGE;
+        if (*entry & PTE_PAT_HUGE) flags |= PTE_PAT_4K;
+    }
+
+    for (unsigned int i = 0; i < 512; i++)
+        table[i] = (base + i * child_size) | flags;
+
+    *entry = virt_to_phys(table) | PTE_PRESENT | PTE_WRITE;
+    return table;
+}
+
+static int map_level(uint64_t *table, unsigned int level, uint64_t virt, uint64_t phys,
+                     uint64_t size, uint64_t flags) {
+    unsigned int shift = 12 + 9 * (level - 1);
+    uint64_t entry_size = 1UL << shift;
+
+    while (size) {
+        uint64_t *entry = &table[(virt >> shift) & 511];
+        uint64_t chunk = entry_size - (virt & (entry_size - 1));
+        if (chunk > size) chunk = size;
+
+        int huge_ok = (level == 2 || (level == 3 && g_has_1g_pages)) &&
+                      chunk == entry_size && !(phys & (entry_size - 1));
+        int is_table = (*entry & PTE_PRESENT) && !(*entry & PTE_HUGE);
+
+        if (level == 1) {
+            *entry = phys | flags;
+            g_paging_stats.pages_4k++;
+        } else if (huge_ok && !is_table) {
+            *entry = phys | flags | PTE_HUGE;
+            if (level == 3) g_paging_stats.pages_1g++;
+            else g_paging_stats.pages_2m++;
+        } else {
+            uint64_t *next;
+            if (!(*entry & PTE_PRESENT)) {
+                next = alloc_table();
+                if (!next) return -1;
+                *entry = virt_to_phys(next) | PTE_PRESENT | PTE_WRITE;
+            } else if (*entry & PTE_HUGE) {
+                next = split_huge(entry, level);
+                if (!next) return -1;
+            } else {
+                next = phys_to_virt(*entry & PTE_ADDR_MASK);
+            }
+            if (map_level(next, level - 1, virt, phys, chunk, flags) != 0) return -1;
+        }
+
+        virt += chunk;
+        phys += chunk;
+        size -= chunk;
+    }
+    return 0;
+}
+
+// Identity map [phys, phys + size), overriding whatever was mapped there
+static int map_identity(uint64_t phys, uint64_t size, page_cache_t cache) {
+    uint64_t end = (phys + size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    phys &= ~(PAGE_SIZE - 1);
+
+    // Huge entries encode the cache type the same way at levels 2 and 3; 4K
+    // leaves only differ in the PAT bit, which slots 0-3 never set
+    uint64_t flags = PTE_PRESENT | PTE_WRITE | PTE_GLOBAL | cache_bits(cache);
+    return map_level(g_pml4, 4, phys, phys, end - phys, flags);
+}
+
+static int is_device_type(unsigned int type) {
+    return type == EFI_RESERVED_MEMORY_TYPE || type == EFI_MEMORY_MAPPED_IO ||
+           type == EFI_MEMORY_MAPPED_IO_PORT_SPACE || type == EFI_PAL_CODE;
+}
+
+static void detect_features(void) {
+    uint32_t a, b, c, d;
+
+    cpuid(0x80000001, 0, &a, &b, &c, &d);
+    g_has_1g_pages = (d & (1U << 26)) != 0;
+
+    cpuid(1, 0, &a, &b, &c, &d);
+    g_has_pcid = (c & (1U << 17)) != 0;
+
+    cpuid(7, 0, &a, &b, &c, &d);
+    g_has_invpcid = g_has_pcid && (b & (1U << 10));
+}
+
+void paging_init_cpu(void) {
+    unsigned long flags = irq_save();
+
+    // PAT changes require flushed caches and TLBs on both sides of the write
+    __asm__ volatile("wbinvd" ::: "memory");
+    wrmsr(MSR_IA32_PAT, PAT_VALUE);
+    write_cr3(virt_to_phys(g_pml4));
+    __asm__ volatile("wbinvd" ::: "memory");
+
+    unsigned long cr4 = read_cr4() | CR4_PGE;
+    // PCIDE may only be set while CR3 holds PCID 0, which it does here
+    if (g_has_pcid) cr4 |= CR4_PCIDE;
+    write_cr4(cr4);
+
+    irq_restore(flags);
+}
+
+int paging_init(memory_info_t *memory_info, framebuffer_info_t *framebuffer) {
+    detect_features();
+
+    g_pml4 = alloc_table();
+    if (!g_pml4) return -1;
+
+    // The low 4 GiB holds the PCI hole, LAPIC, IOAPIC and HPET: uncached by
+    // default, with RAM descriptors re-mapped write-back on top
+    if (map_identity(0, LOW_4G, PAGE_CACHE_UC) != 0) return -1;
+
+    efi_memory_descriptor_t *desc;
+    unsigned char *map = memory_info->memory_map;
+    for (unsigned long off = 0; off < memory_info->map_size; off += memory_info->descriptor_size) {
+        desc = (efi_memory_descriptor_t *)(map + off);
+        uint64_t size = desc->number_of_pages * EFI_PAGE_SIZE;
+        page_cache_t cache = is_device_type(desc->type) ? PAGE_CACHE_UC : PAGE_CACHE_WB;
+
+        // Device ranges below 4 GiB are already covered
+        if (cache == PAGE_CACHE_UC && desc->physical_start + size <= LOW_4G) continue;
+        if (map_identity(desc->physical_start, size, cache) != 0) return -1;
+    }
+
+    uint64_t fb_size = (uint64_t)framebuffer->framebuffer_height * framebuffer->framebuffer_pitch;
+    if (map_identity(framebuffer->framebuffer_base, fb_size, PAGE_CACHE_WC) != 0) return -1;
+
+    paging_init_cpu();
+
+    g_paging_stats.pcid = g_has_pcid;
+    g_paging_stats.invpcid = g_has_invpcid;
+    return 0;
+}
+
+int paging_map_mmio(uint64_t phys, uint64_t size, page_cache_t cache) {
+    unsigned long flags = spin_lock_irqsave(&g_paging_lock);
+    int ret = map_identity(phys, size, cache);
+    spin_unlock_irqrestore(&g_paging_lock, flags);
+
+    // Cache type changes must not leave stale translations behind
+    uint64_t pages = (size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    if (pages > 64) {
+        paging_flush_all();
+    } else {
+        for (uint64_t i = 0; i < pages; i++)
+            paging_invalidate((phys & ~(PAGE_SIZE - 1)) + i * PAGE_SIZE);
+    }
+    return ret;
+}
+
+void paging_load(uint64_t pml4_phys, uint16_t pcid) {
+    if (g_has_pcid)
+        write_cr3(pml4_phys | (pcid & 0xFFF) | CR3_NOFLUSH);
+    else
+        write_cr3(pml4_phys);
+}
+
+void paging_invalidate(uint64_t virt) {
+    __asm__ volatile("invlpg (%0)" : : "r"(virt) : "memory");
+}
+
+void paging_flush_all(void) {
+    if (g_has_invpcid) {
+        // Type 2: all PCIDs, global entries included
+        struct { uint64_t pcid, addr; } desc = { 0, 0 };
+        __asm__ volatile("invpcid %0, %1" : : "m"(desc), "r"(2UL) : "memory");
+    } else {
+        // Toggling PGE drops global entries without touching CR3
+        unsigned long cr4 = read_cr4();
+        write_cr4(cr4 & ~CR4_PGE);
+        write_cr4(cr4);
+    }
+}
+
+uint64_t paging_kernel_pml4(void) {
+    return virt_to_phys(g_pml4);
+}
+
+void paging_get_stats(paging_stats_t *stats) {
+    *stats = g_paging_stats;
+}
@@ -0,0 +1,529 @@
+#include "../include/pci.h"
+#include "../include/acpi.h"
+#include "../include/apic.h"
+#include "../include/cpu.h"
+#include "../include/histogram.h"
+#include "../include/idt.h"
+#include "../include/kernel.h"
+#include "../include/klog.h"
+#include "../include/paging.h"
+#include "../include/percpu.h"
+#include "../include/pmm.h"
+#include "../include/spinlock.h"
+#include "../include/tsc.h"
+#include "../include/util.h"
+
+#define LOW_4G              0x100000000UL
+
+#define ECAM_BUS_SHIFT      20
+#define ECAM_DEV_SHIFT      15
+#define ECAM_FUNC_SHIFT     12
+
+#define HEADER_MULTI_FUNC   0x80
+#define HEADER_TYPE_MASK    0x7F
+
+#define BAR_IO              0x1
+#define BAR_TYPE_64         0x4
+#define BAR_PREFETCH        0x8
+
+// MSI capability
+#define MSI_CONTROL         0x02
+#define MSI_ADDR_LOW        0x04
+#define MSI_ADDR_HIGH       0x08    // 64-bit capable functions only
+#define MSI_CTRL_ENABLE     (1U << 0)
+#define MSI_CTRL_MMC_SHIFT  1       // log2 of the vectors the function can use
+#define MSI_CTRL_MME_SHIFT  4       // log2 of the vectors enabled
+#define MSI_CTRL_64BIT      (1U << 7)
+#define MSI_CTRL_MASKABLE   (1U << 8)
+
+// MSI-X capability and table
+#define MSIX_CONTROL        0x02
+#define MSIX_TABLE          0x04
+#define MSIX_CTRL_SIZE_MASK 0x7FF
+#define MSIX_CTRL_MASK_ALL  (1U << 14)
+#define MSIX_CTRL_ENABLE    (1U << 15)
+#define MSIX_BIR_MASK       0x7
+#define MSIX_ENTRY_WORDS    4       // address low, address high, data, control
+#define MSIX_ENTRY_MASKED   (1U << 0)
+
+// Fixed delivery, physical destination, edge triggered
+#define MSI_ADDRESS_BASE    0xFEE00000U
+#define MSI_DEST_SHIFT      12
+
+#define VECTOR_COUNT        (PCI_IRQ_VECTOR_LAST - PCI_IRQ_VECTOR_FIRST + 1)
+
+static pci_device_t g_devices[PCI_MAX_DEVICES];
+static unsigned int g_device_count;
+static pci_stats_t g_stats;
+
+// Vector pool: the irq each vector belongs to, NULL if free
+static pci_irq_t *g_vector_irqs[VECTOR_COUNT];
+static unsigned int g_cpu_vectors[MAX_CPUS];
+static spinlock_t g_pci_lock = SPINLOCK_INIT;
+
+static void size_bars(pci_device_t *dev) {
+    // Decoding stays off while the BARs hold all-ones
+    uint16_t command = pci_read16(dev, PCI_CFG_COMMAND);
+    pci_write16(dev, PCI_CFG_COMMAND, command & ~(PCI_COMMAND_IO | PCI_COMMAND_MEMORY));
+
+    for (unsigned int i = 0; i < PCI_MAX_BARS; i++) {
+        unsigned int off = PCI_CFG_BAR0 + i * 4;
+        uint32_t orig = pci_read32(dev, off);
+        pci_write32(dev, off, 0xFFFFFFFF);
+        uint32_t mask = pci_read32(dev, off);
+        pci_write32(dev, off, orig);
+        pci_bar_t *bar = &dev->bars[i];
+
+        if (orig & BAR_IO) {
+            mask &= ~3U;
+            if (!mask) continue;
+            // The upper half may read back as zero for 16-bit decoders
+            if (!(mask & 0xFFFF0000)) mask |= 0xFFFF0000;
+            bar->io = 1;
+            bar->base = orig & ~3U;
+            bar->size = (uint32_t)(~mask + 1);
+            continue;
+        }
+
+        uint64_t base = orig & ~0xFUL;
+        uint64_t size_mask = mask & ~0xFUL;
+        if ((orig & 0x6) == BAR_TYPE_64 && i + 1 < PCI_MAX_BARS) {
+            uint32_t orig_high = pci_read32(dev, off + 4);
+            pci_write32(dev, off + 4, 0xFFFFFFFF);
+            uint32_t mask_high = pci_read32(dev, off + 4);
+            pci_write32(dev, off + 4, orig_high);
+            base |= (uint64_t)orig_high << 32;
+            size_mask |= (uint64_t)mask_high << 32;
+            bar->is_64 = 1;
+        } else if (size_mask) {
+            size_mask |= 0xFFFFFFFF00000000UL;
+        }
+        if (size_mask) {
+            bar->base = base;
+            bar->size = ~size_mask + 1;
+            bar->prefetchable = (orig & BAR_PREFETCH) != 0;
+        }
+        // The upper half of a 64-bit BAR has no entry of its own
+        if (bar->is_64) i++;
+    }
+    pci_write16(dev, PCI_CFG_COMMAND, command);
+}
+
+unsigned int pci_next_capability(const pci_device_t *dev, unsigned int id, unsigned int after) {
+    if (!(pci_read16(dev, PCI_CFG_STATUS) & PCI_STATUS_CAP_LIST)) return 0;
+
+    unsigned int off = after ? pci_read8(dev, after + 1) : pci_read8(dev, PCI_CFG_CAP_PTR);
+    // The list lives in the first 256 bytes; the bound also stops loops
+    for (unsigned int hops = 0; off >= 0x40 && hops < 48; hops++) {
+        off &= ~3U;
+        if (pci_read8(dev, off) == id) return off;
+        off = pci_read8(dev, off + 1);
+    }
+    return 0;
+}
+
+static void add_function(volatile uint8_t *config, uint16_t segment, unsigned int bus,
+                         unsigned int dev, unsigned int func) {
+    if (g_device_count == PCI_MAX_DEVICES) {
+        klog_warn("pci: more than %u functions, ignoring %02x:%02x.%u", PCI_MAX_DEVICES, bus, dev, func);
+        return;
+    }
+    pci_device_t *d = &g_devices[g_device_count++];
+    d->config = config;
+    d->segment = segment;
+    d->bus = bus;
+    d->dev = dev;
+    d->func = func;
+    d->vendor_id = pci_read16(d, PCI_CFG_VENDOR_ID);
+    d->device_id = pci_read16(d, PCI_CFG_DEVICE_ID);
+    uint32_t class_rev = pci_read32(d, PCI_CFG_REVISION);
+    d->revision = class_rev & 0xFF;
+    d->prog_if = (class_rev >> 8) & 0xFF;
+    d->subclass = (class_rev >> 16) & 0xFF;
+    d->class_code = class_rev >> 24;
+    d->header_type = pci_read8(d, PCI_CFG_HEADER_TYPE) & HEADER_TYPE_MASK;
+
+    // Bridges have a different layout past the first two BARs
+    if (d->header_type == 0) {
+        d->subsystem_vendor = pci_read16(d, PCI_CFG_SUBSYSTEM_VENDOR);
+        d->subsystem_id = pci_read16(d, PCI_CFG_SUBSYSTEM_ID);
+        size_bars(d);
+    }
+    d->msi_cap = pci_next_capability(d, PCI_CAP_MSI, 0);
+    d->msix_cap = pci_next_capability(d, PCI_CAP_MSIX, 0);
+    d->pcie_cap = pci_next_capability(d, PCI_CAP_PCIE, 0);
+    if (d->msix_cap)
+        d->msix_entries = (pci_read16(d, d->msix_cap + MSIX_CONTROL) & MSIX_CTRL_SIZE_MASK) + 1;
+}
+
+static void scan_ecam(const acpi_ecam_t *ecam) {
+    for (unsigned int bus = ecam->bus_start; bus <= ecam->bus_end; bus++) {
+        for (unsigned int dev = 0; dev < 32; dev++) {
+            for (unsigned int func = 0; func < 8; func++) {
+                volatile uint8_t *config = phys_to_virt(ecam->base +
+                    ((uint64_t)(bus - ecam->bus_start) << ECAM_BUS_SHIFT) +
+                    ((uint64_t)dev << ECAM_DEV_SHIFT) + ((uint64_t)func << ECAM_FUNC_SHIFT));
+                g_stats.functions_probed++;
+                if (*(volatile uint16_t *)config == 0xFFFF) {
+                    // Without function 0 there is no device
+                    if (func == 0) break;
+                    continue;
+                }
+                add_function(config, ecam->segment, bus, dev, func);
+                if (func == 0 && !(config[PCI_CFG_HEADER_TYPE] & HEADER_MULTI_FUNC)) break;
+            }
+        }
+    }
+}
+
+int pci_init(void) {
+    const acpi_info_t *acpi = acpi_get_info();
+    if (!acpi || !acpi->ecam_count) return -1;
+
+    uint64_t start = rdtsc();
+    for (unsigned int i = 0; i < acpi->ecam_count; i++) {
+        const acpi_ecam_t *ecam = &acpi->ecam[i];
+        if (ecam->bus_end < ecam->bus_start) continue;
+        uint64_t size = (uint64_t)(ecam->bus_end - ecam->bus_start + 1) << ECAM_BUS_SHIFT;
+        // The low 4 GiB is already mapped uncached
+        if (ecam->base + size > LOW_4G && paging_map_mmio(ecam->base, size, PAGE_CACHE_UC) != 0) {
+            klog_err("pci: cannot map ECAM at 0x%lx", ecam->base);
+            continue;
+        }
+        scan_ecam(ecam);
+    }
+    g_stats.enumerate_cycles = rdtsc() - start;
+
+    // Too many fields for one klog record; format them here instead
+    char line[80];
+    for (unsigned int i = 0; i < g_device_count; i++) {
+        const pci_device_t *d = &g_devices[i];
+        ksnprintf(line, sizeof(line), "pci: %04x:%02x:%02x.%u %04x:%04x class %02x.%02x.%02x%s%s",
+                  d->segment, d->bus, d->dev, d->func, d->vendor_id, d->device_id,
+                  d->class_code, d->subclass, d->prog_if,
+                  d->msix_cap ? " MSI-X" : "", d->msi_cap ? " MSI" : "");
+        klog_text(KLOG_INFO, line);
+    }
+    return g_device_count;
+}
+
+unsigned int pci_device_count(void) {
+    return g_device_count;
+}
+
+pci_device_t *pci_get_device(unsigned int index) {
+    return index < g_device_count ? &g_devices[index] : 0;
+}
+
+static unsigned int next_index(const pci_device_t *from) {
+    return from ? (unsigned int)(from - g_devices) + 1 : 0;
+}
+
+pci_device_t *pci_find_device(uint16_t vendor_id, uint16_t device_id, pci_device_t *from) {
+    for (unsigned int i = next_index(from); i < g_device_count; i++) {
+        pci_device_t *d = &g_devices[i];
+        if ((vendor_id == 0xFFFF || d->vendor_id == vendor_id) &&
+            (device_id == 0xFFFF || d->device_id == device_id))
+            return d;
+    }
+    return 0;
+}
+
+pci_device_t *pci_find_class(uint8_t class_code, uint8_t subclass, pci_device_t *from) {
+    for (unsigned int i = next_index(from); i < g_device_count; i++) {
+        pci_device_t *d = &g_devices[i];
+        if ((class_code == 0xFF || d->class_code == class_code) &&
+            (subclass == 0xFF || d->subclass == subclass))
+            return d;
+    }
+    return 0;
+}
+
+void pci_enable_device(pci_device_t *dev) {
+    uint16_t command = pci_read16(dev, PCI_CFG_COMMAND) | PCI_COMMAND_MEMORY | PCI_COMMAND_BUS_MASTER;
+    for (unsigned int i = 0; i < PCI_MAX_BARS; i++)
+        if (dev->bars[i].io && dev->bars[i].size) command |= PCI_COMMAND_IO;
+    pci_write16(dev, PCI_CFG_COMMAND, command);
+}
+
+volatile void *pci_map_bar(pci_device_t *dev, unsigned int index) {
+    if (index >= PCI_MAX_BARS) return 0;
+    pci_bar_t *bar = &dev->bars[index];
+    if (!bar->size || bar->io) return 0;
+
+    if (!bar->mapped) {
+        if (bar->base + bar->size > LOW_4G &&
+            paging_map_mmio(bar->base, bar->size, PAGE_CACHE_UC) != 0)
+            return 0;
+        bar->mapped = 1;
+    }
+    return phys_to_virt(bar->base);
+}
+
+static void pci_interrupt(interrupt_frame_t *frame) {
+    unsigned int vector = frame->vector & (IDT_VECTORS - 1);
+    pci_irq_t *irq = __atomic_load_n(&g_vector_irqs[vector - PCI_IRQ_VECTOR_FIRST], __ATOMIC_ACQUIRE);
+    if (irq) {
+        pci_irq_handler_t handler = __atomic_load_n(&irq->handler, __ATOMIC_ACQUIRE);
+        if (handler) handler(irq->ctx);
+    }
+    apic_eoi();
+}
+
+// First of `count` free vectors aligned to `align`; -1 if there is no room.
+// Called with g_pci_lock held.
+static int alloc_vectors(unsigned int count, unsigned int align) {
+    unsigned int first = (PCI_IRQ_VECTOR_FIRST + align - 1) & ~(align - 1);
+    for (unsigned int v = first; v + count - 1 <= PCI_IRQ_VECTOR_LAST; v += align) {
+        unsigned int n = 0;
+        while (n < count && !g_vector_irqs[v + n - PCI_IRQ_VECTOR_FIRST]) n++;
+        if (n == count) return v;
+    }
+    return -1;
+}
+
+// Online CPU with the fewest vectors; MSI can only name 8-bit APIC ids
+static unsigned int pick_cpu(void) {
+    unsigned int best = 0;
+    for (unsigned int i = 1; i < MAX_CPUS; i++) {
+        percpu_t *cpu = percpu_get(i);
+        if (!cpu || !cpu->online || cpu->apic_id > 0xFF) continue;
+        if (g_cpu_vectors[i] < g_cpu_vectors[best]) best = i;
+    }
+    return best;
+}
+
+// Claim `vector` for irq `index` of `dev`, targeting `cpu`
+static int claim_vector(pci_device_t *dev, unsigned int index, unsigned int vector, unsigned int cpu) {
+    pci_irq_t *irq = &dev->irqs[index];
+    if (interrupt_register(vector, pci_interrupt) != 0) return -1;
+    irq->vector = vector;
+    irq->cpu = cpu;
+    irq->handler = 0;
+    irq->ctx = 0;
+    __atomic_store_n(&g_vector_irqs[vector - PCI_IRQ_VECTOR_FIRST], irq, __ATOMIC_RELEASE);
+    g_cpu_vectors[cpu]++;
+    g_stats.vectors_used++;
+    return 0;
+}
+
+static void release_vectors(pci_device_t *dev, unsigned int count) {
+    for (unsigned int i = 0; i < count; i++) {
+        pci_irq_t *irq = &dev->irqs[i];
+        interrupt_unregister(irq->vector);
+        __atomic_store_n(&g_vector_irqs[irq->vector - PCI_IRQ_VECTOR_FIRST], 0, __ATOMIC_RELEASE);
+        g_cpu_vectors[irq->cpu]--;
+        g_stats.vectors_used--;
+    }
+}
+
+static uint32_t msi_address(unsigned int cpu) {
+    return MSI_ADDRESS_BASE | percpu_get(cpu)->apic_id << MSI_DEST_SHIFT;
+}
+
+static int setup_msix(pci_device_t *dev, unsigned int count) {
+    uint32_t table_reg = pci_read32(dev, dev->msix_cap + MSIX_TABLE);
+    volatile uint8_t *bar = pci_map_bar(dev, table_reg & MSIX_BIR_MASK);
+    if (!bar) return -1;
+    dev->msix_table = (volatile uint32_t *)(bar + (table_reg & ~MSIX_BIR_MASK));
+
+    if (count > dev->msix_entries) count = dev->msix_entries;
+    unsigned int n = 0;
+    for (; n < count; n++) {
+        int vector = alloc_vectors(1, 1);
+        if (vector < 0 || claim_vector(dev, n, vector, pick_cpu()) != 0) break;
+    }
+    if (!n) return -1;
+
+    // Hold the whole function masked while the entries change
+    uint16_t control = pci_read16(dev, dev->msix_cap + MSIX_CONTROL);
+    pci_write16(dev, dev->msix_cap + MSIX_CONTROL, control | MSIX_CTRL_ENABLE | MSIX_CTRL_MASK_ALL);
+    for (unsigned int i = 0; i < n; i++) {
+        volatile uint32_t *entry = dev->msix_table + i * MSIX_ENTRY_WORDS;
+        entry[3] = MSIX_ENTRY_MASKED;
+        entry[0] = msi_address(dev->irqs[i].cpu);
+        entry[1] = 0;
+        entry[2] = dev->irqs[i].vector;
+    }
+    pci_write16(dev, dev->msix_cap + MSIX_CONTROL, (control | MSIX_CTRL_ENABLE) & ~MSIX_CTRL_MASK_ALL);
+    dev->irq_mode = PCI_IRQ_MSIX;
+    return n;
+}
+
+static int setup_msi(pci_device_t *dev, unsigned int count) {
+    uint16_t control = pci_read16(dev, dev->msi_cap + MSI_CONTROL);
+    unsigned int capable = 1U << ((control >> MSI_CTRL_MMC_SHIFT) & 7);
+
+    // Multiple messages need an aligned block, all on one CPU
+    unsigned int n = 1;
+    while (n * 2 <= count && n * 2 <= capable) n *= 2;
+    int first = -1;
+    for (; n; n /= 2)
+        if ((first = alloc_vectors(n, n)) >= 0) break;
+    if (first < 0) return -1;
+
+    unsigned int cpu = pick_cpu();
+    for (unsigned int i = 0; i < n; i++) {
+        if (claim_vector(dev, i, first + i, cpu) != 0) {
+            release_vectors(dev, i);
+            return -1;
+        }
+    }
+
+    unsigned int data_off = control & MSI_CTRL_64BIT ? 0x0C : 0x08;
+    pci_write32(dev, dev->msi_cap + MSI_ADDR_LOW, msi_address(cpu));
+    if (control & MSI_CTRL_64BIT) pci_write32(dev, dev->msi_cap + MSI_ADDR_HIGH, 0);
+    pci_write16(dev, dev->msi_cap + data_off, first);
+    if (control & MSI_CTRL_MASKABLE) pci_write32(dev, dev->msi_cap + data_off + 4, (1U << n) - 1);
+
+    unsigned int log2 = 0;
+    while ((1U << log2) < n) log2++;
+    control &= ~(7U << MSI_CTRL_MME_SHIFT);
+    control |= log2 << MSI_CTRL_MME_SHIFT;
+    // Without mask bits, MSI stays off until pci_request_irq() unmasks it
+    if (control & MSI_CTRL_MASKABLE) control |= MSI_CTRL_ENABLE;
+    pci_write16(dev, dev->msi_cap + MSI_CONTROL, control);
+    dev->irq_mode = PCI_IRQ_MSI;
+    return n;
+}
+
+int pci_alloc_irqs(pci_device_t *dev, unsigned int count) {
+    if (!count || dev->irq_mode != PCI_IRQ_NONE) return -1;
+    if (count > PCI_MAX_IRQS) count = PCI_MAX_IRQS;
+
+    // The MSI-X table sits behind a memory BAR
+    pci_write16(dev, PCI_CFG_COMMAND, pci_read16(dev, PCI_CFG_COMMAND) | PCI_COMMAND_MEMORY);
+
+    unsigned long flags = spin_lock_irqsave(&g_pci_lock);
+    int n = -1;
+    if (dev->msix_cap) n = setup_msix(dev, count);
+    if (n < 0 && dev->msi_cap) n = setup_msi(dev, count);
+    if (n > 0) dev->irq_count = n;
+    spin_unlock_irqrestore(&g_pci_lock, flags);
+
+    if (n > 0)
+        pci_write16(dev, PCI_CFG_COMMAND, pci_read16(dev, PCI_CFG_COMMAND) | PCI_COMMAND_INTX_OFF);
+    return n;
+}
+
+void pci_mask_irq(pci_device_t *dev, unsigned int index, int masked) {
+    if (index >= dev->irq_count) return;
+
+    if (dev->irq_mode == PCI_IRQ_MSIX) {
+        volatile uint32_t *control = dev->msix_table + index * MSIX_ENTRY_WORDS + 3;
+        *control = masked ? MSIX_ENTRY_MASKED : 0;
+    } else if (dev->irq_mode == PCI_IRQ_MSI) {
+        uint16_t msi_control = pci_read16(dev, dev->msi_cap + MSI_CONTROL);
+        if (msi_control & MSI_CTRL_MASKABLE) {
+            unsigned int mask_off = dev->msi_cap + (msi_control & MSI_CTRL_64BIT ? 0x10 : 0x0C);
+            uint32_t bits = pci_read32(dev, mask_off);
+            bits = masked ? bits | 1U << index : bits & ~(1U << index);
+            pci_write32(dev, mask_off, bits);
+        } else {
+            msi_control = masked ? msi_control & ~MSI_CTRL_ENABLE : msi_control | MSI_CTRL_ENABLE;
+            pci_write16(dev, dev->msi_cap + MSI_CONTROL, msi_control);
+        }
+    }
+}
+
+int pci_request_irq(pci_device_t *dev, unsigned int index, pci_irq_handler_t handler, void *ctx) {
+    if (index >= dev->irq_count || !handler) return -1;
+    pci_irq_t *irq = &dev->irqs[index];
+    irq->ctx = ctx;
+    __atomic_store_n(&irq->handler, handler, __ATOMIC_RELEASE);
+    pci_mask_irq(dev, index, 0);
+    return 0;
+}
+
+void pci_free_irqs(pci_device_t *dev) {
+    if (dev->irq_mode == PCI_IRQ_NONE) return;
+
+    for (unsigned int i = 0; i < dev->irq_count; i++) pci_mask_irq(dev, i, 1);
+    if (dev->irq_mode == PCI_IRQ_MSIX) {
+        uint16_t control = pci_read16(dev, dev->msix_cap + MSIX_CONTROL);
+        pci_write16(dev, dev->msix_cap + MSIX_CONTROL, control & ~MSIX_CTRL_ENABLE);
+    } else {
+        uint16_t control = pci_read16(dev, dev->msi_cap + MSI_CONTROL);
+        pci_write16(dev, dev->msi_cap + MSI_CONTROL, control & ~MSI_CTRL_ENABLE);
+    }
+
+    unsigned long flags = spin_lock_irqsave(&g_pci_lock);
+    release_vectors(dev, dev->irq_count);
+    spin_unlock_irqrestore(&g_pci_lock, flags);
+
+    dev->irq_mode = PCI_IRQ_NONE;
+    dev->irq_count = 0;
+    pci_write16(dev, PCI_CFG_COMMAND, pci_read16(dev, PCI_CFG_COMMAND) & ~PCI_COMMAND_INTX_OFF);
+}
+
+void pci_get_stats(pci_stats_t *stats) {
+    *stats = g_stats;
+    stats->vectors_free = VECTOR_COUNT - g_stats.vectors_used;
+}
+
+#define SELFTEST_CONFIG_READS   1024
+
+// Time configuration reads and check that vectors spread over the CPUs and
+// return to the pool
+void pci_selftest(void) {
+    char line[128];
+    pci_stats_t stats;
+
+    if (!g_device_count) {
+        boot_print("pci: no functions, selftest skipped", COLOR_YELLOW);
+        return;
+    }
+
+    histogram_t cost;
+    hist_reset(&cost);
+    for (unsigned int i = 0; i < SELFTEST_CONFIG_READS; i++) {
+        const pci_device_t *d = &g_devices[i % g_device_count];
+        uint64_t t0 = rdtsc();
+        (void)pci_read16(d, PCI_CFG_VENDOR_ID);
+        hist_add(&cost, rdtsc() - t0);
+    }
+
+    pci_get_stats(&stats);
+    ksnprintf(line, sizeof(line), "pci: %u functions in %lu us (%lu probed), config read mean %lu cycles",
+              g_device_count, tsc_cycles_to_ns(stats.enumerate_cycles) / 1000, stats.functions_probed,
+              hist_mean(&cost));
+    boot_print(line, COLOR_CYAN);
+
+    // Borrow vectors from the first function with MSI-X (or MSI) that no
+    // driver has claimed, without enabling its interrupt sources
+    pci_device_t *dev = 0;
+    for (unsigned int i = 0; i < g_device_count && !dev; i++)
+        if (g_devices[i].msix_cap && g_devices[i].irq_mode == PCI_IRQ_NONE) dev = &g_devices[i];
+    for (unsigned int i = 0; i < g_device_count && !dev; i++)
+        if (g_devices[i].msi_cap && g_devices[i].irq_mode == PCI_IRQ_NONE) dev = &g_devices[i];
+    if (!dev) {
+        boot_print("pci: no MSI-capable function, vector test skipped", COLOR_YELLOW);
+        return;
+    }
+
+    uint16_t command = pci_read16(dev, PCI_CFG_COMMAND);
+    unsigned int free_before = stats.vectors_free;
+    int n = pci_alloc_irqs(dev, PCI_MAX_IRQS);
+    unsigned int cpus = 0;
+    int ok = n > 0;
+    for (int i = 0; i < n; i++) {
+        unsigned int j;
+        for (j = 0; j < (unsigned int)i && dev->irqs[j].cpu != dev->irqs[i].cpu; j++) ;
+        if (j == (unsigned int)i) cpus++;
+        for (j = 0; j < (unsigned int)i; j++)
+            if (dev->irqs[j].vector == dev->irqs[i].vector) ok = 0;
+    }
+    // MSI-X vectors go to distinct CPUs until every online CPU has one
+    unsigned int online = percpu_online_count();
+    if (dev->irq_mode == PCI_IRQ_MSIX && cpus < ((unsigned int)n < online ? (unsigned int)n : online)) ok = 0;
+    const char *mode = dev->irq_mode == PCI_IRQ_MSIX ? "MSI-X" : "MSI";
+
+    pci_free_irqs(dev);
+    pci_write16(dev, PCI_CFG_COMMAND, command);
+    pci_get_stats(&stats);
+    ok = ok && stats.vectors_free == free_before;
+
+    ksnprintf(line, sizeof(line), "pci: %02x:%02x.%u got %d %s vectors on %u CPUs, %s",
+              dev->bus, dev->dev, dev->func, n, mode, cpus, ok ? "ok" : "FAILED");
+    boot_print(line, ok ? COLOR_CYAN : COLOR_RED);
+}
@@ -0,0 +1,30 @@
+#include "../include/percpu.h"
+
+static percpu_t g_bsp_percpu;
+static percpu_t *g_percpu[MAX_CPUS];
+static unsigned int g_online_count;
+
+void percpu_install(percpu_t *p, unsigned int cpu_id) {
+    p->self = p;
+    p->cpu_id = cpu_id;
+    g_percpu[cpu_id] = p;
+    wrmsr(MSR_GS_BASE, (uint64_t)p);
+}
+
+void percpu_set_online(percpu_t *p) {
+    __atomic_store_n(&p->online, 1, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&g_online_count, 1, __ATOMIC_RELEASE);
+}
+
+void percpu_init_bsp(void) {
+    percpu_install(&g_bsp_percpu, 0);
+    percpu_set_online(&g_bsp_percpu);
+}
+
+percpu_t *percpu_get(unsigned int cpu_id) {
+    return cpu_id < MAX_CPUS ? g_percpu[cpu_id] : 0;
+}
+
+unsigned int percpu_online_count(void) {
+    return __atomic_load_n(&g_online_count, __ATOMIC_ACQUIRE);
+}
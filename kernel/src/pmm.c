@@ -0,0 +1,394 @@
+#include "../include/pmm.h"
+#include "../include/error.h"
+#include "../include/util.h"
+#include "../include/tsc.h"
+#include "../include/cpu.h"
+#include "../include/spinlock.h"
+
+// Per-page state byte: heads of free and allocated blocks carry their order,
+// every other page of a block is a tail. Reserved/absent pages stay zero.
+#define PAGE_INFO_RESERVED  0x00
+#define PAGE_INFO_FREE      0x80
+#define PAGE_INFO_USED      0x40
+#define PAGE_INFO_TAIL      0x20
+#define PAGE_INFO_ORDER     0x1F
+
+// Free blocks are linked through their own first bytes
+typedef struct free_block {
+    struct free_block *next;
+    struct free_block *prev;
+} free_block_t;
+
+typedef struct {
+    uint64_t base;
+    uint64_t end;
+} phys_range_t;
+
+extern char _kernel_start[];
+extern char _kernel_end[];
+
+static free_block_t *g_free_lists[PMM_MAX_ORDER + 1];
+static uint64_t g_free_counts[PMM_MAX_ORDER + 1];
+static uint8_t *g_page_info;
+static uint64_t g_max_pfn;
+static phys_range_t g_reserved[PMM_MAX_RESERVED];
+static unsigned int g_reserved_count;
+static uint64_t g_total_pages;
+static uint64_t g_free_pages;
+static uint64_t g_reclaimed_pages;
+static int g_boot_services_released;
+static memory_info_t *g_memory_info;
+static uint64_t g_low_next = PAGE_SIZE;    // page 0 holds the real-mode IVT
+static spinlock_t g_pmm_lock = SPINLOCK_INIT;
+
+#define FOR_EACH_DESCRIPTOR(desc, info)                                              \
+    for (efi_memory_descriptor_t *desc = (efi_memory_descriptor_t *)(info)->memory_map; \
+         (unsigned char *)desc < (unsigned char *)(info)->memory_map + (info)->map_size;  \
+         desc = (efi_memory_descriptor_t *)((unsigned char *)desc + (info)->descriptor_size))
+
+// Memory the kernel may own once boot services are gone. Loader regions hold
+// the bootloader image (including its 64 MiB scratch buffer) and are dead
+// after the jump to kernel_main; boot services regions are firmware leftovers.
+static int is_boot_services_type(unsigned int type) {
+    return type == EFI_BOOT_SERVICES_CODE || type == EFI_BOOT_SERVICES_DATA;
+}
+
+// Memory the kernel may own once boot services are gone. Loader regions hold
+// the bootloader image (including its 64 MiB scratch buffer) and are dead
+// after the jump to kernel_main. Boot services regions are firmware leftovers,
+// but they hold the page tables, GDT and IDT the kernel is entered with, so
+// they stay off limits until pmm_release_boot_services().
+static int is_usable_type(unsigned int type) {
+    switch (type) {
+    case EFI_CONVENTIONAL_MEMORY:
+    case EFI_LOADER_CODE:
+    case EFI_LOADER_DATA:
+        return 1;
+    case EFI_BOOT_SERVICES_CODE:
+    case EFI_BOOT_SERVICES_DATA:
+        return g_boot_services_released;
+    default:
+        return 0;
+    }
+}
+
+static inline free_block_t *pfn_to_block(uint64_t pfn) {
+    return (free_block_t *)phys_to_virt(pfn << PAGE_SHIFT);
+}
+
+static inline uint64_t block_to_pfn(free_block_t *block) {
+    return virt_to_phys(block) >> PAGE_SHIFT;
+}
+
+static void list_push(uint64_t pfn, unsigned int order) {
+    free_block_t *block = pfn_to_block(pfn);
+    block->prev = 0;
+    block->next = g_free_lists[order];
+    if (block->next) block->next->prev = block;
+    g_free_lists[order] = block;
+    g_free_counts[order]++;
+}
+
+static void list_remove(free_block_t *block, unsigned int order) {
+    if (block->prev) block->prev->next = block->next;
+    else g_free_lists[order] = block->next;
+    if (block->next) block->next->prev = block->prev;
+    g_free_counts[order]--;
+}
+
+// Insert a block into the free lists, merging with free buddies on the way up
+static void buddy_insert(uint64_t pfn, unsigned int order) {
+    g_page_info[pfn] = PAGE_INFO_TAIL;
+
+    while (order < PMM_MAX_ORDER) {
+        uint64_t buddy = pfn ^ (1UL << order);
+        if (buddy + (1UL << order) > g_max_pfn) break;
+        if (g_page_info[buddy] != (PAGE_INFO_FREE | order)) break;
+
+        list_remove(pfn_to_block(buddy), order);
+        g_page_info[buddy] = PAGE_INFO_TAIL;
+        pfn &= ~(1UL << order);
+        order++;
+    }
+
+    g_page_info[pfn] = PAGE_INFO_FREE | order;
+    list_push(pfn, order);
+}
+
+// Hand [start_pfn, end_pfn) to the allocator as maximal aligned blocks
+static uint64_t free_aligned_range(uint64_t start_pfn, uint64_t end_pfn) {
+    uint64_t pfn = start_pfn;
+
+    while (pfn < end_pfn) {
+        unsigned int order = PMM_MAX_ORDER;
+        while (order && ((pfn & ((1UL << order) - 1)) || pfn + (1UL << order) > end_pfn))
+            order--;
+        buddy_insert(pfn, order);
+        pfn += 1UL << order;
+    }
+    return end_pfn - start_pfn;
+}
+
+// Free [base, end) minus every reserved range from index `first` onwards
+static uint64_t seed_range(uint64_t base, uint64_t end, unsigned int first) {
+    for (unsigned int i = first; i < g_reserved_count; i++) {
+        phys_range_t *r = &g_reserved[i];
+        if (r->end <= base || r->base >= end) continue;
+
+        uint64_t pages = 0;
+        if (r->base > base) pages += seed_range(base, r->base, i + 1);
+        if (r->end < end) pages += seed_range(r->end, end, i + 1);
+        return pages;
+    }
+
+    base = (base + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    end &= ~(PAGE_SIZE - 1);
+    if (base >= end) return 0;
+    return free_aligned_range(base >> PAGE_SHIFT, end >> PAGE_SHIFT);
+}
+
+// Seed every usable descriptor clipped to [lo, hi), or only the boot
+// services ones
+static uint64_t seed_descriptors(memory_info_t *info, uint64_t lo, uint64_t hi, int boot_services) {
+    uint64_t seeded = 0;
+
+    FOR_EACH_DESCRIPTOR(desc, info) {
+        if (!is_usable_type(desc->type)) continue;
+        if (boot_services && !is_boot_services_type(desc->type)) continue;
+
+        uint64_t base = desc->physical_start;
+        uint64_t end = base + desc->number_of_pages * EFI_PAGE_SIZE;
+        if (base < lo) base = lo;
+        if (end > hi) end = hi;
+        if (base < PMM_LOW_LIMIT) base = PMM_LOW_LIMIT;
+        if (base >= end) continue;
+
+        uint64_t pages = seed_range(base, end, 0);
+        g_total_pages += pages;
+        g_free_pages += pages;
+        if (desc->type != EFI_CONVENTIONAL_MEMORY) g_reclaimed_pages += pages;
+        seeded += pages;
+    }
+    return seeded;
+}
+
+// First usable, unreserved stretch of `size` bytes at or above 1 MiB
+static uint64_t find_free_range(memory_info_t *info, uint64_t size) {
+    FOR_EACH_DESCRIPTOR(desc, info) {
+        if (desc->type != EFI_CONVENTIONAL_MEMORY) continue;
+
+        uint64_t end = desc->physical_start + desc->number_of_pages * EFI_PAGE_SIZE;
+        uint64_t base = desc->physical_start < PMM_LOW_LIMIT ? PMM_LOW_LIMIT : desc->physical_start;
+        int moved = 1;
+
+        while (moved && base + size <= end) {
+            moved = 0;
+            for (unsigned int i = 0; i < g_reserved_count; i++) {
+                if (g_reserved[i].end > base && g_reserved[i].base < base + size) {
+                    base = (g_reserved[i].end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+                    moved = 1;
+                }
+            }
+        }
+        if (base + size <= end) return base;
+    }
+    return 0;
+}
+
+void pmm_add_reserved(uint64_t base, uint64_t size) {
+    if (g_reserved_count >= PMM_MAX_RESERVED) panic("pmm: too many reserved ranges");
+    g_reserved[g_reserved_count].base = base & ~(PAGE_SIZE - 1);
+    g_reserved[g_reserved_count].end = (base + size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    g_reserved_count++;
+}
+
+static void remove_reserved(uint64_t base) {
+    for (unsigned int i = 0; i < g_reserved_count; i++) {
+        if (g_reserved[i].base == (base & ~(PAGE_SIZE - 1))) {
+            g_reserved[i] = g_reserved[--g_reserved_count];
+            return;
+        }
+    }
+}
+
+int pmm_init(memory_info_t *memory_info) {
+    uint64_t map_base = (uint64_t)memory_info->memory_map;
+    g_memory_info = memory_info;
+
+    pmm_add_reserved((uint64_t)_kernel_start, (uint64_t)(_kernel_end - _kernel_start));
+    pmm_add_reserved(map_base, memory_info->map_size);
+
+    g_max_pfn = 0;
+    FOR_EACH_DESCRIPTOR(desc, memory_info) {
+        if (!is_usable_type(desc->type) && !is_boot_services_type(desc->type)) continue;
+        uint64_t end_pfn = (desc->physical_start >> PAGE_SHIFT) + desc->number_of_pages;
+        if (end_pfn > g_max_pfn) g_max_pfn = end_pfn;
+    }
+
+    // One state byte per page frame, carved out of conventional memory
+    uint64_t info_size = (g_max_pfn + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    uint64_t info_base = find_free_range(memory_info, info_size);
+    if (!info_base) return -1;
+    pmm_add_reserved(info_base, info_size);
+    g_page_info = phys_to_virt(info_base);
+    memset(g_page_info, PAGE_INFO_RESERVED, info_size);
+
+    seed_descriptors(memory_info, 0, ~0UL, 0);
+
+    // Move the map into allocator-owned memory so the loader's buffer can be reused
+    uint64_t copy = pmm_alloc_pages(pmm_order_for_size(memory_info->map_size));
+    if (!copy) return -1;
+    memcpy(phys_to_virt(copy), memory_info->memory_map, memory_info->map_size);
+    memory_info->memory_map = phys_to_virt(copy);
+
+    remove_reserved(map_base);
+    seed_descriptors(memory_info, map_base & ~(PAGE_SIZE - 1),
+                     (map_base + memory_info->map_size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1), 0);
+    return 0;
+}
+
+uint64_t pmm_release_boot_services(void) {
+    unsigned long flags = spin_lock_irqsave(&g_pmm_lock);
+    uint64_t pages = 0;
+    if (!g_boot_services_released) {
+        g_boot_services_released = 1;
+        pages = seed_descriptors(g_memory_info, 0, ~0UL, 1);
+    }
+    spin_unlock_irqrestore(&g_pmm_lock, flags);
+    return pages;
+}
+
+unsigned int pmm_order_for_size(uint64_t size) {
+    unsigned int order = 0;
+    while ((PAGE_SIZE << order) < size) order++;
+    return order;
+}
+
+uint64_t pmm_alloc_pages(unsigned int order) {
+    if (order > PMM_MAX_ORDER) return 0;
+
+    unsigned long flags = spin_lock_irqsave(&g_pmm_lock);
+    unsigned int k = order;
+    while (k <= PMM_MAX_ORDER && !g_free_lists[k]) k++;
+    if (k > PMM_MAX_ORDER) {
+        spin_unlock_irqrestore(&g_pmm_lock, flags);
+        return 0;
+    }
+
+    free_block_t *block = g_free_lists[k];
+    list_remove(block, k);
+    uint64_t pfn = block_to_pfn(block);
+
+    // Split down, returning the upper halves to their free lists
+    while (k > order) {
+        k--;
+        uint64_t buddy = pfn + (1UL << k);
+        g_page_info[buddy] = PAGE_INFO_FREE | k;
+        list_push(buddy, k);
+    }
+
+    g_page_info[pfn] = PAGE_INFO_USED | order;
+    g_free_pages -= 1UL << order;
+    spin_unlock_irqrestore(&g_pmm_lock, flags);
+    return pfn << PAGE_SHIFT;
+}
+
+void pmm_free_pages(uint64_t phys, unsigned int order) {
+    uint64_t pfn = phys >> PAGE_SHIFT;
+    unsigned long flags = spin_lock_irqsave(&g_pmm_lock);
+
+    if ((phys & (PAGE_SIZE - 1)) || pfn >= g_max_pfn || order > PMM_MAX_ORDER ||
+        g_page_info[pfn] != (PAGE_INFO_USED | order))
+        panic("pmm_free_pages: invalid or double free");
+
+    buddy_insert(pfn, order);
+    g_free_pages += 1UL << order;
+    spin_unlock_irqrestore(&g_pmm_lock, flags);
+}
+
+int pmm_block_order(uint64_t phys) {
+    uint64_t pfn = phys >> PAGE_SHIFT;
+
+    if ((phys & (PAGE_SIZE - 1)) || pfn >= g_max_pfn) return -1;
+    uint8_t info = g_page_info[pfn];
+    return (info & PAGE_INFO_USED) ? (int)(info & PAGE_INFO_ORDER) : -1;
+}
+
+uint64_t pmm_alloc_low(unsigned int pages) {
+    uint64_t size = (uint64_t)pages * PAGE_SIZE;
+    unsigned long flags = spin_lock_irqsave(&g_pmm_lock);
+    uint64_t found = 0;
+
+    FOR_EACH_DESCRIPTOR(desc, g_memory_info) {
+        if (!is_usable_type(desc->type)) continue;
+        uint64_t base = desc->physical_start;
+        uint64_t end = base + desc->number_of_pages * EFI_PAGE_SIZE;
+        if (base < g_low_next) base = g_low_next;
+        if (end > PMM_LOW_END) end = PMM_LOW_END;
+        if (base + size <= end) {
+            found = base;
+            g_low_next = base + size;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&g_pmm_lock, flags);
+    return found;
+}
+
+void pmm_get_stats(pmm_stats_t *stats) {
+    stats->total_pages = g_total_pages;
+    stats->free_pages = g_free_pages;
+    stats->reclaimed_pages = g_reclaimed_pages;
+    for (unsigned int i = 0; i <= PMM_MAX_ORDER; i++)
+        stats->free_blocks[i] = g_free_counts[i];
+}
+
+static void bench_order(unsigned int order, uint64_t *table, unsigned int count,
+                        unsigned int rounds, const char *label) {
+    uint64_t alloc_cycles = 0, free_cycles = 0, ops = 0;
+    unsigned int got = 0;
+
+    for (unsigned int r = 0; r < rounds; r++) {
+        uint64_t t0 = rdtsc();
+        for (got = 0; got < count; got++) {
+            table[got] = pmm_alloc_pages(order);
+            if (!table[got]) break;
+        }
+        uint64_t t1 = rdtsc();
+        for (unsigned int i = 0; i < got; i++)
+            pmm_free_pages(table[i], order);
+        uint64_t t2 = rdtsc();
+
+        alloc_cycles += t1 - t0;
+        free_cycles += t2 - t1;
+        ops += got;
+    }
+
+    char line[128];
+    if (!ops) {
+        ksnprintf(line, sizeof(line), "PMM %s: no blocks available", label);
+    } else {
+        ksnprintf(line, sizeof(line), "PMM %s: %u blocks, alloc %lu/s (%lu cyc), free %lu/s (%lu cyc)",
+                  label, got,
+                  tsc_rate_per_sec(ops, alloc_cycles), alloc_cycles / ops,
+                  tsc_rate_per_sec(ops, free_cycles), free_cycles / ops);
+    }
+    boot_print(line, COLOR_CYAN);
+}
+
+void pmm_selftest(void) {
+    uint64_t free_before = g_free_pages;
+    uint64_t table_phys = pmm_alloc_pages(3);
+    if (!table_phys) {
+        boot_print("PMM selftest: out of memory", COLOR_RED);
+        return;
+    }
+    uint64_t *table = phys_to_virt(table_phys);
+
+    bench_order(PMM_ORDER_4K, table, 4096, 16, "4K");
+    bench_order(PMM_ORDER_2M, table, 256, 4, "2M");
+    bench_order(PMM_ORDER_1G, table, 4, 4, "1G");
+
+    pmm_free_pages(table_phys, 3);
+    if (g_free_pages != free_before) panic("pmm_selftest: pages leaked");
+}
@@ -0,0 +1,345 @@
+#include "../include/profile.h"
+#include "../include/apic.h"
+#include "../include/cpu.h"
+#include "../include/error.h"
+#include "../include/idt.h"
+#include "../include/klog.h"
+#include "../include/ksym.h"
+#include "../include/percpu.h"
+#include "../include/pmm.h"
+#include "../include/slab.h"
+#include "../include/timer.h"
+#include "../include/tsc.h"
+#include "../include/util.h"
+
+#define PROFILE_FORMAT_VERSION      1
+
+#define MSR_PERFEVTSEL0             0x186
+#define MSR_PMC0                    0x0C1
+#define MSR_PERF_GLOBAL_STATUS      0x38E
+#define MSR_PERF_GLOBAL_CTRL        0x38F
+#define MSR_PERF_GLOBAL_OVF_CTRL    0x390
+
+#define PERFEVTSEL_CORE_CYCLES      0x3CUL      // unhalted core cycles, umask 0
+#define PERFEVTSEL_OS               (1UL << 17)
+#define PERFEVTSEL_INT              (1UL << 20)
+#define PERFEVTSEL_EN               (1UL << 22)
+
+// Writes through MSR_PMC0 sign-extend bit 31, so periods stay below it
+#define PMU_MAX_PERIOD              0x7FFFFFFFUL
+// How long after stopping an overflow NMI latched before the stop may
+// still be delivered
+#define PMU_NMI_GRACE_NS            1000000UL
+
+// Frames must lie above the interrupted RSP and within this distance of it,
+// which keeps a corrupt chain from walking into unmapped memory
+#define PROFILE_STACK_SPAN          (64 * 1024)
+
+#define SOURCE_TIMER                0
+#define SOURCE_PMU                  1
+
+typedef struct {
+    uint32_t depth;
+    uint32_t cpu;
+    uint64_t pc[PROFILE_MAX_DEPTH];         // pc[0] is the interrupted RIP
+} profile_sample_t;
+
+_Static_assert(sizeof(profile_sample_t) == 128, "samples should fill cache lines");
+
+typedef struct {
+    profile_sample_t *samples;
+    unsigned int capacity;
+    volatile unsigned int count;            // written by the owning CPU only
+    uint64_t dropped;
+    uint64_t truncated;
+    uint64_t nmi_grace_until;               // TSC; 0 once used or never stopped
+    timer_event_t tick;
+} profile_cpu_t;
+
+typedef struct {
+    profile_sample_t *sample;               // first sample with this stack
+    unsigned int count;
+} fold_slot_t;
+
+static profile_cpu_t *g_profile_cpus[MAX_CPUS];
+static int g_source = SOURCE_TIMER;
+static volatile int g_running;
+static unsigned int g_hz;
+static uint64_t g_period;                   // TSC or core cycles between samples
+
+static void record(interrupt_frame_t *frame) {
+    profile_cpu_t *p = g_profile_cpus[this_cpu_id()];
+    if (!p || !g_running) return;
+
+    unsigned int n = p->count;
+    if (n == p->capacity) {
+        p->dropped++;
+        return;
+    }
+
+    profile_sample_t *s = &p->samples[n];
+    unsigned int depth = 0;
+    s->pc[depth++] = frame->rip;
+
+    // [rbp] holds the caller's RBP and [rbp + 8] the return address
+    uint64_t rbp = frame->rbp, base = frame->rsp;
+    while (rbp >= base && rbp - base < PROFILE_STACK_SPAN - 16 && !(rbp & 7)) {
+        const uint64_t *fp = (const uint64_t *)rbp;
+        if (!ksym_in_text(fp[1])) break;
+        if (depth == PROFILE_MAX_DEPTH) {
+            p->truncated++;
+            break;
+        }
+        s->pc[depth++] = fp[1];
+        if (fp[0] <= rbp) break;
+        rbp = fp[0];
+    }
+    s->depth = depth;
+    s->cpu = this_cpu_id();
+    __atomic_store_n(&p->count, n + 1, __ATOMIC_RELEASE);
+}
+
+static void timer_tick(timer_event_t *ev, uint64_t now) {
+    if (!g_running) return;
+    interrupt_frame_t *frame = this_cpu()->irq_frame;
+    if (frame) record(frame);
+    timer_schedule(ev, now + g_period);
+}
+
+static void pmu_start_local(void) {
+    wrmsr(MSR_PERFEVTSEL0, 0);
+    wrmsr(MSR_PMC0, -g_period);
+    wrmsr(MSR_PERF_GLOBAL_OVF_CTRL, 1);
+    apic_write(APIC_REG_LVT_PERF, APIC_LVT_DELIVERY_NMI);
+    wrmsr(MSR_PERFEVTSEL0, PERFEVTSEL_CORE_CYCLES | PERFEVTSEL_OS | PERFEVTSEL_INT | PERFEVTSEL_EN);
+    wrmsr(MSR_PERF_GLOBAL_CTRL, rdmsr(MSR_PERF_GLOBAL_CTRL) | 1);
+}
+
+static void pmu_stop_local(void) {
+    wrmsr(MSR_PERF_GLOBAL_CTRL, rdmsr(MSR_PERF_GLOBAL_CTRL) & ~1UL);
+    wrmsr(MSR_PERFEVTSEL0, 0);
+    apic_write(APIC_REG_LVT_PERF, APIC_LVT_MASKED);
+    wrmsr(MSR_PERF_GLOBAL_OVF_CTRL, 1);
+}
+
+static void handle_nmi(interrupt_frame_t *frame) {
+    if (!(rdmsr(MSR_PERF_GLOBAL_STATUS) & 1)) {
+        // pmu_stop_local() clears the status, so an overflow latched just
+        // before it arrives without the bit: forgive one, shortly after the
+        // stop. Anything else is a hardware NMI (watchdog, SERR, IOCHK).
+        profile_cpu_t *p = g_profile_cpus[this_cpu_id()];
+        if (!g_running && p && p->nmi_grace_until && rdtsc() < p->nmi_grace_until) {
+            p->nmi_grace_until = 0;
+            return;
+        }
+        exception_panic(frame, 0);
+    }
+    wrmsr(MSR_PMC0, -g_period);
+    wrmsr(MSR_PERF_GLOBAL_OVF_CTRL, 1);
+    record(frame);
+    // Delivery masked the LVT entry
+    if (g_running) apic_write(APIC_REG_LVT_PERF, APIC_LVT_DELIVERY_NMI);
+}
+
+static void start_local(void) {
+    unsigned long flags = irq_save();
+    if (g_source == SOURCE_PMU) {
+        pmu_start_local();
+    } else {
+        profile_cpu_t *p = g_profile_cpus[this_cpu_id()];
+        if (p) timer_schedule(&p->tick, rdtsc() + g_period);
+    }
+    irq_restore(flags);
+}
+
+static void stop_local(void) {
+    unsigned long flags = irq_save();
+    if (g_source == SOURCE_PMU) {
+        pmu_stop_local();
+        profile_cpu_t *p = g_profile_cpus[this_cpu_id()];
+        if (p) p->nmi_grace_until = rdtsc() + tsc_ns_to_cycles(PMU_NMI_GRACE_NS);
+    } else {
+        profile_cpu_t *p = g_profile_cpus[this_cpu_id()];
+        if (p) timer_cancel(&p->tick);
+    }
+    irq_restore(flags);
+}
+
+static void handle_ipi(interrupt_frame_t *frame) {
+    (void)frame;
+    apic_eoi();
+    if (g_running) start_local();
+    else stop_local();
+}
+
+// Make every other online CPU follow g_running
+static void notify_cpus(void) {
+    unsigned int self = this_cpu_id();
+    for (unsigned int i = 0; i < MAX_CPUS; i++) {
+        percpu_t *p = percpu_get(i);
+        if (i == self || !p || !p->online) continue;
+        apic_send_ipi(p->apic_id, PROFILE_IPI_VECTOR);
+    }
+}
+
+static profile_cpu_t *alloc_cpu(void) {
+    profile_cpu_t *p = kzalloc(sizeof(profile_cpu_t));
+    uint64_t samples = pmm_alloc_pages(PROFILE_BUFFER_ORDER);
+    if (!p || !samples) {
+        kfree(p);
+        if (samples) pmm_free_pages(samples, PROFILE_BUFFER_ORDER);
+        return 0;
+    }
+    p->samples = phys_to_virt(samples);
+    p->capacity = (PAGE_SIZE << PROFILE_BUFFER_ORDER) / sizeof(profile_sample_t);
+    p->tick.fn = timer_tick;
+    return p;
+}
+
+void profile_init(void) {
+    uint32_t max_leaf, a, b, c, d;
+    cpuid(0, 0, &max_leaf, &b, &c, &d);
+    if (max_leaf >= 0xA) {
+        cpuid(0xA, 0, &a, &b, &c, &d);
+        // Version 2 brings the global control and status registers. EBX
+        // bit 0 set means the cycle event is missing.
+        unsigned int version = a & 0xFF, counters = (a >> 8) & 0xFF, events = (a >> 24) & 0xFF;
+        if (version >= 2 && counters >= 1 && events >= 1 && !(b & 1) &&
+            interrupt_register(EXC_NMI, handle_nmi) == 0)
+            g_source = SOURCE_PMU;
+    }
+
+    if (interrupt_register(PROFILE_IPI_VECTOR, handle_ipi) != 0)
+        panic("profile_init: IPI vector already in use");
+}
+
+int profile_start(unsigned int hz) {
+    if (g_running || !hz) return -1;
+
+    for (unsigned int i = 0; i < MAX_CPUS; i++) {
+        percpu_t *cpu = percpu_get(i);
+        if (!cpu || !cpu->online) continue;
+        if (!g_profile_cpus[i] && !(g_profile_cpus[i] = alloc_cpu())) return -1;
+
+        profile_cpu_t *p = g_profile_cpus[i];
+        p->count = 0;
+        p->dropped = p->truncated = 0;
+    }
+
+    g_hz = hz;
+    g_period = tsc_hz() / hz;
+    if (g_source == SOURCE_PMU && g_period > PMU_MAX_PERIOD) g_period = PMU_MAX_PERIOD;
+
+    __atomic_store_n(&g_running, 1, __ATOMIC_RELEASE);
+    start_local();
+    notify_cpus();
+    klog_info("profile: sampling at %u Hz from the %s", hz, profile_source());
+    return 0;
+}
+
+void profile_stop(void) {
+    if (!g_running) return;
+    __atomic_store_n(&g_running, 0, __ATOMIC_RELEASE);
+    stop_local();
+    notify_cpus();
+}
+
+static uint64_t stack_hash(const profile_sample_t *s) {
+    uint64_t h = 0xcbf29ce484222325UL;      // FNV-1a over whole frames
+    for (unsigned int i = 0; i < s->depth; i++) {
+        h ^= s->pc[i];
+        h *= 0x100000001b3UL;
+    }
+    return h ^ (h >> 29);
+}
+
+static int same_stack(const profile_sample_t *a, const profile_sample_t *b) {
+    return a->depth == b->depth && !memcmp(a->pc, b->pc, a->depth * sizeof(uint64_t));
+}
+
+static void write_folded(const fold_slot_t *slot) {
+    // Room is kept for the count; frames that do not fit are cut
+    char line[512];
+    const size_t frames_max = sizeof(line) - 16;
+    const profile_sample_t *s = slot->sample;
+    size_t pos = 0;
+
+    // Outermost caller first
+    for (unsigned int i = s->depth; i-- > 0 && pos < frames_max;) {
+        const char *sep = pos ? ";" : "";
+        const char *name = ksym_lookup(s->pc[i], 0);
+        pos += name ? ksnprintf(line + pos, frames_max - pos, "%s%s", sep, name)
+                    : ksnprintf(line + pos, frames_max - pos, "%s0x%lx", sep, s->pc[i]);
+    }
+    if (pos > frames_max - 1) pos = frames_max - 1;
+    pos += ksnprintf(line + pos, sizeof(line) - pos, " %u\n", slot->count);
+    klog_write_raw(line, pos);
+}
+
+void profile_dump(void) {
+    char line[128];
+    profile_stats_t stats;
+    profile_get_stats(&stats);
+
+    // Fold by function: every frame becomes the start of its symbol
+    for (unsigned int i = 0; i < MAX_CPUS; i++) {
+        profile_cpu_t *p = g_profile_cpus[i];
+        if (!p) continue;
+        unsigned int count = __atomic_load_n(&p->count, __ATOMIC_ACQUIRE);
+        for (unsigned int j = 0; j < count; j++) {
+            profile_sample_t *s = &p->samples[j];
+            for (unsigned int k = 0; k < s->depth; k++) {
+                uint64_t offset;
+                if (ksym_lookup(s->pc[k], &offset)) s->pc[k] -= offset;
+            }
+        }
+    }
+
+    uint64_t slots = 16;
+    while (slots < stats.samples * 2) slots <<= 1;
+    fold_slot_t *table = kzalloc(slots * sizeof(fold_slot_t));
+    if (!table) {
+        klog_warn("profile: no memory to fold %lu samples", stats.samples);
+        return;
+    }
+
+    for (unsigned int i = 0; i < MAX_CPUS; i++) {
+        profile_cpu_t *p = g_profile_cpus[i];
+        if (!p) continue;
+        unsigned int count = __atomic_load_n(&p->count, __ATOMIC_ACQUIRE);
+        for (unsigned int j = 0; j < count; j++) {
+            profile_sample_t *s = &p->samples[j];
+            uint64_t h = stack_hash(s) & (slots - 1);
+            while (table[h].sample && !same_stack(table[h].sample, s)) h = (h + 1) & (slots - 1);
+            if (!table[h].sample) table[h].sample = s;
+            table[h].count++;
+        }
+    }
+
+    // Drained rings first, so that no log line lands inside the dump
+    klog_flush_sync();
+    int len = ksnprintf(line, sizeof(line), "PROFILE-BEGIN %u source=%s hz=%u samples=%lu dropped=%lu truncated=%lu\n",
+                        PROFILE_FORMAT_VERSION, profile_source(), g_hz, stats.samples, stats.dropped,
+                        stats.truncated);
+    klog_write_raw(line, len);
+    for (uint64_t i = 0; i < slots; i++)
+        if (table[i].sample) write_folded(&table[i]);
+    klog_write_raw("PROFILE-END\n", 12);
+
+    kfree(table);
+}
+
+void profile_get_stats(profile_stats_t *stats) {
+    stats->samples = stats->dropped = stats->truncated = 0;
+    for (unsigned int i = 0; i < MAX_CPUS; i++) {
+        profile_cpu_t *p = g_profile_cpus[i];
+        if (!p) continue;
+        stats->samples += __atomic_load_n(&p->count, __ATOMIC_ACQUIRE);
+        stats->dropped += p->dropped;
+        stats->truncated += p->truncated;
+    }
+}
+
+const char *profile_source(void) {
+    return g_source == SOURCE_PMU ? "PMU overflow NMI" : "APIC timer";
+}
@@ -0,0 +1,407 @@
+#include "../include/ps2.h"
+#include "../include/apic.h"
+#include "../include/cpu.h"
+#include "../include/idt.h"
+#include "../include/ioapic.h"
+#include "../include/kernel.h"
+#include "../include/tsc.h"
+#include "../include/util.h"
+
+#define PS2_TIMEOUT_NS          50000000UL  // per controller byte or device reply
+#define PS2_RETRIES             3
+#define PS2_IRQ_BYTES_MAX       16          // bound on the bytes one IRQ reads
+
+// Controller commands
+#define CMD_READ_CONFIG         0x20
+#define CMD_WRITE_CONFIG        0x60
+#define CMD_DISABLE_AUX         0xA7
+#define CMD_ENABLE_AUX          0xA8
+#define CMD_DISABLE_KBD         0xAD
+#define CMD_ENABLE_KBD          0xAE
+#define CMD_WRITE_AUX           0xD4        // next data byte goes to the mouse
+
+#define CONFIG_KBD_IRQ          (1U << 0)
+#define CONFIG_AUX_IRQ          (1U << 1)
+#define CONFIG_AUX_DISABLED     (1U << 5)
+#define CONFIG_TRANSLATE        (1U << 6)
+
+// Device commands and replies
+#define DEV_GET_ID              0xF2
+#define DEV_SET_SAMPLE_RATE     0xF3
+#define DEV_ENABLE_REPORTING    0xF4
+#define DEV_SET_DEFAULTS        0xF6
+#define DEV_ACK                 0xFA
+#define DEV_RESEND              0xFE
+
+#define MOUSE_ID_WHEEL          3
+
+// ps2_kbd_state_t.held
+#define HELD_LSHIFT             (1U << 0)
+#define HELD_RSHIFT             (1U << 1)
+#define HELD_LCTRL              (1U << 2)
+#define HELD_RCTRL              (1U << 3)
+#define HELD_LALT               (1U << 4)
+#define HELD_RALT               (1U << 5)
+
+static ps2_kbd_state_t g_kbd;
+static ps2_mouse_state_t g_mouse;
+static ps2_stats_t g_stats;
+static uint64_t g_timeout_cycles;
+
+// US layout for make codes 0x00-0x39
+static const char g_keymap[] =
+    "\0\x1b" "1234567890-=" "\b\t" "qwertyuiop[]" "\n\0" "asdfghjkl;'`" "\0\\" "zxcvbnm,./" "\0*\0 ";
+static const char g_keymap_shift[] =
+    "\0\x1b" "!@#$%^&*()_+" "\b\t" "QWERTYUIOP{}" "\n\0" "ASDFGHJKL:\"~" "\0|" "ZXCVBNM<>?" "\0*\0 ";
+
+static int wait_status(uint8_t mask, uint8_t want) {
+    uint64_t deadline = rdtsc() + g_timeout_cycles;
+    while ((inb(PS2_STATUS) & mask) != want) {
+        if (rdtsc() > deadline) return -1;
+        cpu_pause();
+    }
+    return 0;
+}
+
+static int write_command(uint8_t cmd) {
+    if (wait_status(PS2_STATUS_INPUT_FULL, 0) != 0) return -1;
+    outb(PS2_COMMAND, cmd);
+    return 0;
+}
+
+static int write_data(uint8_t byte) {
+    if (wait_status(PS2_STATUS_INPUT_FULL, 0) != 0) return -1;
+    outb(PS2_DATA, byte);
+    return 0;
+}
+
+static int read_data(uint8_t *byte) {
+    if (wait_status(PS2_STATUS_OUTPUT_FULL, PS2_STATUS_OUTPUT_FULL) != 0) return -1;
+    *byte = inb(PS2_DATA);
+    return 0;
+}
+
+static void flush_output(void) {
+    for (int i = 0; i < PS2_IRQ_BYTES_MAX && (inb(PS2_STATUS) & PS2_STATUS_OUTPUT_FULL); i++)
+        (void)inb(PS2_DATA);
+}
+
+// Send a command or argument byte to a device and wait for its ACK
+static int device_write(int aux, uint8_t byte) {
+    for (int attempt = 0; attempt < PS2_RETRIES; attempt++) {
+        uint8_t reply;
+        if (aux && write_command(CMD_WRITE_AUX) != 0) return -1;
+        if (write_data(byte) != 0 || read_data(&reply) != 0) return -1;
+        if (reply == DEV_ACK) return 0;
+        if (reply != DEV_RESEND) return -1;
+    }
+    return -1;
+}
+
+static int set_sample_rate(uint8_t rate) {
+    return device_write(1, DEV_SET_SAMPLE_RATE) == 0 && device_write(1, rate) == 0 ? 0 : -1;
+}
+
+// IntelliMouse: sample rates 200, 100, 80 in a row switch the ID to 3
+// and the packets to four bytes
+static int enable_wheel(void) {
+    uint8_t id;
+    if (set_sample_rate(200) != 0 || set_sample_rate(100) != 0 || set_sample_rate(80) != 0) return 0;
+    if (device_write(1, DEV_GET_ID) != 0 || read_data(&id) != 0) return 0;
+    set_sample_rate(100);
+    return id == MOUSE_ID_WHEEL;
+}
+
+static uint8_t modifier_bit(uint8_t key) {
+    switch (key) {
+    case KEY_LSHIFT: return HELD_LSHIFT;
+    case KEY_RSHIFT: return HELD_RSHIFT;
+    case KEY_LCTRL: return HELD_LCTRL;
+    case KEY_RCTRL: return HELD_RCTRL;
+    case KEY_LALT: return HELD_LALT;
+    case KEY_RALT: return HELD_RALT;
+    default: return 0;
+    }
+}
+
+static uint8_t key_ascii(uint8_t key, uint8_t mods) {
+    switch (key) {
+    case KEY_KP_ENTER: return '\n';
+    case KEY_KP_SLASH: return '/';
+    case 0x4A: return '-';
+    case 0x4E: return '+';
+    }
+    if (key >= sizeof(g_keymap) - 1) return 0;
+
+    char c = (mods & INPUT_MOD_SHIFT ? g_keymap_shift : g_keymap)[key];
+    int letter = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    if (letter && (mods & INPUT_MOD_CAPSLOCK)) c ^= 0x20;
+    if (letter && (mods & INPUT_MOD_CTRL)) c &= 0x1F;
+    return (uint8_t)c;
+}
+
+int ps2_kbd_decode(ps2_kbd_state_t *s, uint8_t byte, uint64_t tsc, input_event_t *ev) {
+    if (s->skip) {
+        s->skip--;
+        return 0;
+    }
+    if (byte == 0xE1) {
+        s->skip = 5;                    // Pause: E1 1D 45 E1 9D C5, no release
+        return 0;
+    }
+    if (byte == 0xE0) {
+        s->extended = 1;
+        return 0;
+    }
+    // ACK, resend and error replies; 0xAA (self-test passed) decodes as a
+    // harmless left shift release
+    if (!s->extended && (byte == DEV_ACK || byte == DEV_RESEND || byte == 0x00 || byte == 0xFF))
+        return 0;
+
+    uint8_t key = (byte & 0x7F) | (s->extended ? 0x80 : 0);
+    int released = (byte & 0x80) != 0;
+    s->extended = 0;
+    // Print Screen and the navigation keys wrap themselves in fake shifts
+    if (key == (0x80 | KEY_LSHIFT) || key == (0x80 | KEY_RSHIFT)) return 0;
+
+    uint8_t bit = modifier_bit(key);
+    if (bit) s->held = released ? s->held & ~bit : s->held | bit;
+    else if (key == KEY_CAPSLOCK && !released) s->capslock = !s->capslock;
+
+    uint8_t mods = 0;
+    if (s->held & (HELD_LSHIFT | HELD_RSHIFT)) mods |= INPUT_MOD_SHIFT;
+    if (s->held & (HELD_LCTRL | HELD_RCTRL)) mods |= INPUT_MOD_CTRL;
+    if (s->held & (HELD_LALT | HELD_RALT)) mods |= INPUT_MOD_ALT;
+    if (s->capslock) mods |= INPUT_MOD_CAPSLOCK;
+
+    memset(ev, 0, sizeof(*ev));
+    ev->tsc = tsc;
+    ev->type = INPUT_EV_KEY;
+    ev->key = key;
+    ev->ascii = released ? 0 : key_ascii(key, mods);
+    ev->flags = mods | (released ? INPUT_KEY_RELEASED : 0);
+    return 1;
+}
+
+int ps2_mouse_decode(ps2_mouse_state_t *s, uint8_t byte, uint64_t tsc, input_event_t *ev) {
+    if (s->index && s->resync_cycles && tsc - s->last_tsc > s->resync_cycles) {
+        s->index = 0;
+        s->resyncs++;
+    }
+    s->last_tsc = tsc;
+    // The first byte always has bit 3 set; anything else belongs to a
+    // packet whose start was lost
+    if (s->index == 0 && !(byte & 0x08)) {
+        s->resyncs++;
+        return 0;
+    }
+    s->packet[s->index++] = byte;
+    if (s->index < (s->size ? s->size : 3)) return 0;
+    s->index = 0;
+
+    uint8_t flags = s->packet[0];
+    memset(ev, 0, sizeof(*ev));
+    ev->tsc = tsc;
+    ev->type = INPUT_EV_MOUSE;
+    ev->buttons = flags & (INPUT_BUTTON_LEFT | INPUT_BUTTON_RIGHT | INPUT_BUTTON_MIDDLE);
+    // Nine-bit two's complement with the sign in the first byte; an
+    // overflowed axis carries no usable motion
+    if (!(flags & 0x40)) ev->dx = (int16_t)(s->packet[1] - ((flags << 4) & 0x100));
+    if (!(flags & 0x80)) ev->dy = (int16_t)-(s->packet[2] - ((flags << 3) & 0x100));
+    if (s->size == 4) ev->wheel = (int8_t)(s->packet[3] << 4) >> 4;
+    return 1;
+}
+
+// IRQ 1 and 12 share the output buffer: whichever fires reads everything
+// waiting there and tells the devices apart by the AUX bit. Both are
+// routed to the same CPU and interrupt gates do not nest, so each queue
+// keeps a single producer.
+static void drain(uint64_t tsc) {
+    input_event_t ev;
+    unsigned int bytes = 0;
+    uint8_t status;
+
+    while (bytes < PS2_IRQ_BYTES_MAX && ((status = inb(PS2_STATUS)) & PS2_STATUS_OUTPUT_FULL)) {
+        uint8_t byte = inb(PS2_DATA);
+        bytes++;
+        if (status & PS2_STATUS_AUX_DATA) {
+            if (ps2_mouse_decode(&g_mouse, byte, tsc, &ev)) input_post(INPUT_SOURCE_MOUSE, &ev);
+        } else if (ps2_kbd_decode(&g_kbd, byte, tsc, &ev)) {
+            input_post(INPUT_SOURCE_KEYBOARD, &ev);
+        }
+    }
+    if (!bytes) g_stats.spurious++;
+}
+
+static void handle_keyboard(interrupt_frame_t *frame) {
+    (void)frame;
+    uint64_t tsc = rdtsc();
+    g_stats.keyboard_irqs++;
+    drain(tsc);
+    apic_eoi();
+}
+
+static void handle_mouse(interrupt_frame_t *frame) {
+    (void)frame;
+    uint64_t tsc = rdtsc();
+    g_stats.mouse_irqs++;
+    drain(tsc);
+    apic_eoi();
+}
+
+int ps2_init(void) {
+    uint8_t config;
+
+    g_timeout_cycles = tsc_ns_to_cycles(PS2_TIMEOUT_NS);
+    // No controller: the status port floats high
+    if (!ioapic_available() || inb(PS2_STATUS) == 0xFF) return -1;
+
+    // Both ports off while the configuration changes, so that no device
+    // byte is mistaken for a controller reply
+    if (write_command(CMD_DISABLE_KBD) != 0 || write_command(CMD_DISABLE_AUX) != 0) return -1;
+    flush_output();
+    if (write_command(CMD_READ_CONFIG) != 0 || read_data(&config) != 0) return -1;
+    config = (config & ~(CONFIG_KBD_IRQ | CONFIG_AUX_IRQ)) | CONFIG_TRANSLATE;
+    if (write_command(CMD_WRITE_CONFIG) != 0 || write_data(config) != 0) return -1;
+
+    if (write_command(CMD_ENABLE_KBD) == 0 && device_write(0, DEV_ENABLE_REPORTING) == 0)
+        g_stats.keyboard = 1;
+
+    // Enabling the second port clears its disable bit only if it exists
+    if (write_command(CMD_ENABLE_AUX) == 0 && write_command(CMD_READ_CONFIG) == 0 && read_data(&config) == 0 &&
+        !(config & CONFIG_AUX_DISABLED) && device_write(1, DEV_SET_DEFAULTS) == 0) {
+        g_stats.wheel = enable_wheel();
+        g_stats.mouse = device_write(1, DEV_ENABLE_REPORTING) == 0;
+    }
+    if (!g_stats.keyboard && !g_stats.mouse) return -1;
+
+    g_mouse.size = g_stats.wheel ? 4 : 3;
+    g_mouse.resync_cycles = tsc_ns_to_cycles(PS2_MOUSE_RESYNC_NS);
+    flush_output();
+
+    uint32_t dest = apic_id();
+    if (g_stats.keyboard && (interrupt_register(IRQ_ISA_VECTOR(ISA_IRQ_KEYBOARD), handle_keyboard) != 0 ||
+                             ioapic_route_isa(ISA_IRQ_KEYBOARD, dest) != 0))
+        g_stats.keyboard = 0;
+    if (g_stats.mouse && (interrupt_register(IRQ_ISA_VECTOR(ISA_IRQ_MOUSE), handle_mouse) != 0 ||
+                          ioapic_route_isa(ISA_IRQ_MOUSE, dest) != 0))
+        g_stats.mouse = 0;
+    if (!g_stats.keyboard && !g_stats.mouse) return -1;
+
+    if (write_command(CMD_READ_CONFIG) != 0 || read_data(&config) != 0) return -1;
+    config |= (g_stats.keyboard ? CONFIG_KBD_IRQ : 0) | (g_stats.mouse ? CONFIG_AUX_IRQ : 0);
+    if (write_command(CMD_WRITE_CONFIG) != 0 || write_data(config) != 0) return -1;
+    return 0;
+}
+
+void ps2_get_stats(ps2_stats_t *stats) {
+    *stats = g_stats;
+    stats->mouse_resyncs = g_mouse.resyncs;
+}
+
+typedef struct {
+    const char *name;
+    uint8_t bytes[6];
+    unsigned int count;
+    uint8_t key;                // of the last event
+    uint8_t ascii;
+    uint8_t flags;
+    unsigned int events;
+} kbd_case_t;
+
+// Run in order on one decoder state, so modifiers carry over
+static const kbd_case_t g_kbd_cases[] = {
+    { "a", { 0x1E }, 1, 0x1E, 'a', 0, 1 },
+    { "a release", { 0x9E }, 1, 0x1E, 0, INPUT_KEY_RELEASED, 1 },
+    { "shift+a", { 0x2A, 0x1E }, 2, 0x1E, 'A', INPUT_MOD_SHIFT, 2 },
+    { "shift+2", { 0x03 }, 1, 0x03, '@', INPUT_MOD_SHIFT, 1 },
+    { "shift release", { 0xAA }, 1, KEY_LSHIFT, 0, INPUT_KEY_RELEASED, 1 },
+    { "capslock+a", { 0x3A, 0xBA, 0x1E }, 3, 0x1E, 'A', INPUT_MOD_CAPSLOCK, 3 },
+    { "capslock+shift+a", { 0x36, 0x1E }, 2, 0x1E, 'a', INPUT_MOD_SHIFT | INPUT_MOD_CAPSLOCK, 2 },
+    { "right shift release", { 0xB6 }, 1, KEY_RSHIFT, 0, INPUT_KEY_RELEASED | INPUT_MOD_CAPSLOCK, 1 },
+    { "capslock off", { 0x3A, 0xBA }, 2, KEY_CAPSLOCK, 0, INPUT_KEY_RELEASED, 2 },
+    { "ctrl+c", { 0xE0, 0x1D, 0x2E }, 3, 0x2E, 0x03, INPUT_MOD_CTRL, 2 },
+    { "ctrl release", { 0xE0, 0x9D }, 2, KEY_RCTRL, 0, INPUT_KEY_RELEASED, 1 },
+    { "page up", { 0xE0, 0x49 }, 2, KEY_PGUP, 0, 0, 1 },
+    { "page up release", { 0xE0, 0xC9 }, 2, KEY_PGUP, 0, INPUT_KEY_RELEASED, 1 },
+    { "print screen", { 0xE0, 0x2A, 0xE0, 0x37 }, 4, 0xB7, 0, 0, 1 },
+    { "pause", { 0xE1, 0x1D, 0x45, 0xE1, 0x9D, 0xC5 }, 6, 0, 0, 0, 0 },
+    { "ack", { DEV_ACK }, 1, 0, 0, 0, 0 },
+    { "keypad enter", { 0xE0, 0x1C }, 2, KEY_KP_ENTER, '\n', 0, 1 },
+};
+
+typedef struct {
+    const char *name;
+    uint8_t size;
+    uint8_t bytes[6];
+    unsigned int count;
+    int dx, dy, wheel;
+    uint8_t buttons;
+    unsigned int resyncs;       // expected by the end of the case
+} mouse_case_t;
+
+static const mouse_case_t g_mouse_cases[] = {
+    { "left, right-down", 3, { 0x29, 0x05, 0xFE }, 3, 5, 2, 0, INPUT_BUTTON_LEFT, 0 },
+    { "left-up", 3, { 0x18, 0xF0, 0x03 }, 3, -16, -3, 0, 0, 0 },
+    { "overflow", 3, { 0x4A, 0x80, 0x10 }, 3, 0, -16, 0, INPUT_BUTTON_RIGHT, 0 },
+    { "resync", 3, { 0x00, 0x07, 0x08, 0x01, 0x01 }, 5, 1, -1, 0, 0, 2 },
+    { "wheel", 4, { 0x0C, 0x00, 0x00, 0x0F }, 4, 0, 0, -1, INPUT_BUTTON_MIDDLE, 0 },
+};
+
+void ps2_selftest(void) {
+    char line[128];
+    input_event_t ev;
+    unsigned int failed = 0;
+    const char *first = 0;
+
+    ps2_kbd_state_t kbd;
+    memset(&kbd, 0, sizeof(kbd));
+    for (unsigned int i = 0; i < sizeof(g_kbd_cases) / sizeof(g_kbd_cases[0]); i++) {
+        const kbd_case_t *c = &g_kbd_cases[i];
+        input_event_t last;
+        unsigned int events = 0;
+        memset(&last, 0, sizeof(last));
+        for (unsigned int b = 0; b < c->count; b++)
+            if (ps2_kbd_decode(&kbd, c->bytes[b], b, &ev)) {
+                last = ev;
+                events++;
+            }
+        if (events != c->events ||
+            (events && (last.key != c->key || last.ascii != c->ascii || last.flags != c->flags))) {
+            if (!failed++) first = c->name;
+        }
+    }
+
+    for (unsigned int i = 0; i < sizeof(g_mouse_cases) / sizeof(g_mouse_cases[0]); i++) {
+        const mouse_case_t *c = &g_mouse_cases[i];
+        ps2_mouse_state_t mouse;
+        unsigned int events = 0;
+        memset(&mouse, 0, sizeof(mouse));
+        memset(&ev, 0, sizeof(ev));
+        mouse.size = c->size;
+        for (unsigned int b = 0; b < c->count; b++) events += ps2_mouse_decode(&mouse, c->bytes[b], b, &ev);
+        if (events != 1 || ev.dx != c->dx || ev.dy != c->dy || ev.wheel != c->wheel || ev.buttons != c->buttons ||
+            mouse.resyncs != c->resyncs) {
+            if (!failed++) first = c->name;
+        }
+    }
+
+    // A packet left half-finished for longer than the resync interval is
+    // abandoned: the late byte has bit 3 clear and is dropped as well
+    ps2_mouse_state_t mouse;
+    memset(&mouse, 0, sizeof(mouse));
+    mouse.size = 3;
+    mouse.resync_cycles = 1000;
+    int late = ps2_mouse_decode(&mouse, 0x08, 0, &ev) + ps2_mouse_decode(&mouse, 0x01, 5000, &ev);
+    if (late != 0 || mouse.resyncs != 2 || mouse.index != 0) {
+        if (!failed++) first = "resync timeout";
+    }
+
+    if (failed)
+        ksnprintf(line, sizeof(line), "PS/2: decoder selftest FAILED: %u cases, first '%s'", failed, first);
+    else
+        ksnprintf(line, sizeof(line), "PS/2: decoder selftest ok (%u keyboard, %u mouse cases)",
+                  (unsigned int)(sizeof(g_kbd_cases) / sizeof(g_kbd_cases[0])),
+                  (unsigned int)(sizeof(g_mouse_cases) / sizeof(g_mouse_cases[0])) + 1);
+    boot_print(line, failed ? COLOR_RED : COLOR_CYAN);
+}
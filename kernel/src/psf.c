@@ -0,0 +1,284 @@
+#include "../include/psf.h"
+#include "../include/cpu.h"
+#include "../include/framebuffer.h"
+#include "../include/glyph_cache.h"
+#include "../include/initrd.h"
+#include "../include/kernel.h"
+#include "../include/pmm.h"
+#include "../include/slab.h"
+#include "../include/tsc.h"
+#include "../include/util.h"
+
+#define MAP_MIN_SLOTS   16
+#define TABLE_MALFORMED 0xFFFFFFFF
+
+static unsigned int g_next_font_id = 1;
+
+// Decode one codepoint from the unicode table without reading past its
+// end; TABLE_MALFORMED for a byte that starts no valid sequence
+static uint32_t table_next(const uint8_t **p, const uint8_t *end) {
+    char buf[5] = { 0 };
+    size_t n = end - *p < 4 ? (size_t)(end - *p) : 4;
+    memcpy(buf, *p, n);
+
+    const char *s = buf;
+    uint32_t cp = utf8_next(&s);
+    size_t used = s > buf ? (size_t)(s - buf) : 1;
+    *p += used;
+    return cp == UNICODE_REPLACEMENT && used == 1 ? TABLE_MALFORMED : cp;
+}
+
+static void map_insert(font_t *font, uint32_t codepoint, unsigned int glyph) {
+    for (unsigned int slot = (codepoint * 0x9E3779B1U) & font->map_mask;; slot = (slot + 1) & font->map_mask) {
+        if (font->map_keys[slot] == codepoint + 1) return;      // the first glyph listed wins
+        if (!font->map_keys[slot]) {
+            font->map_keys[slot] = codepoint + 1;
+            font->map_glyphs[slot] = glyph;
+            font->map_entries++;
+            return;
+        }
+    }
+}
+
+// Walk the table: per glyph, single codepoints, then optional sequences
+// (ignored; they need combining support), then PSF2_SEPARATOR. With `font`
+// NULL only count the codepoints.
+static unsigned int walk_table(const uint8_t *p, const uint8_t *end, unsigned int glyph_count, font_t *font) {
+    unsigned int glyph = 0, count = 0;
+    int in_sequence = 0;
+
+    while (p < end && glyph < glyph_count) {
+        if (*p == PSF2_SEPARATOR) {
+            glyph++;
+            in_sequence = 0;
+            p++;
+        } else if (*p == PSF2_START_SEQ) {
+            in_sequence = 1;
+            p++;
+        } else {
+            uint32_t cp = table_next(&p, end);
+            if (in_sequence || cp == TABLE_MALFORMED) continue;
+            if (font) map_insert(font, cp, glyph);
+            count++;
+        }
+    }
+    return count;
+}
+
+int psf_parse(const void *data, size_t size, const char *name, font_t *font) {
+    psf2_header_t hdr;
+
+    if (size < sizeof(hdr)) return -1;
+    memcpy(&hdr, data, sizeof(hdr));
+    if (hdr.magic != PSF2_MAGIC || hdr.header_size < sizeof(hdr) || !hdr.glyph_count) return -1;
+    if (!hdr.width || !hdr.height || hdr.width > PSF_MAX_WIDTH || hdr.height > PSF_MAX_HEIGHT) return -1;
+    if (hdr.bytes_per_glyph != hdr.height * ((hdr.width + 7) / 8)) return -1;
+    uint64_t glyphs_end = hdr.header_size + (uint64_t)hdr.glyph_count * hdr.bytes_per_glyph;
+    if (glyphs_end > size) return -1;
+
+    memset(font, 0, sizeof(*font));
+    font->name = name;
+    font->width = hdr.width;
+    font->height = hdr.height;
+    font->line_height = hdr.height;
+    font->bytes_per_row = (hdr.width + 7) / 8;
+    font->bytes_per_glyph = hdr.bytes_per_glyph;
+    font->glyph_count = hdr.glyph_count;
+    font->glyphs = (const uint8_t *)data + hdr.header_size;
+    font->fallback = '?' < hdr.glyph_count ? '?' : 0;
+
+    if (hdr.flags & PSF2_HAS_UNICODE_TABLE) {
+        const uint8_t *table = (const uint8_t *)data + glyphs_end, *end = (const uint8_t *)data + size;
+        unsigned int count = walk_table(table, end, hdr.glyph_count, 0);
+
+        if (count) {
+            unsigned int slots = MAP_MIN_SLOTS;
+            while (slots < count * 2) slots <<= 1;
+            font->map_keys = kzalloc((size_t)slots * 2 * sizeof(uint32_t));
+            if (!font->map_keys) return -1;
+            font->map_glyphs = font->map_keys + slots;
+            font->map_mask = slots - 1;
+            walk_table(table, end, hdr.glyph_count, font);
+
+            // Unmapped codepoints show as U+FFFD's glyph, else as '?'
+            font->fallback = hdr.glyph_count;
+            unsigned int replacement = font_glyph(font, UNICODE_REPLACEMENT);
+            unsigned int question = font_glyph(font, '?');
+            font->fallback = replacement < hdr.glyph_count ? replacement : question < hdr.glyph_count ? question : 0;
+        }
+    }
+
+    font->id = g_next_font_id++;
+    return 0;
+}
+
+int psf_load(const char *path, font_t *font) {
+    const initrd_file_t *file = initrd_lookup(path);
+    if (!file) return -1;
+    return psf_parse(file->data, file->size, file->path, font);
+}
+
+void psf_free(font_t *font) {
+    kfree(font->map_keys);
+    memset(font, 0, sizeof(*font));
+}
+
+#define TEST_SCALE          2
+#define TEST_SIZE           (8 * TEST_SCALE)
+#define TEST_GLYPHS         128
+#define TEST_BYTES_PER_ROW  ((TEST_SIZE + 7) / 8)
+#define TEST_WIDTH          1920
+#define TEST_HEIGHT         1080
+
+static uint8_t *put_utf8(uint8_t *p, uint32_t cp) {
+    if (cp < 0x80) {
+        *p++ = cp;
+    } else if (cp < 0x800) {
+        *p++ = 0xC0 | cp >> 6;
+        *p++ = 0x80 | (cp & 0x3F);
+    } else if (cp < 0x10000) {
+        *p++ = 0xE0 | cp >> 12;
+        *p++ = 0x80 | (cp >> 6 & 0x3F);
+        *p++ = 0x80 | (cp & 0x3F);
+    } else {
+        *p++ = 0xF0 | cp >> 18;
+        *p++ = 0x80 | (cp >> 12 & 0x3F);
+        *p++ = 0x80 | (cp >> 6 & 0x3F);
+        *p++ = 0x80 | (cp & 0x3F);
+    }
+    return p;
+}
+
+// The built-in font scaled up as a PSF2 image, with a unicode table that
+// maps ASCII, two accented letters, the euro sign and U+FFFD, plus a
+// sequence that must be ignored; returns the image size
+static size_t build_test_font(uint8_t *image) {
+    psf2_header_t hdr = { PSF2_MAGIC, 0, sizeof(psf2_header_t), PSF2_HAS_UNICODE_TABLE, TEST_GLYPHS,
+                          TEST_SIZE * TEST_BYTES_PER_ROW, TEST_SIZE, TEST_SIZE };
+    memcpy(image, &hdr, sizeof(hdr));
+
+    uint8_t *glyph = image + sizeof(hdr);
+    memset(glyph, 0, TEST_GLYPHS * hdr.bytes_per_glyph);
+    for (unsigned int g = 0; g < TEST_GLYPHS; g++, glyph += hdr.bytes_per_glyph)
+        for (unsigned int row = 0; row < TEST_SIZE; row++)
+            for (unsigned int col = 0; col < TEST_SIZE; col++)
+                if (g_font[g][row / TEST_SCALE] & (0x80 >> (col / TEST_SCALE)))
+                    glyph[row * TEST_BYTES_PER_ROW + col / 8] |= 0x80 >> (col % 8);
+
+    uint8_t *p = glyph;
+    for (unsigned int g = 0; g < TEST_GLYPHS; g++) {
+        if (g >= 32 && g < 127) p = put_utf8(p, g);
+        if (g == 'e') p = put_utf8(put_utf8(p, 0xE9), 0xE8);
+        if (g == 'E') p = put_utf8(p, 0x20AC);
+        if (g == '?') p = put_utf8(p, UNICODE_REPLACEMENT);
+        if (g == 'A') {
+            *p++ = PSF2_START_SEQ;
+            p = put_utf8(put_utf8(p, 'A'), 0x0301);
+        }
+        *p++ = PSF2_SEPARATOR;
+    }
+    return p - image;
+}
+
+static int check_utf8(void) {
+    static const char text[] = "A\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80\xC0\xAF\xED\xA0\x80Z";
+    static const uint32_t expect[] = { 'A', 0xE9, 0x20AC, 0x1F600, UNICODE_REPLACEMENT, UNICODE_REPLACEMENT,
+                                       UNICODE_REPLACEMENT, UNICODE_REPLACEMENT, UNICODE_REPLACEMENT, 'Z', 0 };
+    const char *s = text;
+    for (unsigned int i = 0; i < sizeof(expect) / sizeof(expect[0]); i++)
+        if (utf8_next(&s) != expect[i]) return 0;
+    return *s == 0;
+}
+
+// Fill the draw target with lines of text; returns the glyphs drawn
+static unsigned int text_page(const font_t *font) {
+    static const char line[] = "Caf\xC3\xA9 cr\xC3\xA8me: 42 \xE2\x82\xAC, status ok [0x1F] -> next; ";
+    unsigned int glyphs = 0, per_line = 0;
+    for (const char *s = line; utf8_next(&s);) per_line++;
+
+    for (unsigned int y = 0; y + font->line_height <= g_fb_height; y += font->line_height)
+        for (unsigned int x = 0; x + (per_line + 1) * font->width <= g_fb_width; x += per_line * font->width) {
+            draw_text(x, y, line, COLOR_WHITE, COLOR_BLUE);
+            glyphs += per_line;
+        }
+    return glyphs;
+}
+
+// Parse a generated font, check the codepoint map and the UTF-8 decoder,
+// then time an off-screen page of text drawn bit by bit and from tiles
+void psf_selftest(void) {
+    char report[160];
+    font_t font;
+    glyph_cache_stats_t before, after;
+    int ok = check_utf8();
+
+    uint8_t *image = kmalloc(sizeof(psf2_header_t) + TEST_GLYPHS * TEST_SIZE * TEST_BYTES_PER_ROW + 1024);
+    uint64_t surface_bytes = (uint64_t)TEST_WIDTH * TEST_HEIGHT * 4;
+    uint64_t surface_phys = pmm_alloc_pages(pmm_order_for_size(surface_bytes));
+    if (!image || !surface_phys) {
+        kfree(image);
+        if (surface_phys) pmm_free_pages(surface_phys, pmm_order_for_size(surface_bytes));
+        boot_print("PSF: out of memory, selftest skipped", COLOR_YELLOW);
+        return;
+    }
+    size_t size = build_test_font(image);
+
+    // Malformed images are refused
+    uint32_t magic = PSF2_MAGIC ^ 1;
+    ok = ok && psf_parse(image, sizeof(psf2_header_t) - 1, "short", &font) != 0;
+    ok = ok && psf_parse(image, sizeof(psf2_header_t) + 100, "truncated", &font) != 0;
+    memcpy(image, &magic, sizeof(magic));
+    ok = ok && psf_parse(image, size, "magic", &font) != 0;
+    magic = PSF2_MAGIC;
+    memcpy(image, &magic, sizeof(magic));
+
+    if (psf_parse(image, size, "test", &font) != 0) {
+        kfree(image);
+        pmm_free_pages(surface_phys, pmm_order_for_size(surface_bytes));
+        boot_print("PSF: test font rejected", COLOR_RED);
+        return;
+    }
+    ok = ok && font.width == TEST_SIZE && font.bytes_per_row == TEST_BYTES_PER_ROW;
+    ok = ok && font_glyph(&font, 'A') == 'A' && font_glyph(&font, 0xE9) == 'e' && font_glyph(&font, 0xE8) == 'e';
+    ok = ok && font_glyph(&font, 0x20AC) == 'E' && font_glyph(&font, 0x0301) == '?';
+    ok = ok && font_glyph(&font, 0x1F600) == '?' && font.map_entries == 95 + 4;
+
+    fb_surface_t surface = { phys_to_virt(surface_phys), TEST_WIDTH, TEST_HEIGHT, TEST_WIDTH };
+    const font_t *previous = draw_get_font();
+    fb_set_target(&surface);
+    draw_set_font(&font);
+
+    // A tile must match the bit-by-bit rendering of the same glyph
+    int was_enabled = glyph_cache_set_enabled(0);
+    draw_glyph(0, 0, &font, 'g', COLOR_YELLOW, COLOR_BLUE);
+    glyph_cache_set_enabled(1);
+    draw_glyph(TEST_SIZE, 0, &font, 'g', COLOR_YELLOW, COLOR_BLUE);
+    for (unsigned int y = 0; y < TEST_SIZE; y++)
+        ok = ok && !memcmp(surface.pixels + y * TEST_WIDTH, surface.pixels + y * TEST_WIDTH + TEST_SIZE,
+                           TEST_SIZE * 4);
+
+    glyph_cache_set_enabled(0);
+    uint64_t t0 = rdtsc();
+    unsigned int glyphs = text_page(&font);
+    uint64_t t1 = rdtsc();
+    glyph_cache_set_enabled(1);
+    glyph_cache_get_stats(&before);
+    uint64_t t2 = rdtsc();
+    text_page(&font);
+    uint64_t t3 = rdtsc();
+    glyph_cache_get_stats(&after);
+    glyph_cache_set_enabled(was_enabled);
+
+    draw_set_font(previous);
+    fb_set_target(0);
+    psf_free(&font);
+    kfree(image);
+    pmm_free_pages(surface_phys, pmm_order_for_size(surface_bytes));
+
+    uint64_t slow = t1 - t0, fast = t3 - t2 ? t3 - t2 : 1, lookups = after.hits - before.hits + after.misses - before.misses;
+    ksnprintf(report, sizeof(report), "PSF %ux%u: %u glyphs bit-test %lu us, tiles %lu us (x%lu.%lu), hits %lu%%, %s",
+              TEST_SIZE, TEST_SIZE, glyphs, tsc_cycles_to_ns(slow) / 1000, tsc_cycles_to_ns(fast) / 1000,
+              slow / fast, slow * 10 / fast % 10, lookups ? (after.hits - before.hits) * 100 / lookups : 0,
+              ok ? "ok" : "FAILED");
+    boot_print(report, ok ? COLOR_CYAN : COLOR_RED);
+}
@@ -0,0 +1,549 @@
+#include "../include/raster.h"
+#include "../include/cpu.h"
+#include "../include/fpu.h"
+#include "../include/kernel.h"
+#include "../include/pmm.h"
+#include "../include/tsc.h"
+#include "../include/util.h"
+
+// Below this many pixels the FPU section costs more than SIMD saves
+#define SIMD_MIN_PIXELS     64
+
+#define ALPHA_MASK          0xFF000000U
+
+typedef char v16qi __attribute__((vector_size(16)));
+typedef short v8hi __attribute__((vector_size(16)));
+typedef unsigned short v8hu __attribute__((vector_size(16)));
+typedef unsigned int v4si __attribute__((vector_size(16)));
+typedef unsigned int v4si_u __attribute__((vector_size(16), aligned(1), may_alias));
+typedef char v32qi __attribute__((vector_size(32)));
+typedef short v16hi __attribute__((vector_size(32)));
+typedef unsigned short v16hu __attribute__((vector_size(32)));
+typedef unsigned int v8si __attribute__((vector_size(32)));
+typedef unsigned int v8si_u __attribute__((vector_size(32), aligned(1), may_alias));
+
+// Row kernels; counts are in pixels
+typedef struct {
+    const char *name;
+    void (*fill)(uint32_t *dst, uint32_t color, unsigned int count);
+    void (*copy)(uint32_t *dst, const uint32_t *src, unsigned int count);
+    void (*blend)(uint32_t *dst, const uint32_t *src, unsigned int count);
+} raster_ops_t;
+
+// Exact for every sum of two 8x8-bit products that stays below 65536
+static inline uint32_t div255(uint32_t t) {
+    return (t + 1 + (t >> 8)) >> 8;
+}
+
+// The alpha channel blends 255 instead of the source alpha, which makes it
+// come out as a + dst_alpha * (255 - a) / 255
+static inline uint32_t blend_pixel(uint32_t s, uint32_t d) {
+    uint32_t a = s >> 24, ia = 255 - a, out = 0;
+    s |= ALPHA_MASK;
+    for (unsigned int shift = 0; shift < 32; shift += 8)
+        out |= div255(((s >> shift) & 0xFF) * a + ((d >> shift) & 0xFF) * ia) << shift;
+    return out;
+}
+
+static void fill_scalar(uint32_t *dst, uint32_t color, unsigned int count) {
+    __asm__ volatile("rep stosl" : "+D"(dst), "+c"(count) : "a"(color) : "memory");
+}
+
+static void copy_scalar(uint32_t *dst, const uint32_t *src, unsigned int count) {
+    __asm__ volatile("rep movsl" : "+D"(dst), "+S"(src), "+c"(count) : : "memory");
+}
+
+static void blend_scalar(uint32_t *dst, const uint32_t *src, unsigned int count) {
+    for (unsigned int i = 0; i < count; i++) {
+        uint32_t a = src[i] & ALPHA_MASK;
+        if (a == ALPHA_MASK) dst[i] = src[i];
+        else if (a) dst[i] = blend_pixel(src[i], dst[i]);
+    }
+}
+
+__attribute__((target("sse2")))
+static void fill_sse2(uint32_t *dst, uint32_t color, unsigned int count) {
+    while (((uint64_t)dst & 15) && count) {
+        *dst++ = color;
+        count--;
+    }
+
+    v4si v = { color, color, color, color };
+    for (; count >= 16; count -= 16, dst += 16) {
+        *(v4si *)(dst + 0) = v;
+        *(v4si *)(dst + 4) = v;
+        *(v4si *)(dst + 8) = v;
+        *(v4si *)(dst + 12) = v;
+    }
+    for (; count >= 4; count -= 4, dst += 4) *(v4si *)dst = v;
+    fill_scalar(dst, color, count);
+}
+
+__attribute__((target("sse2")))
+static void copy_sse2(uint32_t *dst, const uint32_t *src, unsigned int count) {
+    for (; count >= 16; count -= 16, dst += 16, src += 16) {
+        v4si a = *(const v4si_u *)(src + 0), b = *(const v4si_u *)(src + 4);
+        v4si c = *(const v4si_u *)(src + 8), d = *(const v4si_u *)(src + 12);
+        *(v4si_u *)(dst + 0) = a;
+        *(v4si_u *)(dst + 4) = b;
+        *(v4si_u *)(dst + 8) = c;
+        *(v4si_u *)(dst + 12) = d;
+    }
+    copy_scalar(dst, src, count);
+}
+
+// Four pixels at a time: widen to 16-bit lanes, broadcast each pixel's
+// alpha over its lanes, multiply-add, divide by 255 and pack back
+__attribute__((target("sse2")))
+static void blend_sse2(uint32_t *dst, const uint32_t *src, unsigned int count) {
+    const v16qi zero = { 0 };
+    const v8hu force_alpha = { 0, 0, 0, 255, 0, 0, 0, 255 };
+    const v4si alpha = { ALPHA_MASK, ALPHA_MASK, ALPHA_MASK, ALPHA_MASK };
+
+    for (; count >= 4; count -= 4, dst += 4, src += 4) {
+        v4si s = *(const v4si_u *)src;
+        v4si sa = s & alpha;
+        if (__builtin_ia32_pmovmskb128((v16qi)(sa == alpha)) == 0xFFFF) {
+            *(v4si_u *)dst = s;
+            continue;
+        }
+        if (__builtin_ia32_pmovmskb128((v16qi)(sa == 0)) == 0xFFFF) continue;
+
+        v4si d = *(const v4si_u *)dst;
+        v8hu s_lo = (v8hu)__builtin_ia32_punpcklbw128((v16qi)s, zero);
+        v8hu s_hi = (v8hu)__builtin_ia32_punpckhbw128((v16qi)s, zero);
+        v8hu d_lo = (v8hu)__builtin_ia32_punpcklbw128((v16qi)d, zero);
+        v8hu d_hi = (v8hu)__builtin_ia32_punpckhbw128((v16qi)d, zero);
+        v8hu a_lo = (v8hu)__builtin_ia32_pshufhw(__builtin_ia32_pshuflw((v8hi)s_lo, 0xFF), 0xFF);
+        v8hu a_hi = (v8hu)__builtin_ia32_pshufhw(__builtin_ia32_pshuflw((v8hi)s_hi, 0xFF), 0xFF);
+
+        v8hu t_lo = (s_lo | force_alpha) * a_lo + d_lo * (255 - a_lo);
+        v8hu t_hi = (s_hi | force_alpha) * a_hi + d_hi * (255 - a_hi);
+        t_lo = (t_lo + 1 + (t_lo >> 8)) >> 8;
+        t_hi = (t_hi + 1 + (t_hi >> 8)) >> 8;
+        *(v4si_u *)dst = (v4si)__builtin_ia32_packuswb128((v8hi)t_lo, (v8hi)t_hi);
+    }
+    blend_scalar(dst, src, count);
+}
+
+__attribute__((target("avx2")))
+static void fill_avx2(uint32_t *dst, uint32_t color, unsigned int count) {
+    while (((uint64_t)dst & 31) && count) {
+        *dst++ = color;
+        count--;
+    }
+
+    v8si v = { color, color, color, color, color, color, color, color };
+    for (; count >= 32; count -= 32, dst += 32) {
+        *(v8si *)(dst + 0) = v;
+        *(v8si *)(dst + 8) = v;
+        *(v8si *)(dst + 16) = v;
+        *(v8si *)(dst + 24) = v;
+    }
+    for (; count >= 8; count -= 8, dst += 8) *(v8si *)dst = v;
+    fill_scalar(dst, color, count);
+}
+
+__attribute__((target("avx2")))
+static void copy_avx2(uint32_t *dst, const uint32_t *src, unsigned int count) {
+    for (; count >= 32; count -= 32, dst += 32, src += 32) {
+        v8si a = *(const v8si_u *)(src + 0), b = *(const v8si_u *)(src + 8);
+        v8si c = *(const v8si_u *)(src + 16), d = *(const v8si_u *)(src + 24);
+        *(v8si_u *)(dst + 0) = a;
+        *(v8si_u *)(dst + 8) = b;
+        *(v8si_u *)(dst + 16) = c;
+        *(v8si_u *)(dst + 24) = d;
+    }
+    copy_scalar(dst, src, count);
+}
+
+// As blend_sse2, eight pixels at a time; unpack and pack both work within
+// 128-bit lanes, so pixels come back in order
+__attribute__((target("avx2")))
+static void blend_avx2(uint32_t *dst, const uint32_t *src, unsigned int count) {
+    const v32qi zero = { 0 };
+    const v16hu force_alpha = { 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255 };
+    const v8si alpha = { ALPHA_MASK, ALPHA_MASK, ALPHA_MASK, ALPHA_MASK,
+                         ALPHA_MASK, ALPHA_MASK, ALPHA_MASK, ALPHA_MASK };
+
+    for (; count >= 8; count -= 8, dst += 8, src += 8) {
+        v8si s = *(const v8si_u *)src;
+        v8si sa = s & alpha;
+        if (__builtin_ia32_pmovmskb256((v32qi)(sa == alpha)) == -1) {
+            *(v8si_u *)dst = s;
+            continue;
+        }
+        if (__builtin_ia32_pmovmskb256((v32qi)(sa == 0)) == -1) continue;
+
+        v8si d = *(const v8si_u *)dst;
+        v16hu s_lo = (v16hu)__builtin_ia32_punpcklbw256((v32qi)s, zero);
+        v16hu s_hi = (v16hu)__builtin_ia32_punpckhbw256((v32qi)s, zero);
+        v16hu d_lo = (v16hu)__builtin_ia32_punpcklbw256((v32qi)d, zero);
+        v16hu d_hi = (v16hu)__builtin_ia32_punpckhbw256((v32qi)d, zero);
+        v16hu a_lo = (v16hu)__builtin_ia32_pshufhw256(__builtin_ia32_pshuflw256((v16hi)s_lo, 0xFF), 0xFF);
+        v16hu a_hi = (v16hu)__builtin_ia32_pshufhw256(__builtin_ia32_pshuflw256((v16hi)s_hi, 0xFF), 0xFF);
+
+        v16hu t_lo = (s_lo | force_alpha) * a_lo + d_lo * (255 - a_lo);
+        v16hu t_hi = (s_hi | force_alpha) * a_hi + d_hi * (255 - a_hi);
+        t_lo = (t_lo + 1 + (t_lo >> 8)) >> 8;
+        t_hi = (t_hi + 1 + (t_hi >> 8)) >> 8;
+        *(v8si_u *)dst = (v8si)__builtin_ia32_packuswb256((v16hi)t_lo, (v16hi)t_hi);
+    }
+    blend_scalar(dst, src, count);
+}
+
+static const raster_ops_t g_ops_scalar = { "scalar", fill_scalar, copy_scalar, blend_scalar };
+static const raster_ops_t g_ops_sse2 = { "sse2", fill_sse2, copy_sse2, blend_sse2 };
+static const raster_ops_t g_ops_avx2 = { "avx2", fill_avx2, copy_avx2, blend_avx2 };
+static const raster_ops_t *g_ops = &g_ops_scalar;
+
+void raster_init(void) {
+    if (g_cpu_simd & SIMD_AVX2) g_ops = &g_ops_avx2;
+    else if (g_cpu_simd & SIMD_SSE2) g_ops = &g_ops_sse2;
+    else g_ops = &g_ops_scalar;
+}
+
+const char *raster_variant(void) {
+    return g_ops->name;
+}
+
+// Kernels for an operation over `pixels` pixels, opening an FPU section
+// when they are SIMD ones
+static const raster_ops_t *ops_begin(uint64_t pixels) {
+    if (pixels < SIMD_MIN_PIXELS || g_ops == &g_ops_scalar) return &g_ops_scalar;
+    kernel_fpu_begin();
+    return g_ops;
+}
+
+static void ops_end(const raster_ops_t *ops) {
+    if (ops != &g_ops_scalar) kernel_fpu_end();
+}
+
+void raster_screen(fb_surface_t *surface) {
+    surface->pixels = g_fb_draw;
+    surface->width = g_fb_width;
+    surface->height = g_fb_height;
+    surface->stride = g_fb_stride;
+}
+
+// Clip the span [*pos, *pos + *len) to [0, limit), moving *other (the
+// matching coordinate on the other surface) along with its start
+static int clip_span(long *pos, long *len, long limit, long *other) {
+    if (*pos < 0) {
+        *len += *pos;
+        *other -= *pos;
+        *pos = 0;
+    }
+    if (*pos + *len > limit) *len = limit - *pos;
+    return *len > 0;
+}
+
+static inline uint32_t *pixel_at(const fb_surface_t *s, long x, long y) {
+    return s->pixels + (uint64_t)y * s->stride + x;
+}
+
+void raster_fill_rect(const fb_surface_t *dst, int x, int y, int w, int h, uint32_t color) {
+    long cx = x, cy = y, cw = w, ch = h, unused = 0;
+    if (!clip_span(&cx, &cw, dst->width, &unused) || !clip_span(&cy, &ch, dst->height, &unused)) return;
+
+    const raster_ops_t *ops = ops_begin((uint64_t)cw * ch);
+    uint32_t *row = pixel_at(dst, cx, cy);
+    for (long i = 0; i < ch; i++, row += dst->stride) ops->fill(row, color, cw);
+    ops_end(ops);
+}
+
+// Clip a copy between two surfaces against both; returns 0 if nothing is left
+static int clip_blit(const fb_surface_t *dst, long *dx, long *dy, const fb_surface_t *src, long *sx, long *sy,
+                     long *w, long *h) {
+    return clip_span(dx, w, dst->width, sx) && clip_span(dy, h, dst->height, sy) &&
+           clip_span(sx, w, src->width, dx) && clip_span(sy, h, src->height, dy);
+}
+
+void raster_blit(const fb_surface_t *dst, int dx, int dy, const fb_surface_t *src, int sx, int sy, int w, int h) {
+    long cdx = dx, cdy = dy, csx = sx, csy = sy, cw = w, ch = h;
+    if (!clip_blit(dst, &cdx, &cdy, src, &csx, &csy, &cw, &ch)) return;
+
+    uint32_t *d = pixel_at(dst, cdx, cdy);
+    const uint32_t *s = pixel_at(src, csx, csy);
+    long d_step = dst->stride, s_step = src->stride;
+    int same = dst->pixels == src->pixels;
+
+    // Sideways within the same rows: the row kernels copy forwards
+    if (same && cdy == csy && cdx > csx) {
+        for (long i = 0; i < ch; i++, d += d_step, s += s_step) memmove(d, s, cw * 4);
+        return;
+    }
+    // Moving down within one surface: copy from the bottom row up
+    if (same && cdy > csy) {
+        d += (ch - 1) * d_step;
+        s += (ch - 1) * s_step;
+        d_step = -d_step;
+        s_step = -s_step;
+    }
+
+    const raster_ops_t *ops = ops_begin((uint64_t)cw * ch);
+    for (long i = 0; i < ch; i++, d += d_step, s += s_step) ops->copy(d, s, cw);
+    ops_end(ops);
+}
+
+void raster_blend(const fb_surface_t *dst, int dx, int dy, const fb_surface_t *src, int sx, int sy, int w, int h) {
+    long cdx = dx, cdy = dy, csx = sx, csy = sy, cw = w, ch = h;
+    if (!clip_blit(dst, &cdx, &cdy, src, &csx, &csy, &cw, &ch)) return;
+
+    uint32_t *d = pixel_at(dst, cdx, cdy);
+    const uint32_t *s = pixel_at(src, csx, csy);
+    const raster_ops_t *ops = ops_begin((uint64_t)cw * ch);
+    for (long i = 0; i < ch; i++, d += dst->stride, s += src->stride) ops->blend(d, s, cw);
+    ops_end(ops);
+}
+
+static inline long iabs(long v) {
+    return v < 0 ? -v : v;
+}
+
+// a * b / c rounded up; the quotient must fit in 64 bits. The remainder is
+// below c, so the wrapping 64-bit products still recover it exactly.
+static inline uint64_t muldiv64_up(uint64_t a, uint64_t b, uint64_t c) {
+    uint64_t q = muldiv64(a, b, c);
+    return q + (a * b - q * c != 0);
+}
+
+// Minor-axis steps the Bresenham walk below has taken after n major steps:
+// n * minor / major, rounded half up
+static inline uint64_t line_minor_steps(uint64_t n, uint64_t minor, uint64_t major) {
+    uint64_t q = muldiv64(n, minor, major);
+    return q + (2 * (n * minor - q * major) >= major);
+}
+
+// Narrow the major steps [*first, *last] to those where a coordinate that
+// starts at c and moves by s (+1/-1) every step stays in [0, limit)
+static void clip_line_major(long c, long s, long limit, long *first, long *last) {
+    long lo = s > 0 ? -c : c - (limit - 1), hi = s > 0 ? limit - 1 - c : c;
+    if (lo > *first) *first = lo;
+    if (hi < *last) *last = hi;
+}
+
+// The same for the minor coordinate, which moves by s on the steps where
+// line_minor_steps() grows; that count never decreases, so the steps that
+// keep it in range are again one interval
+static void clip_line_minor(long c, long s, long limit, uint64_t minor, uint64_t major,
+                            long *first, long *last) {
+    long kmin = s > 0 ? -c : c - (limit - 1), kmax = s > 0 ? limit - 1 - c : c;
+    if (kmax > (long)minor) kmax = (long)minor;
+    if (kmin > 0) {
+        long n = (long)muldiv64_up(2 * kmin - 1, major, 2 * minor);
+        if (n > *first) *first = n;
+    }
+    long n = (long)muldiv64_up(2 * kmax + 1, major, 2 * minor) - 1;
+    if (n < *last) *last = n;
+}
+
+void raster_line(const fb_surface_t *dst, int x0, int y0, int x1, int y1, uint32_t color) {
+    long minx = x0 < x1 ? x0 : x1, maxx = x0 < x1 ? x1 : x0;
+    long miny = y0 < y1 ? y0 : y1, maxy = y0 < y1 ? y1 : y0;
+    if (maxx < 0 || maxy < 0 || minx >= dst->width || miny >= dst->height) return;
+
+    long dx = iabs((long)x1 - x0), dy = -iabs((long)y1 - y0);
+    long sx = x0 < x1 ? 1 : -1, sy = y0 < y1 ? 1 : -1;
+
+    // Every iteration below steps along the major axis, so the walk can be
+    // clipped to the steps whose pixel is on the surface and entered there
+    // directly, drawing the same pixels as an unclipped walk would
+    int x_major = dx >= -dy;
+    uint64_t major = x_major ? dx : -dy, minor = x_major ? -dy : dx;
+    long first = 0, last = (long)major;
+    clip_line_major(x_major ? x0 : y0, x_major ? sx : sy, x_major ? dst->width : dst->height, &first, &last);
+    if (minor) clip_line_minor(x_major ? y0 : x0, x_major ? sy : sx, x_major ? dst->height : dst->width,
+                               minor, major, &first, &last);
+    if (first > last) return;
+
+    uint64_t kmajor = first, kminor = minor ? line_minor_steps(first, minor, major) : 0;
+    uint64_t kx = x_major ? kmajor : kminor, ky = x_major ? kminor : kmajor;
+    long x = x0 + sx * (long)kx, y = y0 + sy * (long)ky;
+    // The error term is small, but its products are not: wrap and cast back
+    long err = (long)((uint64_t)dx + (uint64_t)dy + kx * (uint64_t)dy + ky * (uint64_t)dx);
+
+    for (long n = first;; n++) {
+        *pixel_at(dst, x, y) = color;
+        if (n == last) break;
+        long e2 = 2 * err;
+        if (e2 >= dy) {
+            err += dy;
+            x += sx;
+        }
+        if (e2 <= dx) {
+            err += dx;
+            y += sy;
+        }
+    }
+}
+
+static inline void plot_coverage(const fb_surface_t *dst, long x, long y, uint32_t rgb, uint32_t coverage) {
+    if ((unsigned long)x >= dst->width || (unsigned long)y >= dst->height || !coverage) return;
+    uint32_t *p = pixel_at(dst, x, y);
+    *p = blend_pixel(rgb | coverage << 24, *p);
+}
+
+void raster_line_aa(const fb_surface_t *dst, int x0, int y0, int x1, int y1, uint32_t color) {
+    long ax = x0, ay = y0, bx = x1, by = y1, t;
+    int steep = iabs(by - ay) > iabs(bx - ax);
+    if (steep) {
+        t = ax; ax = ay; ay = t;
+        t = bx; bx = by; by = t;
+    }
+    if (ax > bx) {
+        t = ax; ax = bx; bx = t;
+        t = ay; ay = by; by = t;
+    }
+
+    // Walk the major axis only where it is on the surface
+    long limit = steep ? dst->height : dst->width;
+    long start = ax < 0 ? 0 : ax, end = bx >= limit ? limit - 1 : bx;
+    if (start > end) return;
+
+    // Minor coordinate in 16.16 fixed point; the fraction is the coverage
+    // of the second pixel
+    int64_t gradient = bx != ax ? ((int64_t)(by - ay) << 16) / (bx - ax) : 0;
+    int64_t minor = ((int64_t)ay << 16) + gradient * (start - ax);
+    uint32_t rgb = color & ~ALPHA_MASK;
+
+    for (long x = start; x <= end; x++, minor += gradient) {
+        long y = (long)(minor >> 16);
+        uint32_t frac = (uint32_t)(minor >> 8) & 0xFF;
+        if (steep) {
+            plot_coverage(dst, y, x, rgb, 255 - frac);
+            plot_coverage(dst, y + 1, x, rgb, frac);
+        } else {
+            plot_coverage(dst, x, y, rgb, 255 - frac);
+            plot_coverage(dst, x, y + 1, rgb, frac);
+        }
+    }
+}
+
+#define SELFTEST_SIZE       512
+#define SELFTEST_WIDTHS     67          // row lengths 1..67 cover every head/tail
+#define SELFTEST_REPS       16
+
+static uint64_t xorshift64(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+// Pixels with every kind of alpha the kernels special-case: a quarter
+// opaque, a quarter transparent, the rest translucent
+static uint32_t random_pixel(uint64_t *rng) {
+    uint64_t r = xorshift64(rng);
+    uint32_t p = (uint32_t)r;
+    switch ((r >> 32) & 3) {
+    case 0:  return p | ALPHA_MASK;
+    case 1:  return p & ~ALPHA_MASK;
+    default: return p;
+    }
+}
+
+// Run every row kernel of `ops` against the scalar ones at all lengths up
+// to SELFTEST_WIDTHS and at every alignment; returns the mismatches
+static unsigned int compare_ops(const raster_ops_t *ops, uint32_t *src, uint32_t *dst, uint32_t *ref,
+                                uint64_t *rng) {
+    unsigned int bad = 0;
+    for (unsigned int w = 1; w <= SELFTEST_WIDTHS; w++) {
+        unsigned int off = w & 7;
+        for (unsigned int i = 0; i < w + 16; i++) {
+            src[i] = random_pixel(rng);
+            dst[i] = ref[i] = (uint32_t)xorshift64(rng);
+        }
+
+        kernel_fpu_begin();
+        ops->blend(dst + off, src, w);
+        ops->copy(dst + off + 1, src + 5, w / 2);
+        ops->fill(dst + off + w - w / 3, src[0], w / 3);
+        kernel_fpu_end();
+        blend_scalar(ref + off, src, w);
+        copy_scalar(ref + off + 1, src + 5, w / 2);
+        fill_scalar(ref + off + w - w / 3, src[0], w / 3);
+
+        for (unsigned int i = 0; i < w + 16; i++) bad += dst[i] != ref[i];
+    }
+    return bad;
+}
+
+// Mpix/s for blending a full SELFTEST_SIZE square with `ops`
+static uint64_t blend_rate(const raster_ops_t *ops, const uint32_t *src, uint32_t *dst) {
+    uint64_t pixels = (uint64_t)SELFTEST_SIZE * SELFTEST_SIZE;
+    uint64_t start = rdtsc();
+    for (unsigned int r = 0; r < SELFTEST_REPS; r++) {
+        kernel_fpu_begin();
+        ops->blend(dst, src, pixels);
+        kernel_fpu_end();
+    }
+    return tsc_rate_per_sec(pixels * SELFTEST_REPS, rdtsc() - start) / 1000000;
+}
+
+static uint64_t fill_rate(const fb_surface_t *s) {
+    uint64_t start = rdtsc();
+    for (unsigned int r = 0; r < SELFTEST_REPS; r++) raster_fill_rect(s, 0, 0, s->width, s->height, r);
+    return tsc_rate_per_sec((uint64_t)s->width * s->height * SELFTEST_REPS, rdtsc() - start) / 1000000;
+}
+
+// Compare the SIMD kernels with the scalar ones, check clipping and
+// overlapping blits, and time blending in each available variant
+void raster_selftest(void) {
+    char line[160];
+    uint64_t bytes = (uint64_t)SELFTEST_SIZE * SELFTEST_SIZE * 4;
+    unsigned int order = pmm_order_for_size(bytes);
+    uint64_t src_phys = pmm_alloc_pages(order), dst_phys = pmm_alloc_pages(order);
+    uint64_t rng = 0x9E3779B97F4A7C15UL;
+    unsigned int bad = 0;
+
+    if (!src_phys || !dst_phys) {
+        if (src_phys) pmm_free_pages(src_phys, order);
+        if (dst_phys) pmm_free_pages(dst_phys, order);
+        boot_print("Raster: out of memory, selftest skipped", COLOR_YELLOW);
+        return;
+    }
+    fb_surface_t src = { phys_to_virt(src_phys), SELFTEST_SIZE, SELFTEST_SIZE, SELFTEST_SIZE };
+    fb_surface_t dst = { phys_to_virt(dst_phys), SELFTEST_SIZE, SELFTEST_SIZE, SELFTEST_SIZE };
+    uint32_t *ref = dst.pixels + SELFTEST_SIZE * (SELFTEST_SIZE / 2);
+
+    if (g_cpu_simd & SIMD_SSE2) bad += compare_ops(&g_ops_sse2, src.pixels, dst.pixels, ref, &rng);
+    if (g_cpu_simd & SIMD_AVX2) bad += compare_ops(&g_ops_avx2, src.pixels, dst.pixels, ref, &rng);
+
+    // Clipping: a fill hanging over the top-left corner covers exactly the
+    // on-surface part
+    raster_fill_rect(&dst, 0, 0, SELFTEST_SIZE, SELFTEST_SIZE, 0);
+    raster_fill_rect(&dst, -5, -3, 10, 10, 0xFFFFFFFF);
+    for (unsigned int y = 0; y < 8; y++)
+        for (unsigned int x = 0; x < 8; x++) bad += (dst.pixels[y * SELFTEST_SIZE + x] != 0) != (x < 5 && y < 7);
+
+    // Overlapping blit down and to the right, then a line and its far end
+    for (unsigned int x = 0; x < 100; x++) dst.pixels[x] = x;
+    raster_blit(&dst, 3, 1, &dst, 0, 0, 100, 1);
+    raster_blit(&dst, 3, 0, &dst, 0, 0, 100, 1);
+    for (unsigned int x = 0; x < 97; x++) bad += dst.pixels[x + 3] != x || dst.pixels[SELFTEST_SIZE + x + 3] != x;
+    raster_line(&dst, -100, 300, 600, 300, 0x00123456);
+    bad += dst.pixels[300 * SELFTEST_SIZE] != 0x00123456 || dst.pixels[301 * SELFTEST_SIZE - 1] != 0x00123456;
+    // A diagonal whose ends are a billion pixels away is clipped, not walked
+    raster_line(&dst, -1000000000, -1000000000, 1000000000, 1000000000, 0x00654321);
+    bad += dst.pixels[0] != 0x00654321 || dst.pixels[(SELFTEST_SIZE - 1) * (SELFTEST_SIZE + 1)] != 0x00654321;
+
+    // Timing
+    for (unsigned int i = 0; i < SELFTEST_SIZE * SELFTEST_SIZE; i++) {
+        src.pixels[i] = random_pixel(&rng) & ~ALPHA_MASK;
+        src.pixels[i] |= (uint32_t)(1 + i % 254) << 24;
+    }
+    uint64_t scalar = blend_rate(&g_ops_scalar, src.pixels, dst.pixels);
+    uint64_t sse2 = g_cpu_simd & SIMD_SSE2 ? blend_rate(&g_ops_sse2, src.pixels, dst.pixels) : 0;
+    uint64_t avx2 = g_cpu_simd & SIMD_AVX2 ? blend_rate(&g_ops_avx2, src.pixels, dst.pixels) : 0;
+    uint64_t fill = fill_rate(&dst);
+
+    pmm_free_pages(src_phys, order);
+    pmm_free_pages(dst_phys, order);
+
+    ksnprintf(line, sizeof(line),
+              "Raster: %s, blend Mpix/s scalar %lu sse2 %lu avx2 %lu, fill %lu Mpix/s, %s",
+              raster_variant(), scalar, sse2, avx2, fill, bad ? "FAILED" : "ok");
+    boot_print(line, bad ? COLOR_RED : COLOR_CYAN);
+}
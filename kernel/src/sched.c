@@ -0,0 +1,578 @@
+#include "../include/sched.h"
+#include "../include/apic.h"
+#include "../include/cpu.h"
+#include "../include/error.h"
+#include "../include/kernel.h"
+#include "../include/pmm.h"
+#include "../include/slab.h"
+#include "../include/spinlock.h"
+#include "../include/timer.h"
+#include "../include/trace.h"
+#include "../include/tsc.h"
+#include "../include/util.h"
+
+typedef struct {
+    spinlock_t lock;
+    task_t *head, *tail;        // runnable threads, oldest first
+    unsigned int nr_queued;
+    unsigned int nr_stealable;  // queued threads that are not pinned here
+    unsigned int cpu;
+    task_t *idle;
+
+    task_t *prev;               // switched-out thread awaiting finish_switch()
+    uint64_t switch_start;
+
+    timer_event_t slice;
+    int slice_armed;
+    volatile unsigned int wake; // MWAIT monitor target, written by kick_cpu()
+
+    sched_stats_t stats;        // histograms and counters of this CPU
+} runqueue_t;
+
+// context_switch.asm
+void context_switch(uint64_t *save_rsp, uint64_t next_rsp);
+
+static int g_use_mwait;
+static uint64_t g_slice_cycles;
+static uint64_t g_idle_mask;    // CPUs asleep in the idle loop, one bit each
+static unsigned int g_next_task_id = 1;
+
+static inline runqueue_t *this_rq(void) {
+    return this_cpu()->runqueue;
+}
+
+static runqueue_t *cpu_rq(unsigned int cpu) {
+    percpu_t *p = percpu_get(cpu);
+    return p ? p->runqueue : 0;
+}
+
+// Run queue lock with contention accounting; the counters belong to the
+// queue and are only updated while holding its lock
+static void rq_lock(runqueue_t *rq) {
+    if (!spin_trylock(&rq->lock)) {
+        uint64_t start = rdtsc();
+        spin_lock(&rq->lock);
+        rq->stats.lock_contended++;
+        rq->stats.lock_spin_cycles += rdtsc() - start;
+    }
+    rq->stats.lock_acquires++;
+}
+
+static void kick_cpu(unsigned int cpu) {
+    uint64_t bit = 1UL << cpu;
+    if (!(__atomic_fetch_and(&g_idle_mask, ~bit, __ATOMIC_ACQ_REL) & bit)) return;
+
+    runqueue_t *rq = cpu_rq(cpu);
+    if (g_use_mwait) {
+        // The store to the monitored line ends MWAIT; no interrupt needed
+        __atomic_store_n(&rq->wake, 1, __ATOMIC_RELEASE);
+    } else {
+        apic_send_ipi(percpu_get(cpu)->apic_id, SCHED_IPI_VECTOR);
+    }
+}
+
+// Wake one sleeping CPU so it can steal from the caller's queue
+static void kick_idle_cpu(unsigned int self) {
+    // Pairs with the barrier in idle_once(): publish the queued thread
+    // before looking for sleepers
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint64_t mask = __atomic_load_n(&g_idle_mask, __ATOMIC_RELAXED) & ~(1UL << self);
+    if (mask) kick_cpu((unsigned int)__builtin_ctzl(mask));
+}
+
+static void update_slice(runqueue_t *rq, task_t *running, uint64_t now) {
+    if (!running->idle && __atomic_load_n(&rq->nr_queued, __ATOMIC_RELAXED)) {
+        timer_schedule(&rq->slice, now + g_slice_cycles);
+        rq->slice_armed = 1;
+    } else if (rq->slice_armed) {
+        timer_cancel(&rq->slice);
+        rq->slice_armed = 0;
+    }
+}
+
+static void append(runqueue_t *rq, task_t *t) {
+    t->state = TASK_RUNNABLE;
+    t->next = 0;
+    t->enqueue_tsc = rdtsc();
+
+    rq_lock(rq);
+    if (rq->tail) rq->tail->next = t;
+    else rq->head = t;
+    rq->tail = t;
+    rq->nr_queued++;
+    if (!t->pinned) rq->nr_stealable++;
+    spin_unlock(&rq->lock);
+}
+
+// Append to the calling CPU's queue; interrupts disabled
+static void enqueue(runqueue_t *rq, task_t *t) {
+    append(rq, t);
+
+    // Someone is now waiting behind the running thread: give it a slice
+    task_t *running = this_cpu()->current_task;
+    if (!rq->slice_armed && !running->idle) update_slice(rq, running, t->enqueue_tsc);
+    if (!t->pinned) kick_idle_cpu(rq->cpu);
+}
+
+// Append to another CPU's queue; interrupts disabled. Its slice timer is not
+// ours to arm, so a busy CPU is told to reschedule instead.
+static void enqueue_remote(runqueue_t *rq, task_t *t) {
+    append(rq, t);
+
+    // Pairs with the barrier in idle_once(), as in kick_idle_cpu()
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&g_idle_mask, __ATOMIC_RELAXED) & (1UL << rq->cpu)) kick_cpu(rq->cpu);
+    else apic_send_ipi(percpu_get(rq->cpu)->apic_id, SCHED_IPI_VECTOR);
+}
+
+static task_t *dequeue(runqueue_t *rq) {
+    if (!__atomic_load_n(&rq->nr_queued, __ATOMIC_RELAXED)) return 0;
+
+    rq_lock(rq);
+    task_t *t = rq->head;
+    if (t) {
+        rq->head = t->next;
+        if (!rq->head) rq->tail = 0;
+        rq->nr_queued--;
+        if (!t->pinned) rq->nr_stealable--;
+        t->next = 0;
+    }
+    spin_unlock(&rq->lock);
+    return t;
+}
+
+// Take the older half of the unpinned threads of the first queue after our
+// own that has any; returns one thread to run and queues the rest locally
+static task_t *steal(runqueue_t *self) {
+    for (unsigned int i = 1; i < MAX_CPUS; i++) {
+        runqueue_t *victim = cpu_rq((self->cpu + i) % MAX_CPUS);
+        if (!victim || !__atomic_load_n(&victim->nr_stealable, __ATOMIC_RELAXED)) continue;
+
+        rq_lock(victim);
+        unsigned int want = (victim->nr_stealable + 1) / 2, take = 0;
+        task_t *first = 0, *last = 0, *kept = 0;
+        task_t **link = &victim->head;
+        while (*link && take < want) {
+            task_t *t = *link;
+            if (t->pinned) {
+                kept = t;
+                link = &t->next;
+                continue;
+            }
+            *link = t->next;
+            t->next = 0;
+            if (last) last->next = t;
+            else first = t;
+            last = t;
+            take++;
+        }
+        // Everything after the last thread left behind went, tail included
+        if (!*link) victim->tail = kept;
+        if (!take) {
+            spin_unlock(&victim->lock);
+            continue;
+        }
+        victim->nr_queued -= take;
+        victim->nr_stealable -= take;
+        spin_unlock(&victim->lock);
+
+        self->stats.steals += take;
+        if (first != last) {
+            rq_lock(self);
+            if (self->tail) self->tail->next = first->next;
+            else self->head = first->next;
+            self->tail = last;
+            self->nr_queued += take - 1;
+            self->nr_stealable += take - 1;
+            spin_unlock(&self->lock);
+        }
+        first->next = 0;
+        return first;
+    }
+    return 0;
+}
+
+// Anything queued here, or that this CPU could steal
+static int work_available(runqueue_t *self) {
+    if (__atomic_load_n(&self->nr_queued, __ATOMIC_RELAXED)) return 1;
+    for (unsigned int i = 1; i < MAX_CPUS; i++) {
+        runqueue_t *rq = cpu_rq((self->cpu + i) % MAX_CPUS);
+        if (rq && __atomic_load_n(&rq->nr_stealable, __ATOMIC_RELAXED)) return 1;
+    }
+    return 0;
+}
+
+// Second half of a switch, on the incoming thread: requeue or free the
+// thread that was switched out, whose stack is no longer in use
+static void finish_switch(void) {
+    runqueue_t *rq = this_rq();
+    task_t *prev = rq->prev;
+    rq->prev = 0;
+
+    rq->stats.switches++;
+    hist_add(&rq->stats.switch_cycles, rdtsc() - rq->switch_start);
+
+    if (prev->state == TASK_DEAD) {
+        pmm_free_pages(prev->stack, SCHED_STACK_ORDER);
+        kfree(prev);
+    } else if (!prev->idle) {
+        enqueue(rq, prev);
+    }
+}
+
+// Switch to the next runnable thread, if any; interrupts disabled. The
+// current thread keeps running when nothing else is runnable, unless it is
+// exiting, in which case the CPU falls back to its idle task.
+static void schedule(int preempt) {
+    percpu_t *cpu = this_cpu();
+    runqueue_t *rq = cpu->runqueue;
+    task_t *prev = cpu->current_task;
+    uint64_t start = rdtsc();
+
+    cpu->need_resched = 0;
+    task_t *next = dequeue(rq);
+    if (!next) next = steal(rq);
+    if (!next) {
+        if (prev->state == TASK_RUNNING) return;
+        next = rq->idle;
+    }
+
+    if (!next->idle) hist_add(&rq->stats.latency_ns, tsc_cycles_to_ns(start - next->enqueue_tsc));
+    if (prev->state == TASK_RUNNING) prev->state = TASK_RUNNABLE;
+    next->state = TASK_RUNNING;
+    next->cpu = rq->cpu;
+    cpu->current_task = next;
+    rq->prev = prev;
+    rq->switch_start = start;
+    if (preempt && !prev->idle) rq->stats.preemptions++;
+    update_slice(rq, next, start);
+    TRACE_INSTANT(TRACE_SCHED_SWITCH, prev->id, next->id);
+
+    context_switch(&prev->rsp, next->rsp);
+
+    // Back on prev, possibly on another CPU: nothing above is still valid
+    finish_switch();
+}
+
+static void slice_expired(timer_event_t *ev, uint64_t now) {
+    (void)ev;
+    (void)now;
+    this_rq()->slice_armed = 0;
+    this_cpu()->need_resched = 1;
+}
+
+static void handle_resched_ipi(interrupt_frame_t *frame) {
+    (void)frame;
+    this_cpu()->need_resched = 1;
+    apic_eoi();
+}
+
+void sched_irq_exit(interrupt_frame_t *frame) {
+    percpu_t *cpu = this_cpu();
+
+    // Only threads that had interrupts enabled and preemption allowed; the
+    // interrupted frame stays on the thread's stack until it runs again
+    if (!cpu->need_resched || cpu->preempt_count || !cpu->runqueue) return;
+    if (!(frame->rflags & RFLAGS_IF)) return;
+
+    schedule(1);
+}
+
+void sched_preempt(void) {
+    unsigned long flags = irq_save();
+    percpu_t *cpu = this_cpu();
+
+    // With interrupts off the next interrupt exit picks the request up
+    if ((flags & RFLAGS_IF) && !cpu->preempt_count && cpu->runqueue) schedule(1);
+    irq_restore(flags);
+}
+
+static void task_entry(void) {
+    finish_switch();
+    irq_enable();
+
+    task_t *self = this_cpu()->current_task;
+    self->fn(self->arg);
+    sched_exit();
+}
+
+static task_t *new_task(const char *name, task_fn_t fn, void *arg) {
+    task_t *t = kzalloc(sizeof(task_t));
+    uint64_t stack = pmm_alloc_pages(SCHED_STACK_ORDER);
+    if (!t || !stack) {
+        kfree(t);
+        if (stack) pmm_free_pages(stack, SCHED_STACK_ORDER);
+        return 0;
+    }
+
+    t->id = __atomic_fetch_add(&g_next_task_id, 1, __ATOMIC_RELAXED);
+    t->name = name;
+    t->fn = fn;
+    t->arg = arg;
+    t->stack = stack;
+
+    // Callee-saved registers for context_switch(), whose RET enters
+    // task_entry() with the stack aligned as after a CALL
+    uint64_t *sp = (uint64_t *)((uint8_t *)phys_to_virt(stack) + (PAGE_SIZE << SCHED_STACK_ORDER));
+    *--sp = 0;
+    *--sp = (uint64_t)task_entry;
+    for (int i = 0; i < 6; i++) *--sp = 0;
+    t->rsp = (uint64_t)sp;
+    return t;
+}
+
+int sched_spawn(const char *name, task_fn_t fn, void *arg) {
+    task_t *t = new_task(name, fn, arg);
+    if (!t) return -1;
+
+    unsigned long flags = irq_save();
+    runqueue_t *rq = this_rq();
+    if (!rq) panic("sched_spawn: scheduler not initialised on this CPU");
+    rq->stats.spawned++;
+    enqueue(rq, t);
+    irq_restore(flags);
+    return 0;
+}
+
+int sched_spawn_on(unsigned int cpu, const char *name, task_fn_t fn, void *arg) {
+    runqueue_t *target = cpu < MAX_CPUS ? cpu_rq(cpu) : 0;
+    if (!target) return -1;
+    task_t *t = new_task(name, fn, arg);
+    if (!t) return -1;
+    t->cpu = cpu;
+    t->pinned = 1;
+
+    unsigned long flags = irq_save();
+    runqueue_t *rq = this_rq();
+    if (!rq) panic("sched_spawn_on: scheduler not initialised on this CPU");
+    rq->stats.spawned++;
+    if (target == rq) enqueue(rq, t);
+    else enqueue_remote(target, t);
+    irq_restore(flags);
+    return 0;
+}
+
+void sched_yield(void) {
+    unsigned long flags = irq_save();
+    if (this_cpu()->preempt_count) panic("sched_yield: called with preemption disabled");
+    schedule(0);
+    irq_restore(flags);
+}
+
+void sched_exit(void) {
+    irq_disable();
+    if (this_cpu()->preempt_count) panic("sched_exit: called with preemption disabled");
+
+    task_t *self = this_cpu()->current_task;
+    if (self->idle) panic("sched_exit: idle task cannot exit");
+    this_rq()->stats.exited++;
+    self->state = TASK_DEAD;
+    schedule(0);
+    panic("sched_exit: dead task scheduled");
+}
+
+task_t *sched_current(void) {
+    return this_cpu()->current_task;
+}
+
+// One round of the idle loop: run whatever is runnable, then sleep until
+// a thread is queued somewhere, an interrupt arrives or kick_cpu() is called.
+// A boot context waiting for `*until` to reach `target` passes the counter so
+// that it is rechecked after advertising the sleep. Interrupts disabled.
+static void idle_once(unsigned int *until, unsigned int target) {
+    schedule(0);
+
+    runqueue_t *rq = this_rq();
+    uint64_t bit = 1UL << rq->cpu;
+    rq->wake = 0;
+    __atomic_fetch_or(&g_idle_mask, bit, __ATOMIC_SEQ_CST);
+    int done = until && __atomic_load_n(until, __ATOMIC_ACQUIRE) >= target;
+
+    if (g_use_mwait) {
+        __asm__ volatile("monitor" : : "a"(&rq->wake), "c"(0), "d"(0));
+        // ECX bit 0: masked interrupts still end the wait
+        if (!done && !work_available(rq) && !rq->wake && !this_cpu()->need_resched) {
+            rq->stats.idle_sleeps++;
+            __asm__ volatile("mwait" : : "a"(0), "c"(1) : "memory");
+        }
+        __asm__ volatile("sti\n\tnop\n\tcli" ::: "memory");
+    } else if (!done && !work_available(rq) && !this_cpu()->need_resched) {
+        rq->stats.idle_sleeps++;
+        timer_idle();
+    }
+
+    __atomic_fetch_and(&g_idle_mask, ~bit, __ATOMIC_RELAXED);
+}
+
+void sched_idle(void) {
+    irq_disable();
+    while (1) idle_once(0, 0);
+}
+
+void sched_kick(unsigned int cpu) {
+    kick_cpu(cpu);
+}
+
+void sched_wait_for(unsigned int *counter, unsigned int target) {
+    unsigned long flags = irq_save();
+    while (__atomic_load_n(counter, __ATOMIC_ACQUIRE) < target) idle_once(counter, target);
+    irq_restore(flags);
+}
+
+void sched_init_cpu(void) {
+    runqueue_t *rq = kzalloc(sizeof(runqueue_t));
+    task_t *idle = kzalloc(sizeof(task_t));
+    if (!rq || !idle) panic("sched_init_cpu: out of memory");
+
+    percpu_t *cpu = this_cpu();
+    idle->idle = 1;
+    idle->state = TASK_RUNNING;
+    idle->cpu = cpu->cpu_id;
+    idle->name = "idle";
+
+    rq->cpu = cpu->cpu_id;
+    rq->idle = idle;
+    rq->slice.fn = slice_expired;
+    hist_reset(&rq->stats.switch_cycles);
+    hist_reset(&rq->stats.latency_ns);
+
+    cpu->current_task = idle;
+    __atomic_store_n(&cpu->runqueue, rq, __ATOMIC_RELEASE);
+}
+
+void sched_init(void) {
+    uint32_t max_leaf, a, b, c, d;
+    cpuid(0, 0, &max_leaf, &b, &c, &d);
+    cpuid(1, 0, &a, &b, &c, &d);
+    g_use_mwait = (c & (1U << 3)) != 0;
+    // idle_once() relies on ECX bit 0 (interrupts break MWAIT even with IF
+    // clear), which leaf 5 must advertise along with its extensions
+    if (g_use_mwait) {
+        if (max_leaf >= 5) cpuid(5, 0, &a, &b, &c, &d);
+        g_use_mwait = max_leaf >= 5 && (c & 3) == 3;
+    }
+    g_slice_cycles = tsc_ns_to_cycles(SCHED_SLICE_NS);
+
+    interrupt_register(SCHED_IPI_VECTOR, handle_resched_ipi);
+    sched_init_cpu();
+}
+
+const char *sched_idle_method(void) {
+    return g_use_mwait ? "MWAIT" : "HLT";
+}
+
+void sched_get_stats(sched_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    for (unsigned int i = 0; i < MAX_CPUS; i++) {
+        runqueue_t *rq = cpu_rq(i);
+        if (!rq) continue;
+        const sched_stats_t *s = &rq->stats;
+        stats->spawned += s->spawned;
+        stats->exited += s->exited;
+        stats->switches += s->switches;
+        stats->preemptions += s->preemptions;
+        stats->steals += s->steals;
+        stats->idle_sleeps += s->idle_sleeps;
+        stats->lock_acquires += s->lock_acquires;
+        stats->lock_contended += s->lock_contended;
+        stats->lock_spin_cycles += s->lock_spin_cycles;
+        hist_merge(&stats->switch_cycles, &s->switch_cycles);
+        hist_merge(&stats->latency_ns, &s->latency_ns);
+    }
+}
+
+#define STRESS_THREADS      4096
+#define STRESS_IN_FLIGHT    256     // bounds stack memory: 4 MiB at 16 KiB each
+#define STRESS_YIELDS       2
+#define STRESS_WORK_CYCLES  20000
+#define HOG_SLICES          3
+#define HOGS_PER_CPU        2
+
+static unsigned int g_stress_done;
+static unsigned int g_stress_waiter;
+
+static void stress_thread(void *arg) {
+    (void)arg;
+    for (int i = 0; i <= STRESS_YIELDS; i++) {
+        uint64_t start = rdtsc();
+        while (rdtsc() - start < STRESS_WORK_CYCLES / (STRESS_YIELDS + 1))
+            cpu_pause();
+        if (i < STRESS_YIELDS) sched_yield();
+    }
+    __atomic_fetch_add(&g_stress_done, 1, __ATOMIC_RELEASE);
+    kick_cpu(g_stress_waiter);
+}
+
+// Spins with interrupts enabled for several slices; with more hogs than
+// CPUs, only preemption lets the queued ones make progress
+static void hog_thread(void *arg) {
+    uint64_t start = rdtsc();
+    while (rdtsc() - start < HOG_SLICES * g_slice_cycles)
+        cpu_pause();
+    __atomic_fetch_add((unsigned int *)arg, 1, __ATOMIC_RELEASE);
+    kick_cpu(g_stress_waiter);
+}
+
+void sched_selftest(void) {
+    char line[128];
+    sched_stats_t before, after;
+
+    if (!this_rq()) return;
+    g_stress_waiter = this_cpu_id();
+
+    unsigned int hogs = HOGS_PER_CPU * percpu_online_count(), hogs_spawned = 0, hogs_done = 0;
+    sched_get_stats(&before);
+    while (hogs_spawned < hogs && sched_spawn("hog", hog_thread, &hogs_done) == 0) hogs_spawned++;
+    sched_wait_for(&hogs_done, hogs_spawned);
+    sched_get_stats(&after);
+    uint64_t hog_preemptions = after.preemptions - before.preemptions;
+
+    sched_get_stats(&before);
+    uint64_t start = rdtsc();
+    unsigned int spawned = 0, failed = 0;
+    g_stress_done = 0;
+    while (spawned < STRESS_THREADS) {
+        sched_wait_for(&g_stress_done, spawned > STRESS_IN_FLIGHT ? spawned - STRESS_IN_FLIGHT : 0);
+        if (sched_spawn("stress", stress_thread, 0) != 0) {
+            failed++;
+            break;
+        }
+        spawned++;
+    }
+    sched_wait_for(&g_stress_done, spawned);
+    uint64_t elapsed_ns = tsc_cycles_to_ns(rdtsc() - start);
+    sched_get_stats(&after);
+
+    // Histograms only ever grow, so the difference is this run's samples
+    for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+        after.switch_cycles.buckets[i] -= before.switch_cycles.buckets[i];
+        after.latency_ns.buckets[i] -= before.latency_ns.buckets[i];
+    }
+    after.switch_cycles.count -= before.switch_cycles.count;
+    after.switch_cycles.sum -= before.switch_cycles.sum;
+    after.latency_ns.count -= before.latency_ns.count;
+    after.latency_ns.sum -= before.latency_ns.sum;
+
+    uint64_t acquires = after.lock_acquires - before.lock_acquires;
+    uint64_t contended = after.lock_contended - before.lock_contended;
+    ksnprintf(line, sizeof(line), "Sched: %u threads on %u CPUs in %lu ms (%lu/s), idle %s%s",
+              spawned, percpu_online_count(), elapsed_ns / 1000000,
+              elapsed_ns ? spawned * 1000000000UL / elapsed_ns : 0, sched_idle_method(),
+              failed ? ", out of memory" : "");
+    boot_print(line, failed ? COLOR_RED : COLOR_CYAN);
+
+    ksnprintf(line, sizeof(line), "  switch: %lu, mean %lu cycles, p99 <%lu; latency mean %lu ns, p99 <%lu",
+              after.switch_cycles.count, hist_mean(&after.switch_cycles),
+              hist_percentile(&after.switch_cycles, 99), hist_mean(&after.latency_ns),
+              hist_percentile(&after.latency_ns, 99));
+    boot_print(line, COLOR_CYAN);
+
+    ksnprintf(line, sizeof(line), "  rq locks: %lu, %lu contended (%lu spin cycles); steals %lu, idle sleeps %lu",
+              acquires, contended, after.lock_spin_cycles - before.lock_spin_cycles,
+              after.steals - before.steals, after.idle_sleeps - before.idle_sleeps);
+    boot_print(line, COLOR_CYAN);
+
+    ksnprintf(line, sizeof(line), "  preemption: %lu during %u hogs of %u slices",
+              hog_preemptions, hogs_spawned, HOG_SLICES);
+    boot_print(line, hog_preemptions ? COLOR_CYAN : COLOR_YELLOW);
+}
@@ -0,0 +1,471 @@
+#include "../include/slab.h"
+#include "../include/pmm.h"
+#include "../include/spinlock.h"
+#include "../include/cpu.h"
+#include "../include/tsc.h"
+#include "../include/util.h"
+#include "../include/error.h"
+#include "../include/histogram.h"
+
+typedef struct magazine {
+    struct magazine *next;
+    unsigned int rounds;
+    void *objects[MAGAZINE_SIZE];
+} magazine_t;
+
+// Only ever touched by its own CPU with interrupts off
+typedef struct {
+    magazine_t *loaded;
+    magazine_t *previous;
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t hits;
+} __attribute__((aligned(64))) cpu_cache_t;
+
+// Header at the start of every slab; objects follow at first_offset
+typedef struct slab {
+    struct slab *next;
+    struct slab *prev;
+    kmem_cache_t *cache;
+    void *free_list;
+    unsigned int inuse;
+} slab_t;
+
+struct kmem_cache {
+    const char *name;
+    size_t object_size;
+    size_t stride;
+    size_t first_offset;
+    unsigned int objects_per_slab;
+    unsigned int flags;
+
+    spinlock_t lock;
+    slab_t *partial;
+    slab_t *full;
+    slab_t *empty;
+    magazine_t *depot_full;
+    magazine_t *depot_empty;
+    unsigned int depot_full_count;
+    uint64_t slabs;
+
+    kmem_cache_t *next;
+    cpu_cache_t cpu[MAX_CPUS];
+};
+
+static kmem_cache_t *g_magazine_cache;
+static kmem_cache_t *g_kmalloc_caches[KMALLOC_CLASSES];
+static kmem_cache_t *g_cache_list;
+static spinlock_t g_cache_list_lock = SPINLOCK_INIT;
+
+static const char *g_kmalloc_names[KMALLOC_CLASSES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128", "kmalloc-256",
+    "kmalloc-512", "kmalloc-1k", "kmalloc-2k", "kmalloc-4k", "kmalloc-8k"
+};
+
+static void slab_list_add(slab_t **head, slab_t *slab) {
+    slab->prev = 0;
+    slab->next = *head;
+    if (*head) (*head)->prev = slab;
+    *head = slab;
+}
+
+static void slab_list_del(slab_t **head, slab_t *slab) {
+    if (slab->prev) slab->prev->next = slab->next;
+    else *head = slab->next;
+    if (slab->next) slab->next->prev = slab->prev;
+}
+
+static slab_t *slab_create(kmem_cache_t *cache) {
+    uint64_t phys = pmm_alloc_pages(SLAB_ORDER);
+    if (!phys) return 0;
+
+    slab_t *slab = phys_to_virt(phys);
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->free_list = 0;
+
+    // Thread the free list so objects are handed out in address order
+    unsigned char *base = (unsigned char *)slab + cache->first_offset;
+    for (unsigned int i = cache->objects_per_slab; i-- > 0;) {
+        void **obj = (void **)(base + i * cache->stride);
+        *obj = slab->free_list;
+        slab->free_list = obj;
+    }
+
+    cache->slabs++;
+    return slab;
+}
+
+// Slab layer; called with cache->lock held
+static void *slab_alloc_object(kmem_cache_t *cache) {
+    slab_t *slab = cache->partial;
+
+    if (!slab) {
+        slab = cache->empty;
+        if (slab) {
+            slab_list_del(&cache->empty, slab);
+        } else {
+            slab = slab_create(cache);
+            if (!slab) return 0;
+        }
+        slab_list_add(&cache->partial, slab);
+    }
+
+    void **obj = slab->free_list;
+    slab->free_list = *obj;
+    if (++slab->inuse == cache->objects_per_slab) {
+        slab_list_del(&cache->partial, slab);
+        slab_list_add(&cache->full, slab);
+    }
+    return obj;
+}
+
+static void slab_free_object(kmem_cache_t *cache, void *obj) {
+    slab_t *slab = (slab_t *)((uint64_t)obj & ~(SLAB_SIZE - 1));
+
+    if (slab->cache != cache) panic("kmem_cache_free: object freed to the wrong cache");
+
+    if (slab->inuse == cache->objects_per_slab) {
+        slab_list_del(&cache->full, slab);
+        slab_list_add(&cache->partial, slab);
+    }
+
+    *(void **)obj = slab->free_list;
+    slab->free_list = obj;
+
+    if (--slab->inuse == 0) {
+        slab_list_del(&cache->partial, slab);
+        // Keep one empty slab around to absorb alloc/free ping-pong
+        if (cache->empty) {
+            cache->slabs--;
+            pmm_free_pages(virt_to_phys(slab), SLAB_ORDER);
+        } else {
+            slab_list_add(&cache->empty, slab);
+        }
+    }
+}
+
+// Magazine helpers; called with cache->lock held
+static magazine_t *magazine_get_empty(kmem_cache_t *cache) {
+    magazine_t *mag = cache->depot_empty;
+    if (mag) {
+        cache->depot_empty = mag->next;
+        return mag;
+    }
+    mag = kmem_cache_alloc(g_magazine_cache);
+    if (mag) mag->rounds = 0;
+    return mag;
+}
+
+static void magazine_put_empty(kmem_cache_t *cache, magazine_t *mag) {
+    mag->next = cache->depot_empty;
+    cache->depot_empty = mag;
+}
+
+static void magazine_put_full(kmem_cache_t *cache, magazine_t *mag) {
+    if (cache->depot_full_count >= DEPOT_MAX_FULL) {
+        // Depot is saturated: give the objects back to their slabs
+        while (mag->rounds) slab_free_object(cache, mag->objects[--mag->rounds]);
+        magazine_put_empty(cache, mag);
+        return;
+    }
+    mag->next = cache->depot_full;
+    cache->depot_full = mag;
+    cache->depot_full_count++;
+}
+
+static unsigned int cache_align(size_t size) {
+    if (size >= 64) return 64;
+    unsigned int align = 8;
+    while (align < size) align <<= 1;
+    return align;
+}
+
+static void cache_setup(kmem_cache_t *cache, const char *name, size_t size, size_t align, unsigned int flags) {
+    if (align < sizeof(void *)) align = sizeof(void *);
+    if (size < sizeof(void *)) size = sizeof(void *);
+
+    cache->name = name;
+    cache->object_size = size;
+    cache->stride = (size + align - 1) & ~(align - 1);
+    cache->first_offset = (sizeof(slab_t) + align - 1) & ~(align - 1);
+    cache->objects_per_slab = (unsigned int)((SLAB_SIZE - cache->first_offset) / cache->stride);
+    cache->flags = flags;
+
+    unsigned long irq = spin_lock_irqsave(&g_cache_list_lock);
+    cache->next = g_cache_list;
+    g_cache_list = cache;
+    spin_unlock_irqrestore(&g_cache_list_lock, irq);
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align, unsigned int flags) {
+    if (align & (align - 1)) return 0;
+    if (size + sizeof(slab_t) + align > SLAB_SIZE) return 0;
+
+    uint64_t phys = pmm_alloc_pages(pmm_order_for_size(sizeof(kmem_cache_t)));
+    if (!phys) return 0;
+
+    kmem_cache_t *cache = phys_to_virt(phys);
+    memset(cache, 0, sizeof(*cache));
+    cache_setup(cache, name, size, align, flags);
+    return cache;
+}
+
+void *kmem_cache_alloc(kmem_cache_t *cache) {
+    void *obj;
+    unsigned long irq = irq_save();
+    cpu_cache_t *cc = &cache->cpu[this_cpu_id()];
+    cc->allocs++;
+
+    if (!(cache->flags & KMEM_CACHE_NO_MAGAZINE)) {
+        if (cc->loaded && cc->loaded->rounds) {
+            cc->hits++;
+            obj = cc->loaded->objects[--cc->loaded->rounds];
+            irq_restore(irq);
+            return obj;
+        }
+        if (cc->previous && cc->previous->rounds) {
+            magazine_t *tmp = cc->loaded;
+            cc->loaded = cc->previous;
+            cc->previous = tmp;
+            cc->hits++;
+            obj = cc->loaded->objects[--cc->loaded->rounds];
+            irq_restore(irq);
+            return obj;
+        }
+    }
+
+    spin_lock(&cache->lock);
+    if (cache->flags & KMEM_CACHE_NO_MAGAZINE) {
+        obj = slab_alloc_object(cache);
+    } else if (cache->depot_full) {
+        // Both magazines are empty: park one and load a full one from the depot
+        if (cc->previous) magazine_put_empty(cache, cc->previous);
+        cc->previous = cc->loaded;
+        cc->loaded = cache->depot_full;
+        cache->depot_full = cc->loaded->next;
+        cache->depot_full_count--;
+        obj = cc->loaded->objects[--cc->loaded->rounds];
+    } else {
+        // Refill half a magazine from the slabs in one lock hold
+        if (!cc->loaded) cc->loaded = magazine_get_empty(cache);
+        obj = slab_alloc_object(cache);
+        if (obj && cc->loaded) {
+            while (cc->loaded->rounds < MAGAZINE_SIZE / 2) {
+                void *extra = slab_alloc_object(cache);
+                if (!extra) break;
+                cc->loaded->objects[cc->loaded->rounds++] = extra;
+            }
+        }
+    }
+    spin_unlock(&cache->lock);
+
+    if (!obj) cc->allocs--;
+    irq_restore(irq);
+    return obj;
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *obj) {
+    unsigned long irq = irq_save();
+    cpu_cache_t *cc = &cache->cpu[this_cpu_id()];
+    cc->frees++;
+
+    if (!(cache->flags & KMEM_CACHE_NO_MAGAZINE)) {
+        if (cc->loaded && cc->loaded->rounds < MAGAZINE_SIZE) {
+            cc->loaded->objects[cc->loaded->rounds++] = obj;
+            irq_restore(irq);
+            return;
+        }
+        if (cc->previous && cc->previous->rounds == 0) {
+            magazine_t *tmp = cc->loaded;
+            cc->loaded = cc->previous;
+            cc->previous = tmp;
+            cc->loaded->objects[cc->loaded->rounds++] = obj;
+            irq_restore(irq);
+            return;
+        }
+    }
+
+    spin_lock(&cache->lock);
+    if (cache->flags & KMEM_CACHE_NO_MAGAZINE) {
+        slab_free_object(cache, obj);
+    } else {
+        // Loaded is full and previous is full or missing: retire previous to the depot
+        magazine_t *mag = magazine_get_empty(cache);
+        if (mag) {
+            if (cc->previous) magazine_put_full(cache, cc->previous);
+            cc->previous = cc->loaded;
+            cc->loaded = mag;
+            mag->objects[mag->rounds++] = obj;
+        } else {
+            slab_free_object(cache, obj);
+        }
+    }
+    spin_unlock(&cache->lock);
+    irq_restore(irq);
+}
+
+void kmem_cache_get_stats(kmem_cache_t *cache, kmem_cache_stats_t *stats) {
+    stats->name = cache->name;
+    stats->object_size = cache->object_size;
+    stats->stride = cache->stride;
+    stats->objects_per_slab = cache->objects_per_slab;
+    stats->allocs = stats->frees = stats->magazine_hits = 0;
+
+    for (unsigned int i = 0; i < MAX_CPUS; i++) {
+        stats->allocs += cache->cpu[i].allocs;
+        stats->frees += cache->cpu[i].frees;
+        stats->magazine_hits += cache->cpu[i].hits;
+    }
+
+    unsigned long irq = spin_lock_irqsave(&cache->lock);
+    stats->slabs = cache->slabs;
+    spin_unlock_irqrestore(&cache->lock, irq);
+
+    stats->objects_total = stats->slabs * cache->objects_per_slab;
+    stats->objects_active = stats->allocs - stats->frees;
+
+    uint64_t slab_bytes = stats->slabs * SLAB_SIZE;
+    uint64_t live_bytes = stats->objects_active * cache->object_size;
+    stats->fragmentation_pct = slab_bytes ? (unsigned int)((slab_bytes - live_bytes) * 100 / slab_bytes) : 0;
+}
+
+static unsigned int kmalloc_index(size_t size) {
+    if (size <= (1UL << KMALLOC_MIN_SHIFT)) return 0;
+    unsigned int shift = 64 - (unsigned int)__builtin_clzl(size - 1);
+    return shift - KMALLOC_MIN_SHIFT;
+}
+
+void slab_init(void) {
+    static kmem_cache_t magazine_cache;
+
+    // The magazine cache cannot use magazines itself, and is static so that
+    // creating the first cache needs no allocation
+    cache_setup(&magazine_cache, "magazine", sizeof(magazine_t), 64, KMEM_CACHE_NO_MAGAZINE);
+    g_magazine_cache = &magazine_cache;
+
+    for (unsigned int i = 0; i < KMALLOC_CLASSES; i++) {
+        size_t size = 1UL << (i + KMALLOC_MIN_SHIFT);
+        g_kmalloc_caches[i] = kmem_cache_create(g_kmalloc_names[i], size, cache_align(size), 0);
+        if (!g_kmalloc_caches[i]) panic("slab_init: cannot create kmalloc caches");
+    }
+}
+
+kmem_cache_t *kmalloc_cache(unsigned int index) {
+    return index < KMALLOC_CLASSES ? g_kmalloc_caches[index] : 0;
+}
+
+void *kmalloc(size_t size) {
+    if (!size) return 0;
+    if (size > KMALLOC_MAX_SIZE) {
+        uint64_t phys = pmm_alloc_pages(pmm_order_for_size(size));
+        return phys ? phys_to_virt(phys) : 0;
+    }
+    return kmem_cache_alloc(g_kmalloc_caches[kmalloc_index(size)]);
+}
+
+void *kzalloc(size_t size) {
+    void *ptr = kmalloc(size);
+    if (ptr) memset(ptr, 0, size);
+    return ptr;
+}
+
+void kfree(void *ptr) {
+    if (!ptr) return;
+
+    // Large allocations are whole page blocks; slab objects never start a
+    // block because the slab header occupies its first bytes
+    int order = pmm_block_order(virt_to_phys(ptr));
+    if (order >= 0) {
+        pmm_free_pages(virt_to_phys(ptr), (unsigned int)order);
+        return;
+    }
+
+    slab_t *slab = (slab_t *)((uint64_t)ptr & ~(SLAB_SIZE - 1));
+    kmem_cache_free(slab->cache, ptr);
+}
+
+#define BENCH_SLOTS     2048
+#define BENCH_OPS       200000
+
+static uint64_t xorshift64(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+// Mostly small objects with a tail of page-sized and large requests
+static size_t bench_size(uint64_t *rng) {
+    uint64_t r = xorshift64(rng);
+    unsigned int pick = (unsigned int)(r % 100);
+    r >>= 8;
+    if (pick < 55) return 8 + r % 121;
+    if (pick < 85) return 129 + r % 896;
+    if (pick < 97) return 1025 + r % 7168;
+    return 8193 + r % 24576;
+}
+
+static void report_latency(const char *label, histogram_t *lat) {
+    char line[128];
+    ksnprintf(line, sizeof(line), "  %s: avg %lu cyc (%lu ns), p50 <%lu, p99 <%lu cyc",
+              label, hist_mean(lat), tsc_cycles_to_ns(hist_mean(lat)),
+              hist_percentile(lat, 50), hist_percentile(lat, 99));
+    boot_print(line, COLOR_CYAN);
+}
+
+void slab_selftest(void) {
+    char line[128];
+    static histogram_t alloc_lat, free_lat;
+    uint64_t rng = 0x9E3779B97F4A7C15UL;
+
+    hist_reset(&alloc_lat);
+    hist_reset(&free_lat);
+
+    void **slots = kzalloc(BENCH_SLOTS * sizeof(void *));
+    if (!slots) {
+        boot_print("kmalloc selftest: out of memory", COLOR_RED);
+        return;
+    }
+
+    // Random alloc/free mix over a bounded working set
+    uint64_t start = rdtsc();
+    for (unsigned int i = 0; i < BENCH_OPS; i++) {
+        unsigned int slot = (unsigned int)(xorshift64(&rng) % BENCH_SLOTS);
+        if (slots[slot]) {
+            uint64_t t0 = rdtsc();
+            kfree(slots[slot]);
+            hist_add(&free_lat, rdtsc() - t0);
+            slots[slot] = 0;
+        } else {
+            size_t size = bench_size(&rng);
+            uint64_t t0 = rdtsc();
+            void *p = kmalloc(size);
+            hist_add(&alloc_lat, rdtsc() - t0);
+            if (!p) panic("slab_selftest: allocation failed");
+            *(volatile unsigned char *)p = 0xA5;
+            slots[slot] = p;
+        }
+    }
+    uint64_t elapsed = rdtsc() - start;
+
+    for (unsigned int i = 0; i < BENCH_SLOTS; i++) kfree(slots[i]);
+    kfree(slots);
+
+    ksnprintf(line, sizeof(line), "kmalloc mixed 8B-32K: %u ops, %lu ops/s",
+              BENCH_OPS, tsc_rate_per_sec(BENCH_OPS, elapsed));
+    boot_print(line, COLOR_CYAN);
+    report_latency("kmalloc", &alloc_lat);
+    report_latency("kfree  ", &free_lat);
+
+    for (unsigned int i = 0; i < KMALLOC_CLASSES; i += 3) {
+        kmem_cache_stats_t cs;
+        kmem_cache_get_stats(g_kmalloc_caches[i], &cs);
+        if (!cs.allocs) continue;
+        ksnprintf(line, sizeof(line), "  %-11s slabs %lu, objs %lu/%lu, hits %lu%%, frag %u%%",
+                  cs.name, cs.slabs, cs.objects_active, cs.objects_total,
+                  cs.magazine_hits * 100 / cs.allocs, cs.fragmentation_pct);
+        boot_print(line, COLOR_CYAN);
+    }
+}
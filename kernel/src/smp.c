@@ -0,0 +1,165 @@
+#include "../include/smp.h"
+#include "../include/acpi.h"
+#include "../include/apic.h"
+#include "../include/cpu.h"
+#include "../include/fpu.h"
+#include "../include/gdt.h"
+#include "../include/idt.h"
+#include "../include/klog.h"
+#include "../include/kernel.h"
+#include "../include/paging.h"
+#include "../include/percpu.h"
+#include "../include/pmm.h"
+#include "../include/sched.h"
+#include "../include/slab.h"
+#include "../include/timer.h"
+#include "../include/trace.h"
+#include "../include/tsc.h"
+#include "../include/util.h"
+
+#define AP_STACK_ORDER      2           // 16 KiB, like the BSP stack
+#define AP_ONLINE_TIMEOUT   100000      // us
+#define INIT_DELAY          10000       // us, per the MP specification
+#define SIPI_DELAY          200         // us
+
+#define ICR_INIT            0x4500      // INIT, level assert
+#define ICR_STARTUP         0x4600      // start-up, level assert, vector = page
+
+#define EFER_LMA            (1UL << 10)
+
+// smp_trampoline.asm
+extern uint8_t smp_trampoline_start[], smp_trampoline_end[];
+extern uint8_t tramp_gdtr[], tramp_far32[], tramp_far64[], tramp_pml4_low[];
+extern uint8_t tramp_efer[], tramp_cr3[], tramp_stack[], tramp_percpu[], tramp_entry[];
+extern const uint32_t tramp_pm32_offset, tramp_lm64_offset, tramp_gdt_offset;
+
+static uint8_t *g_trampoline;
+
+// Address of a trampoline symbol in the low-memory copy
+#define TRAMP_FIELD(type, sym) ((type *)(g_trampoline + ((sym) - smp_trampoline_start)))
+
+static void delay_us(uint64_t us) {
+    uint64_t end = rdtsc() + tsc_ns_to_cycles(us * 1000);
+    while (rdtsc() < end) cpu_pause();
+}
+
+// First C code on an AP, on its own stack with the kernel page tables
+static void ap_entry(percpu_t *cpu) {
+    percpu_install(cpu, cpu->cpu_id);
+    fpu_init();             // before anything can reach the SIMD memops
+    paging_init_cpu();
+    gdt_init_cpu();
+    idt_load_cpu();
+    apic_init_cpu();
+    fpu_init_state();
+    timer_init_cpu();
+    klog_init_cpu();
+    trace_init_cpu();
+    sched_init_cpu();
+    percpu_set_online(cpu);
+
+    sched_idle();
+}
+
+static int setup_trampoline(void) {
+    uint64_t phys = pmm_alloc_low(2);
+    if (!phys) return -1;
+    g_trampoline = phys_to_virt(phys);
+
+    // Page 0: code and data; page 1: a PML4 copy CR3 can reach from 32-bit code
+    memcpy(g_trampoline, smp_trampoline_start, smp_trampoline_end - smp_trampoline_start);
+    memcpy(g_trampoline + PAGE_SIZE, phys_to_virt(paging_kernel_pml4()), PAGE_SIZE);
+
+    *TRAMP_FIELD(uint32_t, tramp_gdtr + 2) = (uint32_t)phys + tramp_gdt_offset;
+    *TRAMP_FIELD(uint32_t, tramp_far32) = (uint32_t)phys + tramp_pm32_offset;
+    *TRAMP_FIELD(uint32_t, tramp_far64) = (uint32_t)phys + tramp_lm64_offset;
+    *TRAMP_FIELD(uint64_t, tramp_pml4_low) = phys + PAGE_SIZE;
+    *TRAMP_FIELD(uint64_t, tramp_efer) = rdmsr(MSR_EFER) & ~EFER_LMA;
+    *TRAMP_FIELD(uint64_t, tramp_cr3) = paging_kernel_pml4();
+    *TRAMP_FIELD(uint64_t, tramp_entry) = (uint64_t)ap_entry;
+    return 0;
+}
+
+// Start one AP and wait until it is online; returns the cycles from the
+// first start-up IPI, or 0 on timeout
+static uint64_t start_ap(percpu_t *cpu) {
+    uint64_t stack = pmm_alloc_pages(AP_STACK_ORDER);
+    if (!stack) return 0;
+    cpu->stack_top = (uint64_t)phys_to_virt(stack) + (PAGE_SIZE << AP_STACK_ORDER);
+
+    *TRAMP_FIELD(uint64_t, tramp_stack) = cpu->stack_top;
+    *TRAMP_FIELD(uint64_t, tramp_percpu) = (uint64_t)cpu;
+    uint32_t vector = (uint32_t)(virt_to_phys(g_trampoline) >> PAGE_SHIFT);
+
+    uint64_t start = rdtsc();
+    apic_send_ipi(cpu->apic_id, ICR_INIT);
+    delay_us(INIT_DELAY);
+
+    // The second SIPI is ignored by an AP that already left wait-for-SIPI
+    uint64_t sipi = rdtsc();
+    for (int i = 0; i < 2 && !cpu->online; i++) {
+        apic_send_ipi(cpu->apic_id, ICR_STARTUP | vector);
+        delay_us(SIPI_DELAY);
+    }
+
+    uint64_t timeout = rdtsc() + tsc_ns_to_cycles(AP_ONLINE_TIMEOUT * 1000UL);
+    while (!__atomic_load_n(&cpu->online, __ATOMIC_ACQUIRE)) {
+        // A late AP would still run on this stack and percpu block, so
+        // neither is freed on failure
+        if (rdtsc() > timeout) return 0;
+        cpu_pause();
+    }
+
+    uint64_t now = rdtsc();
+    cpu->boot_cycles = now - start;
+    return now - sipi;
+}
+
+void smp_init(void) {
+    char line[96];
+    const acpi_info_t *acpi = acpi_get_info();
+    percpu_t *bsp = this_cpu();
+
+    bsp->apic_id = apic_id();
+    if (!acpi || acpi->cpu_count < 2) {
+        boot_print("SMP: single CPU", COLOR_CYAN);
+        return;
+    }
+    if (setup_trampoline() != 0) {
+        boot_print("SMP: no low memory for the AP trampoline", COLOR_RED);
+        return;
+    }
+
+    unsigned int next_id = 1, attempted = 0;
+    uint64_t total = 0, worst = 0;
+    for (unsigned int i = 0; i < acpi->cpu_count && next_id < MAX_CPUS; i++) {
+        if (acpi->cpus[i].apic_id == bsp->apic_id) continue;
+        attempted++;
+
+        percpu_t *cpu = kzalloc(sizeof(percpu_t));
+        if (!cpu) break;
+        cpu->cpu_id = next_id;
+        cpu->apic_id = acpi->cpus[i].apic_id;
+
+        uint64_t sipi_cycles = start_ap(cpu);
+        if (!sipi_cycles) {
+            ksnprintf(line, sizeof(line), "  APIC %u: no response", cpu->apic_id);
+            boot_print(line, COLOR_RED);
+            continue;
+        }
+        next_id++;
+        total += cpu->boot_cycles;
+        if (cpu->boot_cycles > worst) worst = cpu->boot_cycles;
+
+        ksnprintf(line, sizeof(line), "  CPU%u (APIC %u): %lu us from INIT, %lu us from SIPI",
+                  cpu->cpu_id, cpu->apic_id, tsc_cycles_to_ns(cpu->boot_cycles) / 1000,
+                  tsc_cycles_to_ns(sipi_cycles) / 1000);
+        boot_print(line, COLOR_CYAN);
+    }
+
+    unsigned int started = next_id - 1;
+    ksnprintf(line, sizeof(line), "SMP: %u/%u APs online, avg %lu us, max %lu us",
+              started, attempted, started ? tsc_cycles_to_ns(total / started) / 1000 : 0,
+              tsc_cycles_to_ns(worst) / 1000);
+    boot_print(line, started == attempted ? COLOR_CYAN : COLOR_YELLOW);
+}
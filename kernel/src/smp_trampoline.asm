@@ -0,0 +1,117 @@
+BITS 16
+GLOBAL smp_trampoline_start
+GLOBAL smp_trampoline_end
+GLOBAL tramp_gdtr
+GLOBAL tramp_far32
+GLOBAL tramp_far64
+GLOBAL tramp_pml4_low
+GLOBAL tramp_efer
+GLOBAL tramp_cr3
+GLOBAL tramp_stack
+GLOBAL tramp_percpu
+GLOBAL tramp_entry
+
+; AP startup code. smp.c copies this block to a page below 1 MiB, patches the
+; data fields at the end and points the SIPI vector at it. The code must be
+; position independent: EBX holds the physical base from the first
+; instructions on, and every data access is relative to it.
+
+%define REL(x) ((x) - smp_trampoline_start)
+
+SECTION .rodata
+ALIGN 16
+smp_trampoline_start:
+    CLI
+    CLD
+    MOV     AX, CS
+    MOV     DS, AX
+    XOR     EBX, EBX
+    MOV     BX, AX
+    SHL     EBX, 4
+
+    O32 LGDT [REL(tramp_gdtr)]
+    MOV     EAX, CR0
+    OR      EAX, 1
+    MOV     CR0, EAX
+    O32 JMP FAR [REL(tramp_far32)]
+
+BITS 32
+tramp_pm32:
+    MOV     AX, 0x10
+    MOV     DS, AX
+    MOV     ES, AX
+    MOV     SS, AX
+
+    ; PAE, then the low copy of the kernel PML4: CR3 only takes 32 bits here
+    MOV     EAX, CR4
+    OR      EAX, 1 << 5
+    MOV     CR4, EAX
+    MOV     EAX, [EBX + REL(tramp_pml4_low)]
+    MOV     CR3, EAX
+
+    ; Same EFER as the BSP (LME, plus NXE if the firmware enabled it)
+    MOV     ECX, 0xC0000080
+    MOV     EAX, [EBX + REL(tramp_efer)]
+    XOR     EDX, EDX
+    WRMSR
+
+    MOV     EAX, CR0
+    OR      EAX, 0x80000000
+    MOV     CR0, EAX
+    JMP     FAR [EBX + REL(tramp_far64)]
+
+BITS 64
+tramp_lm64:
+    MOV     EBX, EBX
+    MOV     RAX, [RBX + REL(tramp_cr3)]
+    MOV     CR3, RAX
+    MOV     RSP, [RBX + REL(tramp_stack)]
+    MOV     RDI, [RBX + REL(tramp_percpu)]
+    MOV     RAX, [RBX + REL(tramp_entry)]
+    XOR     EBP, EBP
+    CALL    RAX
+
+.halt:
+    CLI
+    HLT
+    JMP     .halt
+
+ALIGN 8
+tramp_gdt:
+    DQ      0
+    DQ      0x00CF9A000000FFFF      ; 0x08: 32-bit code
+    DQ      0x00CF92000000FFFF      ; 0x10: data
+    DQ      0x00AF9A000000FFFF      ; 0x18: 64-bit code
+tramp_gdt_end:
+
+; Patched by smp.c before each start-up IPI
+tramp_gdtr:
+    DW      tramp_gdt_end - tramp_gdt - 1
+    DD      0                       ; base + REL(tramp_gdt)
+tramp_far32:
+    DD      0                       ; base + REL(tramp_pm32)
+    DW      0x08
+tramp_far64:
+    DD      0                       ; base + REL(tramp_lm64)
+    DW      0x18
+ALIGN 8
+tramp_pml4_low:
+    DQ      0
+tramp_efer:
+    DQ      0
+tramp_cr3:
+    DQ      0
+tramp_stack:
+    DQ      0
+tramp_percpu:
+    DQ      0
+tramp_entry:
+    DQ      0
+smp_trampoline_end:
+
+GLOBAL tramp_pm32_offset
+GLOBAL tramp_lm64_offset
+GLOBAL tramp_gdt_offset
+tramp_pm32_offset:  DD REL(tramp_pm32)
+tramp_lm64_offset:  DD REL(tramp_lm64)
+tramp_gdt_offset:   DD REL(tramp_gdt)
@@ -0,0 +1,286 @@
+#include "../include/timer.h"
+#include "../include/apic.h"
+#include "../include/cpu.h"
+#include "../include/histogram.h"
+#include "../include/idt.h"
+#include "../include/kernel.h"
+#include "../include/slab.h"
+#include "../include/spinlock.h"
+#include "../include/tsc.h"
+#include "../include/util.h"
+
+#define MSR_TSC_DEADLINE    0x6E0
+#define LAPIC_DIVIDE_16     0x3
+#define LAPIC_MAX_COUNT     0xFFFFFFFFUL
+#define CALIBRATE_MS        10
+
+typedef struct {
+    timer_event_t *head;        // pending events, earliest first
+    uint64_t armed;             // deadline currently programmed, 0 if none
+    uint64_t period;            // TSC cycles per periodic tick, 0 if off
+    uint64_t last_tick;
+    uint64_t ticks;
+} timer_cpu_t;
+
+static timer_cpu_t g_timer_cpu[MAX_CPUS];
+static uint64_t g_lapic_hz;
+static int g_mode = TIMER_MODE_ONESHOT;
+
+// Programmed deadline to handler, across all CPUs
+static histogram_t g_wakeup_ns;
+static spinlock_t g_wakeup_lock = SPINLOCK_INIT;
+
+static void program(timer_cpu_t *t, uint64_t deadline) {
+    t->armed = deadline;
+    if (t->period) return;      // periodic ticks poll the queue
+
+    if (g_mode == TIMER_MODE_TSC_DEADLINE) {
+        // Keep the MSR write from passing earlier stores (SDM 10.5.4.1)
+        __asm__ volatile("mfence" ::: "memory");
+        wrmsr(MSR_TSC_DEADLINE, deadline);
+        return;
+    }
+
+    uint64_t count = 0;
+    if (deadline) {
+        uint64_t now = rdtsc();
+        count = deadline > now ? muldiv64(deadline - now, g_lapic_hz, tsc_hz()) : 1;
+        // Far deadlines fire early and re-arm from the handler
+        if (count > LAPIC_MAX_COUNT) count = LAPIC_MAX_COUNT;
+        if (!count) count = 1;
+    }
+    apic_write(APIC_REG_TIMER_INIT, (uint32_t)count);
+}
+
+static void unlink(timer_cpu_t *t, timer_event_t *ev) {
+    for (timer_event_t **p = &t->head; *p; p = &(*p)->next) {
+        if (*p == ev) {
+            *p = ev->next;
+            ev->next = 0;
+            return;
+        }
+    }
+}
+
+static void run_expired(timer_cpu_t *t) {
+    while (t->head && t->head->deadline <= rdtsc()) {
+        timer_event_t *ev = t->head;
+        t->head = ev->next;
+        ev->next = 0;
+        ev->fn(ev, rdtsc());
+    }
+    program(t, t->head ? t->head->deadline : 0);
+}
+
+static void handle_timer(interrupt_frame_t *frame) {
+    (void)frame;
+    uint64_t now = rdtsc();
+    timer_cpu_t *t = &g_timer_cpu[this_cpu_id()];
+
+    if (t->period) {
+        t->last_tick = now;
+        t->ticks++;
+    } else if (t->armed && now >= t->armed) {
+        spin_lock(&g_wakeup_lock);
+        hist_add(&g_wakeup_ns, tsc_cycles_to_ns(now - t->armed));
+        spin_unlock(&g_wakeup_lock);
+        // The deadline MSR clears itself when it fires
+        t->armed = 0;
+    }
+
+    apic_eoi();
+    run_expired(t);
+}
+
+static void set_lvt(timer_cpu_t *t) {
+    uint32_t mode = APIC_TIMER_ONESHOT;
+    if (t->period) mode = APIC_TIMER_PERIODIC;
+    else if (g_mode == TIMER_MODE_TSC_DEADLINE) mode = APIC_TIMER_TSC_DEADLINE;
+
+    apic_write(APIC_REG_TIMER_DIVIDE, LAPIC_DIVIDE_16);
+    apic_write(APIC_REG_LVT_TIMER, mode | APIC_TIMER_VECTOR);
+    // Switching into TSC-deadline mode needs the LVT write to land first
+    __asm__ volatile("mfence" ::: "memory");
+}
+
+void timer_init_cpu(void) {
+    timer_cpu_t *t = &g_timer_cpu[this_cpu_id()];
+    set_lvt(t);
+    program(t, 0);
+}
+
+// LAPIC timer ticks per second at divide-by-16, measured against the TSC
+static uint64_t calibrate_lapic(void) {
+    uint64_t window = tsc_hz() / 1000 * CALIBRATE_MS;
+    unsigned long flags = irq_save();
+
+    apic_write(APIC_REG_TIMER_DIVIDE, LAPIC_DIVIDE_16);
+    apic_write(APIC_REG_LVT_TIMER, APIC_LVT_MASKED | APIC_TIMER_ONESHOT);
+    apic_write(APIC_REG_TIMER_INIT, (uint32_t)LAPIC_MAX_COUNT);
+
+    uint64_t start = rdtsc();
+    while (rdtsc() - start < window)
+        cpu_pause();
+    uint32_t remaining = apic_read(APIC_REG_TIMER_CURRENT);
+    uint64_t cycles = rdtsc() - start;
+
+    apic_write(APIC_REG_TIMER_INIT, 0);
+    irq_restore(flags);
+    return muldiv64(LAPIC_MAX_COUNT - remaining, tsc_hz(), cycles);
+}
+
+void timer_init(void) {
+    uint32_t a, b, c, d;
+    cpuid(1, 0, &a, &b, &c, &d);
+    if (c & (1U << 24)) g_mode = TIMER_MODE_TSC_DEADLINE;
+
+    g_lapic_hz = calibrate_lapic();
+    interrupt_register(APIC_TIMER_VECTOR, handle_timer);
+    timer_init_cpu();
+}
+
+void timer_schedule(timer_event_t *ev, uint64_t deadline_tsc) {
+    unsigned long flags = irq_save();
+    timer_cpu_t *t = &g_timer_cpu[this_cpu_id()];
+
+    unlink(t, ev);
+    ev->deadline = deadline_tsc;
+    timer_event_t **p = &t->head;
+    while (*p && (*p)->deadline <= deadline_tsc) p = &(*p)->next;
+    ev->next = *p;
+    *p = ev;
+
+    if (t->head == ev) program(t, deadline_tsc);
+    irq_restore(flags);
+}
+
+void timer_cancel(timer_event_t *ev) {
+    unsigned long flags = irq_save();
+    timer_cpu_t *t = &g_timer_cpu[this_cpu_id()];
+    int was_head = t->head == ev;
+
+    unlink(t, ev);
+    if (was_head) program(t, t->head ? t->head->deadline : 0);
+    irq_restore(flags);
+}
+
+void timer_start_periodic(uint64_t period_ns) {
+    unsigned long flags = irq_save();
+    timer_cpu_t *t = &g_timer_cpu[this_cpu_id()];
+
+    if (g_mode == TIMER_MODE_TSC_DEADLINE) wrmsr(MSR_TSC_DEADLINE, 0);
+    t->period = tsc_ns_to_cycles(period_ns);
+    t->last_tick = 0;
+    set_lvt(t);
+
+    uint64_t count = muldiv64(period_ns, g_lapic_hz, 1000000000UL);
+    if (count > LAPIC_MAX_COUNT) count = LAPIC_MAX_COUNT;
+    apic_write(APIC_REG_TIMER_INIT, (uint32_t)(count ? count : 1));
+    irq_restore(flags);
+}
+
+void timer_stop_periodic(void) {
+    unsigned long flags = irq_save();
+    timer_cpu_t *t = &g_timer_cpu[this_cpu_id()];
+
+    apic_write(APIC_REG_TIMER_INIT, 0);
+    t->period = 0;
+    set_lvt(t);
+    program(t, t->head ? t->head->deadline : 0);
+    irq_restore(flags);
+}
+
+int timer_mode(void) {
+    return g_timer_cpu[this_cpu_id()].period ? TIMER_MODE_PERIODIC : g_mode;
+}
+
+const char *timer_mode_name(void) {
+    switch (timer_mode()) {
+    case TIMER_MODE_TSC_DEADLINE: return "TSC-deadline";
+    case TIMER_MODE_PERIODIC:     return "periodic";
+    default:                      return "one-shot";
+    }
+}
+
+uint64_t timer_lapic_hz(void) {
+    return g_lapic_hz;
+}
+
+#define SELFTEST_WAKEUPS    200
+#define SELFTEST_DELAY_NS   250000
+#define SELFTEST_TICKS      200
+#define SELFTEST_PERIOD_NS  1000000
+
+static volatile int g_selftest_fired;
+
+static void selftest_event(timer_event_t *ev, uint64_t now) {
+    (void)ev;
+    (void)now;
+    g_selftest_fired = 1;
+}
+
+static void report(const char *label, histogram_t *h) {
+    char line[128];
+    ksnprintf(line, sizeof(line), "  %s: avg %lu ns, p50 <%lu, p99 <%lu, max %lu ns",
+              label, hist_mean(h), hist_percentile(h, 50), hist_percentile(h, 99), h->max);
+    boot_print(line, COLOR_CYAN);
+    hist_print(h, label, "ns");
+}
+
+void timer_selftest(void) {
+    static histogram_t wakeup, jitter;
+    timer_event_t ev = { 0, selftest_event, 0, 0 };
+    timer_cpu_t *t = &g_timer_cpu[this_cpu_id()];
+
+    uint64_t *stamps = kmalloc((SELFTEST_TICKS + 1) * sizeof(uint64_t));
+    if (!stamps) {
+        boot_print("Timer selftest: out of memory", COLOR_RED);
+        return;
+    }
+
+    unsigned long flags = irq_save();
+
+    // Wake-up latency: sleep in the tickless idle path until a one-shot fires
+    spin_lock(&g_wakeup_lock);
+    hist_reset(&g_wakeup_ns);
+    spin_unlock(&g_wakeup_lock);
+    for (unsigned int i = 0; i < SELFTEST_WAKEUPS; i++) {
+        g_selftest_fired = 0;
+        timer_schedule(&ev, rdtsc() + tsc_ns_to_cycles(SELFTEST_DELAY_NS));
+        while (!g_selftest_fired) timer_idle();
+    }
+    spin_lock(&g_wakeup_lock);
+    wakeup = g_wakeup_ns;
+    spin_unlock(&g_wakeup_lock);
+
+    // Periodic jitter: deviation of each tick interval from the mean, so a
+    // LAPIC calibration error does not show up as jitter
+    unsigned int collected = 0;
+    uint64_t seen = t->ticks;
+    timer_start_periodic(SELFTEST_PERIOD_NS);
+    while (collected <= SELFTEST_TICKS) {
+        timer_idle();
+        if (t->ticks != seen) {
+            seen = t->ticks;
+            stamps[collected++] = t->last_tick;
+        }
+    }
+    timer_stop_periodic();
+    irq_restore(flags);
+
+    hist_reset(&jitter);
+    uint64_t mean = (stamps[SELFTEST_TICKS] - stamps[0]) / SELFTEST_TICKS;
+    for (unsigned int i = 0; i < SELFTEST_TICKS; i++) {
+        uint64_t delta = stamps[i + 1] - stamps[i];
+        hist_add(&jitter, tsc_cycles_to_ns(delta > mean ? delta - mean : mean - delta));
+    }
+    kfree(stamps);
+
+    char line[128];
+    ksnprintf(line, sizeof(line), "Timer: %u wake-ups after %u us, %u ticks of %u us (mean %lu ns)",
+              SELFTEST_WAKEUPS, SELFTEST_DELAY_NS / 1000, SELFTEST_TICKS, SELFTEST_PERIOD_NS / 1000,
+              tsc_cycles_to_ns(mean));
+    boot_print(line, COLOR_CYAN);
+    report("wake-up", &wakeup);
+    report("jitter", &jitter);
+}
@@ -0,0 +1,129 @@
+#include "../include/trace.h"
+#include "../include/cpu.h"
+#include "../include/klog.h"
+#include "../include/pmm.h"
+#include "../include/slab.h"
+#include "../include/tsc.h"
+#include "../include/util.h"
+
+#define TRACE_FORMAT_VERSION 1
+
+_Static_assert(sizeof(trace_event_t) == 32, "trace2json.py expects 32-byte events");
+
+typedef struct {
+    trace_event_t *events;
+    uint64_t mask;
+    uint64_t head;              // events ever recorded; the ring keeps the last mask + 1
+} trace_ring_t;
+
+static trace_event_t g_early_events[TRACE_EARLY_EVENTS];
+static trace_ring_t g_early_ring = { g_early_events, TRACE_EARLY_EVENTS - 1, 0 };
+static trace_ring_t *g_trace_rings[MAX_CPUS] = { &g_early_ring };
+
+static const char *const g_event_names[TRACE_EVENT_COUNT] = {
+    [TRACE_BOOT_CONSOLE]    = "init_console",
+    [TRACE_BOOT_MEMORY]     = "init_memory",
+    [TRACE_BOOT_ACPI]       = "init_acpi",
+    [TRACE_BOOT_INTERRUPTS] = "init_interrupts",
+    [TRACE_BOOT_SMP]        = "smp_init",
+    [TRACE_BOOT_PCI]        = "pci_init",
+    [TRACE_BOOT_STORAGE]    = "init_storage",
+    [TRACE_INTERRUPT]       = "interrupt",
+    [TRACE_SCHED_SWITCH]    = "switch",
+};
+
+static trace_ring_t *alloc_ring(void) {
+    trace_ring_t *r = kzalloc(sizeof(trace_ring_t));
+    uint64_t events = pmm_alloc_pages(TRACE_RING_ORDER);
+    if (!r || !events) {
+        kfree(r);
+        if (events) pmm_free_pages(events, TRACE_RING_ORDER);
+        return 0;
+    }
+    r->events = phys_to_virt(events);
+    r->mask = (PAGE_SIZE << TRACE_RING_ORDER) / sizeof(trace_event_t) - 1;
+    return r;
+}
+
+void trace_init_cpu(void) {
+    trace_ring_t *r = alloc_ring();
+    if (r) __atomic_store_n(&g_trace_rings[this_cpu_id()], r, __ATOMIC_RELEASE);
+}
+
+void trace_init(void) {
+    trace_ring_t *r = alloc_ring();
+    if (!r) return;             // keep recording into the early ring
+
+    unsigned long flags = irq_save();
+    uint64_t first = g_early_ring.head > TRACE_EARLY_EVENTS ? g_early_ring.head - TRACE_EARLY_EVENTS : 0;
+    for (uint64_t i = first; i < g_early_ring.head; i++)
+        r->events[r->head++ & r->mask] = g_early_events[i & g_early_ring.mask];
+    g_trace_rings[this_cpu_id()] = r;
+    irq_restore(flags);
+}
+
+void trace_record(unsigned int id, unsigned int phase, uint64_t tsc, uint64_t a0, uint64_t a1) {
+    unsigned long flags = irq_save();
+    unsigned int cpu = this_cpu_id();
+    trace_ring_t *r = g_trace_rings[cpu];
+
+    if (r) {
+        trace_event_t *e = &r->events[r->head++ & r->mask];
+        e->tsc = tsc;
+        e->id = (uint16_t)id;
+        e->cpu = (uint16_t)cpu;
+        e->phase = (uint8_t)phase;
+        e->a0 = a0;
+        e->a1 = a1;
+    }
+    irq_restore(flags);
+}
+
+static void dump_line(const char *line) {
+    klog_write_raw(line, strlen(line));
+}
+
+// "TRACE <64 hex digits>": the event's bytes in memory order
+static void dump_event(const trace_event_t *e) {
+    static const char hex[] = "0123456789abcdef";
+    char line[6 + sizeof(trace_event_t) * 2 + 2];
+    const uint8_t *bytes = (const uint8_t *)e;
+
+    memcpy(line, "TRACE ", 6);
+    for (unsigned int i = 0; i < sizeof(trace_event_t); i++) {
+        line[6 + i * 2] = hex[bytes[i] >> 4];
+        line[6 + i * 2 + 1] = hex[bytes[i] & 0xF];
+    }
+    line[sizeof(line) - 2] = '\n';
+    line[sizeof(line) - 1] = '\0';
+    dump_line(line);
+}
+
+void trace_dump(void) {
+    char line[96];
+    unsigned long flags = irq_save();
+
+    // Queued log lines first, so the dump is not interleaved with them
+    klog_flush_sync();
+
+    ksnprintf(line, sizeof(line), "TRACE-BEGIN %u tsc_hz=%lu\n", TRACE_FORMAT_VERSION, tsc_hz());
+    dump_line(line);
+    for (unsigned int id = 0; id < TRACE_EVENT_COUNT; id++) {
+        ksnprintf(line, sizeof(line), "TRACE-NAME %u %s\n", id, g_event_names[id]);
+        dump_line(line);
+    }
+
+    for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        trace_ring_t *r = __atomic_load_n(&g_trace_rings[cpu], __ATOMIC_ACQUIRE);
+        if (!r || !r->head) continue;
+
+        uint64_t size = r->mask + 1;
+        uint64_t first = r->head > size ? r->head - size : 0;
+        ksnprintf(line, sizeof(line), "TRACE-CPU %u events=%lu lost=%lu\n", cpu, r->head - first, first);
+        dump_line(line);
+        for (uint64_t i = first; i < r->head; i++) dump_event(&r->events[i & r->mask]);
+    }
+
+    dump_line("TRACE-END\n");
+    irq_restore(flags);
+}
@@ -0,0 +1,88 @@
+#include "../include/tsc.h"
+#include "../include/cpu.h"
+#include "../include/hpet.h"
+#include "../include/util.h"
+
+#define PIT_HZ            1193182UL
+#define PIT_CH2_DATA      0x42
+#define PIT_COMMAND       0x43
+#define PIT_GATE_PORT     0x61
+#define CALIBRATE_MS      10
+
+#define FS_PER_SEC        1000000000000000UL
+
+static uint64_t g_tsc_hz;
+static const char *g_tsc_source = "none";
+
+// Time a one-shot countdown of PIT channel 2 with the speaker gate enabled
+static uint64_t pit_measure_cycles(unsigned int ms) {
+    unsigned int latch = (unsigned int)(PIT_HZ * ms / 1000);
+
+    outb(PIT_GATE_PORT, (inb(PIT_GATE_PORT) & ~0x02) | 0x01);
+    outb(PIT_COMMAND, 0xB0);    // channel 2, lobyte/hibyte, mode 0
+    outb(PIT_CH2_DATA, latch & 0xFF);
+    outb(PIT_CH2_DATA, latch >> 8);
+
+    uint64_t start = rdtsc();
+    while (!(inb(PIT_GATE_PORT) & 0x20))
+        ;
+    return rdtsc() - start;
+}
+
+// TSC rate over an HPET interval; both clocks are read back to back at each
+// end, so overshooting the interval costs no accuracy
+static uint64_t hpet_measure_hz(unsigned int ms) {
+    uint64_t ticks = FS_PER_SEC / 1000 * ms / hpet_period_fs();
+
+    uint64_t t0 = rdtsc();
+    uint64_t h0 = hpet_counter();
+    uint64_t elapsed;
+    while ((elapsed = hpet_ticks_since(h0)) < ticks)
+        cpu_pause();
+    uint64_t cycles = rdtsc() - t0;
+
+    return muldiv64(cycles, FS_PER_SEC, elapsed * hpet_period_fs());
+}
+
+uint64_t tsc_calibrate(void) {
+    // Take the best of a few runs; a VM exit in the middle only ever inflates a sample
+    uint64_t best = ~0UL;
+    if (hpet_available()) {
+        for (int i = 0; i < 3; i++) {
+            uint64_t hz = hpet_measure_hz(CALIBRATE_MS);
+            if (hz < best) best = hz;
+        }
+        g_tsc_hz = best;
+        g_tsc_source = "HPET";
+    } else {
+        for (int i = 0; i < 3; i++) {
+            uint64_t cycles = pit_measure_cycles(CALIBRATE_MS);
+            if (cycles < best) best = cycles;
+        }
+        g_tsc_hz = best * (1000 / CALIBRATE_MS);
+        g_tsc_source = "PIT";
+    }
+    return g_tsc_hz;
+}
+
+const char *tsc_calibration_source(void) {
+    return g_tsc_source;
+}
+
+uint64_t tsc_hz(void) {
+    return g_tsc_hz;
+}
+
+uint64_t tsc_cycles_to_ns(uint64_t cycles) {
+    if (!g_tsc_hz) return 0;
+    return muldiv64(cycles, 1000000000UL, g_tsc_hz);
+}
+
+uint64_t tsc_ns_to_cycles(uint64_t ns) {
+    return muldiv64(ns, g_tsc_hz, 1000000000UL);
+}
+
+uint64_t tsc_rate_per_sec(uint64_t ops, uint64_t cycles) {
+    if (!g_tsc_hz || !cycles) return 0;
+    return muldiv64(ops, g_tsc_hz, cycles);
+}
@@ -0,0 +1,124 @@
+#include "../include/util.h"
+
+int memcmp(const void *a, const void *b, size_t n) {
+    const unsigned char *x = a, *y = b;
+    for (; n; n--, x++, y++) {
+        if (*x != *y) return *x - *y;
+    }
+    return 0;
+}
+
+size_t strlen(const char *str) {
+    size_t len = 0;
+    while (str[len]) len++;
+    return len;
+}
+
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t pos;
+} fmt_out_t;
+
+static void fmt_putc(fmt_out_t *out, char c) {
+    if (out->pos + 1 < out->size) out->buf[out->pos] = c;
+    out->pos++;
+}
+
+static void fmt_number(fmt_out_t *out, unsigned long val, unsigned int base, int upper,
+                       int negative, unsigned int width, int zero_pad, int left) {
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char tmp[24];
+    unsigned int len = 0;
+
+    do {
+        tmp[len++] = digits[val % base];
+        val /= base;
+    } while (val);
+
+    unsigned int total = len + (negative ? 1 : 0);
+    unsigned int pad = width > total ? width - total : 0;
+
+    if (!left && !zero_pad) while (pad--) fmt_putc(out, ' ');
+    if (negative) fmt_putc(out, '-');
+    if (!left && zero_pad) while (pad--) fmt_putc(out, '0');
+    while (len) fmt_putc(out, tmp[--len]);
+    if (left) while (pad--) fmt_putc(out, ' ');
+}
+
+int kvsnprintf(char *buf, size_t size, const char *fmt, va_list args) {
+    fmt_out_t out = { buf, size, 0 };
+
+    for (; *fmt; fmt++) {
+        if (*fmt != '%') {
+            fmt_putc(&out, *fmt);
+            continue;
+        }
+        fmt++;
+
+        int left = 0, zero_pad = 0, longs = 0;
+        unsigned int width = 0;
+        for (;; fmt++) {
+            if (*fmt == '-') left = 1;
+            else if (*fmt == '0') zero_pad = 1;
+            else break;
+        }
+        while (*fmt >= '0' && *fmt <= '9') width = width * 10 + (unsigned int)(*fmt++ - '0');
+        while (*fmt == 'l' || *fmt == 'z') { longs++; fmt++; }
+
+        switch (*fmt) {
+        case 'd':
+        case 'i': {
+            long v = longs ? va_arg(args, long) : va_arg(args, int);
+            fmt_number(&out, v < 0 ? -(unsigned long)v : (unsigned long)v, 10, 0, v < 0, width, zero_pad, left);
+            break;
+        }
+        case 'u':
+        case 'x':
+        case 'X': {
+            unsigned long v = longs ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
+            fmt_number(&out, v, *fmt == 'u' ? 10 : 16, *fmt == 'X', 0, width, zero_pad, left);
+            break;
+        }
+        case 'p':
+            fmt_putc(&out, '0');
+            fmt_putc(&out, 'x');
+            fmt_number(&out, (unsigned long)va_arg(args, void *), 16, 0, 0, 16, 1, 0);
+            break;
+        case 'c':
+            fmt_putc(&out, (char)va_arg(args, int));
+            break;
+        case 's': {
+            const char *s = va_arg(args, const char *);
+            if (!s) s = "(null)";
+            size_t len = strlen(s);
+            unsigned int pad = width > len ? width - (unsigned int)len : 0;
+            if (!left) while (pad--) fmt_putc(&out, ' ');
+            while (*s) fmt_putc(&out, *s++);
+            if (left) while (pad--) fmt_putc(&out, ' ');
+            break;
+        }
+        case '%':
+            fmt_putc(&out, '%');
+            break;
+        case '\0':
+            fmt--;
+            break;
+        default:
+            fmt_putc(&out, '%');
+            fmt_putc(&out, *fmt);
+            break;
+        }
+    }
+
+    if (size) out.buf[out.pos < size ? out.pos : size - 1] = '\0';
+    return (int)out.pos;
+}
+
+int ksnprintf(char *buf, size_t size, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int len = kvsnprintf(buf, size, fmt, args);
+    va_end(args);
+    return len;
+}
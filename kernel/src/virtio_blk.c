@@ -0,0 +1,595 @@
+#include "../include/virtio_blk.h"
+#include "../include/cpu.h"
+#include "../include/kernel.h"
+#include "../include/klog.h"
+#include "../include/pci.h"
+#include "../include/percpu.h"
+#include "../include/pmm.h"
+#include "../include/slab.h"
+#include "../include/spinlock.h"
+#include "../include/tsc.h"
+#include "../include/util.h"
+
+#define VIRTIO_VENDOR_ID            0x1AF4
+#define VIRTIO_BLK_DEVICE_ID        0x1042  // modern
+#define VIRTIO_BLK_TRANSITIONAL_ID  0x1001
+
+// virtio_pci_cap, a vendor capability
+#define VIRTIO_CAP_CFG_TYPE         3
+#define VIRTIO_CAP_BAR              4
+#define VIRTIO_CAP_OFFSET           8
+#define VIRTIO_CAP_LENGTH           12
+#define VIRTIO_CAP_NOTIFY_MULT      16
+
+#define VIRTIO_PCI_CAP_COMMON_CFG   1
+#define VIRTIO_PCI_CAP_NOTIFY_CFG   2
+#define VIRTIO_PCI_CAP_DEVICE_CFG   4
+
+// virtio_pci_common_cfg
+#define COMMON_DEVICE_FEATURE_SELECT 0x00
+#define COMMON_DEVICE_FEATURE       0x04
+#define COMMON_DRIVER_FEATURE_SELECT 0x08
+#define COMMON_DRIVER_FEATURE       0x0C
+#define COMMON_MSIX_CONFIG          0x10
+#define COMMON_NUM_QUEUES           0x12
+#define COMMON_DEVICE_STATUS        0x14
+#define COMMON_QUEUE_SELECT         0x16
+#define COMMON_QUEUE_SIZE           0x18
+#define COMMON_QUEUE_MSIX_VECTOR    0x1A
+#define COMMON_QUEUE_ENABLE         0x1C
+#define COMMON_QUEUE_NOTIFY_OFF     0x1E
+#define COMMON_QUEUE_DESC           0x20
+#define COMMON_QUEUE_DRIVER         0x28
+#define COMMON_QUEUE_DEVICE         0x30
+
+#define STATUS_ACKNOWLEDGE          1
+#define STATUS_DRIVER               2
+#define STATUS_DRIVER_OK            4
+#define STATUS_FEATURES_OK          8
+#define STATUS_FAILED               128
+
+#define VIRTIO_NO_VECTOR            0xFFFF
+
+#define FEATURE_BLK_RO              (1ULL << 5)
+#define FEATURE_BLK_SIZE            (1ULL << 6)
+#define FEATURE_BLK_MQ              (1ULL << 12)
+#define FEATURE_VERSION_1           (1ULL << 32)
+
+// virtio_blk_config
+#define BLK_CFG_CAPACITY            0x00
+#define BLK_CFG_BLK_SIZE            0x14
+#define BLK_CFG_NUM_QUEUES          0x22
+
+#define VIRTIO_BLK_T_IN             0
+#define VIRTIO_BLK_T_OUT            1
+
+#define VRING_DESC_F_NEXT           1
+#define VRING_DESC_F_WRITE          2
+#define VRING_AVAIL_F_NO_INTERRUPT  1
+#define VRING_USED_F_NO_NOTIFY      1
+
+#define DESCS_PER_REQUEST           3       // header, data, status
+#define RESET_TIMEOUT_NS            100000000UL
+
+typedef struct {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} vring_desc_t;
+
+typedef struct {
+    uint16_t flags;
+    volatile uint16_t idx;
+    uint16_t ring[];
+} vring_avail_t;
+
+typedef struct {
+    uint32_t id;
+    uint32_t len;
+} vring_used_elem_t;
+
+typedef struct {
+    volatile uint16_t flags;
+    volatile uint16_t idx;
+    vring_used_elem_t ring[];
+} vring_used_t;
+
+// Written mostly by the CPUs its vector targets; one cache line apart from
+// its neighbours so that queues on different CPUs do not share lines
+typedef struct {
+    spinlock_t lock;
+    uint16_t index;
+    uint16_t size;
+    uint16_t free_head;
+    uint16_t num_free;
+    uint16_t last_used;
+    uint16_t avail_idx;
+    vring_desc_t *desc;
+    vring_avail_t *avail;
+    vring_used_t *used;
+    volatile uint16_t *notify;
+    blk_request_t **inflight;           // by head descriptor
+    blk_queue_stats_t stats;
+} __attribute__((aligned(64))) blk_queue_t;
+
+typedef struct {
+    pci_device_t *pci;
+    volatile uint8_t *common;
+    volatile uint8_t *device;
+    volatile uint8_t *notify_base;
+    uint32_t notify_mult;
+    uint64_t features;
+    uint64_t capacity;
+    uint32_t block_size;
+    unsigned int queue_count;
+    int has_irqs;
+    int mode;
+    uint8_t cpu_queue[MAX_CPUS];
+    blk_queue_t queues[BLK_MAX_QUEUES];
+} blk_device_t;
+
+static blk_device_t g_blk;
+
+static inline uint8_t common_read8(unsigned int off) {
+    return *(g_blk.common + off);
+}
+
+static inline uint16_t common_read16(unsigned int off) {
+    return *(volatile uint16_t *)(g_blk.common + off);
+}
+
+static inline uint32_t common_read32(unsigned int off) {
+    return *(volatile uint32_t *)(g_blk.common + off);
+}
+
+static inline void common_write8(unsigned int off, uint8_t val) {
+    *(g_blk.common + off) = val;
+}
+
+static inline void common_write16(unsigned int off, uint16_t val) {
+    *(volatile uint16_t *)(g_blk.common + off) = val;
+}
+
+static inline void common_write32(unsigned int off, uint32_t val) {
+    *(volatile uint32_t *)(g_blk.common + off) = val;
+}
+
+// 64-bit fields are written as two halves, low first, as the spec allows
+static inline void common_write64(unsigned int off, uint64_t val) {
+    common_write32(off, (uint32_t)val);
+    common_write32(off + 4, (uint32_t)(val >> 32));
+}
+
+// Locate the common, notify and device-specific structures from the vendor
+// capabilities
+static int map_structures(pci_device_t *dev) {
+    for (unsigned int cap = pci_next_capability(dev, PCI_CAP_VENDOR, 0); cap;
+         cap = pci_next_capability(dev, PCI_CAP_VENDOR, cap)) {
+        uint8_t type = pci_read8(dev, cap + VIRTIO_CAP_CFG_TYPE);
+        uint8_t bar = pci_read8(dev, cap + VIRTIO_CAP_BAR);
+        uint32_t offset = pci_read32(dev, cap + VIRTIO_CAP_OFFSET);
+        if (bar >= PCI_MAX_BARS) continue;
+        if (type != VIRTIO_PCI_CAP_COMMON_CFG && type != VIRTIO_PCI_CAP_NOTIFY_CFG &&
+            type != VIRTIO_PCI_CAP_DEVICE_CFG) continue;
+
+        volatile uint8_t *base = pci_map_bar(dev, bar);
+        if (!base || offset + pci_read32(dev, cap + VIRTIO_CAP_LENGTH) > dev->bars[bar].size) continue;
+        base += offset;
+
+        if (type == VIRTIO_PCI_CAP_COMMON_CFG && !g_blk.common) {
+            g_blk.common = base;
+        } else if (type == VIRTIO_PCI_CAP_NOTIFY_CFG && !g_blk.notify_base) {
+            g_blk.notify_base = base;
+            g_blk.notify_mult = pci_read32(dev, cap + VIRTIO_CAP_NOTIFY_MULT);
+        } else if (type == VIRTIO_PCI_CAP_DEVICE_CFG && !g_blk.device) {
+            g_blk.device = base;
+        }
+    }
+    return g_blk.common && g_blk.notify_base && g_blk.device ? 0 : -1;
+}
+
+static int reset_device(void) {
+    common_write8(COMMON_DEVICE_STATUS, 0);
+    uint64_t deadline = rdtsc() + tsc_ns_to_cycles(RESET_TIMEOUT_NS);
+    while (common_read8(COMMON_DEVICE_STATUS) != 0) {
+        if (rdtsc() > deadline) return -1;
+        cpu_pause();
+    }
+    return 0;
+}
+
+static int negotiate_features(void) {
+    common_write32(COMMON_DEVICE_FEATURE_SELECT, 0);
+    uint64_t offered = common_read32(COMMON_DEVICE_FEATURE);
+    common_write32(COMMON_DEVICE_FEATURE_SELECT, 1);
+    offered |= (uint64_t)common_read32(COMMON_DEVICE_FEATURE) << 32;
+    if (!(offered & FEATURE_VERSION_1)) return -1;
+
+    g_blk.features = offered & (FEATURE_VERSION_1 | FEATURE_BLK_MQ | FEATURE_BLK_SIZE | FEATURE_BLK_RO);
+    common_write32(COMMON_DRIVER_FEATURE_SELECT, 0);
+    common_write32(COMMON_DRIVER_FEATURE, (uint32_t)g_blk.features);
+    common_write32(COMMON_DRIVER_FEATURE_SELECT, 1);
+    common_write32(COMMON_DRIVER_FEATURE, (uint32_t)(g_blk.features >> 32));
+
+    common_write8(COMMON_DEVICE_STATUS, common_read8(COMMON_DEVICE_STATUS) | STATUS_FEATURES_OK);
+    return common_read8(COMMON_DEVICE_STATUS) & STATUS_FEATURES_OK ? 0 : -1;
+}
+
+static unsigned int ring_order(uint64_t bytes) {
+    unsigned int order = 0;
+    while ((PAGE_SIZE << order) < bytes) order++;
+    return order;
+}
+
+// Allocate the rings of queue `index` in one block (descriptor table, then
+// the available ring, then the used ring 4-byte aligned) and hand them to
+// the device
+static int setup_queue(unsigned int index, uint16_t vector) {
+    blk_queue_t *q = &g_blk.queues[index];
+
+    common_write16(COMMON_QUEUE_SELECT, index);
+    uint16_t size = common_read16(COMMON_QUEUE_SIZE);
+    if (!size) return -1;
+    if (size > BLK_QUEUE_SIZE) size = BLK_QUEUE_SIZE;
+    common_write16(COMMON_QUEUE_SIZE, size);
+
+    uint64_t desc_bytes = (uint64_t)size * sizeof(vring_desc_t);
+    uint64_t avail_bytes = sizeof(vring_avail_t) + (uint64_t)size * sizeof(uint16_t) + sizeof(uint16_t);
+    uint64_t used_off = (desc_bytes + avail_bytes + 3) & ~3UL;
+    uint64_t used_bytes = sizeof(vring_used_t) + (uint64_t)size * sizeof(vring_used_elem_t) + sizeof(uint16_t);
+    unsigned int order = ring_order(used_off + used_bytes);
+
+    uint64_t phys = pmm_alloc_pages(order);
+    q->inflight = kzalloc(size * sizeof(blk_request_t *));
+    if (!phys || !q->inflight) return -1;
+    uint8_t *rings = phys_to_virt(phys);
+    memset(rings, 0, PAGE_SIZE << order);
+
+    q->index = index;
+    q->size = size;
+    q->desc = (vring_desc_t *)rings;
+    q->avail = (vring_avail_t *)(rings + desc_bytes);
+    q->used = (vring_used_t *)(rings + used_off);
+    for (uint16_t i = 0; i < size; i++) q->desc[i].next = i + 1;
+    q->free_head = 0;
+    q->num_free = size;
+
+    common_write64(COMMON_QUEUE_DESC, virt_to_phys(q->desc));
+    common_write64(COMMON_QUEUE_DRIVER, virt_to_phys(q->avail));
+    common_write64(COMMON_QUEUE_DEVICE, virt_to_phys(q->used));
+    common_write16(COMMON_QUEUE_MSIX_VECTOR, vector);
+    if (common_read16(COMMON_QUEUE_MSIX_VECTOR) != vector) return -1;
+
+    uint16_t notify_off = common_read16(COMMON_QUEUE_NOTIFY_OFF);
+    q->notify = (volatile uint16_t *)(g_blk.notify_base + (uint64_t)notify_off * g_blk.notify_mult);
+    common_write16(COMMON_QUEUE_ENABLE, 1);
+    return 0;
+}
+
+// Return finished chains to the free list and publish each request's
+// status. Caller holds the queue lock.
+static unsigned int reap(blk_queue_t *q) {
+    unsigned int n = 0;
+    uint16_t used_idx = __atomic_load_n(&q->used->idx, __ATOMIC_ACQUIRE);
+
+    while (q->last_used != used_idx) {
+        uint16_t head = q->used->ring[q->last_used % q->size].id;
+        q->last_used++;
+        blk_request_t *req = q->inflight[head];
+        q->inflight[head] = 0;
+
+        uint16_t tail = head, count = 1;
+        while (q->desc[tail].flags & VRING_DESC_F_NEXT) {
+            tail = q->desc[tail].next;
+            count++;
+        }
+        q->desc[tail].next = q->free_head;
+        q->free_head = head;
+        q->num_free += count;
+
+        if (req) {
+            req->complete_tsc = rdtsc();
+            uint8_t status = req->device_status;
+            __atomic_store_n(&req->status, status <= BLK_STATUS_UNSUPP ? status : BLK_STATUS_IOERR,
+                             __ATOMIC_RELEASE);
+        }
+        n++;
+    }
+    q->stats.completed += n;
+    return n;
+}
+
+static void queue_interrupt(void *ctx) {
+    blk_queue_t *q = ctx;
+    spin_lock(&q->lock);
+    q->stats.interrupts++;
+    reap(q);
+    spin_unlock(&q->lock);
+}
+
+unsigned int virtio_blk_submit(unsigned int queue, blk_request_t *const *reqs, unsigned int count) {
+    if (queue >= g_blk.queue_count) return 0;
+    blk_queue_t *q = &g_blk.queues[queue];
+
+    unsigned long flags = spin_lock_irqsave(&q->lock);
+    unsigned int n;
+    for (n = 0; n < count && q->num_free >= DESCS_PER_REQUEST; n++) {
+        blk_request_t *req = reqs[n];
+        req->header.type = req->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+        req->header.reserved = 0;
+        req->header.sector = req->sector;
+        req->device_status = 0xFF;
+        req->status = BLK_STATUS_PENDING;
+
+        uint16_t head = q->free_head;
+        uint16_t data = q->desc[head].next;
+        uint16_t status = q->desc[data].next;
+        q->free_head = q->desc[status].next;
+        q->num_free -= DESCS_PER_REQUEST;
+
+        q->desc[head] = (vring_desc_t){ virt_to_phys(&req->header), sizeof(req->header),
+                                        VRING_DESC_F_NEXT, data };
+        q->desc[data] = (vring_desc_t){ virt_to_phys(req->buffer), req->sectors * BLK_SECTOR_SIZE,
+                                        VRING_DESC_F_NEXT | (req->write ? 0 : VRING_DESC_F_WRITE), status };
+        q->desc[status] = (vring_desc_t){ virt_to_phys((const void *)&req->device_status), 1,
+                                          VRING_DESC_F_WRITE, 0 };
+        q->inflight[head] = req;
+        q->avail->ring[q->avail_idx++ % q->size] = head;
+        req->submit_tsc = rdtsc();
+    }
+
+    if (n) {
+        __atomic_store_n(&q->avail->idx, q->avail_idx, __ATOMIC_RELEASE);
+        // The index store must be visible before the device's flag is read,
+        // or a device about to stop polling could miss the new entries
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (!(q->used->flags & VRING_USED_F_NO_NOTIFY)) {
+            *q->notify = q->index;
+            q->stats.notifies++;
+        }
+        q->stats.submitted += n;
+    }
+    spin_unlock_irqrestore(&q->lock, flags);
+    return n;
+}
+
+unsigned int virtio_blk_poll(unsigned int queue) {
+    if (queue >= g_blk.queue_count) return 0;
+    blk_queue_t *q = &g_blk.queues[queue];
+
+    // Cheap check first: spinning pollers must not bounce the lock
+    if (__atomic_load_n(&q->used->idx, __ATOMIC_ACQUIRE) == q->last_used) return 0;
+    unsigned long flags = spin_lock_irqsave(&q->lock);
+    unsigned int n = reap(q);
+    if (n) q->stats.polls++;
+    spin_unlock_irqrestore(&q->lock, flags);
+    return n;
+}
+
+int virtio_blk_set_mode(int mode) {
+    if (mode == BLK_MODE_IRQ && !g_blk.has_irqs) return -1;
+
+    for (unsigned int i = 0; i < g_blk.queue_count; i++) {
+        blk_queue_t *q = &g_blk.queues[i];
+        unsigned long flags = spin_lock_irqsave(&q->lock);
+        q->avail->flags = mode == BLK_MODE_POLL ? VRING_AVAIL_F_NO_INTERRUPT : 0;
+        spin_unlock_irqrestore(&q->lock, flags);
+        if (g_blk.has_irqs) pci_mask_irq(g_blk.pci, i, mode == BLK_MODE_POLL);
+    }
+    g_blk.mode = mode;
+    return 0;
+}
+
+int virtio_blk_mode(void) {
+    return g_blk.mode;
+}
+
+static int transfer(uint64_t sector, void *buffer, uint32_t sectors, int write) {
+    if (!g_blk.queue_count) return BLK_STATUS_IOERR;
+    if (write && (g_blk.features & FEATURE_BLK_RO)) return BLK_STATUS_UNSUPP;
+    if (sector + sectors > g_blk.capacity) return BLK_STATUS_IOERR;
+    uint32_t block_sectors = g_blk.block_size / BLK_SECTOR_SIZE;
+    if ((sector | sectors) & (block_sectors - 1)) return BLK_STATUS_UNSUPP;
+
+    blk_request_t req = { .sector = sector, .buffer = buffer, .sectors = sectors, .write = write };
+    blk_request_t *batch = &req;
+    unsigned int queue = virtio_blk_cpu_queue();
+    while (!virtio_blk_submit(queue, &batch, 1)) virtio_blk_poll(queue);
+
+    // The interrupt handler may get there first; either way the status
+    // store releases the request
+    while (__atomic_load_n(&req.status, __ATOMIC_ACQUIRE) == BLK_STATUS_PENDING) {
+        if (!virtio_blk_poll(queue)) cpu_pause();
+    }
+    return req.status;
+}
+
+int virtio_blk_read(uint64_t sector, void *buffer, uint32_t sectors) {
+    return transfer(sector, buffer, sectors, 0);
+}
+
+int virtio_blk_write(uint64_t sector, const void *buffer, uint32_t sectors) {
+    return transfer(sector, (void *)buffer, sectors, 1);
+}
+
+int virtio_blk_present(void) {
+    return g_blk.queue_count != 0;
+}
+
+uint64_t virtio_blk_capacity(void) {
+    return g_blk.capacity;
+}
+
+unsigned int virtio_blk_queue_count(void) {
+    return g_blk.queue_count;
+}
+
+int virtio_blk_has_irqs(void) {
+    return g_blk.has_irqs;
+}
+
+int virtio_blk_read_only(void) {
+    return (g_blk.features & FEATURE_BLK_RO) != 0;
+}
+
+uint32_t virtio_blk_block_size(void) {
+    return g_blk.block_size;
+}
+
+unsigned int virtio_blk_cpu_queue(void) {
+    return g_blk.cpu_queue[this_cpu_id()];
+}
+
+unsigned int virtio_blk_queue_cpu(unsigned int queue) {
+    if (g_blk.has_irqs && queue < g_blk.queue_count) return g_blk.pci->irqs[queue].cpu;
+    // Polled queues are shared round-robin, starting with CPU `queue`
+    return queue;
+}
+
+void virtio_blk_get_stats(unsigned int queue, blk_queue_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (queue >= g_blk.queue_count) return;
+    blk_queue_t *q = &g_blk.queues[queue];
+    unsigned long flags = spin_lock_irqsave(&q->lock);
+    *stats = q->stats;
+    spin_unlock_irqrestore(&q->lock, flags);
+}
+
+// Each CPU submits on the queue whose vector targets it; CPUs without one
+// share round-robin
+static void map_cpus(void) {
+    for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        unsigned int queue = cpu % g_blk.queue_count;
+        for (unsigned int i = 0; g_blk.has_irqs && i < g_blk.queue_count; i++) {
+            if (g_blk.pci->irqs[i].cpu == cpu) {
+                queue = i;
+                break;
+            }
+        }
+        g_blk.cpu_queue[cpu] = queue;
+    }
+}
+
+static int fail(const char *why) {
+    klog_warn("virtio-blk: %s", why);
+    if (g_blk.common) common_write8(COMMON_DEVICE_STATUS, STATUS_FAILED);
+    if (g_blk.pci && g_blk.pci->irq_mode != PCI_IRQ_NONE) pci_free_irqs(g_blk.pci);
+    g_blk.queue_count = 0;
+    return -1;
+}
+
+int virtio_blk_init(void) {
+    pci_device_t *dev = pci_find_device(VIRTIO_VENDOR_ID, VIRTIO_BLK_DEVICE_ID, 0);
+    if (!dev) dev = pci_find_device(VIRTIO_VENDOR_ID, VIRTIO_BLK_TRANSITIONAL_ID, 0);
+    if (!dev) return -1;
+
+    g_blk.pci = dev;
+    pci_enable_device(dev);
+    if (map_structures(dev) < 0) return fail("no modern virtio capabilities");
+    if (reset_device() < 0) return fail("reset timed out");
+    common_write8(COMMON_DEVICE_STATUS, STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+    if (negotiate_features() < 0) return fail("feature negotiation failed");
+
+    volatile uint8_t *cfg = g_blk.device;
+    g_blk.capacity = *(volatile uint64_t *)(cfg + BLK_CFG_CAPACITY);
+    g_blk.block_size = g_blk.features & FEATURE_BLK_SIZE ? *(volatile uint32_t *)(cfg + BLK_CFG_BLK_SIZE)
+                                                         : BLK_SECTOR_SIZE;
+    // Requests are sized in whole blocks, and the selftest reads one page
+    if (g_blk.block_size < BLK_SECTOR_SIZE || g_blk.block_size > PAGE_SIZE ||
+        (g_blk.block_size & (g_blk.block_size - 1)))
+        return fail("unsupported block size");
+
+    // One queue per online CPU, as far as the device and its vectors go
+    unsigned int count = percpu_online_count();
+    if (g_blk.features & FEATURE_BLK_MQ) {
+        uint16_t device_queues = *(volatile uint16_t *)(cfg + BLK_CFG_NUM_QUEUES);
+        if (device_queues < count) count = device_queues;
+    } else {
+        count = 1;
+    }
+    if (count > BLK_MAX_QUEUES) count = BLK_MAX_QUEUES;
+    if (!count) count = 1;
+
+    // Per-queue vectors need MSI-X; with anything less, run polled
+    if (dev->msix_cap) {
+        int vectors = pci_alloc_irqs(dev, count);
+        if (vectors > 0 && dev->irq_mode == PCI_IRQ_MSIX) {
+            g_blk.has_irqs = 1;
+            count = vectors;
+        } else if (vectors > 0) {
+            pci_free_irqs(dev);
+        }
+    }
+    g_blk.queue_count = count;
+
+    common_write16(COMMON_MSIX_CONFIG, VIRTIO_NO_VECTOR);
+    for (unsigned int i = 0; i < count; i++) {
+        if (setup_queue(i, g_blk.has_irqs ? i : VIRTIO_NO_VECTOR) < 0) return fail("queue setup failed");
+    }
+    common_write8(COMMON_DEVICE_STATUS, common_read8(COMMON_DEVICE_STATUS) | STATUS_DRIVER_OK);
+
+    for (unsigned int i = 0; g_blk.has_irqs && i < count; i++)
+        pci_request_irq(dev, i, queue_interrupt, &g_blk.queues[i]);
+    map_cpus();
+    virtio_blk_set_mode(g_blk.has_irqs ? BLK_MODE_IRQ : BLK_MODE_POLL);
+
+    klog_info("virtio-blk: %02x:%02x.%u, %lu sectors, %u queues", dev->bus, dev->dev, dev->func,
+              g_blk.capacity, count);
+    return 0;
+}
+
+#define SELFTEST_SECTORS    8
+
+void virtio_blk_selftest(void) {
+    char line[128];
+
+    if (!virtio_blk_present()) {
+        boot_print("virtio-blk: no device, selftest skipped", COLOR_YELLOW);
+        return;
+    }
+
+    uint64_t phys = pmm_alloc_pages(1);
+    if (!phys) {
+        boot_print("virtio-blk: out of memory, selftest skipped", COLOR_YELLOW);
+        return;
+    }
+    uint8_t *whole = phys_to_virt(phys);
+    uint8_t *parts = whole + PAGE_SIZE;
+
+    // The disk image starts with a boot sector either way (MBR or FAT)
+    uint64_t start = rdtsc();
+    int status = virtio_blk_read(0, whole, SELFTEST_SECTORS);
+    uint64_t sync_ns = tsc_cycles_to_ns(rdtsc() - start);
+    int ok = status == BLK_STATUS_OK && whole[510] == 0x55 && whole[511] == 0xAA;
+
+    // The same sectors one block per request, batched on every queue in
+    // turn, must read back identically
+    blk_request_t reqs[SELFTEST_SECTORS];
+    blk_request_t *batch[SELFTEST_SECTORS];
+    uint32_t block_sectors = g_blk.block_size / BLK_SECTOR_SIZE;
+    unsigned int count = SELFTEST_SECTORS / block_sectors;
+    for (unsigned int queue = 0; ok && queue < g_blk.queue_count; queue++) {
+        memset(parts, 0, SELFTEST_SECTORS * BLK_SECTOR_SIZE);
+        for (unsigned int i = 0; i < count; i++) {
+            reqs[i] = (blk_request_t){ .sector = i * block_sectors, .buffer = parts + i * g_blk.block_size,
+                                       .sectors = block_sectors };
+            batch[i] = &reqs[i];
+        }
+        unsigned int sent = 0;
+        while (sent < count) sent += virtio_blk_submit(queue, batch + sent, count - sent);
+        for (unsigned int i = 0; i < count; i++) {
+            while (__atomic_load_n(&reqs[i].status, __ATOMIC_ACQUIRE) == BLK_STATUS_PENDING) {
+                if (!virtio_blk_poll(queue)) cpu_pause();
+            }
+            if (reqs[i].status != BLK_STATUS_OK) ok = 0;
+        }
+        if (memcmp(whole, parts, SELFTEST_SECTORS * BLK_SECTOR_SIZE) != 0) ok = 0;
+    }
+    pmm_free_pages(phys, 1);
+
+    ksnprintf(line, sizeof(line), "virtio-blk: %lu MiB, %u queues, %s, sync read %lu us, %s",
+              g_blk.capacity * BLK_SECTOR_SIZE >> 20, g_blk.queue_count,
+              g_blk.has_irqs ? "MSI-X" : "polled", sync_ns / 1000, ok ? "ok" : "FAILED");
+    boot_print(line, ok ? COLOR_CYAN : COLOR_RED);
+}
@@ -9,8 +9,16 @@ readonly CACHE_DIR="${BUILD_DIR}/cache"
 readonly DISK_IMG="${BUILD_DIR}/boot.img"
 readonly DISK_SIZE_MB=256
 readonly RAM_SIZE_MB=4096
+readonly CPU_COUNT="${CPU_COUNT:-4}"
 readonly KERNEL_DIR="kernel"
+# lz4: ship the compressed container (kernel.kz); raw: kernel.elf as linked
+readonly KERNEL_FORMAT="${KERNEL_FORMAT:-lz4}"
 readonly BOOTLOADER_DIR="bootloader"
+# Packed into initrd.tar if present; BOOT_MODULES adds more files as is
+readonly INITRD_DIR="${INITRD_DIR:-initrd}"
+readonly BOOT_MODULES="${BOOT_MODULES:-}"
+# 0: stop after writing the disk image
+readonly RUN_QEMU="${RUN_QEMU:-1}"
 readonly EFI_LDS="${GNUEFI_PATH}/gnuefi/elf_x86_64_efi.lds"
 readonly EFI_CRT_OBJ="${GNUEFI_PATH}/gnuefi/crt0-efi-x86_64.o"
 readonly -a QEMU_PATHS=("/usr/share/OVMF/OVMF_CODE.fd" "/usr/share/qemu/OVMF.fd" "/usr/share/ovmf/OVMF.fd")
@@ -26,9 +34,9 @@ readonly BOOTLOADER_CFLAGS="-I${GNUEFI_PATH}/lib -I${GNUEFI_PATH}/gnuefi -I/usr/
 
 readonly KERNEL_CFLAGS="-m64 -mno-red-zone -ffreestanding -fno-stack-protector \
     -nostdlib -fno-builtin -fno-exceptions -fno-asynchronous-unwind-tables \
-    -mno-mmx -mno-sse -mno-sse2 -O2 -Wall -Wextra -I${KERNEL_DIR}/include"
+    -mno-mmx -mno-sse -mno-sse2 -O2 -fno-omit-frame-pointer -Wall -Wextra -I${KERNEL_DIR}/include"
 
-readonly KERNEL_LDFLAGS="-m elf_x86_64 -T linker.ld --oformat binary"
+readonly KERNEL_LDFLAGS="-m elf_x86_64 -T linker.ld -z max-page-size=0x1000 -z noexecstack"
 
 find_ovmf() {
     for path in "${QEMU_PATHS[@]}"; do
@@ -95,7 +103,7 @@ build_bootloader() {
 }
 
 build_kernel() {
-    local target="${BUILD_DIR}/kernel.bin"
+    local target="${BUILD_DIR}/kernel.elf"
     
     if ! needs_rebuild "$target" "$KERNEL_DIR"; then
         echo "Kernel up to date"
@@ -109,6 +117,13 @@ build_kernel() {
     
     local objects=("${BUILD_DIR}/kernel_entry.o")
     
+    for src in "${KERNEL_DIR}/src"/*.asm; do
+        [[ "$src" == */kernel_entry.asm ]] && continue
+        local obj="${BUILD_DIR}/$(basename "${src%.asm}.o")"
+        "$AS" -f elf64 "$src" -o "$obj"
+        objects+=("$obj")
+    done
+    
     for src in "${KERNEL_DIR}/src"/*.c; do
         [[ -f "$src" ]] || continue
         local obj="${BUILD_DIR}/$(basename "${src%.c}.o")"
@@ -116,14 +131,37 @@ build_kernel() {
         objects+=("$obj")
     done
     
-    "$LD" $KERNEL_LDFLAGS -o "$target" "${objects[@]}"
+    # Two links: the symbol table is generated from the first, with an
+    # empty table, and placed after everything it describes in the second
+    local ksyms="${BUILD_DIR}/ksyms"
+    tools/gen_ksyms.sh < /dev/null > "${ksyms}.asm"
+    "$AS" -f elf64 "${ksyms}.asm" -o "${ksyms}.o"
+    "$LD" $KERNEL_LDFLAGS -o "$target" "${objects[@]}" "${ksyms}.o"
+
+    nm -n "$target" | tools/gen_ksyms.sh > "${ksyms}.asm"
+    "$AS" -f elf64 "${ksyms}.asm" -o "${ksyms}.o"
+    "$LD" $KERNEL_LDFLAGS -o "$target" "${objects[@]}" "${ksyms}.o"
+
+    tools/mkkernelz.py "$target" -o "${BUILD_DIR}/kernel.kz"
     
     save_hash "$target" "$KERNEL_DIR"
 }
 
+build_initrd() {
+    local target="${BUILD_DIR}/initrd.tar"
+    
+    if [[ ! -d "$INITRD_DIR" ]]; then
+        rm -f "$target"
+        return 0
+    fi
+    echo "Packing ${INITRD_DIR}..."
+    tar --format=ustar -cf "$target" -C "$INITRD_DIR" .
+}
+
 create_disk_image() {
     local bootloader="${BUILD_DIR}/BOOTX64.efi"
-    local kernel="${BUILD_DIR}/kernel.bin"
+    local kernel="${BUILD_DIR}/kernel.elf"
+    [[ "$KERNEL_FORMAT" == "lz4" ]] && kernel="${BUILD_DIR}/kernel.kz"
     
     [[ -f "$bootloader" ]] || { echo "Error: Bootloader not found"; return 1; }
     [[ -f "$kernel" ]] || { echo "Error: Kernel not found"; return 1; }
@@ -141,6 +179,18 @@ create_disk_image() {
     mmd -i "$DISK_IMG" ::/EFI ::/EFI/BOOT
     mcopy -i "$DISK_IMG" "$bootloader" ::/EFI/BOOT/
     mcopy -i "$DISK_IMG" "$kernel" ::/EFI/BOOT/
+    
+    local -a modules=()
+    [[ -f "${BUILD_DIR}/initrd.tar" ]] && modules+=("${BUILD_DIR}/initrd.tar")
+    if [[ -n "$BOOT_MODULES" ]]; then
+        local -a extra
+        read -ra extra <<< "$BOOT_MODULES"
+        modules+=("${extra[@]}")
+    fi
+    if (( ${#modules[@]} )); then
+        mmd -i "$DISK_IMG" ::/EFI/BOOT/modules
+        mcopy -i "$DISK_IMG" "${modules[@]}" ::/EFI/BOOT/modules/
+    fi
 }
 
 launch_qemu() {
@@ -150,8 +200,10 @@ launch_qemu() {
     
     qemu-system-x86_64 \
         -bios "$ovmf_path" \
-        -drive file="$DISK_IMG",format=raw,if=ide \
+        -drive file="$DISK_IMG",format=raw,if=none,id=disk0 \
+        -device virtio-blk-pci,drive=disk0,num-queues="$CPU_COUNT",bootindex=0 \
         -m $RAM_SIZE_MB \
+        -smp "$CPU_COUNT" \
         -machine q35,accel=kvm:tcg \
         -cpu qemu64,+nx \
         -display gtk \
@@ -169,8 +221,13 @@ main() {
     create_directories
     build_bootloader
     build_kernel
+    build_initrd
     create_disk_image
-    launch_qemu
+    if [[ "$RUN_QEMU" == "1" ]]; then
+        launch_qemu
+    else
+        echo "Disk image written to ${DISK_IMG}"
+    fi
 }
 
 main "$@"
\ No newline at end of file
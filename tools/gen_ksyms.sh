@@ -0,0 +1,33 @@
+#!/bin/bash
+# Turn `nm -n` output for the intermediate kernel ELF into the NASM source of
+# the embedded symbol table (see kernel/include/ksym.h). Only code symbols are
+# kept; with no input the table is empty, which is what the first link uses.
+#
+# Usage: nm -n kernel.elf | tools/gen_ksyms.sh > ksyms.asm
+
+awk '
+BEGIN { n = 0 }
+NF == 3 && $2 ~ /^[TtWw]$/ && $3 !~ /^_(kernel|text|rodata|data|bss)_(start|end)$/ {
+    # Aliases share an address; the first name wins
+    if ($1 == last) next
+    last = $1
+    addr[n] = $1
+    name[n] = $3
+    n++
+}
+END {
+    print "; Generated by tools/gen_ksyms.sh"
+    print "SECTION .ksyms progbits alloc noexec nowrite align=8"
+    print "GLOBAL ksyms_count, ksyms_addrs, ksyms_names, ksyms_strings"
+    print "ksyms_count:    DQ " n
+    print "ksyms_addrs:"
+    for (i = 0; i < n; i++) print "    DQ 0x" addr[i]
+    print "ksyms_names:"
+    off = 0
+    for (i = 0; i < n; i++) {
+        print "    DD " off
+        off += length(name[i]) + 1
+    }
+    print "ksyms_strings:"
+    for (i = 0; i < n; i++) print "    DB \"" name[i] "\", 0"
+}'
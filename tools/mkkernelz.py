@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+"""Pack the kernel ELF into the compressed container the bootloader loads.
+
+Layout (little-endian), matching kernel_container_t in
+bootloader/include/bootloader.h:
+
+    header      magic "VKZ1", version, header size, block size, CRC-32 of the
+                image, image size and the size of the block stream after it
+    blocks      one per block_size bytes of image: a u32 holding the stored
+                size, with bit 31 set if the block is stored uncompressed,
+                then that many bytes of LZ4 block data
+
+Blocks are linked: a match may reach back into earlier blocks, since the
+loader decompresses into one contiguous buffer. The loader can start on a
+block as soon as its bytes have been read.
+
+Usage: mkkernelz.py kernel.elf -o kernel.kz
+"""
+
+import argparse
+import struct
+import sys
+import zlib
+
+MAGIC = 0x315A4B56          # "VKZ1"
+VERSION = 2
+HEADER = struct.Struct("<IHHIIQQ")
+BLOCK_SIZE = 64 * 1024
+BLOCK_STORED = 1 << 31
+
+MIN_MATCH = 4
+MAX_OFFSET = 0xFFFF
+LAST_LITERALS = 5           # LZ4 ends every block with this many literals
+MF_LIMIT = 12               # and starts no match closer than this to the end
+
+
+def write_length(out, n):
+    while n >= 255:
+        out.append(255)
+        n -= 255
+    out.append(n)
+
+
+def emit(out, literals, offset=None, match=0):
+    lit = len(literals)
+    extra = match - MIN_MATCH if offset is not None else 0
+    out.append((min(lit, 15) << 4) | min(extra, 15))
+    if lit >= 15:
+        write_length(out, lit - 15)
+    out += literals
+    if offset is None:
+        return
+    out += struct.pack("<H", offset)
+    if extra >= 15:
+        write_length(out, extra - 15)
+
+
+def compress_block(data, start, end, table):
+    """Greedy LZ4 over data[start:end]; `table` maps 4-byte strings to their
+    last position and carries over from earlier blocks."""
+    out = bytearray()
+    anchor = i = start
+    match_limit = end - LAST_LITERALS
+    while i < end - MF_LIMIT:
+        key = data[i:i + MIN_MATCH]
+        ref = table.get(key)
+        table[key] = i
+        if ref is None or i - ref > MAX_OFFSET:
+            i += 1
+            continue
+        length = MIN_MATCH
+        while i + length < match_limit and data[ref + length] == data[i + length]:
+            length += 1
+        emit(out, data[anchor:i], i - ref, length)
+        # Index a couple of positions inside the match for later references
+        for j in (i + 1, i + length // 2):
+            if j + MIN_MATCH <= end:
+                table[data[j:j + MIN_MATCH]] = j
+        i += length
+        anchor = i
+    emit(out, data[anchor:end])
+    return out
+
+
+def pack(image):
+    stream = bytearray()
+    table = {}
+    for start in range(0, len(image), BLOCK_SIZE):
+        end = min(start + BLOCK_SIZE, len(image))
+        block = compress_block(image, start, end, table)
+        if len(block) >= end - start:
+            stream += struct.pack("<I", (end - start) | BLOCK_STORED)
+            stream += image[start:end]
+        else:
+            stream += struct.pack("<I", len(block))
+            stream += block
+    header = HEADER.pack(MAGIC, VERSION, HEADER.size, BLOCK_SIZE, zlib.crc32(image),
+                         len(image), len(stream))
+    return header + stream
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("image", help="kernel ELF (kernel.elf)")
+    parser.add_argument("-o", "--output", required=True)
+    args = parser.parse_args()
+
+    with open(args.image, "rb") as f:
+        image = f.read()
+    if image[:4] != b"\x7fELF":
+        sys.exit(f"{args.image}: not an ELF file")
+
+    packed = pack(image)
+    with open(args.output, "wb") as f:
+        f.write(packed)
+    print(f"{args.output}: {len(image)} -> {len(packed)} bytes "
+          f"({100 * len(packed) // max(len(image), 1)}%)", file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+"""Convert a kernel trace dump into Chrome trace / Perfetto JSON.
+
+The kernel writes its tracepoint rings to the serial port at the end of boot
+and on panic (kernel/src/trace.c). This script picks the TRACE lines out of
+serial.log or debug.log and ignores everything else. Load the result in
+chrome://tracing or https://ui.perfetto.dev.
+
+    tools/trace2json.py build/serial.log -o build/trace.json
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+# trace_event_t: tsc, id, cpu, phase, 3 pad bytes, a0, a1
+EVENT = struct.Struct("<QHHB3xQQ")
+
+
+def parse(lines):
+    """Return (tsc_hz, names, events) for the last complete dump in `lines`."""
+    dump = None
+    result = None
+    for line in lines:
+        line = line.strip()
+        if line.startswith("TRACE-BEGIN"):
+            fields = dict(f.split("=", 1) for f in line.split()[2:] if "=" in f)
+            dump = {"tsc_hz": int(fields.get("tsc_hz", "0")), "names": {}, "events": []}
+        elif dump is None:
+            continue
+        elif line.startswith("TRACE-NAME "):
+            _, ident, name = line.split(maxsplit=2)
+            dump["names"][int(ident)] = name
+        elif line.startswith("TRACE "):
+            raw = bytes.fromhex(line[6:])
+            if len(raw) == EVENT.size:
+                dump["events"].append(EVENT.unpack(raw))
+        elif line.startswith("TRACE-END"):
+            result = dump
+            dump = None
+    # A dump cut short by a hang is still worth looking at
+    result = result or dump
+    if result is None:
+        sys.exit("no TRACE-BEGIN found")
+    return result["tsc_hz"], result["names"], result["events"]
+
+
+def to_chrome(tsc_hz, names, events):
+    if not tsc_hz:
+        sys.exit("dump has no TSC frequency")
+    base = min((e[0] for e in events), default=0)
+    out = []
+    for cpu in sorted({e[2] for e in events}):
+        out.append({"name": "thread_name", "ph": "M", "pid": 0, "tid": cpu,
+                    "args": {"name": "CPU %d" % cpu}})
+
+    for tsc, ident, cpu, phase, a0, a1 in sorted(events):
+        name = names.get(ident, "event %d" % ident)
+        args = {"a0": a0, "a1": a1}
+        if name == "interrupt":
+            name = "vector %#x" % a0
+            args = {"vector": a0, "rip": "%#x" % a1}
+        elif name == "switch":
+            args = {"prev": a0, "next": a1}
+        ev = {"name": name, "ph": chr(phase), "ts": (tsc - base) * 1e6 / tsc_hz,
+              "pid": 0, "tid": cpu, "args": args}
+        if ev["ph"] == "i":
+            ev["s"] = "t"
+        out.append(ev)
+    return {"traceEvents": out, "displayTimeUnit": "ns"}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("log", help="serial.log or debug.log")
+    parser.add_argument("-o", "--output", help="JSON file, stdout by default")
+    args = parser.parse_args()
+
+    with open(args.log, errors="replace") as f:
+        trace = to_chrome(*parse(f))
+    text = json.dumps(trace, indent=None)
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(text)
+    else:
+        print(text)
+
+
+if __name__ == "__main__":
+    main()